@@ -0,0 +1,42 @@
+/*
+*******************************************************************************
+* Description:
+*   Front-panel buttons A/B/C captured by GPIO interrupts. Every edge is
+*   timestamped in its interrupt handler and queued, so presses are seen even
+*   while loop() is busy; debouncing, click/hold detection and auto-repeat run
+*   in the consumer (ButtonDecoder).
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ButtonEvents.h"
+
+// M5Stack Core front buttons (active low, external pull-ups)
+constexpr uint8_t BUTTON_A_PIN = 39;
+constexpr uint8_t BUTTON_B_PIN = 38;
+constexpr uint8_t BUTTON_C_PIN = 37;
+
+// Button indices reported in ButtonEvent::button
+constexpr uint8_t BUTTON_A = 0;
+constexpr uint8_t BUTTON_B = 1;
+constexpr uint8_t BUTTON_C = 2;
+constexpr uint8_t BUTTON_COUNT = 3;
+
+/**
+ * Configures the button pins and attaches their edge interrupts.
+ */
+void initButtons();
+
+/**
+ * Enables auto-repeat events while a button is held.
+ */
+void setButtonRepeat(uint8_t button, bool enabled);
+
+/**
+ * Returns the next decoded button event, in the order the edges happened.
+ * @return false if no event is due
+ */
+bool nextButtonEvent(ButtonEvent& event);
@@ -0,0 +1,57 @@
+/*
+*******************************************************************************
+* Description:
+*   Deferred logging for the control path. LOG_EVENT(format, args...) takes
+*   printf-style arguments but only stores the format's ID, an esp_timer µs
+*   timestamp and the argument words in a RAM ring (EventLog.h). A drain task
+*   sends the records as binary frames on Serial, next to the text output;
+*   host/log_decode turns them back into text using the string table that
+*   scripts/log_strings.py extracts from the sources at build time.
+*   Build with -DLOG_TEXT to print LOG_EVENT formats directly instead.
+*
+*   LOG_EVENT is for loop() only (the ring has a single producer); interrupt
+*   handlers must not log.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "EventLog.h"
+
+// Ring size in 32-bit words; a record takes three words plus its arguments
+constexpr uint16_t LOG_RING_WORDS = 1024;
+
+// Drain task stack, and its wait while the ring is empty
+constexpr uint32_t LOG_DRAIN_STACK_BYTES = 3072;
+constexpr uint32_t LOG_DRAIN_IDLE_MS = 10;
+
+// Drain task priority on the core loop() does not run on; just above idle
+constexpr uint32_t LOG_DRAIN_PRIORITY = 1;
+
+#ifdef LOG_TEXT
+#define LOG_EVENT(format, ...) Serial.printf(format, ##__VA_ARGS__)
+#else
+#define LOG_EVENT(format, ...) logEvent(std::integral_constant<uint32_t, logFormatId(format)>::value, ##__VA_ARGS__)
+#endif
+
+/**
+ * Starts the drain task on the core other than the calling one, which must
+ * be loop()'s.
+ */
+void initDeferredLog();
+
+/**
+ * Stores a record; dropped and counted if the ring is full.
+ */
+void logWords(uint32_t id, const uint32_t* words, uint8_t count);
+
+template <class... Args>
+inline void logEvent(uint32_t id, Args... args) {
+  static_assert(logWordCount<Args...>() <= LOG_MAX_ARG_WORDS, "Too many arguments for one log record");
+  uint32_t words[logWordCount<Args...>() + 1];
+  logWords(id, words, packLogArgs(words, args...));
+}
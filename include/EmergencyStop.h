@@ -0,0 +1,47 @@
+/*
+*******************************************************************************
+* Description:
+*   Emergency stop on ESTOP_PIN. The input's edge interrupt detaches every
+*   step pin from its pulse peripheral and drives it low, so no further step
+*   leaves the controller whatever loop() is busy with. The next loop() pass
+*   stops the step queues, discards the queued motion and disables the
+*   driver chip through Module_Stepmotor. Both delays of every stop are
+*   recorded (StopLatencyLog); '?' over Serial reports the worst case.
+*   The stop stays latched, and moves are refused, until it is re-armed
+*   with the input released.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <Module_Stepmotor.h>
+
+/**
+ * Configures the input and attaches its interrupt; a switch already open
+ * stops at once. Call after initMotion() and after the driver is enabled.
+ */
+void initEmergencyStop(Module_Stepmotor& driver);
+
+/**
+ * Finishes a stop the interrupt started: halts the step queues, disables
+ * the driver and records the latencies. Call early in loop().
+ * @return true once per new stop
+ */
+bool serviceEmergencyStop();
+
+/**
+ * True from a stop until it is re-armed.
+ */
+bool emergencyStopLatched();
+
+/**
+ * Reconnects the step outputs and re-enables the driver. Axis positions are
+ * those FastAccelStepper counted and must be re-established (homed).
+ * @return false while the input is still open
+ */
+bool rearmEmergencyStop();
+
+/**
+ * Prints the stop count and the last and worst latencies to Serial.
+ */
+void printEmergencyStopReport();
@@ -0,0 +1,37 @@
+/*
+*******************************************************************************
+* Description:
+*   Serial endpoint of the host step stream. Frames (SerialFrame.h) arrive on
+*   the same port as G-code lines: a line that starts with FRAME_START, and
+*   every byte while a stream session is open, goes to the frame decoder.
+*   Received StepBlocks are handed to the motion executor exactly once and
+*   every frame is answered with an Ack or Nak frame. Clock sync requests
+*   and timed moves (ClockSync.h) share the link; their times are
+*   esp_timer_get_time() µs.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "SerialFrame.h"
+
+// Session dropped after this long without a frame while the stream is not running
+constexpr uint32_t HOST_STREAM_TIMEOUT_MS = 2000;
+
+/**
+ * True while serial bytes belong to the host stream: inside a frame or a session.
+ */
+bool hostStreamReceiving();
+
+/**
+ * Consumes one byte received on Serial for the host link.
+ */
+void feedHostStream(uint8_t byte);
+
+/**
+ * Drops a session whose host went silent or whose stream was stopped. Call
+ * from loop().
+ */
+void serviceHostStream();
@@ -0,0 +1,327 @@
+/*
+*******************************************************************************
+* Description:
+*   Machine axis configuration for the M5Stack Core ESP32 + Module 13.2 stepper
+*   driver. Each axis is a type, Axis<Name, StepPin, DirPin, ...>, so its pins
+*   and steps-per-revolution are compile-time constants: conversions fold into
+*   the code that uses them and invalid pin or microstep choices fail the build.
+*   The firmware sizes every per-axis array and loop from AXIS_COUNT, so adding
+*   or removing an axis only requires editing the Machine list below.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <tuple>
+#include <utility>
+
+#include "Backlash.h"
+#include "InputShaper.h"
+#include "MoveLimits.h"
+#include "PositionCompare.h"
+#include "PulseBench.h"
+
+// Upper bound on axes driven by one controller (FastAccelStepper channel budget)
+constexpr uint8_t MAX_AXES = 4;
+
+// Module 13.2 talks I2C on these pins, so they cannot double as step/dir outputs
+constexpr uint8_t I2C_SDA_PIN = 21;
+constexpr uint8_t I2C_SCL_PIN = 22;
+
+// Marks an optional pin as not connected
+constexpr uint8_t NO_PIN = 0xFF;
+
+// Divergence between expected and actual position that counts as lost steps, in full steps
+constexpr int32_t STEP_LOSS_THRESHOLD_FULL_STEPS = 2;
+
+/**
+ * Runtime view of one stepper axis, generated from its Axis<> type.
+ */
+struct AxisConfig {
+  char name;               // Axis letter used on the LCD and in Serial output
+  uint8_t stepPin;         // Step control pin
+  uint8_t dirPin;          // Direction control pin
+  uint8_t driverChannel;   // Motor channel on Module 13.2 (0 = X, 1 = Y, 2 = Z)
+  int32_t stepsPerRev;     // Microsteps per revolution (full steps * microstepping)
+  int32_t minPosition;     // Lower soft travel limit in microsteps
+  int32_t maxPosition;     // Upper soft travel limit in microsteps
+  uint8_t encoderPinA;     // Quadrature encoder channel A, or NO_PIN
+  uint8_t encoderPinB;     // Quadrature encoder channel B, or NO_PIN
+  int32_t encoderCountsPerRev;  // Encoder counts per revolution after 4x decoding (0 = no encoder)
+  int32_t stepLossThreshold;    // Position divergence flagged as step loss, in microsteps
+};
+
+/**
+ * True for ESP32 GPIOs that can drive a step or direction signal: excludes
+ * input-only pins (34-39), the SPI flash pins (6-11), non-existent pads and
+ * the I2C bus used to talk to Module 13.2.
+ */
+constexpr bool isStepOutputPin(uint8_t pin) {
+  bool output = pin <= 5 || (pin >= 12 && pin <= 19) || (pin >= 21 && pin <= 23) ||
+                (pin >= 25 && pin <= 27) || pin == 32 || pin == 33;
+  return output && pin != I2C_SDA_PIN && pin != I2C_SCL_PIN;
+}
+
+/**
+ * True for ESP32 GPIOs that can read an encoder signal (outputs plus the
+ * input-only pins 34-39).
+ */
+constexpr bool isEncoderInputPin(uint8_t pin) {
+  return isStepOutputPin(pin) || (pin >= 34 && pin <= 39);
+}
+
+/**
+ * True for microstep factors selectable with the Module 13.2 (DRV8825) mode jumpers.
+ */
+constexpr bool isValidMicroStep(uint8_t microSteps) {
+  return microSteps == 1 || microSteps == 2 || microSteps == 4 || microSteps == 8 ||
+         microSteps == 16 || microSteps == 32;
+}
+
+/**
+ * Marks an axis without position feedback.
+ */
+struct NoEncoder {
+  static constexpr uint8_t pinA = NO_PIN;
+  static constexpr uint8_t pinB = NO_PIN;
+  static constexpr int32_t countsPerRev = 0;
+};
+
+/**
+ * Quadrature encoder on the motor shaft, decoded 4x by the ESP32 PCNT peripheral.
+ * @tparam PinA Channel A input
+ * @tparam PinB Channel B input
+ * @tparam LinesPerRev Encoder lines (cycles) per revolution
+ */
+template <uint8_t PinA, uint8_t PinB, uint16_t LinesPerRev>
+struct QuadratureEncoder {
+  static_assert(isEncoderInputPin(PinA) && isEncoderInputPin(PinB), "Encoder pin is not a usable ESP32 input");
+  static_assert(PinA != PinB, "Encoder channels must use different pins");
+  static_assert(LinesPerRev > 0, "Encoder needs at least one line per revolution");
+
+  static constexpr uint8_t pinA = PinA;
+  static constexpr uint8_t pinB = PinB;
+  static constexpr int32_t countsPerRev = 4 * (int32_t)LinesPerRev;
+};
+
+/**
+ * Compile-time description of one stepper axis.
+ * @tparam Name Axis letter
+ * @tparam StepPin Step control pin
+ * @tparam DirPin Direction control pin
+ * @tparam DriverChannel Motor channel on Module 13.2
+ * @tparam FullStepsPerRev Full steps per motor revolution (200 for 1.8° motors)
+ * @tparam MicroSteps Microstepping factor set by the driver jumpers
+ * @tparam TravelRevs Soft travel limit either side of zero, in revolutions
+ * @tparam Encoder Position feedback, NoEncoder or QuadratureEncoder<>
+ */
+template <char Name, uint8_t StepPin, uint8_t DirPin, uint8_t DriverChannel,
+          uint16_t FullStepsPerRev, uint8_t MicroSteps, int32_t TravelRevs = 10000,
+          class Encoder = NoEncoder>
+struct Axis {
+  static_assert(isStepOutputPin(StepPin), "Step pin is not a usable ESP32 output");
+  static_assert(isStepOutputPin(DirPin), "Direction pin is not a usable ESP32 output");
+  static_assert(StepPin != DirPin, "Step and direction pins must differ");
+  static_assert(DriverChannel < 3, "Module 13.2 has motor channels 0-2 only");
+  static_assert(isValidMicroStep(MicroSteps), "Module 13.2 supports 1, 2, 4, 8, 16 or 32 microsteps");
+  static_assert(TravelRevs > 0 && (int64_t)TravelRevs * FullStepsPerRev * MicroSteps <= INT32_MAX,
+                "Travel limit must fit a 32-bit step position");
+
+  static constexpr char name = Name;
+  static constexpr uint8_t stepPin = StepPin;
+  static constexpr uint8_t dirPin = DirPin;
+  static constexpr int32_t stepsPerRev = (int32_t)FullStepsPerRev * MicroSteps;
+  static constexpr int32_t maxPosition = TravelRevs * stepsPerRev;
+  static constexpr int32_t minPosition = -maxPosition;
+  static constexpr int32_t stepLossThreshold = STEP_LOSS_THRESHOLD_FULL_STEPS * MicroSteps;
+  static constexpr AxisConfig config = {Name, StepPin, DirPin, DriverChannel,
+                                        stepsPerRev, minPosition, maxPosition,
+                                        Encoder::pinA, Encoder::pinB, Encoder::countsPerRev,
+                                        stepLossThreshold};
+
+  /**
+   * Converts revolutions to microsteps with the per-axis constant folded in.
+   */
+  static constexpr int32_t revsToSteps(int32_t revolutions) { return revolutions * stepsPerRev; }
+};
+
+/**
+ * The set of axes of one machine variant. Provides the runtime table and
+ * per-axis conversions expanded at compile time for each axis.
+ */
+template <class... Axes>
+struct Machine {
+  static constexpr uint8_t count = sizeof...(Axes);
+  static_assert(count >= 1 && count <= MAX_AXES, "Machine must list between 1 and MAX_AXES axes");
+
+  static constexpr AxisConfig table[] = {Axes::config...};
+
+  template <uint8_t I>
+  using AxisAt = typename std::tuple_element<I, std::tuple<Axes...>>::type;
+
+  /**
+   * Fills steps[] with the microsteps each axis needs for the given revolutions.
+   */
+  static void revsToSteps(int32_t revolutions, int32_t (&steps)[count]) {
+    revsToSteps(revolutions, steps, std::make_index_sequence<count>());
+  }
+
+  /**
+   * True when an axis uses the pin for step, direction or an encoder.
+   */
+  static constexpr bool usesPin(uint8_t pin) {
+    for (uint8_t i = 0; i < count; i++) {
+      if (table[i].stepPin == pin || table[i].dirPin == pin || table[i].encoderPinA == pin ||
+          table[i].encoderPinB == pin) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * True when no step, direction or encoder pin is used twice.
+   */
+  static constexpr bool pinsAreUnique() {
+    uint8_t pins[count * 4] = {};
+    for (uint8_t i = 0; i < count; i++) {
+      pins[i * 4] = table[i].stepPin;
+      pins[i * 4 + 1] = table[i].dirPin;
+      pins[i * 4 + 2] = table[i].encoderPinA;
+      pins[i * 4 + 3] = table[i].encoderPinB;
+    }
+    for (uint8_t i = 0; i < count * 4; i++) {
+      for (uint8_t j = i + 1; j < count * 4; j++) {
+        if (pins[i] != NO_PIN && pins[i] == pins[j]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+ private:
+  template <size_t... I>
+  static void revsToSteps(int32_t revolutions, int32_t (&steps)[count], std::index_sequence<I...>) {
+    ((steps[I] = Axes::revsToSteps(revolutions)), ...);
+  }
+};
+
+// Pin assignments for M5Stack Core (Basic) + Module 13.2, 1/16 microstepping (200 * 16 = 3200 steps/rev).
+// Add QuadratureEncoder<A, B, Lines> as the last parameter of an axis that has shaft feedback, e.g.
+// Axis<'X', 16, 17, 0, 200, 16, 10000, QuadratureEncoder<35, 36, 1000>>
+using MachineAxes = Machine<
+  Axis<'X', 16, 17, 0, 200, 16>,
+  Axis<'Y', 12, 13, 1, 200, 16>
+  // Axis<'Z', 15, 0, 2, 200, 16>  // Third axis variant
+>;
+
+static_assert(MachineAxes::pinsAreUnique(), "A step, direction or encoder pin is used twice");
+
+constexpr uint8_t AXIS_COUNT = MachineAxes::count;
+constexpr const AxisConfig (&axisTable)[AXIS_COUNT] = MachineAxes::table;
+
+// Input shaper per axis, in axisTable order. Measure the ringing frequency and damping of the
+// loaded mechanism (e.g. accelerometer on the carriage) before enabling; ZVD adds one ringing
+// period to every move, ZV half of one.
+constexpr ShaperConfig shaperTable[] = {
+  {ShaperType::None, 40.0f, 0.10f},   // X
+  {ShaperType::None, 40.0f, 0.10f},   // Y
+};
+
+static_assert(sizeof(shaperTable) / sizeof(shaperTable[0]) == AXIS_COUNT, "shaperTable needs one entry per axis");
+
+// Resonance bands per axis, in axisTable order, as microstep rates in Hz. Find them by sweeping
+// the cruise speed and listening for rough running or stalls; leave empty until measured. Cruise
+// speeds inside a band are moved to its nearest edge and ramps cross it at transitAcceleration.
+// Example entry: {{{2400, 2900}}, 1, 8000}
+constexpr BandConfig bandTable[] = {
+  {{}, 0, 8000},   // X
+  {{}, 0, 8000},   // Y
+};
+
+static_assert(sizeof(bandTable) / sizeof(bandTable[0]) == AXIS_COUNT, "bandTable needs one entry per axis");
+
+// Acceleration limit over speed per axis, in axisTable order: {speedHz, steps/sec²} points, first at
+// 0 Hz. Where set, it replaces the move's acceleration for that axis, so ramps are steep at low
+// speed where the motor has torque to spare and gentle near cruise. Derive it from the motor's
+// pull-out torque and load inertia with the host simulator (motor_sim --curve) and keep a margin.
+// Example entry: {{{0, 40000}, {3200, 30000}, {6400, 15000}, {8000, 8000}}, 4}
+constexpr AccelCurve accelCurveTable[] = {
+  {{}, 0},   // X
+  {{}, 0},   // Y
+};
+
+static_assert(sizeof(accelCurveTable) / sizeof(accelCurveTable[0]) == AXIS_COUNT, "accelCurveTable needs one entry per axis");
+
+// Acceleration bound per axis without an acceleration curve, in axisTable order, steps/sec². Below
+// the cruise speed the acceleration rises above the move's as cruise / speed (a stepper's torque
+// falls off about that way), up to this bound; short moves that never reach cruise gain the most.
+// Check the bound with the host simulator (motor_sim --bound) and keep a margin; 0 keeps the
+// move's acceleration at all speeds.
+constexpr uint32_t accelBoundTable[] = {
+  0,   // X
+  0,   // Y
+};
+
+static_assert(sizeof(accelBoundTable) / sizeof(accelBoundTable[0]) == AXIS_COUNT, "accelBoundTable needs one entry per axis");
+
+// Backlash per axis, in axisTable order: {microsteps of lost motion, take-up rate in Hz}. Measure
+// the lost motion with a dial indicator after a reversal. The take-up steps are added on top of
+// the reversing move at that rate, so keep it below the speed the motor starts at without a ramp.
+// Example entry: {24, 2000}
+constexpr BacklashConfig backlashTable[] = {
+  {0, 2000},   // X
+  {0, 2000},   // Y
+};
+
+static_assert(sizeof(backlashTable) / sizeof(backlashTable[0]) == AXIS_COUNT, "backlashTable needs one entry per axis");
+
+// Step pulse peripheral per axis, in axisTable order. Auto leaves the choice to FastAccelStepper
+// (MCPWM/PCNT first, RMT once those run out). Compare the backends on the board with the
+// pulse_bench build (pio run -e pulse_bench), which reports the fastest rate each sustains and
+// its CPU load and jitter at PULSE_BENCH_REFERENCE_HZ.
+constexpr PulseBackend pulseBackendTable[] = {
+  PulseBackend::Auto,   // X
+  PulseBackend::Auto,   // Y
+};
+
+static_assert(sizeof(pulseBackendTable) / sizeof(pulseBackendTable[0]) == AXIS_COUNT, "pulseBackendTable needs one entry per axis");
+
+// Spare outputs the pulse_bench build steps on: MCPWM/PCNT, then RMT. Leave them unconnected.
+constexpr uint8_t PULSE_BENCH_MCPWM_PCNT_PIN = 2;
+constexpr uint8_t PULSE_BENCH_RMT_PIN = 5;
+
+static_assert(isStepOutputPin(PULSE_BENCH_MCPWM_PCNT_PIN) && isStepOutputPin(PULSE_BENCH_RMT_PIN),
+              "Pulse benchmark pin is not a usable ESP32 output");
+static_assert(!MachineAxes::usesPin(PULSE_BENCH_MCPWM_PCNT_PIN) && !MachineAxes::usesPin(PULSE_BENCH_RMT_PIN) &&
+              PULSE_BENCH_MCPWM_PCNT_PIN != PULSE_BENCH_RMT_PIN,
+              "Pulse benchmark pins must be spare");
+
+// Emergency stop input: a normally closed switch to GND, so pressing it or a broken wire pulls the
+// input high through the internal pull-up. Off (NO_PIN) by default: with nothing wired the open
+// input would hold the machine stopped from power-up. Set it once a switch is fitted, e.g. 26 on Port B.
+constexpr uint8_t ESTOP_PIN = NO_PIN;
+
+static_assert(ESTOP_PIN == NO_PIN || isStepOutputPin(ESTOP_PIN),
+              "E-stop input needs an internal pull-up (not GPIO 34-39, not the I2C pins)");
+static_assert(ESTOP_PIN == NO_PIN || (!MachineAxes::usesPin(ESTOP_PIN) && ESTOP_PIN != PULSE_BENCH_MCPWM_PCNT_PIN &&
+                                      ESTOP_PIN != PULSE_BENCH_RMT_PIN),
+              "E-stop input must not share a pin");
+
+// Position compare (PSO) output: pulses or toggles when the armed axis reaches a compare position
+// (PositionTrigger.h). GPIO 15 is free unless the third axis variant is fitted; NO_PIN disables it.
+constexpr uint8_t PSO_OUTPUT_PIN = 15;
+
+// Output action, and the pulse width in pulse mode
+constexpr PsoOutput PSO_OUTPUT_MODE = PsoOutput::Pulse;
+constexpr uint32_t PSO_PULSE_US = 20;
+
+static_assert(PSO_OUTPUT_PIN == NO_PIN || isStepOutputPin(PSO_OUTPUT_PIN), "PSO output is not a usable ESP32 output");
+static_assert(PSO_OUTPUT_PIN == NO_PIN ||
+                  (!MachineAxes::usesPin(PSO_OUTPUT_PIN) && PSO_OUTPUT_PIN != PULSE_BENCH_MCPWM_PCNT_PIN &&
+                   PSO_OUTPUT_PIN != PULSE_BENCH_RMT_PIN && PSO_OUTPUT_PIN != ESTOP_PIN),
+              "PSO output must not share a pin");
+static_assert(PSO_PULSE_US > 0, "PSO pulse needs a width");
@@ -0,0 +1,299 @@
+/*
+*******************************************************************************
+* Description:
+*   Motion executor for the configured axes. Owns the FastAccelStepper engine
+*   and steppers, buffers coordinated moves in a MotionQueue and starts each
+*   queued segment as soon as the previous one has finished, so loop() never
+*   blocks while motors are running. Each segment is generated sample by sample
+*   (trapezoid plus per-axis input shaping) into FastAccelStepper's raw step
+*   command queues. Segments flagged SEGMENT_BLEND are joined at planned
+*   junction speeds instead of stopping, and arcs are split into chords.
+*   Moves from rest start on all axes at once: the queues are loaded first
+*   and released together, and the remaining start skew is logged. A move
+*   with a start time is loaded ahead and released so its first steps fall
+*   on that controller time.
+*   A feed override rescales the running move and everything queued.
+*   Alternatively a host planner streams StepBlocks that are replayed
+*   step-exact; the planner is locked out while such a stream runs.
+*   Every refill pass of a running move samples the step queue depths, so
+*   underruns and the refill latency of loop() can be reported. Backlash
+*   is taken up at each reversal, blended into the reversing move; the
+*   commanded positions and pulse counts leave those steps out. The time
+*   left of the queued job is estimated by planning it without running it.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <FastAccelStepper.h>
+
+#include "MachineConfig.h"
+#include "MotionQueue.h"
+#include "QueueMonitor.h"
+#include "StepBlock.h"
+#include "StepCommand.h"
+
+// Number of segments buffered ahead of the executor (also the playback lookahead)
+constexpr uint8_t MOTION_QUEUE_LENGTH = 8;
+
+// Queue entries kept free for a feed hold to put the interrupted segment and its successor back
+constexpr uint8_t HOLD_REQUEUE_SLOTS = 2;
+
+// Motion generated ahead of the pulse generator; bounds stop latency, must cover loop() stalls
+constexpr uint32_t MOTION_LOOKAHEAD_MS = 20;
+
+// A refill pass finding less motion than this queued counts as a near miss
+constexpr uint32_t QUEUE_NEAR_MISS_MS = 2;
+
+static_assert(QUEUE_NEAR_MISS_MS < MOTION_LOOKAHEAD_MS, "Near-miss margin must be below the lookahead");
+
+// Streamed step blocks buffered per axis ahead of the step queues
+constexpr uint8_t STEP_BLOCK_QUEUE_LENGTH = 32;
+
+// Leading pause of every axis on a move from rest; covers the release of all queues
+constexpr uint32_t START_LEAD_TICKS = STEP_MIN_CMD_TICKS;
+
+static_assert(2 * START_LEAD_TICKS <= UINT16_MAX, "Compensated lead must fit a pause command");
+
+// A timed move is planned and loaded this long before its start time
+constexpr uint32_t TIMED_START_STAGE_MS = 30;
+
+// loop() waits out the last stretch before a timed start; must cover loop() stalls
+constexpr uint32_t TIMED_START_SPIN_US = 5000;
+
+// Last part of that wait, spent with interrupts off so the release is not delayed
+constexpr uint32_t TIMED_START_FINAL_US = 50;
+
+static_assert(TIMED_START_SPIN_US < TIMED_START_STAGE_MS * 1000, "Timed start must be loaded before it is awaited");
+
+// Feed override range and resolution, percent of the programmed speeds
+constexpr uint16_t FEED_OVERRIDE_MIN_PERCENT = 10;
+constexpr uint16_t FEED_OVERRIDE_MAX_PERCENT = 200;
+constexpr uint16_t FEED_OVERRIDE_STEP_PERCENT = 5;
+
+// Largest distance between an arc and its chords, microsteps
+constexpr uint32_t ARC_CHORD_TOLERANCE_STEPS = 2;
+
+// Blend back to back moves that are too short to reach their cruise speed, instead of stopping
+// between them; they still stop wherever the junction needs it (reversals, sharp corners)
+constexpr bool SHORT_MOVE_BLEND = true;
+
+// Shortest interval between progress reports while a blended chain runs
+constexpr uint32_t CHAIN_REPORT_MS = 100;
+
+using AxisSegment = MotionSegment<AXIS_COUNT>;
+
+extern FastAccelStepper* steppers[AXIS_COUNT];   // One stepper per axisTable entry
+extern long pulseCounts[AXIS_COUNT];             // Pulses issued to each motor (for display)
+
+/**
+ * Starts the stepper engine, connects every configured axis on its
+ * pulseBackendTable peripheral and applies the input shapers from shaperTable.
+ */
+void initMotion();
+
+/**
+ * Connects a step pin to the engine on the given pulse peripheral.
+ * @return nullptr if no channel of that peripheral is left
+ */
+FastAccelStepper* connectStepper(uint8_t stepPin, PulseBackend backend);
+
+/**
+ * Appends a move to the motion queue. Steps are clipped to the soft limits
+ * when the segment starts. A segment with startUs set waits at the head of
+ * the queue and starts from rest with its first steps at that controller
+ * time (esp_timer_get_time()), or as soon as possible if that has passed.
+ * With SHORT_MOVE_BLEND, a move too short to reach its cruise speed and
+ * without dwell or start time is queued as blended.
+ * @return false if the queue is full, an arc is still being queued or a host
+ *         step stream owns the axes
+ */
+bool queueMove(const AxisSegment& segment);
+
+/**
+ * Queues a circular arc in the X/Y plane (helical when other axes move).
+ * Speed and acceleration are along the path; the chords blend into each
+ * other and are fed into the motion queue as it drains.
+ * @param steps Relative end point per axis, microsteps
+ * @param centerX Arc center X relative to the start, microsteps
+ * @param centerY Arc center Y relative to the start, microsteps
+ * @param clockwise G2 when true, G3 otherwise
+ * @return false if an arc is still being queued or the radius is zero
+ */
+bool queueArc(const int32_t (&steps)[AXIS_COUNT], int32_t centerX, int32_t centerY, bool clockwise,
+              uint32_t speedHz, uint32_t acceleration);
+
+/**
+ * Position an axis reaches once everything queued so far has run,
+ * including the rest of an arc, in microsteps (before soft-limit clipping).
+ */
+int32_t queuedPosition(uint8_t axis);
+
+/**
+ * Decelerates all motors to rest along the running profile and discards
+ * every queued segment.
+ */
+void stopAllMotion();
+
+/**
+ * Stops every axis at once, without a ramp, and discards all queued motion
+ * and host stream blocks. For the emergency stop, once the step outputs are
+ * cut; the steps FastAccelStepper counts from then on never reached the
+ * driver, so positions must be re-established afterwards.
+ */
+void haltAllMotion();
+
+/**
+ * Refuses new moves, arcs and host streams while locked (emergency stop).
+ */
+void lockMotion(bool locked);
+
+/**
+ * Keeps the step command queues filled and starts the next queued segment
+ * once all axes are idle and its dwell has elapsed. Call from loop() often;
+ * the step queues run dry if it is not called within MOTION_LOOKAHEAD_MS.
+ * @return true if a new segment was started, or a blended chain moved on
+ *         to a new segment (reported at most every CHAIN_REPORT_MS)
+ */
+bool serviceMotion();
+
+/**
+ * True when no segment is running or queued.
+ */
+bool motionIdle();
+
+/**
+ * millis() timestamp at which the executor last became idle.
+ */
+uint32_t motionIdleSinceMs();
+
+/**
+ * Free entries left in the motion queue.
+ */
+uint8_t motionQueueSpace();
+
+/**
+ * True while any axis is still generating pulses.
+ */
+bool anyAxisRunning();
+
+/**
+ * Position the planner expects an axis to reach once every started segment
+ * has finished, in microsteps.
+ */
+int32_t commandedPosition(uint8_t axis);
+
+/**
+ * Steps the motor of an axis runs ahead of its commanded position for
+ * backlash take-up (backlashTable): 0 after moving up, minus the backlash
+ * after moving down. Exact once the axis is at rest.
+ */
+int32_t backlashOffset(uint8_t axis);
+
+/**
+ * False while a stop is settling; the commanded positions are re-based on
+ * the actual positions once all axes are at rest.
+ */
+bool commandedPositionValid();
+
+/**
+ * Hands the step queues to a host-planned stream. The axes start together
+ * once their queues are filled or the stream has ended.
+ * @return false unless the executor is idle
+ */
+bool beginStepStream();
+
+/**
+ * Appends a streamed block to an axis.
+ * @return false if no stream accepts blocks or the axis queue is full
+ */
+bool queueStepBlock(uint8_t axis, const StepBlock& block);
+
+/**
+ * Free block slots of an axis, 0 when no stream accepts blocks.
+ */
+uint8_t stepBlockSpace(uint8_t axis);
+
+/**
+ * Marks the end of the stream; the executor returns to the planner once the
+ * queued blocks have run and re-bases the commanded positions.
+ */
+void endStepStream();
+
+/**
+ * True from beginStepStream() until the stream has finished running.
+ */
+bool stepStreamActive();
+
+/**
+ * Scales the speed of the running move and of every queued one, rounded to
+ * FEED_OVERRIDE_STEP_PERCENT within the override range. The running move
+ * ramps to its new speed at its acceleration limit; host step streams are
+ * not affected.
+ */
+void setFeedOverride(uint16_t percent);
+
+/**
+ * Current feed override, percent.
+ */
+uint16_t feedOverridePercent();
+
+/**
+ * Feed hold: decelerates the running move to rest at its acceleration limit
+ * and starts nothing more until resumeFeedHold(). Once the axes are at rest,
+ * the unexecuted rest of the move goes back to the head of the queue, so
+ * the resumed path ends exactly where it would have. Host step streams are
+ * not held.
+ */
+void feedHold();
+
+/**
+ * Ends a feed hold; the remainder and the queued moves run from where the
+ * axes stopped.
+ */
+void resumeFeedHold();
+
+/**
+ * True between feedHold() and resumeFeedHold().
+ */
+bool feedHoldActive();
+
+/**
+ * Time until the queued job has run, µs: the step commands in the axis
+ * queues, the rest of the running move, and every queued segment and arc
+ * planned without running it, with dwells and start times. 0 while a host
+ * step stream runs.
+ */
+uint32_t remainingJobUs();
+
+/**
+ * Time a move would take from rest to rest, µs, planned as if queued now
+ * (soft limits, acceleration curves, resonance bands, feed override).
+ */
+uint32_t estimateMoveUs(const AxisSegment& segment);
+
+/**
+ * Prints the job time left to Serial.
+ */
+void printJobTimeReport();
+
+/**
+ * Step queue statistics of an axis since startup or the last reset.
+ */
+const QueueHealth& queueHealth(uint8_t axis);
+
+/**
+ * Clears the step queue statistics of every axis.
+ */
+void resetQueueHealth();
+
+/**
+ * Prints per-axis step queue statistics to Serial.
+ */
+void printQueueHealthReport();
+
+/**
+ * Prints how many move plans were reused from the last one and how many
+ * were planned in full.
+ */
+void printPlanCacheReport();
@@ -0,0 +1,24 @@
+/*
+*******************************************************************************
+* Description:
+*   Shares the ESP32's eight pulse counter (PCNT) units. FastAccelStepper's
+*   MCPWM/PCNT backend takes units from 0 upward, one per stepper, so project
+*   features (encoders, position compare) allocate from unit 7 downward.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <driver/pcnt.h>
+
+/**
+ * Claims the highest free PCNT unit not used by the stepper engine.
+ * @return the unit, or PCNT_UNIT_MAX if none is left
+ */
+pcnt_unit_t allocatePcntUnit();
+
+/**
+ * Installs the shared PCNT interrupt service once; later calls are no-ops.
+ * @return false if the service could not be installed
+ */
+bool installPcntIsrService();
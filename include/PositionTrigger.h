@@ -0,0 +1,53 @@
+/*
+*******************************************************************************
+* Description:
+*   Position-synchronized output (PSO) on PSO_OUTPUT_PIN. Two PCNT units
+*   count the step pulses of the armed axis, with its direction pin
+*   selecting up or down. One keeps the axis position and is never cleared
+*   while armed. The other's limits are set from that position to the next
+*   compare position either way (PositionCompare.h). The step that reaches a
+*   position wraps the compare counter, and its interrupt pulses or toggles
+*   the output, so the edge follows the step by the interrupt latency, a few
+*   microseconds, whatever loop() is doing. Positions are motor positions in microsteps: the
+*   commanded position plus the backlash offset, the same thing without
+*   backlash compensation. '?' over Serial reports the trigger count.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Configures the output and claims two PCNT units. Call after initMotion().
+ * @return false if there is no output pin or no two free PCNT units
+ */
+bool initPositionTrigger();
+
+/**
+ * Adds a compare position on an axis and (re-)arms the trigger there. A
+ * different axis, or interval mode, starts a new list.
+ * @return false if the axis is moving or the list is full
+ */
+bool addTriggerPosition(uint8_t axis, int32_t position);
+
+/**
+ * Arms the trigger every everySteps from the axis' current position.
+ * @return false if the axis is moving or the interval is 0
+ */
+bool setTriggerInterval(uint8_t axis, uint32_t everySteps);
+
+/**
+ * Stops triggering and drops the compare positions.
+ */
+void disarmPositionTrigger();
+
+/**
+ * Outputs fired since the trigger was last armed.
+ */
+uint32_t positionTriggerCount();
+
+/**
+ * Prints the armed axis, the compare setup and the trigger count to Serial.
+ */
+void printPositionTriggerReport();
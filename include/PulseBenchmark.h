@@ -0,0 +1,19 @@
+/*
+*******************************************************************************
+* Description:
+*   On-board pulse backend benchmark, built in with -DPULSE_BENCHMARK
+*   (pio run -e pulse_bench). Steps one spare pin per backend with the
+*   trials of PulseBench.h and prints the fastest rate each sustains, the
+*   CPU load of the core running loop() and the jitter of the step edges,
+*   then recommends a pulseBackendTable entry.
+*******************************************************************************
+*/
+
+#pragma once
+
+/**
+ * Runs the benchmark on PULSE_BENCH_MCPWM_PCNT_PIN and PULSE_BENCH_RMT_PIN
+ * and prints the report to Serial. Blocks for several seconds; call from
+ * setup() after initMotion(). The benchmark channels stay allocated.
+ */
+void runPulseBenchmark();
@@ -0,0 +1,45 @@
+/*
+*******************************************************************************
+* Description:
+*   Step-loss detection. Periodically compares the planner's expected position
+*   of each axis with the pulses FastAccelStepper actually generated and, on
+*   axes with a QuadratureEncoder, the generated position with the shaft
+*   position counted by the PCNT peripheral. Divergence beyond the axis
+*   threshold is flagged so a batch can be stopped before it runs out of
+*   position.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Interval between encoder comparisons while moving
+constexpr uint32_t STEP_CHECK_INTERVAL_MS = 50;
+
+/**
+ * Sets up thresholds and the PCNT quadrature decoder of every encoder axis.
+ * Call after initMotion().
+ */
+void initStepVerifier();
+
+/**
+ * Runs the due position checks. Call from loop().
+ * @return true if new step loss was detected during this call
+ */
+bool serviceStepVerifier();
+
+/**
+ * True if step loss has been detected on the axis since startup.
+ */
+bool stepLossDetected(uint8_t axis);
+
+/**
+ * Encoder position of an axis scaled to microsteps, or 0 without encoder.
+ */
+int32_t encoderSteps(uint8_t axis);
+
+/**
+ * Prints per-axis check statistics to Serial.
+ */
+void printStepVerifierReport();
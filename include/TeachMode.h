@@ -0,0 +1,78 @@
+/*
+*******************************************************************************
+* Description:
+*   Teach mode: records the moves an operator issues from the buttons into a
+*   binary motion program in the "motionprog" flash partition and plays it
+*   back through the motion queue. Playback reads records in place from the
+*   memory-mapped partition and keeps the queue topped up, so segments run
+*   back to back without the operator's button latency and RAM use does not
+*   grow with program length. Programs packed on a host with
+*   tools/pack_program.py play back the same way.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "MotionControl.h"
+
+// Idle time between moves shorter than this is treated as button latency, not a dwell
+constexpr uint32_t TEACH_DWELL_THRESHOLD_MS = 1500;
+
+// Moves buffered in RAM while recording; written to flash when recording stops
+constexpr uint16_t TEACH_MAX_MOVES = 256;
+
+enum class TeachState : uint8_t {
+  Idle,
+  Recording,
+  Saving,      // Recording stopped, waiting for motion to finish before writing flash
+  Playing,
+};
+
+/**
+ * Checks the program partition for a stored program.
+ * @return false if no valid program is stored
+ */
+bool initTeach();
+
+/**
+ * Starts a new recording, replacing the stored program.
+ */
+bool startTeachRecording();
+
+/**
+ * Finishes the current recording. The program is written to flash once all
+ * motion has stopped, since flash writes stall the cache.
+ */
+void stopTeachRecording();
+
+/**
+ * Appends a move to the recording. Idle time since the previous move longer
+ * than TEACH_DWELL_THRESHOLD_MS is stored as the segment's dwell.
+ * @return false if the recording buffer is full
+ */
+bool teachRecordMove(const AxisSegment& segment);
+
+/**
+ * Starts playback of the stored program.
+ * @return false if there is no valid program
+ */
+bool startTeachPlayback();
+
+/**
+ * Aborts playback; moves already queued are left to the caller to stop.
+ */
+void stopTeachPlayback();
+
+/**
+ * Streams program records into the motion queue during playback, ends
+ * playback once the program is exhausted and motion is idle, and writes a
+ * stopped recording to flash. Call from loop().
+ * @return true if the teach state changed during this call
+ */
+bool serviceTeach();
+
+TeachState teachState();
+uint32_t teachRecordCount();     // Records in the stored or recording program
+uint32_t teachPlaybackIndex();   // Records queued so far during playback
@@ -0,0 +1,230 @@
+/*
+*******************************************************************************
+* Description:
+*   Speed-dependent acceleration limits. Each axis may describe the highest
+*   acceleration it can sustain at a given step rate (falling with speed as
+*   the motor's torque drops off). For a coordinated move the curves of the
+*   moving axes are mapped onto the dominant axis speed and combined into one
+*   AccelProfile, so the profile accelerates hard at low speed and gently near
+*   cruise instead of using the worst-case value everywhere.
+*   An axis without a curve may instead have an acceleration bound: below
+*   the cruise speed its acceleration rises as cruise / speed, holding the
+*   product of acceleration and speed (the power the ramp asks of the
+*   motor) at that of the move at cruise, up to the bound. A move too short
+*   to reach cruise (triangular) peaks low on that curve and finishes sooner.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "AccelProfile.h"
+#include "ProfileSampler.h"
+
+constexpr uint8_t ACCEL_CURVE_MAX_POINTS = 8;
+
+// Profile pieces a combined curve may use; the rest of an AccelProfile is left for band edges
+constexpr uint8_t ACCEL_CURVE_MAX_PIECES = 32;
+
+/**
+ * Acceleration limit at one step rate.
+ */
+struct AccelPoint {
+  uint32_t speedHz;        // Microsteps/sec
+  uint32_t acceleration;   // Steps/sec² allowed at that speed
+};
+
+/**
+ * Acceleration limit of one axis over speed, linear between points and held
+ * beyond the last one. Points in increasing speed order, the first at 0 Hz.
+ * An empty curve (count 0) uses the move's own acceleration.
+ */
+struct AccelCurve {
+  AccelPoint points[ACCEL_CURVE_MAX_POINTS];
+  uint8_t count;
+};
+
+template <uint8_t N>
+class AccelCurvePlanner {
+ public:
+  /**
+   * @param boundAccel Highest acceleration of an axis without a curve,
+   *                   steps/sec²; 0 keeps the move's acceleration at all speeds
+   */
+  void configure(uint8_t axis, const AccelCurve& curve, uint32_t boundAccel = 0) {
+    _curve[axis] = curve;
+    _bound[axis] = boundAccel;
+  }
+
+  /**
+   * Builds the a(v) limit of the dominant axis: at each speed the lowest limit
+   * of any moving axis, scaled to the dominant axis. The intervals between
+   * curve points are split into as many pieces as the profile has room for,
+   * and each piece uses the lower end of its interval, so the profile never
+   * exceeds a curve.
+   * @param acceleration Limit for axes without a curve, steps/sec²
+   * @param steps Relative microsteps per axis of the move
+   * @param cruiseHz Cruise speed of the dominant axis, for the acceleration
+   *                 bounds; 0 ignores them
+   */
+  void build(uint32_t acceleration, const int32_t (&steps)[N], AccelProfile& profile, uint32_t cruiseHz = 0) const {
+    uint32_t major = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      if (magnitude(steps[i]) > major) {
+        major = magnitude(steps[i]);
+      }
+    }
+
+    // Breakpoints: every curve point mapped to the dominant axis speed
+    uint32_t breaks[N * ACCEL_CURVE_MAX_POINTS + 1];
+    uint8_t count = 0;
+    breaks[count++] = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      uint32_t distance = magnitude(steps[i]);
+      for (uint8_t p = 0; distance > 0 && p < _curve[i].count && p < ACCEL_CURVE_MAX_POINTS; p++) {
+        uint64_t speed = (uint64_t)_curve[i].points[p].speedHz * major / distance;
+        if (speed > 0 && speed <= UINT32_MAX) {
+          insertSorted(breaks, count, (uint32_t)speed);
+        }
+      }
+      // A bounded axis follows its hyperbola from where it leaves the bound up to cruise
+      if (distance > 0 && boosted(i, acceleration, cruiseHz)) {
+        uint64_t knee = (uint64_t)acceleration * cruiseHz / _bound[i];
+        if (knee > 0) {
+          insertSorted(breaks, count, (uint32_t)knee);
+        }
+        insertSorted(breaks, count, cruiseHz);
+      }
+    }
+
+    profile = AccelProfile();
+    uint8_t split = (count > 1) ? ACCEL_CURVE_MAX_PIECES / (count - 1) : 1;
+    int64_t previous = -1;
+    for (uint8_t b = 0; b < count; b++) {
+      uint8_t parts = (b + 1 < count) ? split : 1;
+      for (uint8_t part = 0; part < parts; part++) {
+        // Lower of the limits at both ends of the piece (curves are linear in between)
+        uint32_t from = breaks[b];
+        uint32_t to = from;
+        if (b + 1 < count) {
+          from = breaks[b] + (uint64_t)(breaks[b + 1] - breaks[b]) * part / parts;
+          to = breaks[b] + (uint64_t)(breaks[b + 1] - breaks[b]) * (part + 1) / parts;
+        }
+        uint32_t limit = limitAt(acceleration, steps, major, from, cruiseHz);
+        uint32_t next = limitAt(acceleration, steps, major, to, cruiseHz);
+        if (next < limit) {
+          limit = next;
+        }
+        int64_t accel = accelToSample(limit);
+        if (accel != previous && profile.addPiece(speedToSample(from), accel)) {
+          previous = accel;
+        }
+      }
+    }
+  }
+
+  /**
+   * Lowest limit of the dominant axis between rest and a cruise speed, steps/sec²:
+   * the constant acceleration that respects every curve up to that speed.
+   */
+  uint32_t minimum(uint32_t acceleration, const int32_t (&steps)[N], uint32_t speedHz) const {
+    uint32_t major = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      if (magnitude(steps[i]) > major) {
+        major = magnitude(steps[i]);
+      }
+    }
+    uint64_t lowest = UINT32_MAX;
+    for (uint8_t i = 0; i < N; i++) {
+      uint32_t distance = magnitude(steps[i]);
+      if (distance == 0) {
+        continue;
+      }
+      uint32_t axisSpeed = (uint32_t)((uint64_t)speedHz * distance / major);
+      uint32_t axisAccel = acceleration;
+      if (_curve[i].count > 0) {
+        axisAccel = curveAt(_curve[i], axisSpeed);
+        for (uint8_t p = 0; p < _curve[i].count && _curve[i].points[p].speedHz < axisSpeed; p++) {
+          if (_curve[i].points[p].acceleration < axisAccel) {
+            axisAccel = _curve[i].points[p].acceleration;
+          }
+        }
+      }
+      uint64_t scaled = (uint64_t)axisAccel * major / distance;
+      if (scaled < lowest) {
+        lowest = scaled;
+      }
+    }
+    return (uint32_t)lowest;
+  }
+
+ private:
+  static uint32_t magnitude(int32_t steps) { return (steps < 0) ? -steps : steps; }
+
+  /**
+   * True if an axis accelerates above the move's acceleration below cruise.
+   */
+  bool boosted(uint8_t axis, uint32_t acceleration, uint32_t cruiseHz) const {
+    return _curve[axis].count == 0 && _bound[axis] > acceleration && cruiseHz > 0 && acceleration > 0;
+  }
+
+  static void insertSorted(uint32_t* values, uint8_t& count, uint32_t value) {
+    uint8_t i = 0;
+    while (i < count && values[i] < value) {
+      i++;
+    }
+    if (i < count && values[i] == value) {
+      return;
+    }
+    for (uint8_t j = count; j > i; j--) {
+      values[j] = values[j - 1];
+    }
+    values[i] = value;
+    count++;
+  }
+
+  /**
+   * Curve value of one axis at its own speed, steps/sec².
+   */
+  static uint32_t curveAt(const AccelCurve& curve, uint32_t speedHz) {
+    const AccelPoint* points = curve.points;
+    for (uint8_t p = 1; p < curve.count; p++) {
+      if (speedHz <= points[p].speedHz) {
+        int64_t span = (int64_t)points[p].speedHz - points[p - 1].speedHz;
+        int64_t delta = (int64_t)points[p].acceleration - points[p - 1].acceleration;
+        return (uint32_t)(points[p - 1].acceleration + delta * ((int64_t)speedHz - points[p - 1].speedHz) / span);
+      }
+    }
+    return points[curve.count - 1].acceleration;
+  }
+
+  /**
+   * Lowest limit of the moving axes at a dominant axis speed, scaled to the dominant axis.
+   */
+  uint32_t limitAt(uint32_t acceleration, const int32_t (&steps)[N], uint32_t major, uint32_t speedHz,
+                   uint32_t cruiseHz) const {
+    uint64_t lowest = UINT32_MAX;
+    for (uint8_t i = 0; i < N; i++) {
+      uint32_t distance = magnitude(steps[i]);
+      if (distance == 0) {
+        continue;
+      }
+      uint64_t axisSpeed = (uint64_t)speedHz * distance / major;
+      uint32_t axisAccel = (_curve[i].count > 0) ? curveAt(_curve[i], (uint32_t)axisSpeed) : acceleration;
+      if (boosted(i, acceleration, cruiseHz) && speedHz < cruiseHz) {
+        // Speed ratios are the same on every axis of a straight move
+        uint64_t power = (uint64_t)acceleration * cruiseHz;
+        axisAccel = (speedHz == 0 || power / speedHz > _bound[i]) ? _bound[i] : (uint32_t)(power / speedHz);
+      }
+      uint64_t scaled = (uint64_t)axisAccel * major / distance;
+      if (scaled < lowest) {
+        lowest = scaled;
+      }
+    }
+    return (uint32_t)lowest;
+  }
+
+  AccelCurve _curve[N] = {};
+  uint32_t _bound[N] = {};     // Steps/sec², 0 for none
+};
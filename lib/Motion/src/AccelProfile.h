@@ -0,0 +1,175 @@
+/*
+*******************************************************************************
+* Description:
+*   Speed-dependent acceleration limit a(v) for the profile sampler, stored as
+*   a piecewise-constant table over the velocity of the dominant axis. Provides
+*   the braking distance and time between two velocities and the inverse of
+*   the distance, the highest velocity from which the axis can still brake
+*   within a given distance.
+*   Velocities are Q16 microsteps per sample, accelerations Q32 microsteps
+*   per sample², distances Q16 microsteps.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "FixedPoint.h"
+#include "StepCommand.h"
+
+// Room for the acceleration curves of the moving axes plus resonance band edges
+constexpr uint8_t ACCEL_PROFILE_MAX_PIECES = 64;
+
+/**
+ * Converts an acceleration in steps/sec² to Q32 microsteps per sample².
+ */
+constexpr int64_t accelToSample(uint32_t acceleration) {
+  return (int64_t)(((uint64_t)acceleration << 32) / ((uint64_t)PROFILE_SAMPLES_PER_S * PROFILE_SAMPLES_PER_S));
+}
+
+/**
+ * Converts a Q32 per-sample² acceleration back to steps/sec².
+ */
+constexpr uint32_t sampleToAccel(int64_t acceleration) {
+  return (uint32_t)(((uint64_t)acceleration * PROFILE_SAMPLES_PER_S * PROFILE_SAMPLES_PER_S) >> 32);
+}
+
+class AccelProfile {
+ public:
+  /**
+   * One acceleration over all speeds.
+   */
+  void setConstant(uint32_t acceleration) {
+    _count = 1;
+    _from[0] = 0;
+    _accel[0] = clampAccel(accelToSample(acceleration));
+  }
+
+  /**
+   * Overrides the acceleration from velocity from (Q16 per sample) upward,
+   * up to the next piece. Pieces must be added in increasing velocity order.
+   * @return false if the table is full or out of order
+   */
+  bool addPiece(q16_t from, int64_t accelQ32) {
+    if (_count >= ACCEL_PROFILE_MAX_PIECES || (_count > 0 && from <= _from[_count - 1])) {
+      return false;
+    }
+    _from[_count] = from;
+    _accel[_count] = clampAccel(accelQ32);
+    _count++;
+    return true;
+  }
+
+  /**
+   * Number of pieces; piece i covers [pieceStart(i), pieceStart(i + 1)).
+   */
+  uint8_t pieces() const { return _count; }
+
+  q16_t pieceStart(uint8_t piece) const { return _from[piece]; }
+
+  /**
+   * Acceleration at a velocity, Q32 microsteps per sample².
+   */
+  int64_t at(q16_t velocity) const { return _accel[pieceAt(velocity)]; }
+
+  /**
+   * Lowest acceleration anywhere in [0, velocity], Q32 per sample².
+   */
+  int64_t minimumUpTo(q16_t velocity) const {
+    int64_t lowest = _accel[0];
+    for (uint8_t i = 1; i < _count && _from[i] < velocity; i++) {
+      if (_accel[i] < lowest) {
+        lowest = _accel[i];
+      }
+    }
+    return lowest;
+  }
+
+  /**
+   * Distance needed to change speed between two velocities, Q16 microsteps.
+   * @param braking Round the acceleration to whole Q16 units, as the sampler
+   *                plans its braking; false for the exact acceleration it
+   *                speeds up with
+   */
+  int64_t distance(q16_t low, q16_t high, bool braking = true) const {
+    if (high <= low) {
+      return 0;
+    }
+    int64_t total = 0;
+    for (uint8_t i = pieceAt(low); i < _count; i++) {
+      q16_t start = (_from[i] > low) ? _from[i] : low;
+      q16_t end = (i + 1 < _count && _from[i + 1] < high) ? _from[i + 1] : high;
+      if (start >= high) {
+        break;
+      }
+      if (braking) {
+        total += ((int64_t)end * end - (int64_t)start * start) / (2 * (_accel[i] >> Q16_SHIFT));
+      } else {
+        int64_t samples = ((int64_t)(end - start) << 32) / _accel[i];      // Q16, like duration()
+        total += (samples * ((int64_t)start + end) / 2) >> Q16_SHIFT;
+      }
+    }
+    return total;
+  }
+
+  /**
+   * Time needed to change speed between two velocities, Q16 samples.
+   * @param braking As for distance()
+   */
+  int64_t duration(q16_t low, q16_t high, bool braking = true) const {
+    if (high <= low) {
+      return 0;
+    }
+    int64_t total = 0;
+    for (uint8_t i = pieceAt(low); i < _count; i++) {
+      q16_t start = (_from[i] > low) ? _from[i] : low;
+      q16_t end = (i + 1 < _count && _from[i + 1] < high) ? _from[i + 1] : high;
+      if (start >= high) {
+        break;
+      }
+      int64_t accel = braking ? (_accel[i] >> Q16_SHIFT) << Q16_SHIFT : _accel[i];
+      total += ((int64_t)(end - start) << 32) / accel;
+    }
+    return total;
+  }
+
+  /**
+   * Highest velocity from which the axis can brake to endVelocity within
+   * distance (Q16 microsteps).
+   */
+  q16_t brakeVelocity(int64_t distance, q16_t endVelocity) const {
+    q16_t velocity = endVelocity;
+    for (uint8_t i = pieceAt(endVelocity); i < _count; i++) {
+      int64_t accel = _accel[i] >> Q16_SHIFT;
+      if (i + 1 < _count) {
+        q16_t top = _from[i + 1];
+        int64_t needed = ((int64_t)top * top - (int64_t)velocity * velocity) / (2 * accel);
+        if (needed <= distance) {
+          distance -= needed;
+          velocity = top;
+          continue;
+        }
+      }
+      return (q16_t)isqrt64((uint64_t)velocity * velocity + 2 * (uint64_t)accel * (uint64_t)distance);
+    }
+    return velocity;
+  }
+
+ private:
+  static int64_t clampAccel(int64_t accel) {
+    return (accel < Q16_ONE) ? Q16_ONE : accel;   // Keep at least one Q16 unit for the divisions
+  }
+
+  uint8_t pieceAt(q16_t velocity) const {
+    uint8_t piece = 0;
+    while (piece + 1 < _count && _from[piece + 1] <= velocity) {
+      piece++;
+    }
+    return piece;
+  }
+
+  q16_t _from[ACCEL_PROFILE_MAX_PIECES] = {};
+  int64_t _accel[ACCEL_PROFILE_MAX_PIECES] = {};
+  uint8_t _count = 0;
+};
@@ -0,0 +1,154 @@
+/*
+*******************************************************************************
+* Description:
+*   Splits a circular arc in the plane of axes 0 and 1 (X/Y) into straight
+*   chords whose sagitta stays within a tolerance. Further axes move linearly
+*   with the swept angle, which makes the arc a helix. Chord end points are
+*   computed directly from the center and the angle (CORDIC, integer only), so
+*   rounding never accumulates along the arc; the last point is the exact end.
+*   Coordinates are absolute microsteps; both plane axes are assumed to have
+*   the same steps per unit of travel.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "FixedPoint.h"
+
+// Fixed-point fraction bits for the arc radius vector
+constexpr int ARC_FRACTION_BITS = 8;
+
+// Chords an arc may be split into, whatever the tolerance
+constexpr uint32_t ARC_MAX_CHORDS = 4096;
+
+template <uint8_t N>
+class ArcSegmenter {
+  static_assert(N >= 2, "Arcs need two axes for the plane");
+
+ public:
+  /**
+   * Plans an arc from start to end around start + (offsetX, offsetY).
+   * A full circle results when end equals start in the plane.
+   * @param start Current absolute position
+   * @param end Absolute end position
+   * @param offsetX Center X relative to start (G-code I), microsteps
+   * @param offsetY Center Y relative to start (G-code J), microsteps
+   * @param clockwise G2 when true, G3 otherwise
+   * @param toleranceSteps Largest allowed distance between chord and arc
+   * @return false if the radius is zero
+   */
+  bool begin(const int32_t (&start)[N], const int32_t (&end)[N], int32_t offsetX, int32_t offsetY,
+             bool clockwise, uint32_t toleranceSteps) {
+    _chord = 0;
+    _chords = 0;
+    int64_t centerX = (int64_t)start[0] + offsetX;
+    int64_t centerY = (int64_t)start[1] + offsetY;
+    _centerX = centerX << ARC_FRACTION_BITS;
+    _centerY = centerY << ARC_FRACTION_BITS;
+    for (uint8_t i = 0; i < N; i++) {
+      _start[i] = start[i];
+      _end[i] = end[i];
+    }
+
+    int64_t radius = 0;
+    _startAngle = cordicAtan2(-(int64_t)offsetY, -(int64_t)offsetX, &radius);
+    bangle_t endAngle = cordicAtan2((end[1] - centerY), (end[0] - centerX));
+    if (radius <= 0) {
+      return false;
+    }
+    _radius = radius << ARC_FRACTION_BITS;
+
+    // Swept angle in the direction of travel, as a 33-bit value so a full circle fits
+    uint64_t sweep = clockwise ? (bangle_t)(_startAngle - endAngle) : (bangle_t)(endAngle - _startAngle);
+    if (sweep == 0) {
+      sweep = (uint64_t)1 << 32;
+    }
+    _sweep = sweep;
+    _clockwise = clockwise;
+
+    // Chord angle with sagitta r·(1 - cos(θ/2)) ≈ r·θ²/8 = tolerance: θ = sqrt(8·tol / r)
+    uint32_t tolerance = toleranceSteps ? toleranceSteps : 1;
+    uint64_t ratio = ((uint64_t)8 * tolerance << 40) / (uint64_t)radius;   // 8·tol/r in Q40
+    uint64_t chordAngle = (uint64_t)isqrt64(ratio) * 651898 / 1000;      // Q20 radians to binary angle
+    if (chordAngle == 0) {
+      chordAngle = 1;
+    }
+    uint64_t chords = (sweep + chordAngle - 1) / chordAngle;
+    _chords = (uint32_t)((chords < 1) ? 1 : (chords > ARC_MAX_CHORDS) ? ARC_MAX_CHORDS : chords);
+    return true;
+  }
+
+  /**
+   * Produces the end point of the next chord.
+   * @return false once the whole arc has been emitted
+   */
+  bool next(int32_t (&point)[N]) {
+    if (_chord >= _chords) {
+      return false;
+    }
+    _chord++;
+    if (_chord == _chords) {
+      for (uint8_t i = 0; i < N; i++) {
+        point[i] = _end[i];
+      }
+      return true;
+    }
+
+    uint64_t swept = _sweep * _chord / _chords;
+    bangle_t angle = _clockwise ? _startAngle - (bangle_t)swept : _startAngle + (bangle_t)swept;
+    int64_t x = _radius;
+    int64_t y = 0;
+    cordicRotate(angle, x, y);
+    point[0] = (int32_t)((_centerX + x + (1 << (ARC_FRACTION_BITS - 1))) >> ARC_FRACTION_BITS);
+    point[1] = (int32_t)((_centerY + y + (1 << (ARC_FRACTION_BITS - 1))) >> ARC_FRACTION_BITS);
+
+    // Helical axes follow the swept fraction
+    for (uint8_t i = 2; i < N; i++) {
+      point[i] = _start[i] + (int32_t)(((int64_t)_end[i] - _start[i]) * _chord / _chords);
+    }
+    return true;
+  }
+
+  /**
+   * Chords of the planned arc.
+   */
+  uint32_t chords() const { return _chords; }
+
+  bool active() const { return _chord < _chords; }
+
+  /**
+   * Drops the chords not yet emitted.
+   */
+  void cancel() { _chord = _chords; }
+
+  /**
+   * Arc length still to be emitted, in microsteps of the plane.
+   */
+  uint32_t remainingLength() const {
+    if (_chords == 0) {
+      return 0;
+    }
+    uint64_t angle = _sweep * (_chords - _chord) / _chords;                   // Binary angle
+    uint64_t radius = (uint64_t)_radius >> ARC_FRACTION_BITS;
+    return (uint32_t)(((angle >> 8) * radius * 6283 / 1000) >> 24);          // r·θ with θ = angle·2π / 2^32
+  }
+
+  /**
+   * End point of the arc.
+   */
+  int32_t end(uint8_t axis) const { return _end[axis]; }
+
+ private:
+  int64_t _centerX = 0;      // Center, with ARC_FRACTION_BITS fraction bits
+  int64_t _centerY = 0;
+  int64_t _radius = 0;
+  bangle_t _startAngle = 0;
+  uint64_t _sweep = 0;       // Binary angle, up to one full turn
+  bool _clockwise = false;
+  int32_t _start[N] = {};
+  int32_t _end[N] = {};
+  uint32_t _chord = 0;
+  uint32_t _chords = 0;
+};
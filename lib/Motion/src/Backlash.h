@@ -0,0 +1,78 @@
+/*
+*******************************************************************************
+* Description:
+*   Backlash take-up for one axis. When the axis reverses, the motor has to
+*   cross the lost motion of the drivetrain before the load follows. The
+*   take-up steps are added on top of the move from the start of the
+*   reversing segment at a fixed rate, so no separate approach move or stop
+*   is needed. The motor then runs ahead of the planned (load) position by
+*   the offset, which is 0 after moving up and -steps after moving down.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "FixedPoint.h"
+#include "ProfileSampler.h"
+
+/**
+ * Backlash of one axis.
+ */
+struct BacklashConfig {
+  uint16_t steps;       // Lost motion on a reversal, microsteps; 0 for none
+  uint32_t takeUpHz;    // Rate the take-up steps are added at, on top of the move
+};
+
+class BacklashTakeUp {
+ public:
+  void configure(const BacklashConfig& config) {
+    _steps = config.steps;
+    _rate = speedToSample(config.takeUpHz);
+    if (_rate <= 0) {
+      _rate = Q16_ONE;
+    }
+  }
+
+  /**
+   * Takes the direction of a segment the axis starts; a reversal starts a
+   * take-up (or turns a running one around).
+   * @param steps Signed steps of the axis in the segment
+   */
+  void direct(int32_t steps) {
+    if (steps != 0 && _steps > 0) {
+      _target = (steps < 0) ? -((int64_t)_steps << Q16_SHIFT) : 0;
+    }
+  }
+
+  /**
+   * Take-up for the next sample, Q16 steps.
+   */
+  q16_t next() {
+    int64_t delta = _target - _offset;
+    if (delta > _rate) {
+      delta = _rate;
+    } else if (delta < -_rate) {
+      delta = -_rate;
+    }
+    _offset += delta;
+    return (q16_t)delta;
+  }
+
+  /**
+   * True once the take-up has been fully issued.
+   */
+  bool settled() const { return _offset == _target; }
+
+  /**
+   * Steps the motor runs ahead of the planned position; exact once settled.
+   */
+  int32_t offset() const { return (int32_t)(_offset >> Q16_SHIFT); }
+
+ private:
+  int64_t _target = 0;      // Q16 steps
+  int64_t _offset = 0;      // Q16 steps issued
+  q16_t _rate = Q16_ONE;    // Q16 steps per sample
+  uint16_t _steps = 0;
+};
@@ -0,0 +1,220 @@
+/*
+*******************************************************************************
+* Description:
+*   Button event decoding, independent of the hardware. Interrupt handlers
+*   push raw, timestamped edges into an EdgeQueue; the consumer feeds them to
+*   a ButtonDecoder, which debounces them and turns them into press, click,
+*   hold, auto-repeat and release events. Events carry the time of the first
+*   edge of a press, so their timing does not depend on how late loop() gets
+*   to them. Times are microseconds and may wrap.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+// A level must stay unchanged this long before a transition is accepted
+constexpr uint32_t BUTTON_DEBOUNCE_US = 5000;
+
+// Press duration that turns a press into a hold instead of a click
+constexpr uint32_t BUTTON_HOLD_US = 1000000;
+
+// Interval between auto-repeat events once a button is held
+constexpr uint32_t BUTTON_REPEAT_US = 250000;
+
+// Raw edges buffered between the interrupt handlers and the consumer (power of two)
+constexpr uint16_t BUTTON_EDGE_QUEUE_LENGTH = 64;
+
+/**
+ * One raw level change of a button input, as captured by its interrupt.
+ */
+struct ButtonEdge {
+  uint8_t button;     // Index of the button
+  bool pressed;       // Level after the edge
+  uint32_t timeUs;
+};
+
+enum class ButtonEventType : uint8_t {
+  Press,      // Button went down
+  Click,      // Released before BUTTON_HOLD_US
+  Hold,       // Held for BUTTON_HOLD_US
+  Repeat,     // Every BUTTON_REPEAT_US after a hold, if enabled for the button
+  Release,    // Button went up (after Click, or ending a hold)
+};
+
+struct ButtonEvent {
+  uint8_t button;
+  ButtonEventType type;
+  uint32_t timeUs;    // Time of the edge (Press/Click/Release) or of the hold/repeat deadline
+};
+
+/**
+ * Single-producer, single-consumer edge buffer. push() is safe to call from
+ * an interrupt handler while pop() runs in loop(). A full queue drops the new
+ * edge and counts it.
+ */
+template <uint16_t Cap>
+class EdgeQueue {
+  static_assert((Cap & (Cap - 1)) == 0, "EdgeQueue capacity must be a power of two");
+
+ public:
+  bool push(const ButtonEdge& edge) {
+    uint16_t head = _head.load(std::memory_order_relaxed);
+    if ((uint16_t)(head - _tail.load(std::memory_order_acquire)) >= Cap) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    _slots[head & (Cap - 1)] = edge;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(ButtonEdge& edge) {
+    uint16_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    edge = _slots[tail & (Cap - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Edges lost to a full queue since the last call.
+   */
+  uint32_t takeDropped() { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+ private:
+  ButtonEdge _slots[Cap];
+  std::atomic<uint16_t> _head{0};
+  std::atomic<uint16_t> _tail{0};
+  std::atomic<uint32_t> _dropped{0};
+};
+
+/**
+ * Debounces raw edges of N buttons and derives the higher-level events.
+ * Feed every edge in order with feed(), then call poll() with the current
+ * time until it returns false.
+ */
+template <uint8_t N>
+class ButtonDecoder {
+ public:
+  /**
+   * Enables auto-repeat events while a button is held.
+   */
+  void setRepeat(uint8_t button, bool enabled) { _state[button].repeat = enabled; }
+
+  /**
+   * Sets the debounced level of a button without generating events, e.g. from
+   * a pin read at startup or after edges were dropped.
+   */
+  void reset(uint8_t button, bool pressed, uint32_t nowUs) {
+    State& s = _state[button];
+    s.raw = s.stable = pressed;
+    s.lastEdgeUs = s.firstEdgeUs = s.pressedUs = nowUs;
+    s.tracked = false;   // A button already down at reset never becomes a click or hold
+  }
+
+  /**
+   * Takes one raw edge. Transitions before the edge must be settled first,
+   * so poll() up to edge.timeUs has to be drained before feeding it.
+   */
+  void feed(const ButtonEdge& edge) {
+    if (edge.button >= N) {
+      return;
+    }
+    State& s = _state[edge.button];
+    if (edge.pressed == s.raw) {
+      return;     // Missed the opposite edge; nothing changes
+    }
+    // A transition starts with the first edge after a quiet line; bounces keep its start time
+    if (s.raw == s.stable && elapsed(s.lastEdgeUs, edge.timeUs) >= BUTTON_DEBOUNCE_US) {
+      s.firstEdgeUs = edge.timeUs;
+    }
+    s.raw = edge.pressed;
+    s.lastEdgeUs = edge.timeUs;
+  }
+
+  /**
+   * Produces the next event due at or before nowUs.
+   * @return false if no event is due
+   */
+  bool poll(uint32_t nowUs, ButtonEvent& event) {
+    for (uint8_t i = 0; i < N; i++) {
+      State& s = _state[i];
+      event.button = i;
+
+      if (s.pendingRelease) {
+        s.pendingRelease = false;
+        event.type = ButtonEventType::Release;
+        event.timeUs = s.releasedUs;
+        return true;
+      }
+
+      // Hold and repeat deadlines that passed before a pending release still count; while the
+      // line still bounces (even back at the stable level for a moment) only up to its first edge
+      bool settling = s.raw != s.stable || elapsed(s.lastEdgeUs, nowUs) < BUTTON_DEBOUNCE_US;
+      uint32_t limitUs = settling ? s.firstEdgeUs : nowUs;
+      if (s.tracked && s.stable && !s.held && elapsed(s.pressedUs, limitUs) >= BUTTON_HOLD_US) {
+        s.held = true;
+        event.type = ButtonEventType::Hold;
+        event.timeUs = s.pressedUs + BUTTON_HOLD_US;
+        return true;
+      }
+      if (s.tracked && s.stable && s.held && s.repeat && (int32_t)(limitUs - s.nextRepeatUs) >= 0) {
+        event.type = ButtonEventType::Repeat;
+        event.timeUs = s.nextRepeatUs;
+        s.nextRepeatUs += BUTTON_REPEAT_US;
+        return true;
+      }
+
+      // Accept a level once it has been quiet for the debounce time
+      if (s.raw != s.stable && elapsed(s.lastEdgeUs, nowUs) >= BUTTON_DEBOUNCE_US) {
+        s.stable = s.raw;
+        event.timeUs = s.firstEdgeUs;
+        if (s.stable) {
+          s.pressedUs = s.firstEdgeUs;
+          s.nextRepeatUs = s.pressedUs + BUTTON_HOLD_US + BUTTON_REPEAT_US;
+          s.held = false;
+          s.tracked = true;
+          event.type = ButtonEventType::Press;
+        } else if (s.tracked && !s.held) {
+          s.releasedUs = s.firstEdgeUs;
+          s.pendingRelease = true;
+          event.type = ButtonEventType::Click;
+        } else {
+          event.type = ButtonEventType::Release;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Debounced level of a button.
+   */
+  bool pressed(uint8_t button) const { return _state[button].stable; }
+
+ private:
+  struct State {
+    bool raw = false;            // Level after the last edge
+    bool stable = false;         // Debounced level
+    bool held = false;           // Hold fired for the current press
+    bool tracked = false;        // Current press was seen going down, not just found at reset
+    bool repeat = false;
+    bool pendingRelease = false; // Release still to report after a Click
+    uint32_t lastEdgeUs = 0;
+    uint32_t firstEdgeUs = 0;    // First edge of the transition being debounced
+    uint32_t pressedUs = 0;
+    uint32_t releasedUs = 0;
+    uint32_t nextRepeatUs = 0;
+  };
+
+  static uint32_t elapsed(uint32_t sinceUs, uint32_t nowUs) { return nowUs - sinceUs; }
+
+  State _state[N];
+};
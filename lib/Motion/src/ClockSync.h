@@ -0,0 +1,144 @@
+/*
+*******************************************************************************
+* Description:
+*   Clock synchronization and timestamp-scheduled moves over the host link
+*   (SerialFrame.h), shared by the firmware and the host tools.
+*
+*   Sync works like NTP. The host sends its send time t1. The controller
+*   answers with t1, its own receive time t2 and its reply time t3, all in
+*   µs. The host notes the arrival time t4 and learns:
+*     round trip = (t4 - t1) - (t3 - t2)
+*     controller time at the host midpoint (t1 + t4) / 2 = (t2 + t3) / 2
+*   It fits offset and drift over many such samples (t2 - t1 and t3 - t4
+*   separately, each at its least queued; see ClockEstimator.h) and converts target
+*   times to controller time itself. The controller only ever deals in its
+*   own clock.
+*
+*   A TimedMove carries a move and the controller time its first steps are
+*   due. TimedMoveReceiver applies each one once: a resend of the last move
+*   (same sequence number) is answered again without queuing it twice.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "SerialFrame.h"
+
+/**
+ * Frame types of clock sync and timed moves; replies have the high bit set.
+ */
+enum class ClockFrame : uint8_t { Sync = 0x10, TimedMove = 0x11, SyncReply = 0x90, MoveReply = 0x91 };
+
+/**
+ * Outcome of a TimedMove, first byte of the MoveReply.
+ */
+enum class TimedMoveStatus : uint8_t { Queued = 0, Full = 1, Late = 2, Busy = 3, Invalid = 4 };
+
+// Axes a TimedMove can carry
+constexpr uint8_t TIMED_MOVE_MAX_AXES = 4;
+
+// Least notice a timed move needs: planning, loading the step queues and the start lead
+constexpr uint32_t TIMED_MOVE_MIN_NOTICE_US = 10000;
+
+// Sync: t1. SyncReply: t1, t2, t3. TimedMove: start, speed, acceleration, axis count, steps.
+constexpr uint8_t SYNC_BYTES = 8;
+constexpr uint8_t SYNC_REPLY_BYTES = 24;
+constexpr uint8_t TIMED_MOVE_BYTES = 8 + 4 + 4 + 1 + 4 * TIMED_MOVE_MAX_AXES;
+
+static_assert(TIMED_MOVE_BYTES <= FRAME_MAX_PAYLOAD, "Timed move must fit one frame");
+
+struct TimedMove {
+  uint64_t startUs;        // Controller time the first steps are due
+  uint32_t speedHz;
+  uint32_t acceleration;
+  uint8_t axes;            // Axes carried in steps
+  int32_t steps[TIMED_MOVE_MAX_AXES];
+};
+
+inline void packTimedMove(const TimedMove& move, Frame& frame) {
+  frame.type = (uint8_t)ClockFrame::TimedMove;
+  frame.length = TIMED_MOVE_BYTES;
+  putU64(frame.payload, move.startUs);
+  putU32(frame.payload + 8, move.speedHz);
+  putU32(frame.payload + 12, move.acceleration);
+  frame.payload[16] = move.axes;
+  for (uint8_t i = 0; i < TIMED_MOVE_MAX_AXES; i++) {
+    putU32(frame.payload + 17 + 4 * i, (uint32_t)move.steps[i]);
+  }
+}
+
+/**
+ * @return false if the frame is not a well-formed TimedMove
+ */
+inline bool unpackTimedMove(const Frame& frame, TimedMove& move) {
+  if (frame.length != TIMED_MOVE_BYTES || frame.payload[16] > TIMED_MOVE_MAX_AXES) {
+    return false;
+  }
+  move.startUs = getU64(frame.payload);
+  move.speedHz = getU32(frame.payload + 8);
+  move.acceleration = getU32(frame.payload + 12);
+  move.axes = frame.payload[16];
+  for (uint8_t i = 0; i < TIMED_MOVE_MAX_AXES; i++) {
+    move.steps[i] = (int32_t)getU32(frame.payload + 17 + 4 * i);
+  }
+  return true;
+}
+
+/**
+ * Controller side of sync and timed moves. The sink queues moves:
+ *   TimedMoveStatus queue(const TimedMove&)   Queued, or why the move was refused
+ *   uint8_t space()                           free move slots
+ */
+class TimedMoveReceiver {
+ public:
+  /**
+   * True for the frame types handle() answers.
+   */
+  static bool handles(uint8_t type) {
+    return type == (uint8_t)ClockFrame::Sync || type == (uint8_t)ClockFrame::TimedMove;
+  }
+
+  /**
+   * Handles one received frame and builds the reply to send back.
+   * @param receivedUs Controller time the frame was received
+   * @param nowUs Controller time now, just before the reply is sent
+   */
+  template <class Sink>
+  void handle(const Frame& in, uint64_t receivedUs, uint64_t nowUs, Frame& reply, Sink& sink) {
+    reply.seq = in.seq;
+    if (in.type == (uint8_t)ClockFrame::Sync) {
+      reply.type = (uint8_t)ClockFrame::SyncReply;
+      reply.length = SYNC_REPLY_BYTES;
+      putU64(reply.payload, (in.length == SYNC_BYTES) ? getU64(in.payload) : 0);
+      putU64(reply.payload + 8, receivedUs);
+      putU64(reply.payload + 16, nowUs);
+      return;
+    }
+
+    TimedMove move;
+    TimedMoveStatus status;
+    if (_applied && in.seq == _lastSeq) {
+      status = TimedMoveStatus::Queued;     // Resent after the reply was lost
+    } else if (!unpackTimedMove(in, move)) {
+      status = TimedMoveStatus::Invalid;
+    } else if (move.startUs < nowUs + TIMED_MOVE_MIN_NOTICE_US) {
+      status = TimedMoveStatus::Late;
+    } else {
+      status = sink.queue(move);
+      if (status == TimedMoveStatus::Queued) {
+        _applied = true;
+        _lastSeq = in.seq;
+      }
+    }
+    reply.type = (uint8_t)ClockFrame::MoveReply;
+    reply.length = 2;
+    reply.payload[0] = (uint8_t)status;
+    reply.payload[1] = sink.space();
+  }
+
+ private:
+  uint8_t _lastSeq = 0;     // Sequence number of the last queued move
+  bool _applied = false;
+};
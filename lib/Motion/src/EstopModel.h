@@ -0,0 +1,101 @@
+/*
+*******************************************************************************
+* Description:
+*   Simulated emergency stop path for the host simulator. The step commands
+*   of a move are replayed into per-axis edge times; a stop at any instant
+*   reaches the interrupt after the entry latency, the handler cuts the
+*   step outputs one axis after another, and the driver is disabled once
+*   the loop() pass in progress ends and the I2C write completes. Edges
+*   that still leave an axis between the stop and its cut are counted.
+*   Only the timing is modelled, from the parameters; none of the
+*   firmware's stop code runs here. The default parameters are estimates;
+*   replace them with the figures the controller reports ('?' over Serial)
+*   for the actual firmware.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "StepCommand.h"
+#include "StopLatency.h"
+
+struct EstopModelParams {
+  uint32_t entryNs;           // Longest latency from the input edge to the handler running
+  uint32_t cutNsPerAxis;      // Handler time to cut one axis' step output
+  uint32_t loopPeriodUs;      // Longest loop() pass, until the stop is serviced
+  uint32_t disableUs;         // I2C write disabling the driver chip
+};
+
+constexpr EstopModelParams ESTOP_MODEL = {3000, 250, 12000, 400};
+
+template <uint8_t N>
+class EstopModel {
+ public:
+  explicit EstopModel(const EstopModelParams& params = ESTOP_MODEL) : _params(params) {}
+
+  /**
+   * Appends one step command of an axis to its edge timeline.
+   */
+  void add(uint8_t axis, const StepCommand& command) {
+    uint64_t intervalNs = (uint64_t)command.ticks * 1000000000ull / STEP_TICKS_PER_S;
+    if (command.steps == 0) {
+      _timeNs[axis] += intervalNs;      // Pause
+      return;
+    }
+    for (uint8_t k = 0; k < command.steps; k++) {
+      _edges[axis].push_back(_timeNs[axis]);
+      _timeNs[axis] += intervalNs;
+    }
+  }
+
+  /**
+   * Length of the longest axis timeline, ns.
+   */
+  uint64_t durationNs() const {
+    uint64_t longest = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      longest = (_timeNs[i] > longest) ? _timeNs[i] : longest;
+    }
+    return longest;
+  }
+
+  /**
+   * Stops at triggerNs into the move.
+   * @param pulsesAfter Receives the edges that left any axis after the stop
+   */
+  StopLatency stop(uint64_t triggerNs, uint32_t& pulsesAfter) {
+    uint64_t cutNs = triggerNs + jitter(_params.entryNs);
+    pulsesAfter = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      cutNs += _params.cutNsPerAxis;
+      for (uint64_t edge : _edges[i]) {
+        if (edge > cutNs) {
+          break;
+        }
+        pulsesAfter += edge >= triggerNs;
+      }
+    }
+    StopLatency latency;
+    latency.cutNs = (uint32_t)(cutNs - triggerNs);
+    latency.disableUs = jitter(_params.loopPeriodUs) + _params.disableUs;
+    return latency;
+  }
+
+ private:
+  /**
+   * Pseudo-random delay in [0, range], repeatable between runs.
+   */
+  uint32_t jitter(uint32_t range) {
+    _seed = _seed * 1664525u + 1013904223u;
+    return (range > 0) ? (_seed >> 8) % (range + 1) : 0;
+  }
+
+  EstopModelParams _params;
+  std::vector<uint64_t> _edges[N];
+  uint64_t _timeNs[N] = {};
+  uint32_t _seed = 1;
+};
@@ -0,0 +1,191 @@
+/*
+*******************************************************************************
+* Description:
+*   Deferred binary event log. A log call stores only a format-string ID
+*   (a compile-time hash of the format), a timestamp and the raw
+*   32-bit argument words in a RAM ring. A low-priority task later drains
+*   the ring into binary frames (SerialFrame.h). The host looks the IDs up
+*   in a string table taken from the sources at build time and formats the
+*   text there, so nothing is formatted or printed on the control path and a
+*   full ring drops records instead of blocking.
+*
+*   Arguments are numbers only: integers up to 32 bits and floats take one
+*   word, 64-bit integers two (%lld, %llu). Pointers and strings are refused
+*   at compile time, since their contents are gone by the time the host
+*   reads the record.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+#include "SerialFrame.h"
+
+// Frame type of drained log records
+constexpr uint8_t LOG_FRAME_TYPE = 0x20;
+
+// Argument words one record can carry
+constexpr uint8_t LOG_MAX_ARG_WORDS = 8;
+
+// ID of the record the drain emits for records lost to a full ring (argument: count)
+constexpr uint32_t LOG_DROPPED_ID = 0;
+
+// Record on the wire: ID, timestamp µs, word count, words
+constexpr uint8_t LOG_RECORD_HEADER_BYTES = 9;
+
+static_assert(LOG_RECORD_HEADER_BYTES + 4 * LOG_MAX_ARG_WORDS <= FRAME_MAX_PAYLOAD, "Log record must fit a frame");
+
+/**
+ * FNV-1a hash of a format string, the record ID. The host computes the same
+ * hash over every format it extracts from the sources.
+ */
+constexpr uint32_t logFormatId(const char* format, uint32_t hash = 2166136261u) {
+  return (*format == '\0') ? hash : logFormatId(format + 1, (hash ^ (uint8_t)*format) * 16777619u);
+}
+
+/**
+ * Words an argument of type T takes in a record.
+ */
+template <class T>
+constexpr uint8_t logArgWords() {
+  static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Deferred logs take numbers only");
+  return (std::is_integral<T>::value && sizeof(T) > 4) ? 2 : 1;
+}
+
+template <class... Args>
+constexpr uint8_t logWordCount() {
+  return (0 + ... + logArgWords<Args>());
+}
+
+inline uint8_t packLogArgs(uint32_t*) {
+  return 0;
+}
+
+/**
+ * Stores the arguments as raw words: floats as their float bits, 64-bit
+ * integers low word first, everything else widened to 32 bits.
+ * @return words written
+ */
+template <class T, class... Rest>
+uint8_t packLogArgs(uint32_t* words, T value, Rest... rest) {
+  uint8_t used = logArgWords<T>();
+  if constexpr (std::is_floating_point<T>::value) {
+    float narrow = (float)value;
+    memcpy(words, &narrow, sizeof(narrow));
+  } else if constexpr (std::is_integral<T>::value && sizeof(T) > 4) {
+    words[0] = (uint32_t)(uint64_t)value;
+    words[1] = (uint32_t)((uint64_t)value >> 32);
+  } else {
+    words[0] = (uint32_t)value;
+  }
+  return used + packLogArgs(words + used, rest...);
+}
+
+/**
+ * One record as read back from the ring.
+ */
+struct LogRecord {
+  uint32_t id;
+  uint32_t stamp;     // Timestamp, in whatever unit the producer used
+  uint8_t count;      // Argument words
+  uint32_t words[LOG_MAX_ARG_WORDS];
+};
+
+/**
+ * Single-producer, single-consumer ring of variable-length records, stored
+ * as 32-bit words. push() never waits: a record that does not fit is
+ * dropped and counted.
+ */
+template <uint16_t Words>
+class LogRing {
+  static_assert((Words & (Words - 1)) == 0, "LogRing capacity must be a power of two");
+
+ public:
+  bool push(uint32_t id, uint32_t stamp, const uint32_t* words, uint8_t count) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (Words - (head - _tail.load(std::memory_order_acquire)) < 3u + count) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    _words[head++ & (Words - 1)] = id;
+    _words[head++ & (Words - 1)] = stamp;
+    _words[head++ & (Words - 1)] = count;
+    for (uint8_t i = 0; i < count; i++) {
+      _words[head++ & (Words - 1)] = words[i];
+    }
+    _head.store(head, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(LogRecord& record) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    record.id = _words[tail++ & (Words - 1)];
+    record.stamp = _words[tail++ & (Words - 1)];
+    record.count = (uint8_t)_words[tail++ & (Words - 1)];
+    for (uint8_t i = 0; i < record.count; i++) {
+      record.words[i] = _words[tail++ & (Words - 1)];
+    }
+    _tail.store(tail, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Records lost to a full ring since the last call.
+   */
+  uint32_t takeDropped() { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+ private:
+  uint32_t _words[Words];
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _tail{0};
+  std::atomic<uint32_t> _dropped{0};
+};
+
+/**
+ * Appends a record to a log frame payload.
+ * @return false if it does not fit; the frame is unchanged
+ */
+inline bool appendLogRecord(Frame& frame, const LogRecord& record) {
+  if (frame.length + LOG_RECORD_HEADER_BYTES + 4 * record.count > FRAME_MAX_PAYLOAD) {
+    return false;
+  }
+  uint8_t* out = frame.payload + frame.length;
+  putU32(out, record.id);
+  putU32(out + 4, record.stamp);
+  out[8] = record.count;
+  for (uint8_t i = 0; i < record.count; i++) {
+    putU32(out + LOG_RECORD_HEADER_BYTES + 4 * i, record.words[i]);
+  }
+  frame.length += LOG_RECORD_HEADER_BYTES + 4 * record.count;
+  return true;
+}
+
+/**
+ * Reads the record at offset of a log frame payload and advances offset.
+ * @return false at the end of the payload or on a malformed record
+ */
+inline bool readLogRecord(const Frame& frame, uint8_t& offset, LogRecord& record) {
+  if (offset + LOG_RECORD_HEADER_BYTES > frame.length) {
+    return false;
+  }
+  const uint8_t* in = frame.payload + offset;
+  record.id = getU32(in);
+  record.stamp = getU32(in + 4);
+  record.count = in[8];
+  if (record.count > LOG_MAX_ARG_WORDS || offset + LOG_RECORD_HEADER_BYTES + 4 * record.count > frame.length) {
+    return false;
+  }
+  for (uint8_t i = 0; i < record.count; i++) {
+    record.words[i] = getU32(in + LOG_RECORD_HEADER_BYTES + 4 * i);
+  }
+  offset += LOG_RECORD_HEADER_BYTES + 4 * record.count;
+  return true;
+}
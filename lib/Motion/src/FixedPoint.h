@@ -0,0 +1,116 @@
+/*
+*******************************************************************************
+* Description:
+*   Fixed-point helpers for the motion pipeline. Velocities are carried as
+*   Q16.16 microsteps per profile sample, so per-sample work is integer only.
+*   Angles are binary angles (a full turn is 2^32) handled by CORDIC, so arc
+*   geometry needs no floating point either.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+constexpr int Q16_SHIFT = 16;
+constexpr int32_t Q16_ONE = (int32_t)1 << Q16_SHIFT;
+
+using q16_t = int32_t;   // Q16.16 fixed-point value
+
+/**
+ * Integer square root, rounded down.
+ */
+inline uint32_t isqrt64(uint64_t value) {
+  uint64_t result = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= result + bit) {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t)result;
+}
+
+using bangle_t = uint32_t;   // Binary angle: 2^32 is one full turn, wraps naturally
+
+constexpr bangle_t BANGLE_QUARTER = (bangle_t)1 << 30;
+constexpr bangle_t BANGLE_HALF = (bangle_t)1 << 31;
+
+constexpr uint8_t CORDIC_ITERATIONS = 30;
+
+// atan(2^-i) as binary angles
+constexpr int32_t CORDIC_ATAN[CORDIC_ITERATIONS] = {
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+  2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861,
+  10430, 5215, 2608, 1304, 652, 326, 163, 81, 41, 20, 10, 5, 3, 1,
+};
+
+// 1 / CORDIC gain in Q30
+constexpr int64_t CORDIC_INV_GAIN_Q30 = 652032874;
+
+/**
+ * Rotates the vector (x, y) by angle. Inputs should stay below 2^60 / 1.65
+ * in magnitude; precision is about 2^-29 of the vector length.
+ */
+inline void cordicRotate(bangle_t angle, int64_t& x, int64_t& y) {
+  // Bring the angle into [-90°, 90°], where CORDIC converges
+  if (angle + BANGLE_QUARTER >= BANGLE_HALF) {
+    x = -x;
+    y = -y;
+    angle += BANGLE_HALF;
+  }
+  int32_t z = (int32_t)angle;
+  for (uint8_t i = 0; i < CORDIC_ITERATIONS; i++) {
+    int64_t dx = y >> i;
+    int64_t dy = x >> i;
+    if (z >= 0) {
+      x -= dx;
+      y += dy;
+      z -= CORDIC_ATAN[i];
+    } else {
+      x += dx;
+      y -= dy;
+      z += CORDIC_ATAN[i];
+    }
+  }
+  x = (x * CORDIC_INV_GAIN_Q30) >> 30;
+  y = (y * CORDIC_INV_GAIN_Q30) >> 30;
+}
+
+/**
+ * Angle of the vector (x, y), like atan2(y, x).
+ * @param length Receives the vector length
+ */
+inline bangle_t cordicAtan2(int64_t y, int64_t x, int64_t* length = nullptr) {
+  bangle_t base = 0;
+  if (x < 0) {
+    x = -x;
+    y = -y;
+    base = BANGLE_HALF;
+  }
+  int32_t z = 0;
+  for (uint8_t i = 0; i < CORDIC_ITERATIONS; i++) {
+    int64_t dx = y >> i;
+    int64_t dy = x >> i;
+    if (y > 0) {
+      x += dx;
+      y -= dy;
+      z += CORDIC_ATAN[i];
+    } else {
+      x -= dx;
+      y += dy;
+      z -= CORDIC_ATAN[i];
+    }
+  }
+  if (length) {
+    *length = (x * CORDIC_INV_GAIN_Q30) >> 30;
+  }
+  return base + (bangle_t)z;
+}
@@ -0,0 +1,171 @@
+/*
+*******************************************************************************
+* Description:
+*   Parser for the small G-code subset accepted over Serial: G0/G1 straight
+*   moves, G2/G3 arcs (center offsets I/J), G90/G91 distance modes, axis words
+*   X Y Z A, feed F and one M code per line. Numbers are read as fixed point with GCODE_SCALE units
+*   per whole value, so no floating point is involved. Line numbers (N) and
+*   comments, ';' to end of line or in parentheses, are skipped. The parser
+*   only reports the words of one line; modal state is kept by the caller.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-point scale of parsed values (four decimals)
+constexpr int32_t GCODE_SCALE = 10000;
+
+// Axis words in axis order
+constexpr char GCODE_AXIS_LETTERS[] = "XYZA";
+constexpr uint8_t GCODE_MAX_AXES = sizeof(GCODE_AXIS_LETTERS) - 1;
+
+/**
+ * Motion command of a line.
+ */
+enum class GcodeMotion : uint8_t { None, Rapid, Linear, ArcCW, ArcCCW };
+
+/**
+ * Distance mode set by a line.
+ */
+enum class GcodeDistance : uint8_t { Unchanged, Absolute, Relative };
+
+/**
+ * Words found on one line. Values are scaled by GCODE_SCALE.
+ */
+struct GcodeLine {
+  GcodeMotion motion;
+  GcodeDistance distance;
+  int32_t axes[GCODE_MAX_AXES];
+  uint8_t axisMask;          // Bit i set when axes[i] was given
+  int32_t offsetI;
+  int32_t offsetJ;
+  bool hasOffsets;           // I or J given
+  int32_t feed;
+  bool hasFeed;
+  uint8_t mcode;             // M code number, valid when hasMcode
+  bool hasMcode;
+};
+
+/**
+ * Reads a decimal number (optional sign, up to four decimals) as fixed point.
+ * @param text Advanced past the number
+ * @return false if no digits were found or the value does not fit
+ */
+inline bool parseGcodeNumber(const char*& text, int32_t& value) {
+  bool negative = false;
+  if (*text == '+' || *text == '-') {
+    negative = *text == '-';
+    text++;
+  }
+  int64_t whole = 0;
+  int64_t fraction = 0;
+  int32_t scale = GCODE_SCALE;
+  bool digits = false;
+  while (*text >= '0' && *text <= '9') {
+    whole = whole * 10 + (*text++ - '0');
+    digits = true;
+    if (whole > INT32_MAX / GCODE_SCALE) {
+      return false;
+    }
+  }
+  if (*text == '.') {
+    text++;
+    while (*text >= '0' && *text <= '9') {
+      if (scale > 1) {
+        scale /= 10;
+        fraction += (*text - '0') * scale;
+      }
+      text++;
+      digits = true;
+    }
+  }
+  int64_t scaled = whole * GCODE_SCALE + fraction;
+  value = (int32_t)(negative ? -scaled : scaled);
+  return digits;
+}
+
+/**
+ * Splits one line into its words.
+ * @return false on an unknown or malformed word
+ */
+inline bool parseGcodeLine(const char* text, GcodeLine& line) {
+  line = {};
+  while (*text) {
+    char letter = *text++;
+    if (letter >= 'a' && letter <= 'z') {
+      letter -= 'a' - 'A';
+    }
+    if (letter == ' ' || letter == '\t' || letter == '\r' || letter == '\n') {
+      continue;
+    }
+    if (letter == ';') {
+      break;
+    }
+    if (letter == '(') {
+      while (*text && *text != ')') {
+        text++;
+      }
+      if (*text) {
+        text++;
+      }
+      continue;
+    }
+
+    int32_t value;
+    if (!parseGcodeNumber(text, value)) {
+      return false;
+    }
+    switch (letter) {
+      case 'G':
+        switch (value) {
+          case 0 * GCODE_SCALE: line.motion = GcodeMotion::Rapid; break;
+          case 1 * GCODE_SCALE: line.motion = GcodeMotion::Linear; break;
+          case 2 * GCODE_SCALE: line.motion = GcodeMotion::ArcCW; break;
+          case 3 * GCODE_SCALE: line.motion = GcodeMotion::ArcCCW; break;
+          case 90 * GCODE_SCALE: line.distance = GcodeDistance::Absolute; break;
+          case 91 * GCODE_SCALE: line.distance = GcodeDistance::Relative; break;
+          default: return false;
+        }
+        break;
+      case 'I':
+        line.offsetI = value;
+        line.hasOffsets = true;
+        break;
+      case 'J':
+        line.offsetJ = value;
+        line.hasOffsets = true;
+        break;
+      case 'F':
+        if (value <= 0) {
+          return false;
+        }
+        line.feed = value;
+        line.hasFeed = true;
+        break;
+      case 'M':
+        if (line.hasMcode || value < 0 || value > 255 * GCODE_SCALE || value % GCODE_SCALE != 0) {
+          return false;
+        }
+        line.mcode = (uint8_t)(value / GCODE_SCALE);
+        line.hasMcode = true;
+        break;
+      case 'N':
+        break;
+      default: {
+        uint8_t axis = 0;
+        while (axis < GCODE_MAX_AXES && GCODE_AXIS_LETTERS[axis] != letter) {
+          axis++;
+        }
+        if (axis == GCODE_MAX_AXES) {
+          return false;
+        }
+        line.axes[axis] = value;
+        line.axisMask |= 1 << axis;
+        break;
+      }
+    }
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+*******************************************************************************
+* Description:
+*   ZV / ZVD / EI impulse train design.
+*******************************************************************************
+*/
+
+#include "InputShaper.h"
+
+#include <math.h>
+
+#include "StepCommand.h"
+
+// Residual vibration tolerance of the EI shaper
+constexpr float EI_VIBRATION_TOLERANCE = 0.05f;
+
+bool designShaper(const ShaperConfig& config, ShaperImpulses& impulses) {
+  impulses = {1, {1 << 15, 0, 0}, {0, 0, 0}};
+  if (config.type == ShaperType::None) {
+    return true;
+  }
+  if (config.frequencyHz <= 0.0f || config.dampingRatio < 0.0f || config.dampingRatio >= 1.0f) {
+    return false;
+  }
+
+  // Damped period and the decay of the ringing over half a period
+  float root = sqrtf(1.0f - config.dampingRatio * config.dampingRatio);
+  float halfPeriod = 0.5f / (config.frequencyHz * root);
+  float k = expf(-config.dampingRatio * (float)M_PI / root);
+
+  float weights[SHAPER_MAX_IMPULSES];
+  uint8_t count;
+  switch (config.type) {
+    case ShaperType::Zv:
+      count = 2;
+      weights[0] = 1.0f;
+      weights[1] = k;
+      break;
+    case ShaperType::Zvd:
+      count = 3;
+      weights[0] = 1.0f;
+      weights[1] = 2.0f * k;
+      weights[2] = k * k;
+      break;
+    case ShaperType::Ei:
+    default:
+      count = 3;
+      weights[0] = 0.25f * (1.0f + EI_VIBRATION_TOLERANCE);
+      weights[1] = 0.5f * (1.0f - EI_VIBRATION_TOLERANCE) * k;
+      weights[2] = weights[0] * k * k;
+      break;
+  }
+
+  float total = 0.0f;
+  for (uint8_t i = 0; i < count; i++) {
+    total += weights[i];
+  }
+
+  ShaperImpulses design = {count, {0, 0, 0}, {0, 0, 0}};
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    float delay = i * halfPeriod * PROFILE_SAMPLES_PER_S;
+    if (delay + 0.5f >= SHAPER_HISTORY) {
+      return false;
+    }
+    design.delaySamples[i] = (uint16_t)(delay + 0.5f);
+    design.weightQ15[i] = (uint16_t)(weights[i] / total * 32768.0f + 0.5f);
+    sum += design.weightQ15[i];
+  }
+
+  // Make the weights sum to exactly 1.0 so shaping never changes the distance moved
+  design.weightQ15[0] += (int32_t)32768 - (int32_t)sum;
+  impulses = design;
+  return true;
+}
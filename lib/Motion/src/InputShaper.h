@@ -0,0 +1,103 @@
+/*
+*******************************************************************************
+* Description:
+*   Input shaping to cancel mechanical ringing at the end of moves. A shaper
+*   replaces each velocity sample by a weighted sum of delayed copies (ZV, ZVD
+*   or EI impulse trains designed for one resonance frequency and damping
+*   ratio), so the residual vibration the impulses excite cancels out. The
+*   impulse train is designed once in floating point; filtering runs per
+*   sample with Q15 weights and integer math only.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "FixedPoint.h"
+
+enum class ShaperType : uint8_t {
+  None,   // Pass-through
+  Zv,     // Zero vibration: 2 impulses, shortest delay (half a period), most sensitive to tuning
+  Zvd,    // Zero vibration and derivative: 3 impulses, one period delay, robust to frequency error
+  Ei,     // Extra insensitive (5% residual): 3 impulses, one period delay, widest tolerance
+};
+
+/**
+ * Shaper tuning for one axis.
+ */
+struct ShaperConfig {
+  ShaperType type;
+  float frequencyHz;     // Measured ringing frequency
+  float dampingRatio;    // Measured damping ratio (0 .. <1)
+};
+
+constexpr uint8_t SHAPER_MAX_IMPULSES = 3;
+
+// Longest impulse delay in samples; bounds the lowest usable frequency (~4 Hz at 1 ms samples)
+constexpr uint16_t SHAPER_HISTORY = 256;
+
+/**
+ * Designed impulse train: Q15 weights summing to exactly 1.0 and delays in samples.
+ */
+struct ShaperImpulses {
+  uint8_t count;
+  uint16_t weightQ15[SHAPER_MAX_IMPULSES];
+  uint16_t delaySamples[SHAPER_MAX_IMPULSES];
+};
+
+/**
+ * Designs the impulse train for a shaper configuration.
+ * @param impulses Receives the design; a pass-through train on failure
+ * @return false if the configuration is invalid or needs more than SHAPER_HISTORY samples of delay
+ */
+bool designShaper(const ShaperConfig& config, ShaperImpulses& impulses);
+
+class InputShaper {
+ public:
+  InputShaper() {
+    ShaperImpulses passThrough = {1, {1 << 15, 0, 0}, {0, 0, 0}};
+    configure(passThrough);
+  }
+
+  void configure(const ShaperImpulses& impulses) {
+    _impulses = impulses;
+    reset();
+  }
+
+  /**
+   * Clears the sample history, e.g. before a move that starts from rest.
+   */
+  void reset() {
+    for (uint16_t i = 0; i < SHAPER_HISTORY; i++) {
+      _history[i] = 0;
+    }
+    _head = 0;
+  }
+
+  /**
+   * Feeds one raw velocity sample and returns the shaped sample.
+   */
+  q16_t filter(q16_t velocity) {
+    _history[_head] = velocity;
+    int64_t shaped = 0;
+    for (uint8_t i = 0; i < _impulses.count; i++) {
+      uint16_t index = (_head + SHAPER_HISTORY - _impulses.delaySamples[i]) % SHAPER_HISTORY;
+      shaped += (int64_t)_impulses.weightQ15[i] * _history[index];
+    }
+    _head = (_head + 1) % SHAPER_HISTORY;
+    return (q16_t)(shaped >> 15);
+  }
+
+  /**
+   * Samples the shaped output lasts beyond the raw input (delay of the last impulse).
+   */
+  uint16_t tailSamples() const { return _impulses.delaySamples[_impulses.count - 1]; }
+
+  const ShaperImpulses& impulses() const { return _impulses; }
+
+ private:
+  ShaperImpulses _impulses;
+  q16_t _history[SHAPER_HISTORY];
+  uint16_t _head = 0;
+};
@@ -0,0 +1,115 @@
+/*
+*******************************************************************************
+* Description:
+*   Binary motion program format shared by the teach-mode recorder, the
+*   host-side packer (tools/pack_program.py) and the playback engine.
+*   A program is a ProgramHeader followed by fixed-size ProgramRecord entries,
+*   little-endian, one record per coordinated move, so record i always sits at
+*   sizeof(ProgramHeader) + i * sizeof(ProgramRecord) and can be read in place.
+*   Records always carry PROGRAM_MAX_AXES step counts so a program has the
+*   same layout on every machine variant; unused axes are zero. The header
+*   holds a CRC-32 of the records, so a torn or corrupted image is refused.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MotionQueue.h"
+
+constexpr uint32_t PROGRAM_MAGIC = 0x5052474DUL;   // "MGRP" little-endian
+constexpr uint8_t PROGRAM_VERSION = 3;
+constexpr uint8_t PROGRAM_MAX_AXES = 4;
+
+struct __attribute__((packed)) ProgramHeader {
+  uint32_t magic;          // PROGRAM_MAGIC
+  uint8_t version;         // PROGRAM_VERSION
+  uint8_t axisCount;       // Axes the program was recorded on
+  uint16_t recordSize;     // sizeof(ProgramRecord), guards against layout drift
+  uint32_t recordCount;    // Records following the header
+  uint32_t crc;            // programCrc() of the record bytes
+};
+
+struct __attribute__((packed)) ProgramRecord {
+  int32_t steps[PROGRAM_MAX_AXES];   // Relative microsteps per axis
+  uint16_t speedHz;                  // Cruise speed in microsteps/sec
+  uint16_t acceleration;             // Acceleration in steps/sec²
+  uint16_t dwellMs;                  // Pause before the move, in milliseconds
+  uint16_t flags;                    // SEGMENT_* bits
+};
+
+static_assert(sizeof(ProgramHeader) == 16, "ProgramHeader layout changed");
+static_assert(sizeof(ProgramRecord) == 24, "ProgramRecord layout changed");
+
+/**
+ * CRC-32 (IEEE 802.3, the one Python's zlib.crc32 computes) of the record
+ * bytes. Bitwise, so no table sits in RAM; it runs once per program.
+ * @param crc Result of a previous call, to continue over more bytes
+ */
+inline uint32_t programCrc(const void* data, size_t size, uint32_t crc = 0) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+/**
+ * Checks that a header belongs to a program this firmware can replay. The
+ * record CRC is checked separately, once the records are mapped.
+ * @param axisCount Axes configured on this machine
+ */
+inline bool programHeaderValid(const ProgramHeader& header, uint8_t axisCount) {
+  return header.magic == PROGRAM_MAGIC && header.version == PROGRAM_VERSION &&
+         header.axisCount == axisCount && header.recordSize == sizeof(ProgramRecord);
+}
+
+/**
+ * Builds the header for a program of recordCount records.
+ */
+inline ProgramHeader makeProgramHeader(uint8_t axisCount, const ProgramRecord* records, uint32_t recordCount) {
+  ProgramHeader header = {PROGRAM_MAGIC, PROGRAM_VERSION, axisCount, sizeof(ProgramRecord), recordCount,
+                          programCrc(records, (size_t)recordCount * sizeof(ProgramRecord))};
+  return header;
+}
+
+/**
+ * Packs a queued segment into a program record. Speed, acceleration and
+ * dwell saturate at the 16-bit field limits.
+ */
+template <uint8_t N>
+ProgramRecord toProgramRecord(const MotionSegment<N>& segment) {
+  static_assert(N <= PROGRAM_MAX_AXES, "Program records hold at most PROGRAM_MAX_AXES axes");
+  ProgramRecord record = {};
+  for (uint8_t i = 0; i < N; i++) {
+    record.steps[i] = segment.steps[i];
+  }
+  record.speedHz = (segment.speedHz > UINT16_MAX) ? UINT16_MAX : segment.speedHz;
+  record.acceleration = (segment.acceleration > UINT16_MAX) ? UINT16_MAX : segment.acceleration;
+  record.dwellMs = segment.dwellMs;
+  record.flags = segment.flags;
+  return record;
+}
+
+/**
+ * Unpacks a program record into a segment for the motion queue.
+ */
+template <uint8_t N>
+MotionSegment<N> fromProgramRecord(const ProgramRecord& record) {
+  static_assert(N <= PROGRAM_MAX_AXES, "Program records hold at most PROGRAM_MAX_AXES axes");
+  MotionSegment<N> segment = {};
+  for (uint8_t i = 0; i < N; i++) {
+    segment.steps[i] = record.steps[i];
+  }
+  segment.speedHz = record.speedHz;
+  segment.acceleration = record.acceleration;
+  segment.dwellMs = record.dwellMs;
+  segment.flags = record.flags;
+  return segment;
+}
@@ -0,0 +1,101 @@
+/*
+*******************************************************************************
+* Description:
+*   Hardware-independent motion queue. A MotionSegment holds one coordinated
+*   move (relative microsteps for every axis plus its speed, acceleration,
+*   dwell and optional start time), and MotionQueue buffers segments ahead of the executor so moves run
+*   back to back without waiting on the caller. Both are templated on the axis
+*   count so the same code serves one to four axes.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Segment flag: the move may flow into the next one without stopping. Its speed and
+// acceleration then apply along the path (Euclidean microsteps) instead of to the dominant axis.
+constexpr uint16_t SEGMENT_BLEND = 0x0001;
+
+/**
+ * One coordinated move for N axes.
+ */
+template <uint8_t N>
+struct MotionSegment {
+  int32_t steps[N];        // Relative microsteps per axis (positive or negative)
+  uint32_t speedHz;        // Cruise speed in microsteps/sec
+  uint32_t acceleration;   // Acceleration in steps/sec²
+  uint16_t dwellMs;        // Pause before the move starts, in milliseconds
+  uint16_t flags;          // SEGMENT_* bits
+  uint64_t startUs;        // Controller time (µs since boot) the first steps are due, 0 for as soon as possible
+};
+
+/**
+ * Fixed-capacity FIFO with in-place access to queued items, used by planners
+ * that need to look ahead at upcoming entries.
+ */
+template <class T, uint8_t Capacity>
+class RingQueue {
+ public:
+  /**
+   * Appends an item at the tail.
+   * @return false if the queue is full
+   */
+  bool push(const T& item) {
+    if (full()) {
+      return false;
+    }
+    _items[(_head + _count) % Capacity] = item;
+    _count++;
+    return true;
+  }
+
+  /**
+   * Puts an item back in front of the head, e.g. the rest of an interrupted move.
+   * @return false if the queue is full
+   */
+  bool pushFront(const T& item) {
+    if (full()) {
+      return false;
+    }
+    _head = (_head + Capacity - 1) % Capacity;
+    _items[_head] = item;
+    _count++;
+    return true;
+  }
+
+  /**
+   * Removes the head item into item.
+   * @return false if the queue is empty
+   */
+  bool pop(T& item) {
+    if (empty()) {
+      return false;
+    }
+    item = _items[_head];
+    _head = (_head + 1) % Capacity;
+    _count--;
+    return true;
+  }
+
+  /**
+   * Returns the i-th queued item counted from the head, or nullptr.
+   */
+  T* at(uint8_t i) { return (i < _count) ? &_items[(_head + i) % Capacity] : nullptr; }
+  const T* at(uint8_t i) const { return (i < _count) ? &_items[(_head + i) % Capacity] : nullptr; }
+
+  T* peek() { return at(0); }
+  uint8_t size() const { return _count; }
+  uint8_t space() const { return Capacity - _count; }
+  bool empty() const { return _count == 0; }
+  bool full() const { return _count == Capacity; }
+  void clear() { _head = _count = 0; }
+
+ private:
+  T _items[Capacity];
+  uint8_t _head = 0;
+  uint8_t _count = 0;
+};
+
+template <uint8_t N, uint8_t Capacity>
+using MotionQueue = RingQueue<MotionSegment<N>, Capacity>;
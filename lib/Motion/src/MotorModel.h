@@ -0,0 +1,200 @@
+/*
+*******************************************************************************
+* Description:
+*   Physical model of a hybrid stepper motor and its load for the host
+*   simulator. The rotor is driven by the phase currents the driver sets for
+*   each microstep (a quantized sine table), limited by the pull-out torque
+*   curve of the motor at the current speed, and opposed by detent torque,
+*   friction and viscous damping acting on rotor plus load inertia. It
+*   consumes the same StepCommand stream the firmware feeds FastAccelStepper
+*   and reports the rotor's position error and pole slips (stalls).
+*   Floating point; not meant for the ESP32 build.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "StepCommand.h"
+
+constexpr uint8_t MOTOR_CURVE_MAX_POINTS = 8;
+
+// Integration step of the rotor dynamics
+constexpr double MOTOR_SIM_DT_S = 5e-6;
+
+/**
+ * One point of the pull-out torque curve.
+ */
+struct TorquePoint {
+  double speedRps;     // Shaft speed in revolutions per second
+  double torqueNm;     // Torque available at that speed
+};
+
+/**
+ * Motor, driver and load parameters.
+ */
+struct MotorParams {
+  uint16_t fullStepsPerRev;       // 200 for a 1.8° motor
+  uint16_t microSteps;            // Driver microstep setting
+  uint16_t currentLevels;         // Resolution of the driver's current DAC (per phase, full scale)
+  double rotorInertia;            // kg·m²
+  double loadInertia;             // kg·m², reflected to the motor shaft
+  double detentTorque;            // N·m, amplitude of the unpowered cogging torque
+  double frictionTorque;          // N·m, Coulomb friction of motor and load
+  double viscousDamping;          // N·m per rad/s
+  TorquePoint curve[MOTOR_CURVE_MAX_POINTS];   // Pull-out torque, increasing speed; first point at 0
+  uint8_t curvePoints;
+};
+
+/**
+ * Outcome of a simulated run.
+ */
+struct MotorSimStats {
+  double maxErrorSteps;     // Largest |commanded - rotor| in microsteps before the first slip
+  double finalErrorSteps;   // Error at the end of the run, including slipped poles
+  uint32_t stalls;          // Pole slips: rotor fell a whole electrical cycle behind or ahead
+  double firstStallS;       // Simulated time of the first slip, or -1
+  double timeS;             // Simulated time so far
+};
+
+class MotorModel {
+ public:
+  /**
+   * Applies motor parameters and puts the rotor at rest on microstep 0.
+   */
+  void configure(const MotorParams& params) {
+    _params = params;
+    _polePairs = params.fullStepsPerRev / 4;
+    _stepsPerRad = params.fullStepsPerRev * params.microSteps / (2 * M_PI);
+    _electricalPeriod = 4.0 * params.microSteps;
+    reset();
+  }
+
+  void reset() {
+    _angle = 0;
+    _speed = 0;
+    _microstep = 0;
+    _slips = 0;
+    _stats = {0, 0, 0, -1, 0};
+  }
+
+  /**
+   * Advances the model through one step command: steps pulses spaced ticks
+   * apart, or a pause of ticks when steps is 0.
+   */
+  void run(const StepCommand& command) {
+    double interval = (double)command.ticks / STEP_TICKS_PER_S;
+    if (command.steps == 0) {
+      advance(interval);
+      return;
+    }
+    for (uint8_t i = 0; i < command.steps; i++) {
+      _microstep += command.countUp ? 1 : -1;   // FastAccelStepper steps at the start of each period
+      advance(interval);
+    }
+  }
+
+  /**
+   * Lets the rotor settle with the current microstep held, e.g. after a move.
+   */
+  void settle(double seconds) { advance(seconds); }
+
+  /**
+   * Commanded position minus rotor position, in microsteps.
+   */
+  double errorSteps() const { return _microstep - _angle * _stepsPerRad; }
+
+  const MotorSimStats& stats() const { return _stats; }
+
+  int32_t commandedSteps() const { return _microstep; }
+
+  /**
+   * Pull-out torque at a shaft speed, interpolated from the curve.
+   */
+  double pullOutTorque(double speedRps) const {
+    const TorquePoint* curve = _params.curve;
+    speedRps = fabs(speedRps);
+    for (uint8_t i = 1; i < _params.curvePoints; i++) {
+      if (speedRps <= curve[i].speedRps) {
+        double t = (speedRps - curve[i - 1].speedRps) / (curve[i].speedRps - curve[i - 1].speedRps);
+        return curve[i - 1].torqueNm + t * (curve[i].torqueNm - curve[i - 1].torqueNm);
+      }
+    }
+    return curve[_params.curvePoints - 1].torqueNm;
+  }
+
+ private:
+  /**
+   * Phase current of the driver's table for an electrical angle, in
+   * full-scale units, rounded to the DAC resolution.
+   */
+  double phaseCurrent(double electricalAngle) const {
+    return round(cos(electricalAngle) * _params.currentLevels) / _params.currentLevels;
+  }
+
+  void advance(double seconds) {
+    double commanded = _microstep * (M_PI / 2) / _params.microSteps;   // Electrical angle
+    double currentA = phaseCurrent(commanded);
+    double currentB = phaseCurrent(commanded - M_PI / 2);
+    double inertia = _params.rotorInertia + _params.loadInertia;
+
+    while (seconds > 0) {
+      double dt = (seconds < MOTOR_SIM_DT_S) ? seconds : MOTOR_SIM_DT_S;
+      double rotorElectrical = _polePairs * _angle;
+      double available = pullOutTorque(_speed / (2 * M_PI));
+      double torque = available * (currentB * cos(rotorElectrical) - currentA * sin(rotorElectrical)) -
+                      _params.detentTorque * sin(4 * rotorElectrical) - _params.viscousDamping * _speed;
+
+      // Coulomb friction opposes motion, or holds the rotor while the drive torque is below it
+      if (_speed != 0) {
+        torque -= (_speed > 0) ? _params.frictionTorque : -_params.frictionTorque;
+      } else if (fabs(torque) <= _params.frictionTorque) {
+        torque = 0;
+      } else {
+        torque -= (torque > 0) ? _params.frictionTorque : -_params.frictionTorque;
+      }
+
+      // Semi-implicit Euler; a speed crossing zero stops at zero so friction can hold it
+      double speed = _speed + torque / inertia * dt;
+      if ((_speed > 0 && speed < 0) || (_speed < 0 && speed > 0)) {
+        speed = 0;
+      }
+      _speed = speed;
+      _angle += _speed * dt;
+      seconds -= dt;
+      _stats.timeS += dt;
+      track();
+    }
+  }
+
+  /**
+   * Updates error statistics and counts pole slips.
+   */
+  void track() {
+    double error = errorSteps();
+    _stats.finalErrorSteps = error;
+    int32_t slips = (int32_t)lround(error / _electricalPeriod);
+    if (slips != _slips) {
+      _slips = slips;
+      _stats.stalls++;
+      if (_stats.firstStallS < 0) {
+        _stats.firstStallS = _stats.timeS;
+      }
+    }
+    if (_stats.stalls == 0 && fabs(error) > _stats.maxErrorSteps) {
+      _stats.maxErrorSteps = fabs(error);
+    }
+  }
+
+  MotorParams _params = {};
+  uint16_t _polePairs = 50;
+  double _stepsPerRad = 0;
+  double _electricalPeriod = 0;   // Microsteps per electrical cycle (four full steps)
+  double _angle = 0;              // Rotor angle, rad
+  double _speed = 0;              // rad/s
+  int32_t _microstep = 0;         // Commanded microstep
+  int32_t _slips = 0;             // Electrical cycles the rotor is off by
+  MotorSimStats _stats = {};
+};
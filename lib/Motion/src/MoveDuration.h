@@ -0,0 +1,130 @@
+/*
+*******************************************************************************
+* Description:
+*   Analytic duration of the profiles ProfileSampler runs: accelerate from
+*   the start velocity, cruise, brake to the end velocity, with the
+*   acceleration following an AccelProfile (constant for a trapezoid,
+*   speed-dependent for the S-shaped ramps of an acceleration curve). Moves
+*   too short to reach cruise peak where the two ramps meet (triangular).
+*   Works in the sampler's units, so estimates stay within about a sample
+*   per ramp of the sample count the generator actually produces.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "AccelProfile.h"
+#include "FixedPoint.h"
+#include "ProfileSampler.h"
+#include "StepCommand.h"
+
+// Bisection passes for the peak velocity of a triangular profile
+constexpr uint8_t DURATION_PEAK_ITERATIONS = 24;
+
+// ln 2 in Q16
+constexpr int64_t LN2_Q16 = 45426;
+
+/**
+ * Natural logarithm of a ratio above 1, Q16 in and out. The fraction of the
+ * binary logarithm is interpolated linearly, close enough for a correction
+ * term of a few samples.
+ */
+inline int64_t lnRatioQ16(uint64_t ratio) {
+  if (ratio <= (uint64_t)Q16_ONE) {
+    return 0;
+  }
+  int64_t whole = 0;
+  while (ratio >= 2 * (uint64_t)Q16_ONE) {
+    ratio >>= 1;
+    whole++;
+  }
+  int64_t log2 = (whole << Q16_SHIFT) + (int64_t)(ratio - Q16_ONE);
+  return (log2 * LN2_Q16) >> Q16_SHIFT;
+}
+
+/**
+ * Samples the sampler saves against the analytic braking time. It brakes
+ * along v = sqrt(2 a d) with the velocity taken at the start of each sample,
+ * which runs a little ahead of the continuous curve; summed over the ramp
+ * that is half the logarithm of the velocity ratio, a few samples.
+ * @return Q16 samples
+ */
+inline int64_t brakeLeadSamples(q16_t peak, q16_t end, const AccelProfile& accel) {
+  q16_t floor = (q16_t)(accel.at(end) >> Q16_SHIFT);      // One acceleration increment
+  q16_t low = (end > floor) ? end : floor;
+  if (low <= 0 || peak <= low) {
+    return 0;
+  }
+  return lnRatioQ16(((uint64_t)peak << Q16_SHIFT) / low) / 2;
+}
+
+/**
+ * Highest velocity a profile reaches: the cruise velocity, or for a move
+ * too short to reach it, the velocity where acceleration and braking meet.
+ * @param distance Q16 microsteps of the dominant axis
+ */
+inline q16_t profilePeak(int64_t distance, q16_t start, q16_t cruise, q16_t end, const AccelProfile& accel) {
+  if (accel.distance(start, cruise, false) + accel.distance(end, cruise) <= distance) {
+    return cruise;
+  }
+  q16_t low = (start > end) ? start : end;
+  q16_t high = cruise;
+  for (uint8_t i = 0; i < DURATION_PEAK_ITERATIONS && high - low > 1; i++) {
+    q16_t middle = low + (high - low) / 2;
+    if (accel.distance(start, middle, false) + accel.distance(end, middle) <= distance) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * Duration of a profile in Q16 samples.
+ * @param distance Q16 microsteps of the dominant axis
+ * @param start, cruise, end Velocities in Q16 microsteps per sample
+ */
+inline int64_t profileSamples(int64_t distance, q16_t start, q16_t cruise, q16_t end, const AccelProfile& accel) {
+  if (distance <= 0) {
+    return 0;
+  }
+  if (end > cruise) {
+    end = cruise;
+  }
+  q16_t peak = profilePeak(distance, start, cruise, end, accel);
+  int64_t ramps = accel.distance(start, peak, false) + accel.distance(end, peak);
+  int64_t samples = accel.duration(start, peak, false) + accel.duration(end, peak) - brakeLeadSamples(peak, end, accel);
+  if (start > peak) {
+    // Entering above a lowered cruise speed: slow down to it at the acceleration limit
+    ramps += accel.distance(peak, start, false);
+    samples += accel.duration(peak, start, false);
+  }
+  if (distance > ramps && peak > 0) {
+    samples += ((distance - ramps) << Q16_SHIFT) / peak;
+  }
+  return samples;
+}
+
+/**
+ * Duration of a profile in µs.
+ * @param distance Microsteps of the dominant axis
+ * @param startVelocity Q16 microsteps per sample
+ */
+inline uint32_t profileDurationUs(uint32_t distance, q16_t startVelocity, uint32_t cruiseHz, uint32_t endHz,
+                                  const AccelProfile& accel) {
+  int64_t samples = profileSamples((int64_t)distance << Q16_SHIFT, startVelocity, speedToSample(cruiseHz),
+                                   speedToSample(endHz), accel);
+  return (uint32_t)((samples * PROFILE_SAMPLE_US) >> Q16_SHIFT);
+}
+
+/**
+ * Duration of a move from rest to rest at one acceleration, in µs.
+ */
+inline uint32_t moveDurationUs(uint32_t steps, uint32_t speedHz, uint32_t acceleration) {
+  AccelProfile accel;
+  accel.setConstant(acceleration);
+  return profileDurationUs(steps, 0, speedHz, 0, accel);
+}
@@ -0,0 +1,404 @@
+/*
+*******************************************************************************
+* Description:
+*   Turns coordinated moves into per-axis step commands, one profile sample
+*   at a time. The dominant axis follows a ProfileSampler trapezoid, the other
+*   axes are scaled from it, each axis is passed through its own InputShaper,
+*   and SampleStepper places steps where the accumulated positions cross
+*   them. The caller pulls samples only as fast as the step generator
+*   consumes them. Moves that end moving are chained to an appended
+*   successor in the same sample, so blended paths run without stopping or
+*   resetting the shapers.
+*   The cruise speeds of the running and the appended segment can be
+*   changed while they run (feed override); the profile re-ramps to them.
+*   A feed hold brings the chain to rest at the acceleration limit and
+*   leaves the rest of the segment, and an appended one, to be run later.
+*   The time left is estimated analytically (MoveDuration.h).
+*   Backlash take-up steps are added after shaping wherever an axis
+*   reverses; they are left out of the planned positions (Backlash.h).
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "Backlash.h"
+#include "InputShaper.h"
+#include "MoveDuration.h"
+#include "ProfileSampler.h"
+#include "StepCommand.h"
+
+template <uint8_t N>
+class MoveGenerator {
+ public:
+  /**
+   * Applies a shaper design to one axis; takes effect from the next move.
+   */
+  void setShaper(uint8_t axis, const ShaperImpulses& impulses) { _shapers[axis].configure(impulses); }
+
+  /**
+   * Sets the backlash of one axis; call before the first move.
+   */
+  void setBacklash(uint8_t axis, const BacklashConfig& config) { _backlash[axis].configure(config); }
+
+  /**
+   * Plans a move from rest. With a non-zero end speed the move flows into the
+   * segment passed to append(), which must arrive before this one ends.
+   * @param steps Relative microsteps per axis
+   * @param speedHz Cruise speed of the dominant axis
+   * @param accel Acceleration limit of the dominant axis over speed
+   * @param endHz Speed of the dominant axis at the end of the move
+   * @param feedHz Programmed speed the cruise speed was derived from, for
+   *               rescale(); 0 if it is speedHz itself
+   */
+  void start(const int32_t (&steps)[N], uint32_t speedHz, const AccelProfile& accel, uint32_t endHz = 0,
+             uint32_t feedHz = 0) {
+    _tail = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      _base[i] = 0;
+      _emitted[i] = 0;
+      _position[i] = 0;
+      _shapers[i].reset();
+      _steppers[i].reset();
+      if (_shapers[i].tailSamples() > _tail) {
+        _tail = _shapers[i].tailSamples();
+      }
+      _backlashAtStart[i] = _backlash[i];
+      _backlash[i].direct(steps[i]);
+    }
+    _stopped = false;
+    _holding = false;
+    _hasNext = false;
+    _chainIndex = 0;
+    _current.set(steps, speedHz, accel, endHz, feedHz);
+    _sampler.start(_current.major, 0, speedHz, endHz, accel);
+    _active = _current.major > 0;
+  }
+
+  /**
+   * Plans a move from rest to rest with one acceleration at all speeds.
+   */
+  void start(const int32_t (&steps)[N], uint32_t speedHz, uint32_t acceleration) {
+    AccelProfile accel;
+    accel.setConstant(acceleration);
+    start(steps, speedHz, accel);
+  }
+
+  /**
+   * Queues the segment that continues the running one without stopping. It
+   * starts at the path speed the running segment ends with, in the same
+   * sample, and keeps the shaper history.
+   * @param feedHz As for start()
+   * @return false if a segment is already waiting or the running one ends at rest
+   */
+  bool append(const int32_t (&steps)[N], uint32_t speedHz, const AccelProfile& accel, uint32_t endHz,
+              uint32_t feedHz = 0) {
+    if (!needsNext()) {
+      return false;
+    }
+    _next.set(steps, speedHz, accel, endHz, feedHz);
+    _hasNext = true;
+    return true;
+  }
+
+  /**
+   * True while the running segment ends moving and its successor is missing.
+   */
+  bool needsNext() const { return _active && !_stopped && !_hasNext && _current.endHz > 0 && !_sampler.done(); }
+
+  /**
+   * True once after the generator moved on to an appended segment.
+   */
+  bool takeSegmentSwitched() {
+    bool switched = _switched;
+    _switched = false;
+    return switched;
+  }
+
+  /**
+   * True while samples remain, including the shaper tail after the profile ends.
+   */
+  bool active() const { return _active; }
+
+  /**
+   * True while an appended segment waits; after a hold, true if the chain
+   * came to rest before reaching it.
+   */
+  bool hasNext() const { return _hasNext; }
+
+  /**
+   * Segments the chain has moved on to since start(); 0 for the first one.
+   */
+  uint32_t chainIndex() const { return _chainIndex; }
+
+  /**
+   * Path speed the chain ends with, 0 if it comes to rest. A queued segment
+   * appended next starts from it.
+   */
+  uint32_t chainEndPathHz() const {
+    const Segment& last = _hasNext ? _next : _current;
+    if (!_active || _stopped || _holding || last.major == 0) {
+      return 0;
+    }
+    return (uint32_t)((uint64_t)last.endHz * last.length / last.major);
+  }
+
+  /**
+   * Samples the shapers add after a move comes to rest.
+   */
+  uint16_t shaperTailSamples() const {
+    uint16_t tail = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      tail = (_shapers[i].tailSamples() > tail) ? _shapers[i].tailSamples() : tail;
+    }
+    return tail;
+  }
+
+  /**
+   * Time until the last sample, µs: the rest of the running profile, the
+   * appended segment and the shaper tail.
+   */
+  uint32_t remainingUs() const {
+    if (!_active) {
+      return 0;
+    }
+    int64_t samples = (int64_t)_tail << Q16_SHIFT;
+    if (!_sampler.done()) {
+      q16_t velocity = _sampler.velocity();
+      if (_holding) {
+        samples += _current.accel.duration(0, velocity, false);
+      } else {
+        samples += profileSamples(_sampler.remaining(), velocity, speedToSample(_current.speedHz),
+                                  _stopped ? 0 : speedToSample(_current.endHz), _current.accel);
+      }
+      if (_hasNext) {
+        samples += profileSamples((int64_t)_next.major << Q16_SHIFT,
+                                  carryVelocity(speedToSample(_current.endHz), _current, _next),
+                                  speedToSample(_next.speedHz), speedToSample(_next.endHz), _next.accel);
+      }
+    }
+    return (uint32_t)((samples * PROFILE_SAMPLE_US) >> Q16_SHIFT);
+  }
+
+  /**
+   * Sets new cruise speeds for the running segment and the appended one.
+   * The running profile ramps to its new speed at its acceleration limit.
+   * @param cruiseFor Called as cruiseFor(steps, feedHz) for each segment,
+   *                  returns its new cruise speed of the dominant axis
+   */
+  template <class CruiseFor>
+  void rescale(CruiseFor cruiseFor) {
+    if (!_active || _stopped) {
+      return;
+    }
+    if (!_sampler.done()) {
+      _current.speedHz = cruiseFor(_current.steps, _current.feedHz);
+      _sampler.setCruise(_current.speedHz);
+    }
+    if (_hasNext) {
+      _next.speedHz = cruiseFor(_next.steps, _next.feedHz);
+    }
+  }
+
+  /**
+   * Decelerates the move to rest from its current velocity and drops an
+   * appended segment. The axes end short of their targets, wherever the
+   * shortened profile takes them.
+   */
+  void requestStop() {
+    _stopped = true;
+    _hasNext = false;
+    _sampler.requestStop();
+  }
+
+  /**
+   * Feed hold: decelerates to rest at the acceleration limit, blending into
+   * the appended segment if the running one ends first. The chain stops
+   * short wherever the deceleration ends; the appended segment is kept
+   * (hasNext()) so the caller can requeue it with the rest of this one.
+   */
+  void hold() {
+    if (!_active || _stopped) {
+      return;
+    }
+    _holding = true;
+    _sampler.hold();
+  }
+
+  /**
+   * Abandons the move without generating anything more. Only for a move
+   * none of whose samples has run yet, unless ran is set.
+   * @param ran Samples may have run (emergency halt); keeps the backlash
+   *            take-up already generated instead of undoing it
+   */
+  void cancel(bool ran = false) {
+    _active = false;
+    _hasNext = false;
+    if (!ran) {
+      for (uint8_t i = 0; i < N; i++) {
+        _backlash[i] = _backlashAtStart[i];
+      }
+    }
+  }
+
+  /**
+   * Produces the step commands of every axis for the next sample.
+   * @param commands Receives up to SAMPLE_MAX_COMMANDS commands per axis
+   * @param counts Receives the number of commands per axis
+   */
+  void nextSample(StepCommand (&commands)[N][SAMPLE_MAX_COMMANDS], uint8_t (&counts)[N]) {
+    q16_t axisVelocity[N] = {};
+    if (!_sampler.done()) {
+      addVelocity(_sampler.next(), _current, axisVelocity);
+      if (_sampler.done() && !_sampler.held() && _hasNext) {
+        switchToNext(axisVelocity);
+      }
+    } else if (_tail > 0) {
+      _tail--;
+    }
+    bool last = _sampler.done() && _tail == 0;
+    for (uint8_t i = 0; i < N; i++) {
+      last = last && _backlash[i].settled();
+    }
+
+    for (uint8_t i = 0; i < N; i++) {
+      _position[i] += _shapers[i].filter(axisVelocity[i]) + _backlash[i].next();
+
+      // Whole steps reached so far; the final sample lands exactly on the target
+      int64_t position = _position[i];
+      if (last) {
+        int32_t target = (_stopped || _holding) ? (int32_t)((_position[i] + Q16_ONE / 2) >> Q16_SHIFT)
+                                                : _base[i] + _current.steps[i] + takeUpSinceStart(i);
+        position = (int64_t)target << Q16_SHIFT;
+      }
+      counts[i] = _steppers[i].emit(position, last, commands[i]);
+      _emitted[i] = (int32_t)(position >> Q16_SHIFT);
+    }
+    _active = !last;
+  }
+
+  /**
+   * Steps the motor of an axis runs ahead of the planned position, for
+   * backlash take-up; exact once the generator is idle.
+   */
+  int32_t backlashOffset(uint8_t axis) const { return _backlash[axis].offset(); }
+
+  /**
+   * Steps issued so far on an axis, relative to the start of the move (or of
+   * the first segment of a blended chain), backlash take-up included.
+   */
+  int32_t emitted(uint8_t axis) const { return _emitted[axis]; }
+
+  /**
+   * Velocity of the dominant axis before shaping, in Q16 microsteps per sample.
+   */
+  q16_t velocity() const { return _sampler.velocity(); }
+
+ private:
+  /**
+   * One segment of a chain, with the lengths needed to scale velocities.
+   */
+  struct Segment {
+    int32_t steps[N];
+    uint32_t major;       // Distance of the dominant axis
+    uint32_t length;      // Euclidean path length
+    uint32_t speedHz;
+    uint32_t endHz;
+    uint32_t feedHz;      // Programmed speed speedHz was derived from
+    AccelProfile accel;
+
+    void set(const int32_t (&moveSteps)[N], uint32_t cruiseHz, const AccelProfile& profile, uint32_t finalHz,
+             uint32_t programmedHz) {
+      major = 0;
+      uint64_t squares = 0;
+      for (uint8_t i = 0; i < N; i++) {
+        steps[i] = moveSteps[i];
+        uint32_t distance = (moveSteps[i] < 0) ? -moveSteps[i] : moveSteps[i];
+        if (distance > major) {
+          major = distance;
+        }
+        squares += (uint64_t)distance * distance;
+      }
+      length = isqrt64(squares);
+      speedHz = cruiseHz;
+      endHz = finalHz;
+      feedHz = (programmedHz > 0) ? programmedHz : cruiseHz;
+      accel = profile;
+    }
+  };
+
+  /**
+   * Scales a dominant-axis sample onto every axis of a segment.
+   */
+  static void addVelocity(q16_t velocity, const Segment& segment, q16_t (&axisVelocity)[N]) {
+    for (uint8_t i = 0; i < N; i++) {
+      if (segment.major > 0) {
+        axisVelocity[i] += (q16_t)((int64_t)velocity * segment.steps[i] / (int64_t)segment.major);
+      }
+    }
+  }
+
+  /**
+   * Dominant-axis velocity of one segment -> path velocity -> dominant-axis
+   * velocity of the next.
+   */
+  static q16_t carryVelocity(q16_t velocity, const Segment& from, const Segment& to) {
+    if (from.major == 0 || to.length == 0) {
+      return velocity;
+    }
+    return (q16_t)((int64_t)velocity * from.length / from.major * to.major / to.length);
+  }
+
+  /**
+   * Backlash take-up issued on an axis since start().
+   */
+  int32_t takeUpSinceStart(uint8_t axis) const {
+    return _backlash[axis].offset() - _backlashAtStart[axis].offset();
+  }
+
+  /**
+   * Continues with the appended segment in the rest of the current sample,
+   * carrying the path speed over.
+   */
+  void switchToNext(q16_t (&axisVelocity)[N]) {
+    q16_t velocity = carryVelocity(_sampler.velocity(), _current, _next);
+    q16_t leftover = _sampler.leftover();
+
+    for (uint8_t i = 0; i < N; i++) {
+      _base[i] += _current.steps[i];
+    }
+    _current = _next;
+    for (uint8_t i = 0; i < N; i++) {
+      _backlash[i].direct(_current.steps[i]);
+    }
+    _hasNext = false;
+    _switched = true;
+    _chainIndex++;
+    _sampler.startFrom(_current.major, velocity, _current.speedHz, _current.endHz, _current.accel);
+    if (_holding) {
+      _sampler.hold();
+    }
+    if (leftover > 0) {
+      addVelocity(_sampler.next(leftover), _current, axisVelocity);
+    }
+  }
+
+  ProfileSampler _sampler;
+  InputShaper _shapers[N];
+  SampleStepper _steppers[N];
+  BacklashTakeUp _backlash[N];
+  BacklashTakeUp _backlashAtStart[N];   // Take-up state before start(), for cancel()
+  Segment _current = {};
+  Segment _next = {};
+  int32_t _base[N] = {};       // Start of the current segment relative to the chain start
+  int32_t _emitted[N] = {};
+  int64_t _position[N] = {};   // Q16 steps
+  uint16_t _tail = 0;          // Samples left to drain the shapers
+  uint32_t _chainIndex = 0;    // Segments switched to since start()
+  bool _hasNext = false;
+  bool _switched = false;
+  bool _stopped = false;
+  bool _holding = false;
+  bool _active = false;
+};
@@ -0,0 +1,116 @@
+/*
+*******************************************************************************
+* Description:
+*   Per-move speed and acceleration limits: the acceleration curves or
+*   bounds of the moving axes (AccelCurvePlanner) with the resonance bands
+*   laid over them (SpeedBandPlanner). Shared by the firmware and the host simulator so both
+*   plan a move the same way. MovePlanCache keeps the last plan, since
+*   button moves, jogs and taught programs repeat the same request.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "AccelCurve.h"
+#include "SpeedBands.h"
+
+template <uint8_t N>
+class MoveLimits {
+ public:
+  void configure(uint8_t axis, const AccelCurve& curve, const BandConfig& bands, uint32_t boundAccel = 0) {
+    _curves.configure(axis, curve, boundAccel);
+    _bands.configure(axis, bands);
+  }
+
+  /**
+   * Picks the cruise speed and the a(v) limit of the dominant axis for a move.
+   * @param steps Relative microsteps per axis
+   * @param speedHz Requested cruise speed of the dominant axis
+   * @param acceleration Requested acceleration, used by axes without a curve
+   * @param accel Receives the acceleration limit over speed
+   * @return cruise speed, moved out of any resonance band
+   */
+  uint32_t plan(const int32_t (&steps)[N], uint32_t speedHz, uint32_t acceleration, AccelProfile& accel) const {
+    uint32_t cruiseHz = _bands.selectCruise(speedHz, steps);
+    AccelProfile base;
+    _curves.build(acceleration, steps, base, cruiseHz);
+    _bands.buildAccel(base, steps, accel);
+    return cruiseHz;
+  }
+
+  /**
+   * Cruise speed of the dominant axis for a requested speed, moved out of
+   * any resonance band; the part of plan() a speed change needs.
+   */
+  uint32_t cruise(const int32_t (&steps)[N], uint32_t speedHz) const { return _bands.selectCruise(speedHz, steps); }
+
+  /**
+   * Lowest acceleration of the dominant axis up to a cruise speed, steps/sec²;
+   * resonance bands only ever raise it.
+   */
+  uint32_t minimumAccel(const int32_t (&steps)[N], uint32_t speedHz, uint32_t acceleration) const {
+    return _curves.minimum(acceleration, steps, speedHz);
+  }
+
+ private:
+  AccelCurvePlanner<N> _curves;
+  SpeedBandPlanner<N> _bands;
+};
+
+/**
+ * Remembers the last plan of a MoveLimits. A plan only depends on the speed,
+ * the acceleration and the distance of each axis (not the direction), so a
+ * repeated request reuses it instead of rebuilding the curves and bands.
+ */
+template <uint8_t N>
+class MovePlanCache {
+ public:
+  /**
+   * Same as MoveLimits::plan(), reusing the last result if the request matches it.
+   */
+  uint32_t plan(const MoveLimits<N>& limits, const int32_t (&steps)[N], uint32_t speedHz, uint32_t acceleration,
+                AccelProfile& accel) {
+    bool same = _valid && speedHz == _speedHz && acceleration == _acceleration;
+    for (uint8_t i = 0; same && i < N; i++) {
+      same = magnitude(steps[i]) == _distances[i];
+    }
+    if (same) {
+      _reused++;
+      accel = _accel;
+      return _cruiseHz;
+    }
+
+    _planned++;
+    _cruiseHz = limits.plan(steps, speedHz, acceleration, _accel);
+    _speedHz = speedHz;
+    _acceleration = acceleration;
+    for (uint8_t i = 0; i < N; i++) {
+      _distances[i] = magnitude(steps[i]);
+    }
+    _valid = true;
+    accel = _accel;
+    return _cruiseHz;
+  }
+
+  /**
+   * Forgets the last plan, e.g. after the limits were reconfigured.
+   */
+  void invalidate() { _valid = false; }
+
+  uint32_t reused() const { return _reused; }
+  uint32_t planned() const { return _planned; }
+
+ private:
+  static uint32_t magnitude(int32_t steps) { return (steps < 0) ? -steps : steps; }
+
+  bool _valid = false;
+  uint32_t _speedHz = 0;
+  uint32_t _acceleration = 0;
+  uint32_t _distances[N] = {};
+  uint32_t _cruiseHz = 0;
+  AccelProfile _accel;
+  uint32_t _reused = 0;      // Requests answered from the cache
+  uint32_t _planned = 0;     // Requests planned in full
+};
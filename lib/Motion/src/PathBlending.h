@@ -0,0 +1,102 @@
+/*
+*******************************************************************************
+* Description:
+*   Junction speeds for blended paths. Consecutive straight segments may be
+*   joined without stopping; the speed allowed through a corner follows the
+*   junction-deviation rule (the path may cut the corner by at most a fixed
+*   distance at the planned acceleration), and a backward pass over the
+*   segments known so far caps each junction so the path can still come to
+*   rest at the end of the lookahead. Speeds and lengths are along the path,
+*   in Euclidean microsteps. Integer math only.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "FixedPoint.h"
+
+// Largest distance a blended corner may deviate from the sharp corner, in microsteps
+constexpr uint32_t JUNCTION_DEVIATION_STEPS = 8;
+
+/**
+ * One straight segment as seen by the lookahead.
+ */
+struct PathSegment {
+  uint32_t length;         // Euclidean microsteps
+  uint32_t feedHz;         // Cruise speed along the path
+  uint32_t acceleration;   // Lowest acceleration along the path, steps/sec²
+  uint32_t junctionHz;     // Highest speed through the corner into this segment (0 = from rest)
+};
+
+/**
+ * Euclidean length of a move.
+ */
+template <uint8_t N>
+uint32_t pathLength(const int32_t (&steps)[N]) {
+  uint64_t squares = 0;
+  for (uint8_t i = 0; i < N; i++) {
+    squares += (uint64_t)((int64_t)steps[i] * steps[i]);
+  }
+  return isqrt64(squares);
+}
+
+/**
+ * Highest speed at which the path may turn from move a into move b:
+ * v² = a·δ·sin(θ/2) / (1 − sin(θ/2)), θ the angle between the reversed
+ * incoming and the outgoing direction. Straight continuations are unlimited
+ * (UINT32_MAX), reversals must stop.
+ * @param acceleration Path acceleration through the corner, steps/sec²
+ * @param deviation Allowed corner deviation, microsteps
+ */
+template <uint8_t N>
+uint32_t junctionSpeed(const int32_t (&a)[N], const int32_t (&b)[N], uint32_t acceleration, uint32_t deviation) {
+  uint32_t lengthA = pathLength(a);
+  uint32_t lengthB = pathLength(b);
+  if (lengthA == 0 || lengthB == 0) {
+    return 0;
+  }
+
+  // Dot product of the unit vectors, Q30
+  int64_t dot = 0;
+  for (uint8_t i = 0; i < N; i++) {
+    int64_t unitA = ((int64_t)a[i] << 15) / lengthA;
+    int64_t unitB = ((int64_t)b[i] << 15) / lengthB;
+    dot += unitA * unitB;
+  }
+
+  // sin(θ/2) = sqrt((1 − cos θ) / 2) with cos θ = −dot
+  int64_t halfOneMinusCos = ((int64_t)1 << 29) + dot / 2;   // Q30
+  if (halfOneMinusCos <= 0) {
+    return 0;
+  }
+  uint32_t sinHalf = isqrt64((uint64_t)halfOneMinusCos);   // Q15
+  if (sinHalf >= (1u << 15) - 1) {
+    return UINT32_MAX;
+  }
+  uint64_t squared = (uint64_t)acceleration * deviation * sinHalf / ((1u << 15) - sinHalf);
+  uint32_t speed = isqrt64(squared);
+  return speed;
+}
+
+/**
+ * Highest speed at which the first segment may be entered so that every
+ * segment respects its feed and junction limits and the last one can stop at
+ * its end.
+ */
+inline uint32_t maxEntrySpeed(const PathSegment* segments, uint8_t count) {
+  uint64_t exit = 0;
+  for (int16_t j = (int16_t)count - 1; j >= 0; j--) {
+    const PathSegment& segment = segments[j];
+    uint64_t entry = isqrt64(exit * exit + 2 * (uint64_t)segment.acceleration * segment.length);
+    if (entry > segment.feedHz) {
+      entry = segment.feedHz;
+    }
+    if (entry > segment.junctionHz) {
+      entry = segment.junctionHz;
+    }
+    exit = entry;
+  }
+  return (uint32_t)exit;
+}
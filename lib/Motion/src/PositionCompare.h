@@ -0,0 +1,229 @@
+/*
+*******************************************************************************
+* Description:
+*   Position compare (PSO) targets of one axis: a sorted list of positions,
+*   or a grid every N steps from an origin. Two pulse counters count the
+*   axis' own step pulses. The position counter is never cleared and wraps
+*   at fixed limits; PsoPositionCount extends it into the axis position. The
+*   compare counter's limits are set to the distance from that position to
+*   the nearest target above and below, so it wraps on the step that
+*   reaches one, and its interrupt moves the window on to wherever the
+*   position count says the axis is. Arriving at a target fires, from either
+*   side, except at the one that fired last (or the position armed at): the
+*   axis has to reach another target before it repeats. Hardware-free,
+*   shared by the firmware's counter interrupt and the host simulator.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Positions one list holds
+constexpr uint8_t PSO_MAX_POSITIONS = 32;
+
+// Limits the position counter wraps to 0 at; the PCNT limits are signed 16-bit
+constexpr int16_t PSO_COUNT_LIMIT = 30000;
+
+// Widest compare window either way. The position counter is read at least
+// once per window, so it moves less than half its wrap between readings
+// (with a third of the wrap to spare for the steps of a late interrupt).
+constexpr int16_t PSO_WINDOW_LIMIT = 10000;
+
+static_assert(3 * PSO_WINDOW_LIMIT <= PSO_COUNT_LIMIT, "Compare window too wide for the position counter");
+
+/**
+ * Output action when a target is reached.
+ */
+enum class PsoOutput : uint8_t { Pulse, Toggle };
+
+/**
+ * Axis position from a counter that is never cleared and wraps to 0 at
+ * +-PSO_COUNT_LIMIT. The counter always equals the position modulo the
+ * wrap, so each reading moves the position by its change since the last
+ * one, modulo the wrap: exact as long as the axis moves less than half the
+ * wrap between readings, with no wrap interrupt to miss or count twice.
+ */
+class PsoPositionCount {
+ public:
+  /**
+   * The axis is at position with the counter reading counter.
+   */
+  void start(int32_t position, int16_t counter) {
+    _position = position;
+    _counter = counter;
+  }
+
+  /**
+   * @return the axis position at a new counter reading
+   */
+  int32_t update(int16_t counter) {
+    int32_t change = ((int32_t)counter - _counter) % PSO_COUNT_LIMIT;
+    if (change > PSO_COUNT_LIMIT / 2) {
+      change -= PSO_COUNT_LIMIT;
+    } else if (change < -PSO_COUNT_LIMIT / 2) {
+      change += PSO_COUNT_LIMIT;
+    }
+    _position += change;
+    _counter = counter;
+    return _position;
+  }
+
+  int32_t position() const { return _position; }
+
+ private:
+  int32_t _position = 0;
+  int16_t _counter = 0;
+};
+
+class PositionCompare {
+ public:
+  void clear() {
+    _count = 0;
+    _every = 0;
+  }
+
+  /**
+   * Adds a target to the list (ending interval mode). A position already
+   * listed is accepted and kept once.
+   * @return false if the list is full
+   */
+  bool addPosition(int32_t position) {
+    _every = 0;
+    uint8_t i = 0;
+    while (i < _count && _positions[i] < position) {
+      i++;
+    }
+    if (i < _count && _positions[i] == position) {
+      return true;
+    }
+    if (_count == PSO_MAX_POSITIONS) {
+      return false;
+    }
+    for (uint8_t k = _count; k > i; k--) {
+      _positions[k] = _positions[k - 1];
+    }
+    _positions[i] = position;
+    _count++;
+    return true;
+  }
+
+  /**
+   * Targets every steps from origin, in both directions.
+   * @return false for an interval of 0
+   */
+  bool setInterval(int32_t origin, uint32_t every) {
+    if (every == 0) {
+      return false;
+    }
+    _count = 0;
+    _origin = origin;
+    _every = every;
+    return true;
+  }
+
+  bool armed() const { return _count > 0 || _every > 0; }
+  uint8_t count() const { return _count; }
+  uint32_t every() const { return _every; }
+
+  /**
+   * Starts watching at position, which does not fire until the axis has
+   * reached another target.
+   */
+  void start(int32_t position) {
+    _position = position;
+    _last = position;
+    window();
+  }
+
+  /**
+   * The axis is now at position; moves the window there.
+   * @return true if it reached the target above or below the old window
+   *         position on the way
+   */
+  bool moveTo(int32_t position) {
+    int64_t steps = (int64_t)position - _position;
+    bool fire = false;
+    if (steps >= _high && _highFires) {
+      _last = _position + _high;
+      fire = true;
+    } else if (steps <= _low && _lowFires) {
+      _last = _position + _low;
+      fire = true;
+    }
+    _position = position;
+    window();
+    return fire;
+  }
+
+  /**
+   * Compare counter limits of the current window: high > 0, low < 0.
+   */
+  int16_t high() const { return _high; }
+  int16_t low() const { return _low; }
+
+  /**
+   * Axis position the window was set at, where the compare counter is 0.
+   */
+  int32_t position() const { return _position; }
+
+  /**
+   * Target that fired last, or the position armed at.
+   */
+  int32_t lastTarget() const { return _last; }
+
+ private:
+  /**
+   * Nearest target strictly above (or below) the window position, other
+   * than the one that fired last.
+   * @return false if there is none
+   */
+  bool next(bool above, int32_t& target) const {
+    if (_every > 0) {
+      int64_t offset = (int64_t)_position - _origin;
+      int64_t cell = offset / _every - (offset % (int64_t)_every < 0);   // Floor division
+      if (above) {
+        cell++;
+      } else if (offset == cell * (int64_t)_every) {
+        cell--;
+      }
+      int64_t value = _origin + cell * (int64_t)_every;
+      if (value == _last) {
+        value += above ? (int64_t)_every : -(int64_t)_every;
+      }
+      target = (int32_t)value;
+      return value >= INT32_MIN && value <= INT32_MAX;
+    }
+    for (uint8_t i = 0; i < _count; i++) {
+      uint8_t k = above ? i : _count - 1 - i;
+      if ((above ? _positions[k] > _position : _positions[k] < _position) && _positions[k] != _last) {
+        target = _positions[k];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Sets the limits to the nearest targets, or to the widest window where
+   * the next target is further away.
+   */
+  void window() {
+    int32_t target;
+    _highFires = next(true, target) && (int64_t)target - _position <= PSO_WINDOW_LIMIT;
+    _high = _highFires ? (int16_t)(target - _position) : PSO_WINDOW_LIMIT;
+    _lowFires = next(false, target) && (int64_t)_position - target <= PSO_WINDOW_LIMIT;
+    _low = _lowFires ? (int16_t)(target - _position) : (int16_t)-PSO_WINDOW_LIMIT;
+  }
+
+  int32_t _positions[PSO_MAX_POSITIONS];
+  uint8_t _count = 0;
+  int32_t _origin = 0;
+  uint32_t _every = 0;       // Interval mode when > 0
+  int32_t _position = 0;
+  int32_t _last = 0;
+  int16_t _high = PSO_WINDOW_LIMIT;
+  int16_t _low = -PSO_WINDOW_LIMIT;
+  bool _highFires = false;
+  bool _lowFires = false;
+};
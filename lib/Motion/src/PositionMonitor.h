@@ -0,0 +1,93 @@
+/*
+*******************************************************************************
+* Description:
+*   Step-loss detection logic, independent of the hardware. For each axis it
+*   compares the planner's expected position with the position the pulse
+*   generator reports, and the generated position with an encoder reading
+*   scaled to microsteps. A divergence beyond the axis threshold raises a
+*   fault; the caller then re-baselines with resync() once it has reacted.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+enum class PositionSource : uint8_t {
+  Generator,   // Expected vs. pulses actually generated
+  Encoder,     // Generated pulses vs. shaft encoder
+};
+
+/**
+ * Per-axis statistics kept by PositionMonitor.
+ */
+struct PositionCheckStats {
+  int32_t lastError;       // Most recent divergence in microsteps (signed)
+  int32_t worstError;      // Largest absolute divergence seen
+  uint16_t faults;         // Divergences beyond the threshold
+};
+
+template <uint8_t N>
+class PositionMonitor {
+ public:
+  /**
+   * Sets the divergence, in microsteps, that counts as lost steps on an axis.
+   */
+  void setThreshold(uint8_t axis, int32_t steps) { _threshold[axis] = steps; }
+
+  /**
+   * Aligns the encoder reading with the generated position, e.g. at startup or
+   * after a fault has been acknowledged.
+   */
+  void resync(uint8_t axis, int32_t generated, int32_t encoderSteps) {
+    _encoderOffset[axis] = generated - encoderSteps;
+  }
+
+  /**
+   * Compares the planner's expected position with the generated position.
+   * Only meaningful once the axis has come to rest.
+   * @return true if the divergence exceeds the threshold
+   */
+  bool checkGenerated(uint8_t axis, int32_t expected, int32_t generated) {
+    return record(axis, PositionSource::Generator, generated - expected);
+  }
+
+  /**
+   * Compares the generated position with the encoder (already scaled to
+   * microsteps). Valid while moving, since both are sampled in real time.
+   * @return true if the divergence exceeds the threshold
+   */
+  bool checkEncoder(uint8_t axis, int32_t generated, int32_t encoderSteps) {
+    return record(axis, PositionSource::Encoder, encoderSteps + _encoderOffset[axis] - generated);
+  }
+
+  const PositionCheckStats& stats(uint8_t axis, PositionSource source) const {
+    return _stats[axis][(uint8_t)source];
+  }
+
+  /**
+   * True if any check on the axis has ever exceeded its threshold.
+   */
+  bool faulted(uint8_t axis) const {
+    return _stats[axis][0].faults > 0 || _stats[axis][1].faults > 0;
+  }
+
+ private:
+  bool record(uint8_t axis, PositionSource source, int32_t error) {
+    PositionCheckStats& stats = _stats[axis][(uint8_t)source];
+    int32_t magnitude = (error < 0) ? -error : error;
+    stats.lastError = error;
+    if (magnitude > stats.worstError) {
+      stats.worstError = magnitude;
+    }
+    if (magnitude > _threshold[axis]) {
+      stats.faults++;
+      return true;
+    }
+    return false;
+  }
+
+  int32_t _threshold[N] = {};
+  int32_t _encoderOffset[N] = {};
+  PositionCheckStats _stats[N][2] = {};
+};
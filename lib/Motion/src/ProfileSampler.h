@@ -0,0 +1,205 @@
+/*
+*******************************************************************************
+* Description:
+*   Samples a trapezoidal velocity profile for the dominant axis of a move at
+*   the profile sample rate. Each call to next() returns the velocity for one
+*   sample in Q16.16 microsteps per sample; the sampler accelerates toward
+*   the cruise speed and brakes so that it reaches the end velocity exactly
+*   when the remaining distance runs out. Acceleration may depend on speed
+*   (AccelProfile), e.g. to cross resonance bands quickly. Integer math only.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "AccelProfile.h"
+#include "FixedPoint.h"
+#include "StepCommand.h"
+
+/**
+ * Converts a step rate in Hz (microsteps/sec) to Q16 microsteps per sample.
+ */
+constexpr q16_t speedToSample(uint32_t speedHz) {
+  return (q16_t)(((uint64_t)speedHz << Q16_SHIFT) / PROFILE_SAMPLES_PER_S);
+}
+
+/**
+ * Converts a Q16 microsteps-per-sample velocity back to Hz.
+ */
+constexpr uint32_t sampleToSpeed(q16_t velocity) {
+  return (uint32_t)(((uint64_t)velocity * PROFILE_SAMPLES_PER_S) >> Q16_SHIFT);
+}
+
+class ProfileSampler {
+ public:
+  /**
+   * Plans a new profile.
+   * @param distance Steps of the dominant axis (unsigned)
+   * @param startSpeed Speed at the start of the profile, in Hz
+   * @param cruiseSpeed Maximum speed, in Hz
+   * @param endSpeed Speed to arrive with, in Hz
+   * @param accel Acceleration and deceleration limit over speed
+   */
+  void start(uint32_t distance, uint32_t startSpeed, uint32_t cruiseSpeed, uint32_t endSpeed,
+             const AccelProfile& accel) {
+    startFrom(distance, speedToSample(startSpeed), cruiseSpeed, endSpeed, accel);
+  }
+
+  /**
+   * Plans a new profile that continues at a velocity in Q16 microsteps per
+   * sample, e.g. the end velocity of the previous profile converted to this one.
+   */
+  void startFrom(uint32_t distance, q16_t startVelocity, uint32_t cruiseSpeed, uint32_t endSpeed,
+                 const AccelProfile& accel) {
+    _remaining = (int64_t)distance << Q16_SHIFT;
+    _velocity = (int64_t)startVelocity << Q16_SHIFT;
+    _cruise = (int64_t)speedToSample(cruiseSpeed) << Q16_SHIFT;
+    _end = speedToSample(endSpeed);
+    _accel = accel;
+    _brakeDistance = brakeDistance(_cruise >> Q16_SHIFT);
+    _leftover = 0;
+    _holding = false;
+    _active = distance > 0;
+  }
+
+  /**
+   * Plans a new profile with one acceleration at all speeds.
+   */
+  void start(uint32_t distance, uint32_t startSpeed, uint32_t cruiseSpeed, uint32_t endSpeed,
+             uint32_t acceleration) {
+    AccelProfile accel;
+    accel.setConstant(acceleration);
+    start(distance, startSpeed, cruiseSpeed, endSpeed, accel);
+  }
+
+  /**
+   * True once the whole distance has been sampled.
+   */
+  bool done() const { return !_active; }
+
+  /**
+   * Returns the velocity for the next sample, in Q16 microsteps per sample.
+   * The last sample carries whatever fraction of the distance is left, and
+   * leftover() tells how much of the sample period it did not use.
+   * @param fraction Part of a sample period to advance, Q16 (for the first
+   *                 sample of a profile that continues another one mid-sample)
+   */
+  q16_t next(q16_t fraction = Q16_ONE) {
+    if (!_active) {
+      return 0;
+    }
+    int64_t step = (_accel.at((q16_t)(_velocity >> Q16_SHIFT)) * fraction) >> Q16_SHIFT;
+    int64_t velocity = _velocity + step;
+    if (velocity > _cruise) {
+      // Above a lowered cruise speed, slow down to it at the acceleration limit
+      velocity = (_velocity - step > _cruise) ? _velocity - step : _cruise;
+    }
+    bool rest = false;
+    if (_holding) {
+      // Slow to rest at the acceleration limit; this sample ends once one more increment would stop it
+      velocity = _velocity - step;
+      rest = velocity <= step;
+      if (rest) {
+        velocity = step;
+      }
+    }
+
+    // Brake along the a(v) curve so the end velocity is reached with the distance
+    if (_remaining <= _brakeDistance) {
+      int64_t limit = (int64_t)_accel.brakeVelocity(_remaining, _end) << Q16_SHIFT;
+      if (limit < velocity) {
+        velocity = limit;
+      }
+    }
+
+    // Never crawl: keep at least one acceleration increment per sample (or the cruise
+    // speed, for accelerations that exceed it) so the tail ends
+    int64_t floor = (step < _cruise) ? step : _cruise;
+    if (velocity < floor) {
+      velocity = floor;
+    }
+    q16_t sample = (q16_t)(((velocity >> Q16_SHIFT) * fraction) >> Q16_SHIFT);
+    if (sample <= 0) {
+      sample = 1;
+    }
+    if (sample >= _remaining) {
+      _leftover = (q16_t)(fraction - ((_remaining * fraction) / sample));
+      sample = (q16_t)_remaining;
+      _active = false;
+    } else if (rest) {
+      _leftover = 0;
+      _active = false;
+      velocity = 0;
+    }
+    _remaining -= sample;
+    _velocity = velocity;
+    return sample;
+  }
+
+  /**
+   * Changes the cruise speed of the running profile. The sampler ramps to it
+   * at the acceleration limit, and still brakes to the end speed in time.
+   */
+  void setCruise(uint32_t cruiseSpeed) {
+    _cruise = (int64_t)speedToSample(cruiseSpeed) << Q16_SHIFT;
+    _brakeDistance = brakeDistance(((_velocity > _cruise) ? _velocity : _cruise) >> Q16_SHIFT);
+  }
+
+  /**
+   * Decelerates to rest at the acceleration limit wherever that ends, and
+   * ends the profile there with the rest of the distance unsampled (feed hold).
+   */
+  void hold() { _holding = true; }
+
+  /**
+   * True if the profile ended at rest short of its distance because of hold().
+   */
+  bool held() const { return !_active && _remaining > 0; }
+
+  /**
+   * Shortens the profile so it decelerates to rest from where it is now, at
+   * the planned acceleration.
+   */
+  void requestStop() {
+    _end = 0;
+    int64_t stopDistance = brakeDistance(_velocity >> Q16_SHIFT);
+    if (stopDistance < _remaining) {
+      _remaining = stopDistance;
+    }
+  }
+
+  /**
+   * Distance not yet sampled, in Q16 microsteps.
+   */
+  int64_t remaining() const { return _remaining; }
+
+  /**
+   * Part of the last sample period (Q16) left unused when the profile ended.
+   */
+  q16_t leftover() const { return _leftover; }
+
+  /**
+   * Current velocity in Q16 microsteps per sample.
+   */
+  q16_t velocity() const { return (q16_t)(_velocity >> Q16_SHIFT); }
+
+ private:
+  /**
+   * Distance needed to slow from velocity (Q16 per sample) to the end velocity, in Q16 steps.
+   */
+  int64_t brakeDistance(int64_t velocity) const {
+    return _accel.distance(_end, (q16_t)velocity) + velocity;
+  }
+
+  int64_t _remaining = 0;      // Q16 steps left
+  int64_t _velocity = 0;       // Q32 steps per sample
+  int64_t _cruise = 0;         // Q32 steps per sample
+  AccelProfile _accel;
+  int64_t _brakeDistance = 0;  // Q16 steps needed to brake from cruise
+  q16_t _end = 0;              // Q16 steps per sample
+  q16_t _leftover = 0;         // Q16 sample fraction
+  bool _holding = false;       // Decelerating for a feed hold
+  bool _active = false;
+};
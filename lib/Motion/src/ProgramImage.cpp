@@ -0,0 +1,155 @@
+/*
+*******************************************************************************
+* Description:
+*   ProgramImage backends: ESP32 flash partition mmap, or a file-backed mmap
+*   stand-in for host builds.
+*******************************************************************************
+*/
+
+#include "ProgramImage.h"
+
+#include <string.h>
+
+/**
+ * Checks a mapped header and the CRC of its records; returns the record
+ * count, or 0 if the image is invalid, truncated or corrupted.
+ */
+static uint32_t validRecordCount(const uint8_t* base, size_t size, uint8_t axisCount) {
+  if (size < sizeof(ProgramHeader)) {
+    return 0;
+  }
+  ProgramHeader header;
+  memcpy(&header, base, sizeof(header));
+  if (!programHeaderValid(header, axisCount) ||
+      header.recordCount > (size - sizeof(ProgramHeader)) / sizeof(ProgramRecord)) {
+    return 0;
+  }
+  if (programCrc(base + sizeof(ProgramHeader), (size_t)header.recordCount * sizeof(ProgramRecord)) != header.crc) {
+    return 0;
+  }
+  return header.recordCount;
+}
+
+#ifdef ESP_PLATFORM
+
+static const esp_partition_t* findProgramPartition() {
+  return esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                  (esp_partition_subtype_t)PROGRAM_PARTITION_SUBTYPE,
+                                  PROGRAM_PARTITION_LABEL);
+}
+
+bool ProgramImage::open(uint8_t axisCount) {
+  close();
+  const esp_partition_t* partition = findProgramPartition();
+  if (!partition) {
+    return false;
+  }
+  const void* mapped = nullptr;
+  if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &_handle) != ESP_OK) {
+    return false;
+  }
+  _base = static_cast<const uint8_t*>(mapped);
+  _mappedSize = partition->size;
+  _recordCount = validRecordCount(_base, _mappedSize, axisCount);
+  if (_recordCount == 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ProgramImage::close() {
+  if (_base) {
+    spi_flash_munmap(_handle);
+  }
+  _base = nullptr;
+  _mappedSize = 0;
+  _recordCount = 0;
+}
+
+bool ProgramImage::write(const ProgramRecord* records, uint32_t count, uint8_t axisCount) {
+  const esp_partition_t* partition = findProgramPartition();
+  if (!partition || count > (partition->size - sizeof(ProgramHeader)) / sizeof(ProgramRecord)) {
+    return false;
+  }
+
+  // Erase only the sectors the program occupies, rounded up to the 4 KB erase size
+  size_t used = sizeof(ProgramHeader) + count * sizeof(ProgramRecord);
+  size_t eraseSize = (used + SPI_FLASH_SEC_SIZE - 1) & ~(size_t)(SPI_FLASH_SEC_SIZE - 1);
+  if (esp_partition_erase_range(partition, 0, eraseSize) != ESP_OK) {
+    return false;
+  }
+  if (count > 0 &&
+      esp_partition_write(partition, sizeof(ProgramHeader), records, count * sizeof(ProgramRecord)) != ESP_OK) {
+    return false;
+  }
+
+  // Header last: a program interrupted mid-write stays invalid
+  ProgramHeader header = makeProgramHeader(axisCount, records, count);
+  return esp_partition_write(partition, 0, &header, sizeof(header)) == ESP_OK;
+}
+
+#else  // Host build: file-backed stand-in
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* backingFile = "motionprog.bin";
+
+void ProgramImage::setBackingFile(const char* path) {
+  backingFile = path;
+}
+
+bool ProgramImage::open(uint8_t axisCount) {
+  close();
+  int fd = ::open(backingFile, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);   // The mapping stays valid after the descriptor is closed
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  _base = static_cast<const uint8_t*>(mapped);
+  _mappedSize = info.st_size;
+  _recordCount = validRecordCount(_base, _mappedSize, axisCount);
+  if (_recordCount == 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ProgramImage::close() {
+  if (_base) {
+    munmap(const_cast<uint8_t*>(_base), _mappedSize);
+  }
+  _base = nullptr;
+  _mappedSize = 0;
+  _recordCount = 0;
+}
+
+bool ProgramImage::write(const ProgramRecord* records, uint32_t count, uint8_t axisCount) {
+  if (count > PROGRAM_MAX_RECORDS) {
+    return false;
+  }
+  FILE* file = fopen(backingFile, "wb");
+  if (!file) {
+    return false;
+  }
+  ProgramHeader header = makeProgramHeader(axisCount, records, count);
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            (count == 0 || fwrite(records, sizeof(ProgramRecord), count, file) == count);
+  return fclose(file) == 0 && ok;
+}
+
+#endif
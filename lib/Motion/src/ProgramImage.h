@@ -0,0 +1,80 @@
+/*
+*******************************************************************************
+* Description:
+*   Read-in-place access to a motion program stored in the "motionprog" flash
+*   partition. On the ESP32 the partition is mapped into the data address space
+*   with esp_partition_mmap(), so records are read straight from flash through
+*   the cache and RAM use does not depend on program length. Host builds map a
+*   regular file with POSIX mmap() instead, giving native code the same view.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "MotionProgram.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#endif
+
+// Must match the "motionprog" entry in partitions.csv
+constexpr char PROGRAM_PARTITION_LABEL[] = "motionprog";
+constexpr uint8_t PROGRAM_PARTITION_SUBTYPE = 0x40;
+constexpr uint32_t PROGRAM_PARTITION_SIZE = 0x80000;
+
+// Largest program that fits the partition
+constexpr uint32_t PROGRAM_MAX_RECORDS = (PROGRAM_PARTITION_SIZE - sizeof(ProgramHeader)) / sizeof(ProgramRecord);
+
+class ProgramImage {
+ public:
+  ~ProgramImage() { close(); }
+
+  /**
+   * Maps the program store and validates its header.
+   * @param axisCount Axes configured on this machine
+   * @return false if the store is missing or holds no valid program
+   */
+  bool open(uint8_t axisCount);
+
+  /**
+   * Releases the mapping. Record pointers become invalid.
+   */
+  void close();
+
+  bool isOpen() const { return _base != nullptr; }
+  uint32_t recordCount() const { return _recordCount; }
+
+  /**
+   * Returns a pointer to record index inside the mapped image (no copy).
+   */
+  const ProgramRecord* record(uint32_t index) const {
+    return (index < _recordCount)
+               ? reinterpret_cast<const ProgramRecord*>(_base + sizeof(ProgramHeader)) + index
+               : nullptr;
+  }
+
+  /**
+   * Replaces the stored program. Any open ProgramImage must be closed first.
+   * @return false if the store is missing, the program is too long or the write failed
+   */
+  static bool write(const ProgramRecord* records, uint32_t count, uint8_t axisCount);
+
+#ifndef ESP_PLATFORM
+  /**
+   * Selects the file standing in for the flash partition on host builds.
+   */
+  static void setBackingFile(const char* path);
+#endif
+
+ private:
+  const uint8_t* _base = nullptr;
+  size_t _mappedSize = 0;
+  uint32_t _recordCount = 0;
+#ifdef ESP_PLATFORM
+  spi_flash_mmap_handle_t _handle = 0;
+#endif
+};
@@ -0,0 +1,115 @@
+/*
+*******************************************************************************
+* Description:
+*   Simulated pulse backend for the host benchmark (PulseBench.h). Each
+*   backend is described by its shortest step interval and the interrupt
+*   time it takes per queue command and per step. The model plays a trial
+*   command by command: a command cannot finish before its interrupt work
+*   is done, the refill loop only gets the CPU time the interrupts leave,
+*   and edges are displaced by the timer resolution and, at command
+*   boundaries, by the interrupt latency.
+*   The default parameters are estimates; replace them with the figures
+*   the firmware benchmark measures on the actual board.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "PulseBench.h"
+
+// Commands and motion the refill loop keeps queued, as MotionControl does
+constexpr uint8_t PULSE_MODEL_QUEUE_LENGTH = 32;
+constexpr uint32_t PULSE_MODEL_LOOKAHEAD_US = 20000;
+
+struct PulseBackendParams {
+  uint32_t minIntervalNs;       // Shortest step interval the peripheral can produce
+  uint32_t isrNsPerCommand;     // Interrupt time to take on the next queue command
+  uint32_t isrNsPerStep;        // Interrupt time per step (buffer refills)
+  uint32_t edgeJitterNs;        // Timing resolution of an edge within a command
+  uint32_t boundaryJitterNs;    // Extra delay of the first edge of a command, interrupt latency
+  uint32_t loopPeriodUs;        // Time between two refills on an otherwise idle core
+  uint32_t refillNsPerCommand;  // Refill time per queued command
+};
+
+// MCPWM timer per step, PCNT counting steps: one interrupt per command
+constexpr PulseBackendParams MCPWM_PCNT_MODEL = {5000, 3000, 0, 63, 500, 1000, 2000};
+
+// RMT symbols per step, refilled from the command queue in half-buffer interrupts
+constexpr PulseBackendParams RMT_MODEL = {5000, 1500, 250, 25, 0, 1000, 2000};
+
+class PulseBackendModel {
+ public:
+  PulseBackendModel(const PulseBackendParams& mcpwmPcnt = MCPWM_PCNT_MODEL,
+                    const PulseBackendParams& rmt = RMT_MODEL)
+      : _mcpwmPcnt(mcpwmPcnt), _rmt(rmt) {}
+
+  /**
+   * Plays one trial. Auto is modelled as MCPWM/PCNT, FastAccelStepper's
+   * first choice.
+   */
+  bool run(PulseBackend backend, const PulseTrial& trial, PulseTrialResult& result) {
+    const PulseBackendParams& params = (backend == PulseBackend::Rmt) ? _rmt : _mcpwmPcnt;
+    result = {};
+    result.edges.reset();
+    result.stampsPerUs = 1000;
+
+    ConstantRateCommands commands(trial.rateHz, trial.steps);
+    uint64_t intervalNs = (uint64_t)commands.ticks() * 1000000000ull / STEP_TICKS_PER_S;
+    if (intervalNs < params.minIntervalNs) {
+      intervalNs = params.minIntervalNs;
+    }
+
+    uint64_t nowNs = 0;
+    uint64_t isrNs = 0;
+    uint64_t refillNs = 0;
+    uint64_t commandNs = 0;     // Longest command
+    StepCommand command;
+    while (commands.next(command)) {
+      uint64_t stepsNs = intervalNs * command.steps;
+      uint64_t workNs = params.isrNsPerCommand + (uint64_t)params.isrNsPerStep * command.steps;
+      uint64_t durationNs = (stepsNs > workNs) ? stepsNs : workNs;
+      if (trial.measureJitter) {
+        uint64_t edgeNs = nowNs + (durationNs - stepsNs) + jitter(params.boundaryJitterNs);
+        for (uint8_t i = 0; i < command.steps; i++) {
+          result.edges.edge((uint32_t)(edgeNs + jitter(params.edgeJitterNs)));
+          edgeNs += intervalNs;
+        }
+      }
+      nowNs += durationNs;
+      commandNs = (durationNs > commandNs) ? durationNs : commandNs;
+      isrNs += workNs;
+      refillNs += params.refillNsPerCommand;
+      result.steps += command.steps;
+    }
+    result.elapsedUs = (uint32_t)(nowNs / 1000);
+
+    // Interrupts slow the refill loop down; it underruns once its period exceeds the queued motion
+    uint64_t busyNs = isrNs + refillNs;
+    result.loadPermille = (uint16_t)((nowNs > 0) ? ((busyNs < nowNs) ? busyNs * 1000 / nowNs : 1000) : 0);
+    uint64_t queuedNs = commandNs * PULSE_MODEL_QUEUE_LENGTH;
+    if (queuedNs > PULSE_MODEL_LOOKAHEAD_US * 1000ull) {
+      queuedNs = PULSE_MODEL_LOOKAHEAD_US * 1000ull;
+    }
+    uint32_t idlePermille = 1000 - ((isrNs < nowNs) ? (uint32_t)(isrNs * 1000 / nowNs) : 1000);
+    uint64_t loopNs = (idlePermille > 0) ? (uint64_t)params.loopPeriodUs * 1000 * 1000 / idlePermille : UINT64_MAX;
+    if (loopNs > queuedNs) {
+      result.underruns = (uint32_t)((loopNs == UINT64_MAX) ? 1 : nowNs / loopNs + 1);
+    }
+    return true;
+  }
+
+ private:
+  /**
+   * Pseudo-random delay in [0, rangeNs], repeatable between runs.
+   */
+  uint32_t jitter(uint32_t rangeNs) {
+    _seed = _seed * 1664525u + 1013904223u;
+    return (rangeNs > 0) ? (_seed >> 8) % (rangeNs + 1) : 0;
+  }
+
+  PulseBackendParams _mcpwmPcnt;
+  PulseBackendParams _rmt;
+  uint32_t _seed = 1;
+};
@@ -0,0 +1,261 @@
+/*
+*******************************************************************************
+* Description:
+*   Pulse backend benchmark, independent of the hardware. The ESP32 can
+*   generate step pulses with MCPWM timers counted by PCNT, or with the RMT
+*   peripheral; FastAccelStepper drives both through the same command queue
+*   but they differ in interrupt load and rate limits. A runner (firmware:
+*   the real peripherals, host: PulseBackendModel) plays constant-rate
+*   trials, and the sweep here finds the highest rate each backend sustains
+*   and compares CPU load and edge jitter at the machine's top speed.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "StepCommand.h"
+
+/**
+ * Step pulse peripheral of an axis. Auto lets FastAccelStepper choose
+ * (MCPWM/PCNT while channels are left, then RMT).
+ */
+enum class PulseBackend : uint8_t {
+  Auto,
+  McpwmPcnt,
+  Rmt,
+};
+
+inline const char* pulseBackendName(PulseBackend backend) {
+  switch (backend) {
+    case PulseBackend::McpwmPcnt: return "MCPWM/PCNT";
+    case PulseBackend::Rmt: return "RMT";
+    default: return "auto";
+  }
+}
+
+// Lowest rate of the sweep; every trial rate must keep a step interval within 16 bits of ticks
+constexpr uint32_t PULSE_BENCH_START_HZ = 2000;
+
+// Highest rate tried, the shortest step interval FastAccelStepper accepts
+constexpr uint32_t PULSE_BENCH_MAX_HZ = STEP_TICKS_PER_S / STEP_MIN_INTERVAL_TICKS;
+
+// Length of one trial
+constexpr uint32_t PULSE_BENCH_TRIAL_MS = 200;
+
+// Rate at which load and jitter are compared, the top speed level of the machine
+constexpr uint32_t PULSE_BENCH_REFERENCE_HZ = 8000;
+
+// A trial is sustained if it finishes within this share of its nominal duration, per mille
+constexpr uint32_t PULSE_BENCH_TIMING_TOLERANCE_PERMILLE = 5;
+
+// Bisection passes between the last sustained and the first failed sweep rate
+constexpr uint8_t PULSE_BENCH_BISECT_STEPS = 5;
+
+static_assert(STEP_TICKS_PER_S / PULSE_BENCH_START_HZ <= UINT16_MAX, "Sweep start rate too low for a step interval");
+
+/**
+ * Intervals between successive step edges, in the unit of the timestamps
+ * (CPU cycles on the controller, ns on the host). Jitter is the spread
+ * between the shortest and longest interval.
+ */
+struct EdgeTiming {
+  uint32_t edges;
+  uint32_t lastStamp;
+  uint32_t minInterval;
+  uint32_t maxInterval;
+
+  void reset() { *this = {0, 0, UINT32_MAX, 0}; }
+
+  void edge(uint32_t stamp) {
+    if (edges++ > 0) {
+      uint32_t interval = stamp - lastStamp;
+      if (interval < minInterval) {
+        minInterval = interval;
+      }
+      if (interval > maxInterval) {
+        maxInterval = interval;
+      }
+    }
+    lastStamp = stamp;
+  }
+
+  uint32_t spread() const { return (edges > 1) ? maxInterval - minInterval : 0; }
+};
+
+/**
+ * Steps at a constant rate, split into the shortest commands the queue
+ * accepts, like the profile generator's.
+ */
+class ConstantRateCommands {
+ public:
+  ConstantRateCommands(uint32_t rateHz, uint32_t steps)
+      : _ticks((uint16_t)(STEP_TICKS_PER_S / rateHz)), _left(steps) {
+    uint32_t perCommand = (STEP_MIN_CMD_TICKS + _ticks - 1) / _ticks;
+    _perCommand = (uint8_t)((perCommand < 255) ? perCommand : 255);
+  }
+
+  bool next(StepCommand& command) {
+    if (_left == 0) {
+      return false;
+    }
+    uint8_t steps = (uint8_t)((_left < _perCommand) ? _left : _perCommand);
+    command = {_ticks, steps, true};
+    _left -= steps;
+    return true;
+  }
+
+  bool done() const { return _left == 0; }
+
+  uint16_t ticks() const { return _ticks; }
+
+ private:
+  uint16_t _ticks;        // Step interval
+  uint8_t _perCommand;    // Steps per command
+  uint32_t _left;         // Steps not yet handed out
+};
+
+/**
+ * One benchmark run: rateHz for PULSE_BENCH_TRIAL_MS.
+ */
+struct PulseTrial {
+  uint32_t rateHz;
+  uint32_t steps;
+  bool measureJitter;     // Timestamp every edge; adds its own load, so only on load-free trials
+};
+
+struct PulseTrialResult {
+  uint32_t steps;             // Steps the backend reported issued
+  uint32_t elapsedUs;         // From the release to the end of the last step period
+  uint32_t underruns;         // Refills that found the queue stopped with steps left
+  uint16_t loadPermille;      // CPU time lost by the core that refills the queue
+  EdgeTiming edges;           // Only with measureJitter
+  uint32_t stampsPerUs;       // Unit of the edge timestamps
+};
+
+inline PulseTrial pulseTrial(uint32_t rateHz, bool measureJitter = false) {
+  return {rateHz, (uint32_t)((uint64_t)rateHz * PULSE_BENCH_TRIAL_MS / 1000), measureJitter};
+}
+
+/**
+ * Nominal duration of a trial, µs.
+ */
+inline uint32_t pulseTrialNominalUs(const PulseTrial& trial) {
+  return (uint32_t)((uint64_t)trial.steps * (STEP_TICKS_PER_S / trial.rateHz) / (STEP_TICKS_PER_S / 1000000));
+}
+
+/**
+ * True if the backend issued every step on time without the queue running dry.
+ */
+inline bool pulseTrialSustained(const PulseTrial& trial, const PulseTrialResult& result) {
+  uint32_t nominalUs = pulseTrialNominalUs(trial);
+  uint32_t allowedUs = nominalUs + nominalUs / 1000 * PULSE_BENCH_TIMING_TOLERANCE_PERMILLE;
+  return result.steps == trial.steps && result.underruns == 0 && result.elapsedUs <= allowedUs;
+}
+
+/**
+ * Benchmark outcome of one backend.
+ */
+struct PulseBackendReport {
+  bool available;             // The runner could allocate a channel of this backend
+  uint32_t maxSustainedHz;    // Highest rate sustained, 0 if not even the sweep start
+  uint16_t referenceLoadPermille;   // CPU load at PULSE_BENCH_REFERENCE_HZ
+  uint16_t maxLoadPermille;         // CPU load at maxSustainedHz
+  uint32_t jitterNs;          // Edge interval spread at PULSE_BENCH_REFERENCE_HZ
+  uint32_t minIntervalNs;     // Shortest and longest edge interval seen there
+  uint32_t maxIntervalNs;
+};
+
+/**
+ * Runs the benchmark trials of one backend: load and jitter at the reference
+ * rate, then a sweep up by 25 % per trial and a bisection for the highest
+ * sustained rate.
+ * @param runner Provides bool run(PulseBackend, const PulseTrial&, PulseTrialResult&),
+ *               false if the backend is not available
+ */
+template <class Runner>
+PulseBackendReport benchmarkPulseBackend(Runner& runner, PulseBackend backend) {
+  PulseBackendReport report = {};
+  PulseTrialResult result = {};
+
+  PulseTrial reference = pulseTrial(PULSE_BENCH_REFERENCE_HZ);
+  if (!runner.run(backend, reference, result)) {
+    return report;
+  }
+  report.available = true;
+  report.referenceLoadPermille = result.loadPermille;
+
+  PulseTrial timing = pulseTrial(PULSE_BENCH_REFERENCE_HZ, true);
+  if (runner.run(backend, timing, result) && result.edges.edges > 1 && result.stampsPerUs > 0) {
+    report.minIntervalNs = (uint32_t)((uint64_t)result.edges.minInterval * 1000 / result.stampsPerUs);
+    report.maxIntervalNs = (uint32_t)((uint64_t)result.edges.maxInterval * 1000 / result.stampsPerUs);
+    report.jitterNs = report.maxIntervalNs - report.minIntervalNs;
+  }
+
+  uint32_t good = 0;
+  uint32_t bad = 0;
+  for (uint32_t rate = PULSE_BENCH_START_HZ; rate <= PULSE_BENCH_MAX_HZ; rate += rate / 4) {
+    PulseTrial trial = pulseTrial(rate);
+    if (!runner.run(backend, trial, result) || !pulseTrialSustained(trial, result)) {
+      bad = rate;
+      break;
+    }
+    good = rate;
+    report.maxLoadPermille = result.loadPermille;
+  }
+  if (good == 0) {
+    return report;
+  }
+  if (bad == 0 && good < PULSE_BENCH_MAX_HZ) {
+    PulseTrial trial = pulseTrial(PULSE_BENCH_MAX_HZ);
+    if (runner.run(backend, trial, result) && pulseTrialSustained(trial, result)) {
+      good = PULSE_BENCH_MAX_HZ;
+      report.maxLoadPermille = result.loadPermille;
+    } else {
+      bad = PULSE_BENCH_MAX_HZ;
+    }
+  }
+  for (uint8_t i = 0; i < PULSE_BENCH_BISECT_STEPS && bad > good + 1; i++) {
+    uint32_t rate = good + (bad - good) / 2;
+    PulseTrial trial = pulseTrial(rate);
+    if (runner.run(backend, trial, result) && pulseTrialSustained(trial, result)) {
+      good = rate;
+      report.maxLoadPermille = result.loadPermille;
+    } else {
+      bad = rate;
+    }
+  }
+  report.maxSustainedHz = good;
+  return report;
+}
+
+/**
+ * Backend with the lowest load at the reference rate among those that
+ * sustain requiredHz, or Auto if none does.
+ */
+inline PulseBackend preferredPulseBackend(const PulseBackendReport& mcpwmPcnt, const PulseBackendReport& rmt,
+                                          uint32_t requiredHz) {
+  bool mcpwmOk = mcpwmPcnt.available && mcpwmPcnt.maxSustainedHz >= requiredHz;
+  bool rmtOk = rmt.available && rmt.maxSustainedHz >= requiredHz;
+  if (mcpwmOk && rmtOk) {
+    return (rmt.referenceLoadPermille < mcpwmPcnt.referenceLoadPermille) ? PulseBackend::Rmt : PulseBackend::McpwmPcnt;
+  }
+  return mcpwmOk ? PulseBackend::McpwmPcnt : rmtOk ? PulseBackend::Rmt : PulseBackend::Auto;
+}
+
+/**
+ * One report line for a backend, the same on the controller and the host.
+ */
+inline void formatPulseBackendReport(char* text, size_t size, PulseBackend backend, const PulseBackendReport& report) {
+  if (!report.available) {
+    snprintf(text, size, "%-10s  no channel available", pulseBackendName(backend));
+    return;
+  }
+  snprintf(text, size, "%-10s  max %6lu Hz (load %3u.%u%%)  at %lu Hz: load %3u.%u%%, jitter %lu ns (%lu-%lu ns)",
+           pulseBackendName(backend), (unsigned long)report.maxSustainedHz,
+           report.maxLoadPermille / 10, report.maxLoadPermille % 10, (unsigned long)PULSE_BENCH_REFERENCE_HZ,
+           report.referenceLoadPermille / 10, report.referenceLoadPermille % 10, (unsigned long)report.jitterNs,
+           (unsigned long)report.minIntervalNs, (unsigned long)report.maxIntervalNs);
+}
@@ -0,0 +1,101 @@
+/*
+*******************************************************************************
+* Description:
+*   Step command queue health, independent of the hardware. The executor
+*   reports every refill pass of a running move with how much motion each
+*   axis queue still held. The monitor keeps the depth low-water mark, near
+*   misses (too little motion left), underruns (the queue ran dry mid-move)
+*   and the longest time between two refills. That longest gap, set against
+*   the lookahead, is the headroom left for more work in loop().
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Per-axis statistics kept by QueueMonitor.
+ */
+struct QueueHealth {
+  uint32_t refills;        // Refill passes sampled while the axis was running
+  uint32_t minTicks;       // Least motion left in the queue at a refill, ticks
+  uint8_t minEntries;      // Fewest commands left at a refill
+  uint32_t nearMisses;     // Refills that found less than the near-miss margin
+  uint32_t underruns;      // Refills that found the queue already stopped
+  uint32_t worstGapUs;     // Longest time between two refills of a running move
+  uint64_t sumTicks;       // For the average depth at a refill
+};
+
+template <uint8_t N>
+class QueueMonitor {
+ public:
+  QueueMonitor() { reset(); }
+
+  /**
+   * Sets the queued motion, in ticks, below which a refill counts as a near miss.
+   */
+  void setNearMiss(uint32_t ticks) { _nearMissTicks = ticks; }
+
+  /**
+   * Records one refill pass of a running move on an axis, before it is refilled.
+   * @param nowUs Time of the pass, µs
+   * @param queuedTicks Motion still queued, ticks
+   * @param entries Commands still queued
+   * @param stopped The queue has already run dry
+   */
+  void refill(uint8_t axis, uint32_t nowUs, uint32_t queuedTicks, uint8_t entries, bool stopped) {
+    QueueHealth& health = _health[axis];
+    if (_live[axis]) {
+      uint32_t gap = nowUs - _lastUs[axis];
+      if (gap > health.worstGapUs) {
+        health.worstGapUs = gap;
+      }
+    }
+    _live[axis] = true;
+    _lastUs[axis] = nowUs;
+
+    health.refills++;
+    health.sumTicks += queuedTicks;
+    if (queuedTicks < health.minTicks) {
+      health.minTicks = queuedTicks;
+    }
+    if (entries < health.minEntries) {
+      health.minEntries = entries;
+    }
+    if (stopped) {
+      health.underruns++;
+    } else if (queuedTicks < _nearMissTicks) {
+      health.nearMisses++;
+    }
+  }
+
+  /**
+   * Marks an axis as not running a move, so the wait until the next one is
+   * not taken for a refill gap.
+   */
+  void idle(uint8_t axis) { _live[axis] = false; }
+
+  const QueueHealth& health(uint8_t axis) const { return _health[axis]; }
+
+  /**
+   * Average motion left in the queue at a refill, ticks.
+   */
+  uint32_t averageTicks(uint8_t axis) const {
+    const QueueHealth& health = _health[axis];
+    return (health.refills > 0) ? (uint32_t)(health.sumTicks / health.refills) : 0;
+  }
+
+  void reset() {
+    for (uint8_t i = 0; i < N; i++) {
+      _health[i] = {0, UINT32_MAX, UINT8_MAX, 0, 0, 0, 0};
+      _live[i] = false;
+    }
+  }
+
+ private:
+  QueueHealth _health[N];
+  uint32_t _lastUs[N] = {};
+  bool _live[N] = {};
+  uint32_t _nearMissTicks = 0;
+};
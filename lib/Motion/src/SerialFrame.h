@@ -0,0 +1,177 @@
+/*
+*******************************************************************************
+* Description:
+*   Binary frames for the host link, shared by the firmware and the host
+*   tools. A frame is FRAME_START, payload length, sequence number, type,
+*   payload and a CRC-16/CCITT over everything after FRAME_START. The decoder
+*   hunts for FRAME_START and drops frames whose CRC does not match, so text
+*   printed on the same Serial port between frames is skipped.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint8_t FRAME_START = 0x7E;
+constexpr uint8_t FRAME_MAX_PAYLOAD = 64;
+
+// Start byte, length, sequence, type, payload and two CRC bytes
+constexpr size_t frameBytes(uint8_t payload) {
+  return 4 + (size_t)payload + 2;
+}
+
+constexpr size_t FRAME_MAX_BYTES = frameBytes(FRAME_MAX_PAYLOAD);
+
+struct Frame {
+  uint8_t seq;
+  uint8_t type;
+  uint8_t length;
+  uint8_t payload[FRAME_MAX_PAYLOAD];
+};
+
+/**
+ * CRC-16/CCITT-FALSE, one byte at a time.
+ */
+inline uint16_t crc16Update(uint16_t crc, uint8_t byte) {
+  crc ^= (uint16_t)byte << 8;
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+/**
+ * Writes a frame to out (at least FRAME_MAX_BYTES).
+ * @return bytes written
+ */
+inline size_t encodeFrame(const Frame& frame, uint8_t* out) {
+  size_t n = 0;
+  out[n++] = FRAME_START;
+  out[n++] = frame.length;
+  out[n++] = frame.seq;
+  out[n++] = frame.type;
+  for (uint8_t i = 0; i < frame.length; i++) {
+    out[n++] = frame.payload[i];
+  }
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 1; i < n; i++) {
+    crc = crc16Update(crc, out[i]);
+  }
+  out[n++] = (uint8_t)(crc & 0xFF);
+  out[n++] = (uint8_t)(crc >> 8);
+  return n;
+}
+
+/**
+ * Reassembles frames from a byte stream.
+ */
+class FrameDecoder {
+ public:
+  /**
+   * Consumes one byte.
+   * @return true when it completed a valid frame, available from frame()
+   */
+  bool feed(uint8_t byte) {
+    switch (_state) {
+      case State::Hunt:
+        if (byte == FRAME_START) {
+          _state = State::Length;
+          _crc = 0xFFFF;
+        }
+        return false;
+      case State::Length:
+        if (byte > FRAME_MAX_PAYLOAD) {
+          _state = State::Hunt;
+          _errors++;
+          return false;
+        }
+        _frame.length = byte;
+        _state = State::Seq;
+        break;
+      case State::Seq:
+        _frame.seq = byte;
+        _state = State::Type;
+        break;
+      case State::Type:
+        _frame.type = byte;
+        _received = 0;
+        _state = (_frame.length > 0) ? State::Payload : State::CrcLow;
+        break;
+      case State::Payload:
+        _frame.payload[_received++] = byte;
+        if (_received == _frame.length) {
+          _state = State::CrcLow;
+        }
+        break;
+      case State::CrcLow:
+        _crcLow = byte;
+        _state = State::CrcHigh;
+        return false;
+      case State::CrcHigh:
+        _state = State::Hunt;
+        if (((uint16_t)byte << 8 | _crcLow) != _crc) {
+          _errors++;
+          return false;
+        }
+        return true;
+    }
+    _crc = crc16Update(_crc, byte);
+    return false;
+  }
+
+  const Frame& frame() const { return _frame; }
+
+  /**
+   * True while a frame has started but is not complete.
+   */
+  bool receiving() const { return _state != State::Hunt; }
+
+  /**
+   * Frames dropped for a bad length or CRC.
+   */
+  uint32_t errors() const { return _errors; }
+
+  void reset() { _state = State::Hunt; }
+
+ private:
+  enum class State : uint8_t { Hunt, Length, Seq, Type, Payload, CrcLow, CrcHigh };
+
+  State _state = State::Hunt;
+  Frame _frame = {};
+  uint8_t _received = 0;
+  uint8_t _crcLow = 0;
+  uint16_t _crc = 0xFFFF;
+  uint32_t _errors = 0;
+};
+
+/**
+ * Little-endian field access for frame payloads.
+ */
+inline void putU16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+inline void putU32(uint8_t* p, uint32_t v) {
+  putU16(p, (uint16_t)v);
+  putU16(p + 2, (uint16_t)(v >> 16));
+}
+
+inline void putU64(uint8_t* p, uint64_t v) {
+  putU32(p, (uint32_t)v);
+  putU32(p + 4, (uint32_t)(v >> 32));
+}
+
+inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+  return getU16(p) | (uint32_t)getU16(p + 2) << 16;
+}
+
+inline uint64_t getU64(const uint8_t* p) {
+  return getU32(p) | (uint64_t)getU32(p + 4) << 32;
+}
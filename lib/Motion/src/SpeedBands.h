@@ -0,0 +1,192 @@
+/*
+*******************************************************************************
+* Description:
+*   Resonance band avoidance. Each axis may list step-rate bands where its
+*   motor resonates. For a coordinated move the bands of every moving axis are
+*   mapped onto the dominant axis speed and merged; the cruise speed is moved
+*   to the nearest band edge, and the acceleration profile uses each axis'
+*   transit acceleration inside the bands so ramps pass through them quickly.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "AccelProfile.h"
+#include "ProfileSampler.h"
+
+constexpr uint8_t MAX_RESONANCE_BANDS = 4;
+
+/**
+ * Step rates to avoid, in Hz (microsteps/sec), low < high.
+ */
+struct ResonanceBand {
+  uint32_t lowHz;
+  uint32_t highHz;
+};
+
+/**
+ * Resonance bands of one axis and the acceleration it can sustain while crossing them.
+ */
+struct BandConfig {
+  ResonanceBand bands[MAX_RESONANCE_BANDS];
+  uint8_t count;
+  uint32_t transitAcceleration;   // steps/sec² inside a band; 0 = no faster than the move
+};
+
+template <uint8_t N>
+class SpeedBandPlanner {
+ public:
+  void configure(uint8_t axis, const BandConfig& config) { _config[axis] = config; }
+
+  /**
+   * Moves a requested cruise speed of the dominant axis out of every band of
+   * every moving axis, to whichever edge of the band is nearer.
+   * @param requestedHz Requested speed of the dominant axis
+   * @param steps Relative microsteps per axis of the move
+   */
+  uint32_t selectCruise(uint32_t requestedHz, const int32_t (&steps)[N]) const {
+    Interval intervals[N * MAX_RESONANCE_BANDS];
+    uint8_t count = mergedBands(steps, intervals);
+    for (uint8_t i = 0; i < count; i++) {
+      if (requestedHz > intervals[i].low && requestedHz < intervals[i].high) {
+        bool lower = intervals[i].low > 0 &&
+                     requestedHz - intervals[i].low <= intervals[i].high - requestedHz;
+        return lower ? intervals[i].low : intervals[i].high;
+      }
+    }
+    return requestedHz;
+  }
+
+  /**
+   * Raises a(v) of the dominant axis inside the bands to the lowest transit
+   * acceleration of the moving axes (scaled to the dominant axis), where that
+   * exceeds the base limit; outside the bands the base limit applies.
+   * @param base Acceleration limit of the move without band crossing
+   * @param steps Relative microsteps per axis of the move
+   */
+  void buildAccel(const AccelProfile& base, const int32_t (&steps)[N], AccelProfile& profile) const {
+    profile = base;
+
+    uint32_t major = majorDistance(steps);
+    uint64_t transit = UINT64_MAX;
+    for (uint8_t i = 0; i < N; i++) {
+      uint32_t distance = magnitude(steps[i]);
+      if (distance > 0) {
+        uint64_t scaled = (uint64_t)_config[i].transitAcceleration * major / distance;
+        if (scaled < transit) {
+          transit = scaled;
+        }
+      }
+    }
+    Interval intervals[N * MAX_RESONANCE_BANDS];
+    uint8_t count = mergedBands(steps, intervals);
+    if (count == 0 || transit == 0 || transit == UINT64_MAX) {
+      return;
+    }
+    int64_t transitAccel = accelToSample(transit > UINT32_MAX ? UINT32_MAX : (uint32_t)transit);
+
+    // Breakpoints of the base profile and the band edges, each piece taking the larger limit inside a band
+    profile = AccelProfile();
+    uint8_t piece = 0;
+    uint8_t band = 0;
+    bool inBand = false;
+    q16_t velocity = 0;
+    int64_t previous = -1;
+    while (true) {
+      int64_t accel = base.at(velocity);
+      if (inBand && transitAccel > accel) {
+        accel = transitAccel;
+      }
+      if (accel != previous && profile.addPiece(velocity, accel)) {
+        previous = accel;
+      }
+
+      // Advance to the next base piece start or band edge
+      q16_t nextPiece = (piece + 1 < base.pieces()) ? base.pieceStart(piece + 1) : INT32_MAX;
+      q16_t nextEdge = INT32_MAX;
+      if (band < count) {
+        nextEdge = speedToSample(inBand ? intervals[band].high : intervals[band].low);
+      }
+      q16_t next = (nextPiece < nextEdge) ? nextPiece : nextEdge;
+      if (next == INT32_MAX) {
+        break;
+      }
+      if (next == nextPiece) {
+        piece++;
+      }
+      if (next == nextEdge) {
+        if (inBand) {
+          band++;
+        }
+        inBand = !inBand;
+      }
+      if (next > velocity) {
+        velocity = next;
+      }
+    }
+  }
+
+ private:
+  struct Interval {
+    uint32_t low;
+    uint32_t high;
+  };
+
+  static uint32_t magnitude(int32_t steps) { return (steps < 0) ? -steps : steps; }
+
+  static uint32_t majorDistance(const int32_t (&steps)[N]) {
+    uint32_t major = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      if (magnitude(steps[i]) > major) {
+        major = magnitude(steps[i]);
+      }
+    }
+    return major;
+  }
+
+  /**
+   * Maps the bands of the moving axes to dominant-axis speeds, sorted and merged.
+   */
+  uint8_t mergedBands(const int32_t (&steps)[N], Interval (&intervals)[N * MAX_RESONANCE_BANDS]) const {
+    uint32_t major = majorDistance(steps);
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < N; i++) {
+      uint32_t distance = magnitude(steps[i]);
+      if (distance == 0) {
+        continue;
+      }
+      for (uint8_t b = 0; b < _config[i].count && b < MAX_RESONANCE_BANDS; b++) {
+        uint64_t low = (uint64_t)_config[i].bands[b].lowHz * major / distance;
+        uint64_t high = ((uint64_t)_config[i].bands[b].highHz * major + distance - 1) / distance;
+        intervals[count++] = {(uint32_t)(low > UINT32_MAX ? UINT32_MAX : low),
+                              (uint32_t)(high > UINT32_MAX ? UINT32_MAX : high)};
+      }
+    }
+
+    // Insertion sort by lower edge, then merge overlaps
+    for (uint8_t i = 1; i < count; i++) {
+      Interval key = intervals[i];
+      int8_t j = i - 1;
+      while (j >= 0 && intervals[j].low > key.low) {
+        intervals[j + 1] = intervals[j];
+        j--;
+      }
+      intervals[j + 1] = key;
+    }
+    uint8_t merged = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      if (merged > 0 && intervals[i].low <= intervals[merged - 1].high) {
+        if (intervals[i].high > intervals[merged - 1].high) {
+          intervals[merged - 1].high = intervals[i].high;
+        }
+      } else {
+        intervals[merged++] = intervals[i];
+      }
+    }
+    return merged;
+  }
+
+  BandConfig _config[N] = {};
+};
@@ -0,0 +1,169 @@
+/*
+*******************************************************************************
+* Description:
+*   Compressed step schedules for host-planned motion. A StepBlock describes
+*   count steps of one axis whose spacing starts at interval ticks and grows
+*   by add ticks after every step (interval, interval + add, ...), the way a
+*   host planner compresses an exact step timeline. StepBlockExpander turns
+*   blocks into FastAccelStepper raw commands without changing a single step
+*   time, so the MCU replays exactly the schedule the host computed.
+*
+*   Timing: the first step of a block falls where the previous block ends;
+*   step k falls after the intervals of steps 0..k-1, and the interval after
+*   the last step is part of the block. A block with count 0 is a pause.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "StepCommand.h"
+
+// Longest command FastAccelStepper accepts
+constexpr uint32_t STEP_MAX_CMD_TICKS = UINT16_MAX;
+
+/**
+ * Run of steps of one axis with linearly changing spacing.
+ */
+struct StepBlock {
+  uint32_t interval;   // Ticks from the first step to the second; pause length when count is 0
+  uint16_t count;      // Steps in the block, 0 for a pause
+  int16_t add;         // Ticks added to the interval after every step
+  bool countUp;        // Direction of the steps
+};
+
+/**
+ * Interval after step k of a block, in ticks.
+ */
+inline int64_t stepBlockInterval(const StepBlock& block, uint32_t k) {
+  return (int64_t)block.interval + (int64_t)block.add * k;
+}
+
+/**
+ * Total length of a block in ticks: from its first step to where the next block starts.
+ */
+inline int64_t stepBlockTicks(const StepBlock& block) {
+  if (block.count == 0) {
+    return block.interval;
+  }
+  int64_t count = block.count;
+  return count * block.interval + (int64_t)block.add * count * (count - 1) / 2;
+}
+
+/**
+ * Commands an add == 0 block is split into so none holds more than
+ * STEP_MAX_STEPS_PER_CMD steps.
+ */
+inline uint32_t stepBlockChunks(uint32_t count) {
+  return (count + STEP_MAX_STEPS_PER_CMD - 1) / STEP_MAX_STEPS_PER_CMD;
+}
+
+/**
+ * True if the expander can replay a block with FastAccelStepper commands:
+ * no command shorter than STEP_MIN_CMD_TICKS and no interval below
+ * STEP_MIN_INTERVAL_TICKS. Blocks with a changing interval are replayed one
+ * step per command, so each of their intervals must be a valid command; runs
+ * of equal intervals are packed and only their chunks must be long enough.
+ */
+inline bool stepBlockValid(const StepBlock& block) {
+  if (block.count == 0) {
+    return block.interval >= STEP_MIN_CMD_TICKS;
+  }
+  if (block.add == 0) {
+    uint32_t chunks = stepBlockChunks(block.count);
+    uint64_t shortest = (uint64_t)(block.count / chunks) * block.interval;
+    return block.interval >= STEP_MIN_INTERVAL_TICKS && shortest >= STEP_MIN_CMD_TICKS;
+  }
+  int64_t first = stepBlockInterval(block, 0);
+  int64_t last = stepBlockInterval(block, block.count - 1);
+  return first >= STEP_MIN_CMD_TICKS && last >= STEP_MIN_CMD_TICKS && last <= UINT32_MAX;
+}
+
+/**
+ * Produces the FastAccelStepper commands of one block at a time. Equal
+ * intervals are packed into multi-step commands, changing intervals become
+ * one command per step, and anything longer than STEP_MAX_CMD_TICKS is
+ * continued with pause commands.
+ */
+class StepBlockExpander {
+ public:
+  /**
+   * Starts expanding a block; the previous one is dropped if unfinished.
+   */
+  void load(const StepBlock& block) {
+    _block = block;
+    _step = 0;
+    _pauseTicks = 0;
+    _pausePieces = 0;
+    if (block.count > 0) {
+      _countUp = block.countUp;
+    } else {
+      startPause(block.interval);
+    }
+    _active = true;
+  }
+
+  /**
+   * True while the loaded block has commands left.
+   */
+  bool active() const { return _active; }
+
+  /**
+   * Produces the next command of the loaded block.
+   * @return false once the block is done
+   */
+  bool next(StepCommand& command) {
+    if (!_active) {
+      return false;
+    }
+    if (_pausePieces > 0) {
+      uint32_t piece = _pauseTicks / _pausePieces;
+      _pauseTicks -= piece;
+      _pausePieces--;
+      command = {(uint16_t)piece, 0, _countUp};
+      finishIfDone();
+      return true;
+    }
+
+    if (_step >= _block.count) {
+      _active = false;
+      return false;
+    }
+    uint32_t remaining = _block.count - _step;
+    if (_block.add == 0 && _block.interval <= STEP_MAX_CMD_TICKS) {
+      // Balanced chunks, so the shortest one is never below the block's shortest
+      uint32_t chunks = stepBlockChunks(remaining);
+      uint32_t steps = (remaining + chunks - 1) / chunks;
+      command = {(uint16_t)_block.interval, (uint8_t)steps, _countUp};
+      _step += steps;
+    } else {
+      uint32_t interval = (uint32_t)stepBlockInterval(_block, _step);
+      uint32_t pieces = (uint32_t)(((uint64_t)interval + STEP_MAX_CMD_TICKS - 1) / STEP_MAX_CMD_TICKS);
+      uint32_t first = interval / pieces;
+      command = {(uint16_t)first, 1, _countUp};
+      _step++;
+      if (pieces > 1) {
+        _pauseTicks = interval - first;
+        _pausePieces = pieces - 1;
+      }
+    }
+    finishIfDone();
+    return true;
+  }
+
+ private:
+  void startPause(uint32_t ticks) {
+    _pauseTicks = ticks;
+    _pausePieces = (uint32_t)(((uint64_t)ticks + STEP_MAX_CMD_TICKS - 1) / STEP_MAX_CMD_TICKS);
+  }
+
+  void finishIfDone() { _active = _pausePieces > 0 || _step < _block.count; }
+
+  StepBlock _block = {};
+  uint32_t _step = 0;          // Steps of the block already emitted
+  uint32_t _pauseTicks = 0;    // Pause still to emit after the last command
+  uint32_t _pausePieces = 0;
+  bool _countUp = true;        // Direction kept for pauses
+  bool _active = false;
+};
@@ -0,0 +1,163 @@
+/*
+*******************************************************************************
+* Description:
+*   Step commands in the form FastAccelStepper's raw queue accepts, and
+*   SampleStepper, which turns the axis position at the end of each profile
+*   sample into such commands. Profiles are sampled every PROFILE_SAMPLE_US.
+*   Every axis places its steps on the same sample clock, one held step (or
+*   a short pause) behind it, so axes that start together stay in lockstep.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "FixedPoint.h"
+
+// FastAccelStepper timer rate and minimum command duration on the ESP32
+constexpr uint32_t STEP_TICKS_PER_S = 16000000UL;
+constexpr uint32_t STEP_MIN_CMD_TICKS = STEP_TICKS_PER_S / 5000;
+constexpr uint8_t STEP_MAX_STEPS_PER_CMD = 255;
+
+// Shortest step spacing FastAccelStepper generates (200 kHz)
+constexpr uint32_t STEP_MIN_INTERVAL_TICKS = STEP_TICKS_PER_S / 200000;
+
+// Profile sample period: planners produce one velocity value per sample
+constexpr uint32_t PROFILE_SAMPLE_US = 1000;
+constexpr uint32_t PROFILE_SAMPLES_PER_S = 1000000UL / PROFILE_SAMPLE_US;
+constexpr uint32_t PROFILE_SAMPLE_TICKS = STEP_TICKS_PER_S / PROFILE_SAMPLES_PER_S;
+
+static_assert(PROFILE_SAMPLE_TICKS >= STEP_MIN_CMD_TICKS, "Profile sample shorter than a step command");
+static_assert(2 * PROFILE_SAMPLE_TICKS <= UINT16_MAX, "Profile sample too long for a pause command");
+
+/**
+ * Mirror of FastAccelStepper's stepper_command_s: steps pulses spaced ticks
+ * apart (steps == 0 is a pause of ticks).
+ */
+struct StepCommand {
+  uint16_t ticks;
+  uint8_t steps;
+  bool countUp;
+};
+
+// Most commands SampleStepper::emit() produces for one sample
+constexpr uint8_t SAMPLE_MAX_COMMANDS = 4;
+
+/**
+ * Places each step where the axis position, interpolated linearly across
+ * the sample, crosses it. A command holds equally spaced steps, each
+ * followed by its interval, so the last step placed is held back until the
+ * next one shows where its interval ends; an axis that stands still holds
+ * a pause instead, emitted once it covers a whole sample. Step times are
+ * worked out from the exact crossings every sample, so rounding never
+ * accumulates and a constant speed gives constant intervals to the tick.
+ */
+class SampleStepper {
+ public:
+  void reset() {
+    _position = 0;
+    _held = -(int32_t)STEP_MIN_CMD_TICKS;   // A pause, so the first step can follow at once
+    _heldStep = false;
+    _countUp = true;
+  }
+
+  /**
+   * Emits the commands for one sample.
+   * @param position Q16 axis position at the end of the sample; the steps
+   *                 issued are the whole steps it moved past (at most 2 * 255)
+   * @param last True for the final sample of a move: the held step is
+   *             emitted as well
+   * @param out Receives up to SAMPLE_MAX_COMMANDS commands
+   * @return number of commands written
+   */
+  uint8_t emit(int64_t position, bool last, StepCommand* out) {
+    int64_t from = _position;
+    _position = position;
+    int32_t steps = (int32_t)((position >> Q16_SHIFT) - (from >> Q16_SHIFT));
+    uint8_t written = 0;
+
+    if (steps != 0) {
+      bool up = steps > 0;
+      uint32_t count = up ? steps : -steps;
+      if (count > 2 * STEP_MAX_STEPS_PER_CMD) {
+        count = 2 * STEP_MAX_STEPS_PER_CMD;
+      }
+      int64_t first = (from >> Q16_SHIFT) + (up ? 1 : 0);
+      int32_t firstTicks = crossing(from, position, first);
+      int32_t lastTicks = crossing(from, position, up ? first + (count - 1) : first - (count - 1));
+
+      // The held step leads this sample's run when it is too close for a
+      // command of its own, or already at the run's spacing (cruise)
+      int32_t gap = firstTicks - _held;
+      int32_t span = lastTicks - firstTicks;
+      int32_t runs = (int32_t)count - 1;
+      bool lead = gap < (int32_t)STEP_MIN_CMD_TICKS || (runs > 0 && abs(gap * runs - span) <= runs);
+      if (_heldStep && up == _countUp && lead) {
+        _held = run(out, written, _held, lastTicks, count, up);
+      } else {
+        gap = (gap < (int32_t)STEP_MIN_CMD_TICKS) ? STEP_MIN_CMD_TICKS : gap;
+        out[written++] = {(uint16_t)gap, (uint8_t)(_heldStep ? 1 : 0), _countUp};
+        _held = run(out, written, _held + gap, lastTicks, count - 1, up);
+      }
+      _heldStep = true;
+      _countUp = up;
+    } else if (_held <= -(int32_t)STEP_MIN_CMD_TICKS && !last) {
+      // Still at least a sample behind: emit up to a pause left for the next step
+      int32_t pause = (int32_t)(PROFILE_SAMPLE_TICKS - STEP_MIN_CMD_TICKS) - _held;
+      out[written++] = {(uint16_t)pause, (uint8_t)(_heldStep ? 1 : 0), _countUp};
+      _held += pause;
+      _heldStep = false;
+    }
+
+    if (last) {
+      int32_t tail = (int32_t)PROFILE_SAMPLE_TICKS - _held;
+      tail = (tail < (int32_t)STEP_MIN_CMD_TICKS) ? STEP_MIN_CMD_TICKS : tail;
+      out[written++] = {(uint16_t)tail, (uint8_t)(_heldStep ? 1 : 0), _countUp};
+      _held += tail;
+      _heldStep = false;
+    }
+    _held -= PROFILE_SAMPLE_TICKS;
+    return written;
+  }
+
+ private:
+  /**
+   * Ticks into the sample at which the position, moving linearly from
+   * from to to, reaches step.
+   */
+  static int32_t crossing(int64_t from, int64_t to, int64_t step) {
+    int64_t distance = to - from;
+    int64_t numerator = ((step << Q16_SHIFT) - from) * PROFILE_SAMPLE_TICKS;
+    return (int32_t)((numerator + distance / 2) / distance);
+  }
+
+  /**
+   * Writes steps equally spaced steps starting at start, spaced so the one
+   * after them lands on end, in commands of at least STEP_MIN_CMD_TICKS.
+   * @return when the step after them actually lands
+   */
+  static int32_t run(StepCommand* out, uint8_t& written, int32_t start, int32_t end, uint32_t steps, bool up) {
+    if (steps == 0) {
+      return start;
+    }
+    // Split in two halves when one command cannot hold all steps
+    uint8_t commands = (steps > STEP_MAX_STEPS_PER_CMD) ? 2 : 1;
+    uint32_t first = steps / commands;
+    int32_t spacing = (end - start + (int32_t)steps / 2) / (int32_t)steps;
+    int32_t shortest = (int32_t)((STEP_MIN_CMD_TICKS + first - 1) / first);
+    shortest = (shortest < (int32_t)STEP_MIN_INTERVAL_TICKS) ? STEP_MIN_INTERVAL_TICKS : shortest;
+    spacing = (spacing < shortest) ? shortest : spacing;
+    out[written++] = {(uint16_t)spacing, (uint8_t)first, up};
+    if (commands == 2) {
+      out[written++] = {(uint16_t)spacing, (uint8_t)(steps - first), up};
+    }
+    return start + spacing * (int32_t)steps;
+  }
+
+  int64_t _position = 0;       // Q16 position at the start of the sample
+  int32_t _held = -(int32_t)STEP_MIN_CMD_TICKS;   // Ticks from the start of the sample to the held step or pause
+  bool _heldStep = false;      // The held event is a step, not a pause
+  bool _countUp = true;
+};
@@ -0,0 +1,166 @@
+/*
+*******************************************************************************
+* Description:
+*   Exactly-once delivery of StepBlocks from a host planner. The host opens a
+*   session with a Begin frame, sends numbered Blocks frames and closes with
+*   End. StreamReceiver applies a frame only when it carries the next expected
+*   sequence number and acknowledges every frame with that number, so lost
+*   frames are resent by the host (go-back-N) and duplicated or resent frames
+*   are acknowledged without being applied twice. A frame that does not fit
+*   the block queues is refused as a whole and retried later.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "SerialFrame.h"
+#include "StepBlock.h"
+
+/**
+ * Frame types of the step stream; replies have the high bit set.
+ */
+enum class StreamFrame : uint8_t { Begin = 0x01, Blocks = 0x02, End = 0x03, Ack = 0x81, Nak = 0x82 };
+
+/**
+ * Reason carried by a Nak reply.
+ */
+enum class StreamNak : uint8_t { None = 0, OutOfOrder = 1, Full = 2, Busy = 3, Invalid = 4, NoSession = 5 };
+
+// Packed block: axis and direction, interval, count, add
+constexpr uint8_t STEP_BLOCK_BYTES = 9;
+constexpr uint8_t STREAM_BLOCKS_PER_FRAME = FRAME_MAX_PAYLOAD / STEP_BLOCK_BYTES;
+
+// Frames behind the expected one that are treated as resent duplicates
+constexpr uint8_t STREAM_DUPLICATE_WINDOW = 128;
+
+inline void packStepBlock(uint8_t axis, const StepBlock& block, uint8_t* out) {
+  out[0] = (uint8_t)(axis | (block.countUp ? 0x80 : 0));
+  putU32(out + 1, block.interval);
+  putU16(out + 5, block.count);
+  putU16(out + 7, (uint16_t)block.add);
+}
+
+inline void unpackStepBlock(const uint8_t* in, uint8_t& axis, StepBlock& block) {
+  axis = in[0] & 0x7F;
+  block.countUp = (in[0] & 0x80) != 0;
+  block.interval = getU32(in + 1);
+  block.count = getU16(in + 5);
+  block.add = (int16_t)getU16(in + 7);
+}
+
+/**
+ * MCU side of the stream protocol. The sink owns the block queues:
+ *   bool begin()                      start a session, false if motion is busy
+ *   uint8_t axisCount()
+ *   uint8_t space(uint8_t axis)       free block slots of an axis
+ *   void push(uint8_t axis, const StepBlock&)
+ *   void end()                        no blocks follow
+ */
+class StreamReceiver {
+ public:
+  /**
+   * Handles one received frame and builds the reply to send back.
+   */
+  template <class Sink>
+  void handle(const Frame& in, Frame& reply, Sink& sink) {
+    StreamNak nak = apply(in, sink);
+    reply.seq = _expected;
+    reply.type = (uint8_t)((nak == StreamNak::None) ? StreamFrame::Ack : StreamFrame::Nak);
+    reply.length = 2;
+    reply.payload[0] = (uint8_t)nak;
+    reply.payload[1] = minimumSpace(sink);
+  }
+
+  /**
+   * True between an accepted Begin and End.
+   */
+  bool inSession() const { return _session; }
+
+  /**
+   * Forgets the session, e.g. after the host went silent.
+   */
+  void reset() { _session = false; }
+
+ private:
+  template <class Sink>
+  StreamNak apply(const Frame& in, Sink& sink) {
+    StreamFrame type = (StreamFrame)in.type;
+    uint8_t behind = (uint8_t)(_expected - in.seq);
+    if (type == StreamFrame::Begin) {
+      if (_session && behind == 1 && in.seq == _beginSeq) {
+        return StreamNak::None;       // Begin resent after its ack was lost
+      }
+      if (_session || !sink.begin()) {
+        return StreamNak::Busy;
+      }
+      _session = true;
+      _primed = true;
+      _beginSeq = in.seq;
+      _expected = in.seq + 1;
+      return StreamNak::None;
+    }
+    if (_primed && behind >= 1 && behind <= STREAM_DUPLICATE_WINDOW) {
+      return StreamNak::None;         // Already applied
+    }
+    if (!_session) {
+      return StreamNak::NoSession;
+    }
+    if (in.seq != _expected) {
+      return StreamNak::OutOfOrder;
+    }
+
+    if (type == StreamFrame::End) {
+      sink.end();
+      _session = false;
+      _expected++;
+      return StreamNak::None;
+    }
+    if (type != StreamFrame::Blocks || in.length % STEP_BLOCK_BYTES != 0) {
+      return StreamNak::Invalid;
+    }
+
+    // Check the whole frame first so it is applied completely or not at all
+    uint8_t needed[8] = {};
+    uint8_t count = in.length / STEP_BLOCK_BYTES;
+    for (uint8_t b = 0; b < count; b++) {
+      uint8_t axis;
+      StepBlock block;
+      unpackStepBlock(in.payload + b * STEP_BLOCK_BYTES, axis, block);
+      if (axis >= sink.axisCount() || axis >= sizeof(needed) || !stepBlockValid(block)) {
+        return StreamNak::Invalid;
+      }
+      needed[axis]++;
+    }
+    for (uint8_t axis = 0; axis < sink.axisCount() && axis < sizeof(needed); axis++) {
+      if (needed[axis] > sink.space(axis)) {
+        return StreamNak::Full;
+      }
+    }
+    for (uint8_t b = 0; b < count; b++) {
+      uint8_t axis;
+      StepBlock block;
+      unpackStepBlock(in.payload + b * STEP_BLOCK_BYTES, axis, block);
+      sink.push(axis, block);
+    }
+    _expected++;
+    return StreamNak::None;
+  }
+
+  template <class Sink>
+  static uint8_t minimumSpace(Sink& sink) {
+    uint8_t space = UINT8_MAX;
+    for (uint8_t axis = 0; axis < sink.axisCount(); axis++) {
+      if (sink.space(axis) < space) {
+        space = sink.space(axis);
+      }
+    }
+    return space;
+  }
+
+  uint8_t _expected = 0;     // Sequence number of the next frame to apply
+  uint8_t _beginSeq = 0;
+  bool _session = false;
+  bool _primed = false;      // A session was opened, so older sequence numbers are known
+};
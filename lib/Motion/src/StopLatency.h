@@ -0,0 +1,77 @@
+/*
+*******************************************************************************
+* Description:
+*   Latency bookkeeping of the emergency stop path, shared by the firmware
+*   and the host simulator (EstopModel). A stop has two deadlines: the step
+*   outputs are cut in the e-stop input's interrupt, and the driver chip is
+*   disabled over I2C from the next loop() pass. Every stop records both
+*   delays, and the worst case seen is checked against the budgets below.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest time from the stop to the step outputs cut, ns. The controller measures from the
+// interrupt handler's entry; the simulator adds the modelled entry latency.
+constexpr uint32_t ESTOP_CUT_BUDGET_NS = 10000;
+
+// Longest time from the stop to the driver disabled, µs: the worst loop() pass plus the I2C write
+constexpr uint32_t ESTOP_DISABLE_BUDGET_US = 25000;
+
+struct StopLatency {
+  uint32_t cutNs;         // Step outputs cut
+  uint32_t disableUs;     // Driver chip disabled
+};
+
+class StopLatencyLog {
+ public:
+  void record(const StopLatency& latency) {
+    _last = latency;
+    if (latency.cutNs > _worst.cutNs) {
+      _worst.cutNs = latency.cutNs;
+    }
+    if (latency.disableUs > _worst.disableUs) {
+      _worst.disableUs = latency.disableUs;
+    }
+    _stops++;
+  }
+
+  uint32_t stops() const { return _stops; }
+
+  const StopLatency& last() const { return _last; }
+
+  /**
+   * Worst cut and worst disable latency, each over all stops.
+   */
+  const StopLatency& worst() const { return _worst; }
+
+  bool withinBudget() const {
+    return _worst.cutNs <= ESTOP_CUT_BUDGET_NS && _worst.disableUs <= ESTOP_DISABLE_BUDGET_US;
+  }
+
+  void reset() { *this = StopLatencyLog(); }
+
+ private:
+  StopLatency _last = {};
+  StopLatency _worst = {};
+  uint32_t _stops = 0;
+};
+
+/**
+ * One report line, the same on the controller and the host.
+ */
+inline void formatStopLatencyReport(char* text, size_t size, const StopLatencyLog& log) {
+  if (log.stops() == 0) {
+    snprintf(text, size, "E-stop: no stops recorded");
+    return;
+  }
+  snprintf(text, size, "E-stop: %lu stops, cut last %lu ns worst %lu ns (budget %lu), "
+           "driver off last %lu us worst %lu us (budget %lu)%s",
+           (unsigned long)log.stops(), (unsigned long)log.last().cutNs, (unsigned long)log.worst().cutNs,
+           (unsigned long)ESTOP_CUT_BUDGET_NS, (unsigned long)log.last().disableUs,
+           (unsigned long)log.worst().disableUs, (unsigned long)ESTOP_DISABLE_BUDGET_US,
+           log.withinBudget() ? "" : "  OVER BUDGET");
+}
@@ -0,0 +1,81 @@
+"""
+Extracts the LOG_EVENT format strings from the firmware sources into the
+string table host/log_decode reads: one line per format, its ID (the
+FNV-1a hash logFormatId() computes, in hex), a tab and the format with
+C escapes kept.
+
+Runs before every firmware build as a PlatformIO extra script and writes
+log_strings.tsv into the build directory. Standalone:
+    python scripts/log_strings.py [OUTPUT]
+"""
+
+import os
+import re
+import sys
+
+LOG_CALL = re.compile(r'\bLOG_EVENT\(\s*"((?:[^"\\\n]|\\.)*)"\s*([,)])?')
+SOURCE_DIRS = ("src", "include", "lib")
+SOURCE_EXTENSIONS = (".c", ".cpp", ".h", ".hpp")
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "\\": "\\", '"': '"', "'": "'", "0": "\0"}
+
+
+def unescape(literal):
+    out = []
+    i = 0
+    while i < len(literal):
+        if literal[i] == "\\":
+            out.append(ESCAPES[literal[i + 1]])
+            i += 2
+        else:
+            out.append(literal[i])
+            i += 1
+    return "".join(out)
+
+
+def format_id(text):
+    value = 2166136261
+    for byte in text.encode("utf-8"):
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def extract(project_dir):
+    table = {}
+    for top in SOURCE_DIRS:
+        for root, _, files in os.walk(os.path.join(project_dir, top)):
+            for name in sorted(files):
+                if not name.endswith(SOURCE_EXTENSIONS):
+                    continue
+                path = os.path.join(root, name)
+                with open(path, encoding="utf-8") as source:
+                    text = source.read()
+                for match in LOG_CALL.finditer(text):
+                    if "#define" in text[text.rfind("\n", 0, match.start()) + 1:match.start()]:
+                        continue
+                    if match.group(2) is None:
+                        line = text.count("\n", 0, match.start()) + 1
+                        sys.exit("%s:%d: LOG_EVENT needs a single string literal format" % (path, line))
+                    literal = match.group(1)
+                    key = format_id(unescape(literal))
+                    if table.get(key, literal) != literal:
+                        sys.exit("Log format ID collision: \"%s\" and \"%s\"" % (table[key], literal))
+                    table[key] = literal
+    return table
+
+
+def write_table(table, output):
+    directory = os.path.dirname(output)
+    if directory:
+        os.makedirs(directory, exist_ok=True)
+    with open(output, "w", encoding="utf-8") as out:
+        for key in sorted(table):
+            out.write("%08x\t%s\n" % (key, table[key]))
+
+
+if __name__ == "__main__":
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    write_table(extract(root), sys.argv[1] if len(sys.argv) > 1 else "log_strings.tsv")
+else:
+    Import("env")  # noqa: F821 (PlatformIO SCons environment)
+    write_table(extract(env.subst("$PROJECT_DIR")),  # noqa: F821
+                os.path.join(env.subst("$BUILD_DIR"), "log_strings.tsv"))  # noqa: F821
@@ -0,0 +1,85 @@
+/*
+*******************************************************************************
+* Description:
+*   Button edge interrupts and the event decoder fed from them.
+*******************************************************************************
+*/
+
+#include "ButtonInput.h"
+
+#include <Arduino.h>
+
+#include "DeferredLog.h"
+#include "MachineConfig.h"
+
+constexpr uint8_t buttonPins[BUTTON_COUNT] = {BUTTON_A_PIN, BUTTON_B_PIN, BUTTON_C_PIN};
+
+/**
+ * True if no axis encoder input shares a pin with a button.
+ */
+constexpr bool buttonPinsFree() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    for (uint8_t pin : buttonPins) {
+      if (axisTable[i].encoderPinA == pin || axisTable[i].encoderPinB == pin) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(buttonPinsFree(), "An encoder input uses a front button pin");
+
+static EdgeQueue<BUTTON_EDGE_QUEUE_LENGTH> edges;
+static ButtonDecoder<BUTTON_COUNT> decoder;
+static ButtonEdge pendingEdge;         // Popped edge not yet fed to the decoder
+static bool hasPendingEdge = false;
+
+/**
+ * Records the new level of one button with the time of the edge.
+ */
+static void IRAM_ATTR buttonEdgeIsr(void* arg) {
+  uint8_t button = (uint8_t)(uintptr_t)arg;
+  edges.push({button, digitalRead(buttonPins[button]) == LOW, (uint32_t)micros()});
+}
+
+/**
+ * Re-reads every button level after edges were lost, without reporting events.
+ */
+static void resyncButtons() {
+  uint32_t now = micros();
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    decoder.reset(i, digitalRead(buttonPins[i]) == LOW, now);
+  }
+}
+
+void initButtons() {
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    pinMode(buttonPins[i], INPUT);     // GPIO 34-39 have no internal pull-ups; the board provides them
+  }
+  resyncButtons();
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    attachInterruptArg(digitalPinToInterrupt(buttonPins[i]), buttonEdgeIsr, (void*)(uintptr_t)i, CHANGE);
+  }
+}
+
+void setButtonRepeat(uint8_t button, bool enabled) {
+  decoder.setRepeat(button, enabled);
+}
+
+bool nextButtonEvent(ButtonEvent& event) {
+  // Report events due before an edge, then feed the edge; the edge waits here meanwhile
+  while (hasPendingEdge || edges.pop(pendingEdge)) {
+    hasPendingEdge = true;
+    if (decoder.poll(pendingEdge.timeUs, event)) {
+      return true;
+    }
+    decoder.feed(pendingEdge);
+    hasPendingEdge = false;
+  }
+  if (edges.takeDropped() > 0) {
+    LOG_EVENT("Button edges dropped, re-reading levels.\n");
+    resyncButtons();
+  }
+  return decoder.poll(micros(), event);
+}
@@ -0,0 +1,62 @@
+/*
+*******************************************************************************
+* Description:
+*   Deferred log ring and its drain task. The task runs on the core loop()
+*   does not use, at a low priority, so it never takes time from the motion
+*   core and needs nothing from loop() to get its turn. Records are stamped
+*   with esp_timer µs, which both cores read alike (the cycle counters are
+*   per core). The task writes whole frames, and Serial blocks only the
+*   drain task.
+*******************************************************************************
+*/
+
+#include "DeferredLog.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+static LogRing<LOG_RING_WORDS> ring;
+
+void logWords(uint32_t id, const uint32_t* words, uint8_t count) {
+  ring.push(id, (uint32_t)esp_timer_get_time(), words, count);
+}
+
+static void sendFrame(Frame& frame) {
+  uint8_t bytes[FRAME_MAX_BYTES];
+  Serial.write(bytes, encodeFrame(frame, bytes));
+  frame.seq++;
+  frame.length = 0;
+}
+
+static void drainTask(void*) {
+  Frame frame = {};
+  frame.type = LOG_FRAME_TYPE;
+  LogRecord record;
+  for (;;) {
+    uint32_t dropped = ring.takeDropped();
+    if (dropped > 0) {
+      LogRecord lost = {LOG_DROPPED_ID, (uint32_t)esp_timer_get_time(), 1, {dropped}};
+      appendLogRecord(frame, lost);
+    }
+    bool drained = true;
+    while (ring.pop(record)) {
+      if (!appendLogRecord(frame, record)) {
+        sendFrame(frame);
+        appendLogRecord(frame, record);
+      }
+      drained = false;
+    }
+    if (frame.length > 0) {
+      sendFrame(frame);
+    }
+    if (drained) {
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_IDLE_MS));
+    }
+  }
+}
+
+void initDeferredLog() {
+  BaseType_t otherCore = (xPortGetCoreID() == 0) ? 1 : 0;
+  xTaskCreatePinnedToCore(drainTask, "log drain", LOG_DRAIN_STACK_BYTES, nullptr, LOG_DRAIN_PRIORITY, nullptr,
+                          otherCore);
+}
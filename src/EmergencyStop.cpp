@@ -0,0 +1,120 @@
+/*
+*******************************************************************************
+* Description:
+*   Emergency stop: input interrupt, output cut and latency records.
+*******************************************************************************
+*/
+
+#include "EmergencyStop.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <soc/gpio_sig_map.h>
+#include <soc/gpio_struct.h>
+
+#include "DeferredLog.h"
+#include "MachineConfig.h"
+#include "MotionControl.h"
+#include "StopLatency.h"
+
+static volatile bool tripped = false;          // Step outputs cut by the interrupt
+static volatile uint32_t tripCycles = 0;       // Interrupt entry
+static volatile uint32_t cutCycles = 0;        // Last step output cut
+static volatile int64_t tripUs = 0;
+static DRAM_ATTR uint8_t stepPins[AXIS_COUNT];   // axisTable's step pins, readable with the flash cache off
+static uint32_t savedOutputs[AXIS_COUNT] = {};   // Output signal routing of each step pin before the cut
+static bool latched = false;                   // Stop handled, not yet re-armed
+static Module_Stepmotor* stopDriver = nullptr;
+static StopLatencyLog latencyLog;
+
+/**
+ * Cuts every step output: drives the pin low and routes it to the GPIO
+ * output register instead of its MCPWM or RMT signal. It touches only
+ * IRAM, DRAM and registers (esp_timer_get_time() is in IRAM), so it can run
+ * while the flash cache is disabled. Whether it does depends on the
+ * interrupt being registered as an IRAM one (CONFIG_ARDUINO_ISR_IRAM);
+ * otherwise it is held off until a flash write has finished.
+ */
+static void IRAM_ATTR estopIsr() {
+  uint32_t entry = ESP.getCycleCount();
+  if (tripped) {
+    return;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    uint8_t pin = stepPins[i];
+    savedOutputs[i] = GPIO.func_out_sel_cfg[pin].val;
+    if (pin < 32) {
+      GPIO.out_w1tc = 1u << pin;
+    } else {
+      GPIO.out1_w1tc.val = 1u << (pin - 32);
+    }
+    GPIO.func_out_sel_cfg[pin].val = SIG_GPIO_OUT_IDX;   // Plain GPIO output, not inverted
+  }
+  cutCycles = ESP.getCycleCount();
+  tripCycles = entry;
+  tripUs = esp_timer_get_time();
+  tripped = true;
+}
+
+void initEmergencyStop(Module_Stepmotor& driver) {
+  stopDriver = &driver;
+  if (ESTOP_PIN == NO_PIN) {
+    return;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    stepPins[i] = axisTable[i].stepPin;
+  }
+  pinMode(ESTOP_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ESTOP_PIN), estopIsr, RISING);
+  if (digitalRead(ESTOP_PIN) == HIGH) {
+    estopIsr();                          // Switch open (or not connected) at power-up
+  }
+}
+
+bool serviceEmergencyStop() {
+  if (!tripped || latched) {
+    return false;
+  }
+  latched = true;
+  lockMotion(true);
+  haltAllMotion();
+  stopDriver->enableMotor(0);            // Disable driver chip (all motors)
+
+  StopLatency latency;
+  latency.cutNs = (uint32_t)((uint64_t)(cutCycles - tripCycles) * 1000 / getCpuFrequencyMhz());
+  latency.disableUs = (uint32_t)(esp_timer_get_time() - tripUs) + latency.cutNs / 1000;
+  latencyLog.record(latency);
+  LOG_EVENT("E-stop: outputs cut in %lu ns, driver off after %lu us\n", latency.cutNs, latency.disableUs);
+  return true;
+}
+
+bool emergencyStopLatched() {
+  return tripped;
+}
+
+bool rearmEmergencyStop() {
+  if (!tripped) {
+    return true;
+  }
+  if (!latched || digitalRead(ESTOP_PIN) == HIGH) {
+    return false;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    GPIO.func_out_sel_cfg[stepPins[i]].val = savedOutputs[i];
+  }
+  stopDriver->enableMotor(1);
+  latched = false;
+  lockMotion(false);
+  tripped = false;
+  if (digitalRead(ESTOP_PIN) == HIGH) {
+    estopIsr();                          // Opened again while re-arming; its edge may have been ignored
+  }
+  LOG_EVENT("E-stop re-armed, axis positions must be re-established\n");
+  return true;
+}
+
+void printEmergencyStopReport() {
+  char line[160];
+  formatStopLatencyReport(line, sizeof(line), latencyLog);
+  Serial.println(line);
+}
@@ -0,0 +1,101 @@
+/*
+*******************************************************************************
+* Description:
+*   Host step stream: frame decoding, the exactly-once receiver and the sink
+*   that connects it to the motion executor's block queues. Clock sync and
+*   timed move frames go to their own receiver, which queues moves through
+*   the planner.
+*******************************************************************************
+*/
+
+#include "HostStream.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "ClockSync.h"
+#include "DeferredLog.h"
+#include "MotionControl.h"
+#include "StepStream.h"
+
+/**
+ * Block queues of the motion executor, as seen by StreamReceiver.
+ */
+struct MotionBlockSink {
+  bool begin() { return beginStepStream(); }
+  uint8_t axisCount() const { return AXIS_COUNT; }
+  uint8_t space(uint8_t axis) { return stepBlockSpace(axis); }
+  void push(uint8_t axis, const StepBlock& block) { queueStepBlock(axis, block); }
+  void end() { endStepStream(); }
+};
+
+/**
+ * Motion queue of the planner, as seen by TimedMoveReceiver.
+ */
+struct TimedMoveSink {
+  TimedMoveStatus queue(const TimedMove& move) {
+    if (move.speedHz == 0 || move.acceleration == 0) {
+      return TimedMoveStatus::Invalid;
+    }
+    AxisSegment segment = {};
+    for (uint8_t i = 0; i < move.axes; i++) {
+      if (i < AXIS_COUNT) {
+        segment.steps[i] = move.steps[i];
+      } else if (move.steps[i] != 0) {
+        return TimedMoveStatus::Invalid;     // Moves an axis this machine does not have
+      }
+    }
+    segment.speedHz = move.speedHz;
+    segment.acceleration = move.acceleration;
+    segment.startUs = move.startUs;
+    if (stepStreamActive()) {
+      return TimedMoveStatus::Busy;
+    }
+    return queueMove(segment) ? TimedMoveStatus::Queued : TimedMoveStatus::Full;
+  }
+  uint8_t space() { return motionQueueSpace(); }
+};
+
+static FrameDecoder decoder;
+static StreamReceiver receiver;
+static MotionBlockSink sink;
+static TimedMoveReceiver timedReceiver;
+static TimedMoveSink timedSink;
+static uint32_t lastFrameMs = 0;
+
+bool hostStreamReceiving() {
+  return decoder.receiving() || receiver.inSession();
+}
+
+void feedHostStream(uint8_t byte) {
+  if (!decoder.feed(byte)) {
+    return;
+  }
+  uint64_t receivedUs = esp_timer_get_time();
+  Frame reply;
+  if (TimedMoveReceiver::handles(decoder.frame().type)) {
+    timedReceiver.handle(decoder.frame(), receivedUs, esp_timer_get_time(), reply, timedSink);
+  } else {
+    lastFrameMs = millis();
+    receiver.handle(decoder.frame(), reply, sink);
+  }
+  uint8_t bytes[FRAME_MAX_BYTES];
+  Serial.write(bytes, encodeFrame(reply, bytes));
+}
+
+void serviceHostStream() {
+  if (!receiver.inSession()) {
+    return;
+  }
+  // A stop ends the stream on the motion side; the session cannot continue
+  if (!stepStreamActive()) {
+    LOG_EVENT("Step stream stopped, session closed\n");
+    receiver.reset();
+    return;
+  }
+  if (millis() - lastFrameMs >= HOST_STREAM_TIMEOUT_MS && !anyAxisRunning()) {
+    LOG_EVENT("Host stream timed out, stopping\n");
+    receiver.reset();
+    endStepStream();
+  }
+}
@@ -0,0 +1,1061 @@
+/*
+*******************************************************************************
+* Description:
+*   Motion executor: FastAccelStepper setup and the queued segment runner.
+*   Segments are turned into step commands by a MoveGenerator (trapezoid,
+*   input shaping) and pushed into FastAccelStepper's raw command queues a few
+*   milliseconds ahead of the pulse generator. Blended segments are joined at
+*   junction speeds planned over the queued lookahead; arcs are split into
+*   chords that are fed into the queue as it drains. A move from rest is
+*   loaded into every axis queue before any of them starts; the queues are
+*   then released back to back with interrupts off, and a leading pause per
+*   axis absorbs the measured release offsets so the first steps coincide.
+*   A timed move is loaded TIMED_START_STAGE_MS early and released on time
+*   from loop(), the last microseconds waited out with interrupts off.
+*   Instead of the planner, a host may stream compressed step schedules
+*   (StepBlocks), which are replayed step-exact into the same queues.
+*   A feed override scales the programmed speeds of the running, the
+*   appended and every later segment; the profile re-ramps to the new speed.
+*   Before each refill of a running move the queue depths are sampled into a
+*   QueueMonitor: low-water marks, near misses, underruns and refill gaps.
+*   Backlash take-up makes the motor positions run ahead of the commanded
+*   ones by backlashOffset(); positions read back from FastAccelStepper are
+*   corrected by it.
+*   The job time left is the queued step commands plus the queue planned
+*   dry (MoveDuration.h), the plan cache left untouched.
+*******************************************************************************
+*/
+
+#include "MotionControl.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "ArcSegmenter.h"
+#include "DeferredLog.h"
+#include "MoveGenerator.h"
+#include "PathBlending.h"
+#include "StepBlock.h"
+
+static_assert(AXIS_COUNT <= MAX_STEPPER, "More axes configured than FastAccelStepper channels available");
+static_assert(STEP_TICKS_PER_S == TICKS_PER_S, "Profile tick rate must match FastAccelStepper");
+static_assert(STEP_MIN_CMD_TICKS >= MIN_CMD_TICKS, "Profile commands shorter than FastAccelStepper allows");
+static_assert(STEP_MIN_INTERVAL_TICKS >= MIN_DELTA_TICKS, "Step blocks faster than FastAccelStepper allows");
+
+// FastAccelStepper engine and motor stepper pointers
+FastAccelStepperEngine engine;
+FastAccelStepper* steppers[AXIS_COUNT] = {};
+
+long pulseCounts[AXIS_COUNT] = {};
+
+static int32_t commandedPositions[AXIS_COUNT] = {};   // Planner targets after started segments
+static bool resyncPending = false;     // Commanded positions must be re-based after a stop
+
+static MotionQueue<AXIS_COUNT, MOTION_QUEUE_LENGTH + HOLD_REQUEUE_SLOTS> motionQueue;
+static MoveGenerator<AXIS_COUNT> generator;
+static MoveLimits<AXIS_COUNT> moveLimits;
+static MovePlanCache<AXIS_COUNT> planCache;   // Last plan of moveLimits, reused by repeated moves
+static bool segmentActive = false;     // A started segment may still be running
+static bool dwelling = false;          // Head segment is waiting out its dwell
+static uint32_t dwellStartMs = 0;
+static uint32_t idleSinceMs = 0;
+static uint32_t chainReportMs = 0;     // Last status report while a blended chain runs
+static uint16_t feedOverride = 100;    // Percent of the programmed speeds
+static bool motionLocked = false;     // Emergency stop: no new motion accepted
+static bool feedHeld = false;          // Feed hold: no segment starts until resumed
+static bool holdSettling = false;      // The held segment is still decelerating
+static AxisSegment chainSegments[2];   // Running and appended segment by chain index parity, clipped steps
+static uint32_t chainAppended = 0;     // Chain index of the last segment handed to the generator
+
+static ArcSegmenter<AXIS_COUNT> arc;   // Arc being split into chords
+static AxisSegment arcChord;           // Speed, acceleration and flags of its chords
+static int32_t arcPosition[AXIS_COUNT] = {};   // End of the last chord queued
+
+static portMUX_TYPE startMux = portMUX_INITIALIZER_UNLOCKED;
+static bool startStaged = false;                  // Axis queues are loaded but held
+static uint16_t startLeadTicks[AXIS_COUNT] = {};  // Leading pause of each axis for the staged start
+static uint32_t startOffsetTicks[AXIS_COUNT] = {};   // Release delay of each axis after axis 0, last measured
+static uint64_t timedStartUs = 0;                 // Controller time the staged start is due, 0 to start once loaded
+
+static RingQueue<StepBlock, STEP_BLOCK_QUEUE_LENGTH> blockQueues[AXIS_COUNT];   // Host-planned steps per axis
+static StepBlockExpander blockExpanders[AXIS_COUNT];
+static bool streamActive = false;      // Axis queues are fed from blockQueues instead of the generator
+static bool streamEnding = false;      // The host sent its last block
+static uint32_t streamUnderruns = 0;   // Times an axis queue ran dry mid-stream
+
+static QueueMonitor<AXIS_COUNT> queueMonitor;   // Step queue depths at each refill pass
+
+static void stageStart();
+static void releaseStart(uint64_t dueUs = 0);
+static bool batchShortMove(AxisSegment& segment);
+
+void initMotion() {
+  engine.init();
+
+  // Connect each axis step pin to the engine, then set its direction pin and
+  // enable auto management of enable pin
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    steppers[i] = connectStepper(axisTable[i].stepPin, pulseBackendTable[i]);
+    if (steppers[i]) {
+      steppers[i]->setDirectionPin(axisTable[i].dirPin);     // Set direction control pin
+      steppers[i]->setAutoEnable(true);          // Let library manage enable pin automatically
+    } else {
+      LOG_EVENT("Axis %c has no pulse channel left (backend %u), axis disabled\n", axisTable[i].name,
+                (uint8_t)pulseBackendTable[i]);
+    }
+
+    ShaperImpulses impulses;
+    if (!designShaper(shaperTable[i], impulses)) {
+      LOG_EVENT("Axis %c shaper config invalid, shaping disabled\n", axisTable[i].name);
+    }
+    generator.setShaper(i, impulses);
+    generator.setBacklash(i, backlashTable[i]);
+    moveLimits.configure(i, accelCurveTable[i], bandTable[i], accelBoundTable[i]);
+  }
+  planCache.invalidate();
+  queueMonitor.setNearMiss(QUEUE_NEAR_MISS_MS * (TICKS_PER_S / 1000));
+
+  // Measure the release offsets once with pauses only, so the first move is already compensated
+  stageStart();
+  releaseStart();
+}
+
+FastAccelStepper* connectStepper(uint8_t stepPin, PulseBackend backend) {
+#if defined(SUPPORT_SELECT_DRIVER_TYPE)
+  uint8_t driver = (backend == PulseBackend::McpwmPcnt) ? DRIVER_MCPWM_PCNT
+                   : (backend == PulseBackend::Rmt)     ? DRIVER_RMT
+                                                        : DRIVER_DONT_CARE;
+  return engine.stepperConnectToPin(stepPin, driver);
+#else
+  return (backend == PulseBackend::Auto) ? engine.stepperConnectToPin(stepPin) : nullptr;
+#endif
+}
+
+bool queueMove(const AxisSegment& segment) {
+  if (motionLocked) {
+    return false;
+  }
+  if (arc.active() || streamActive) {
+    return false;     // Keep moves behind the arc still being split; the host owns the axes
+  }
+  if (motionQueue.space() <= HOLD_REQUEUE_SLOTS) {
+    return false;
+  }
+  AxisSegment queued = segment;
+  if (SHORT_MOVE_BLEND && !(segment.flags & SEGMENT_BLEND) && segment.dwellMs == 0 && segment.startUs == 0) {
+    batchShortMove(queued);
+  }
+  return motionQueue.push(queued);
+}
+
+/**
+ * Moves chords of the active arc into the motion queue while it has room.
+ */
+static void expandArc() {
+  int32_t point[AXIS_COUNT];
+  while (arc.active() && motionQueue.space() > HOLD_REQUEUE_SLOTS && arc.next(point)) {
+    bool moves = false;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      arcChord.steps[i] = point[i] - arcPosition[i];
+      arcPosition[i] = point[i];
+      moves = moves || arcChord.steps[i] != 0;
+    }
+    if (moves) {
+      motionQueue.push(arcChord);
+    }
+  }
+}
+
+bool queueArc(const int32_t (&steps)[AXIS_COUNT], int32_t centerX, int32_t centerY, bool clockwise,
+              uint32_t speedHz, uint32_t acceleration) {
+  if (arc.active() || motionLocked) {
+    return false;
+  }
+  int32_t start[AXIS_COUNT];
+  int32_t end[AXIS_COUNT];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    start[i] = queuedPosition(i);
+    end[i] = start[i] + steps[i];
+  }
+  if (!arc.begin(start, end, centerX, centerY, clockwise, ARC_CHORD_TOLERANCE_STEPS)) {
+    return false;
+  }
+  arcChord = {};
+  arcChord.speedHz = speedHz;
+  arcChord.acceleration = acceleration;
+  arcChord.flags = SEGMENT_BLEND;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    arcPosition[i] = start[i];
+  }
+  expandArc();
+  return true;
+}
+
+int32_t queuedPosition(uint8_t axis) {
+  int32_t position = commandedPositions[axis];
+  for (uint8_t k = 0; k < motionQueue.size(); k++) {
+    position += motionQueue.at(k)->steps[axis];
+  }
+  if (arc.active()) {
+    position += arc.end(axis) - arcPosition[axis];
+  }
+  return position;
+}
+
+void stopAllMotion() {
+  if (streamActive) {
+    // A host schedule has no ramp down planned on this side; stop at once
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      blockQueues[i].clear();
+      blockExpanders[i] = StepBlockExpander();
+      if (steppers[i]) {
+        steppers[i]->forceStop();
+      }
+    }
+    streamEnding = true;
+    startStaged = false;
+  }
+  if (timedStartUs > 0) {
+    // Nothing of the timed move has run yet; drop it from the held queues
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (steppers[i]) {
+        steppers[i]->forceStop();
+      }
+    }
+    generator.cancel();
+    startStaged = false;
+    timedStartUs = 0;
+  }
+  arc.cancel();
+  motionQueue.clear();
+  dwelling = false;
+  feedHeld = false;
+  holdSettling = false;
+  resyncPending = true;
+  generator.requestStop();    // Decelerate along the current profile
+}
+
+void haltAllMotion() {
+  stopAllMotion();
+  generator.cancel(true);     // Nothing more of the move is generated, run or not
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (steppers[i]) {
+      steppers[i]->forceStop();
+    }
+  }
+}
+
+void lockMotion(bool locked) {
+  motionLocked = locked;
+}
+
+bool anyAxisRunning() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (steppers[i] && steppers[i]->isRunning()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * True when an axis queue can take another sample without running more than
+ * MOTION_LOOKAHEAD_MS ahead of the pulse generator (always for unconnected axes).
+ */
+static bool axisQueueHasRoom(uint8_t axis) {
+  return !steppers[axis] ||
+         (steppers[axis]->queueEntries() <= QUEUE_LEN - SAMPLE_MAX_COMMANDS &&
+          steppers[axis]->ticksInQueue() < MOTION_LOOKAHEAD_MS * (TICKS_PER_S / 1000));
+}
+
+/**
+ * True when every axis queue can take another sample without running more
+ * than MOTION_LOOKAHEAD_MS ahead of the pulse generator.
+ */
+static bool queuesHaveRoom() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (!axisQueueHasRoom(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void appendNextSegment();
+
+/**
+ * Samples the queue of an axis before it is refilled. Only valid while the
+ * axis runs a released move with more motion still to come; otherwise the
+ * axis is marked idle, so an empty queue or the wait before the next move
+ * is not taken for an underrun or a refill gap.
+ */
+static void sampleQueue(uint8_t axis, bool live, uint32_t nowUs) {
+  if (!steppers[axis]) {
+    return;
+  }
+  if (!live || startStaged) {
+    queueMonitor.idle(axis);
+    return;
+  }
+  queueMonitor.refill(axis, nowUs, steppers[axis]->ticksInQueue(), steppers[axis]->queueEntries(),
+                      !steppers[axis]->isQueueRunning());
+}
+
+/**
+ * Pushes generated samples into the FastAccelStepper queues until they hold
+ * MOTION_LOOKAHEAD_MS of motion or the move has been fully generated.
+ */
+static void feedSteppers() {
+  StepCommand commands[AXIS_COUNT][SAMPLE_MAX_COMMANDS];
+  uint8_t counts[AXIS_COUNT];
+
+  uint32_t nowUs = micros();
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    sampleQueue(i, generator.active(), nowUs);
+  }
+
+  while (generator.active() && queuesHaveRoom()) {
+    if (generator.needsNext()) {
+      appendNextSegment();
+    }
+    generator.nextSample(commands, counts);
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      for (uint8_t c = 0; steppers[i] && c < counts[i]; c++) {
+        struct stepper_command_s command = {commands[i][c].ticks, commands[i][c].steps, commands[i][c].countUp};
+        int8_t result = steppers[i]->addQueueEntry(&command, !startStaged);
+        if (result != AQE_OK) {
+          LOG_EVENT("Axis %c queue rejected step command (%d), stopping\n", axisTable[i].name, result);
+          stopAllMotion();
+          if (startStaged) {
+            releaseStart();
+          }
+          return;
+        }
+      }
+    }
+  }
+
+  // Held queues are full (or the move is short); start all axes together unless timed
+  if (startStaged && timedStartUs == 0) {
+    releaseStart();
+  }
+}
+
+/**
+ * Expands streamed blocks into the axis queues, each axis up to
+ * MOTION_LOOKAHEAD_MS ahead. The held start is released once every axis is
+ * filled or the host has sent everything.
+ */
+static void feedStream() {
+  bool filled = true;
+  uint32_t nowUs = micros();
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (!steppers[i]) {
+      continue;
+    }
+    sampleQueue(i, blockExpanders[i].active() || !blockQueues[i].empty(), nowUs);
+    while (axisQueueHasRoom(i)) {
+      if (!blockExpanders[i].active()) {
+        StepBlock block;
+        if (!blockQueues[i].pop(block)) {
+          break;
+        }
+        pulseCounts[i] += block.countUp ? block.count : -(long)block.count;
+        blockExpanders[i].load(block);
+      }
+      StepCommand next;
+      if (!blockExpanders[i].next(next)) {
+        continue;
+      }
+      if (!startStaged && !steppers[i]->isQueueRunning()) {
+        streamUnderruns++;
+        LOG_EVENT("Axis %c step stream ran dry, timing lost\n", axisTable[i].name);
+      }
+      struct stepper_command_s command = {next.ticks, next.steps, next.countUp};
+      int8_t result = steppers[i]->addQueueEntry(&command, !startStaged);
+      if (result != AQE_OK) {
+        LOG_EVENT("Axis %c queue rejected streamed command (%d), stopping\n", axisTable[i].name, result);
+        stopAllMotion();
+        return;
+      }
+    }
+    filled = filled && !axisQueueHasRoom(i);
+  }
+  if (startStaged && (filled || streamEnding)) {
+    releaseStart();
+  }
+}
+
+/**
+ * Ends the stream once every block has been replayed and the axes stopped.
+ * @return true when the stream just finished
+ */
+static bool finishStream() {
+  if (!streamEnding || anyAxisRunning()) {
+    return false;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (!blockQueues[i].empty() || blockExpanders[i].active()) {
+      return false;
+    }
+  }
+  streamActive = false;
+  resyncPending = true;       // Re-base the planner on where the host left the axes
+  idleSinceMs = millis();
+  LOG_EVENT("Step stream complete, %lu underruns\n", streamUnderruns);
+  return true;
+}
+
+bool beginStepStream() {
+  if (streamActive || motionLocked || !motionIdle() || anyAxisRunning()) {
+    return false;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    blockQueues[i].clear();
+    blockExpanders[i] = StepBlockExpander();
+  }
+  streamActive = true;
+  streamEnding = false;
+  streamUnderruns = 0;
+  stageStart();
+  LOG_EVENT("Step stream started\n");
+  return true;
+}
+
+bool queueStepBlock(uint8_t axis, const StepBlock& block) {
+  if (!streamActive || streamEnding || axis >= AXIS_COUNT) {
+    return false;
+  }
+  return blockQueues[axis].push(block);
+}
+
+uint8_t stepBlockSpace(uint8_t axis) {
+  return (streamActive && !streamEnding) ? blockQueues[axis].space() : 0;
+}
+
+void endStepStream() {
+  streamEnding = true;
+}
+
+bool stepStreamActive() {
+  return streamActive;
+}
+
+/**
+ * Holds the axis queues for a move from rest and loads each with a leading
+ * pause, longer for the axes released earlier by their measured offset.
+ * Only valid while every axis queue is idle.
+ */
+static void stageStart() {
+  uint32_t latest = startOffsetTicks[AXIS_COUNT - 1];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    startLeadTicks[i] = (uint16_t)(START_LEAD_TICKS + latest - startOffsetTicks[i]);
+    if (steppers[i]) {
+      struct stepper_command_s lead = {startLeadTicks[i], 0, true};
+      steppers[i]->addQueueEntry(&lead, false);
+    }
+  }
+  startStaged = true;
+}
+
+/**
+ * Starts every held queue back to back with interrupts off, measures when
+ * each was released and reports the skew left after the lead compensation.
+ * @param dueUs Controller time to release at, waited for with interrupts off
+ */
+static void releaseStart(uint64_t dueUs) {
+  uint32_t cycles[AXIS_COUNT];
+  portENTER_CRITICAL(&startMux);
+  while ((uint64_t)esp_timer_get_time() < dueUs) {
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    cycles[i] = ESP.getCycleCount();
+    if (steppers[i]) {
+      steppers[i]->addQueueEntry(nullptr, true);
+    }
+  }
+  portEXIT_CRITICAL(&startMux);
+  startStaged = false;
+
+  // First step of axis i lands at release + lead; compare against axis 0
+  uint32_t cyclesPerUs = getCpuFrequencyMhz();
+  int32_t worstNs = 0;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    uint32_t offsetNs = (cycles[i] - cycles[0]) * 1000 / cyclesPerUs;
+    int32_t skewNs = (int32_t)offsetNs + ((int32_t)startLeadTicks[i] - startLeadTicks[0]) * 1000 / (int32_t)(STEP_TICKS_PER_S / 1000000);
+    if (abs(skewNs) > abs(worstNs)) {
+      worstNs = skewNs;
+    }
+    // A release stretched by something outside this loop is not worth compensating in full
+    uint32_t offsetTicks = (cycles[i] - cycles[0]) * (STEP_TICKS_PER_S / 1000000) / cyclesPerUs;
+    startOffsetTicks[i] = (offsetTicks < START_LEAD_TICKS) ? offsetTicks : START_LEAD_TICKS;
+  }
+  if (AXIS_COUNT > 1) {
+    uint32_t spreadNs = (cycles[AXIS_COUNT - 1] - cycles[0]) * 1000 / cyclesPerUs;
+    LOG_EVENT("Axis start skew %ld ns (release spread %lu ns)\n", worstNs, spreadNs);
+  }
+}
+
+/**
+ * Releases a staged timed start once it is due. loop() waits here for the
+ * last TIMED_START_SPIN_US and releaseStart() for the final
+ * TIMED_START_FINAL_US, so the first steps land on timedStartUs.
+ */
+static void releaseWhenDue() {
+  // The first steps follow the release by the start lead plus the latest axis offset
+  uint64_t leadUs = (START_LEAD_TICKS + startOffsetTicks[AXIS_COUNT - 1]) / (STEP_TICKS_PER_S / 1000000);
+  int64_t releaseUs = (int64_t)(timedStartUs - leadUs);
+  int64_t early = releaseUs - esp_timer_get_time();
+  if (early > (int64_t)TIMED_START_SPIN_US) {
+    return;
+  }
+  while (releaseUs - esp_timer_get_time() > (int64_t)TIMED_START_FINAL_US) {
+  }
+  timedStartUs = 0;
+  releaseStart((uint64_t)releaseUs);
+  if (early < 0) {
+    LOG_EVENT("Timed move started %lld us late\n", -early);
+  }
+}
+
+/**
+ * A programmed speed with the feed override applied.
+ */
+static uint32_t overridden(uint32_t speedHz) {
+  return (uint32_t)((uint64_t)speedHz * feedOverride / 100);
+}
+
+/**
+ * Clips a move starting at position to the soft limits.
+ */
+static void clipToLimits(const int32_t (&position)[AXIS_COUNT], const AxisSegment& segment,
+                         int32_t (&deltas)[AXIS_COUNT]) {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    int32_t target = constrain(position[i] + segment.steps[i],
+                               axisTable[i].minPosition, axisTable[i].maxPosition);
+    deltas[i] = target - position[i];
+  }
+}
+
+/**
+ * Converts a path quantity (speed or acceleration along the move) to the
+ * dominant axis of a move of the given dominant and path lengths.
+ */
+static uint32_t pathToDominant(uint32_t value, uint32_t major, uint32_t length) {
+  return (length > 0) ? (uint32_t)((uint64_t)value * major / length) : value;
+}
+
+static uint32_t majorDistance(const int32_t (&deltas)[AXIS_COUNT]) {
+  uint32_t major = 0;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    uint32_t distance = (deltas[i] < 0) ? -deltas[i] : deltas[i];
+    if (distance > major) {
+      major = distance;
+    }
+  }
+  return major;
+}
+
+/**
+ * Lowest acceleration along the path of a blended move, steps/sec².
+ */
+static uint32_t pathAcceleration(const AxisSegment& segment, const int32_t (&deltas)[AXIS_COUNT],
+                                 uint32_t major, uint32_t length) {
+  uint32_t cruiseHz = pathToDominant(overridden(segment.speedHz), major, length);
+  uint32_t accel = moveLimits.minimumAccel(deltas, cruiseHz, pathToDominant(segment.acceleration, major, length));
+  uint32_t path = (major > 0) ? (uint32_t)((uint64_t)accel * length / major) : accel;
+  return (path < segment.acceleration) ? path : segment.acceleration;
+}
+
+/**
+ * Highest path speed at which a blended segment may end: the queued segments
+ * that follow it are walked as far as they keep blending, and the chain is
+ * planned so it can still stop at the end of what is known. The rest of an
+ * arc being split counts as one more straight stretch.
+ * @param end Position the segment ends at
+ * @param first Queue index of the segment that follows it
+ */
+static uint32_t plannedExitHz(const AxisSegment& segment, const int32_t (&deltas)[AXIS_COUNT],
+                              const int32_t (&end)[AXIS_COUNT], uint8_t first) {
+  PathSegment lookahead[MOTION_QUEUE_LENGTH + HOLD_REQUEUE_SLOTS + 1];
+  uint8_t count = 0;
+  int32_t position[AXIS_COUNT];
+  int32_t previous[AXIS_COUNT];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    position[i] = end[i];
+    previous[i] = deltas[i];
+  }
+  uint32_t previousFeed = overridden(segment.speedHz);
+  uint32_t previousAccel = segment.acceleration;
+
+  uint8_t k = first;
+  for (; k < motionQueue.size(); k++) {
+    const AxisSegment& next = *motionQueue.at(k);
+    if (!(next.flags & SEGMENT_BLEND) || next.dwellMs > 0) {
+      break;      // The chain comes to rest before this segment
+    }
+    int32_t nextDeltas[AXIS_COUNT];
+    clipToLimits(position, next, nextDeltas);
+    uint32_t length = pathLength(nextDeltas);
+    if (length == 0) {
+      continue;
+    }
+    uint32_t major = majorDistance(nextDeltas);
+    uint32_t accel = pathAcceleration(next, nextDeltas, major, length);
+    uint32_t junction = junctionSpeed(previous, nextDeltas, (accel < previousAccel) ? accel : previousAccel,
+                                      JUNCTION_DEVIATION_STEPS);
+    uint32_t feed = overridden(next.speedHz);
+    uint32_t feedLimit = (feed < previousFeed) ? feed : previousFeed;
+    lookahead[count++] = {length, feed, accel, (junction < feedLimit) ? junction : feedLimit};
+
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      position[i] += nextDeltas[i];
+      previous[i] = nextDeltas[i];
+    }
+    previousFeed = feed;
+    previousAccel = accel;
+  }
+
+  // Chords not yet queued continue the arc at its feed
+  if (k == motionQueue.size() && arc.active() && count > 0) {
+    uint32_t feed = overridden(arcChord.speedHz);
+    lookahead[count] = {arc.remainingLength(), feed, previousAccel, (feed < previousFeed) ? feed : previousFeed};
+    count++;
+  }
+  return maxEntrySpeed(lookahead, count);
+}
+
+/**
+ * Turns a move that peaks below its cruise speed from rest to rest (the
+ * acceleration and braking ramps meet, a triangular profile) into a
+ * blended one. Its speed and acceleration are converted to the path, so
+ * the move runs as fast as before when it does not blend.
+ * @return false if the move reaches cruise and is left as it is
+ */
+static bool batchShortMove(AxisSegment& segment) {
+  uint32_t major = majorDistance(segment.steps);
+  uint32_t length = pathLength(segment.steps);
+  if (major == 0) {
+    return false;
+  }
+  AccelProfile accel;
+  uint32_t cruiseHz = moveLimits.plan(segment.steps, overridden(segment.speedHz), segment.acceleration, accel);
+  q16_t cruise = speedToSample(cruiseHz);
+  if (profilePeak((int64_t)major << Q16_SHIFT, 0, cruise, 0, accel) >= cruise) {
+    return false;
+  }
+  segment.speedHz = (uint32_t)((uint64_t)segment.speedHz * length / major);
+  segment.acceleration = (uint32_t)((uint64_t)segment.acceleration * length / major);
+  segment.flags |= SEGMENT_BLEND;
+  return true;
+}
+
+/**
+ * A segment as the generator runs it, in dominant-axis speeds.
+ */
+struct SegmentPlan {
+  int32_t deltas[AXIS_COUNT];   // Steps clipped to the soft limits
+  uint32_t major;               // Distance of the dominant axis
+  uint32_t feedHz;              // Programmed speed
+  uint32_t speedHz;             // Programmed speed with the feed override
+  uint32_t cruiseHz;            // Speed kept out of the resonance bands
+  uint32_t endHz;
+  AccelProfile accel;
+};
+
+/**
+ * Plans the speeds of a segment whose clipped steps are in plan.deltas,
+ * following the axis acceleration curves and keeping the cruise speed out
+ * of the resonance bands. Blended segments get the exit speed the lookahead
+ * allows.
+ * @param end Position the segment ends at
+ * @param next Queue index of the segment that follows it
+ * @param dryRun Estimate only; leaves the plan cache alone
+ */
+static void planSegment(const AxisSegment& segment, const int32_t (&end)[AXIS_COUNT], uint8_t next, bool dryRun,
+                        SegmentPlan& plan) {
+  // Blended moves give speed and acceleration along the path; the generator works on the dominant axis
+  uint32_t length = pathLength(plan.deltas);
+  uint32_t acceleration = segment.acceleration;
+  plan.major = majorDistance(plan.deltas);
+  plan.feedHz = segment.speedHz;
+  plan.endHz = 0;
+  if ((segment.flags & SEGMENT_BLEND) && length > 0) {
+    plan.feedHz = pathToDominant(segment.speedHz, plan.major, length);
+    acceleration = pathToDominant(segment.acceleration, plan.major, length);
+    plan.endHz = pathToDominant(plannedExitHz(segment, plan.deltas, end, next), plan.major, length);
+  }
+  plan.speedHz = overridden(plan.feedHz);
+  plan.cruiseHz = dryRun ? moveLimits.plan(plan.deltas, plan.speedHz, acceleration, plan.accel)
+                         : planCache.plan(moveLimits, plan.deltas, plan.speedHz, acceleration, plan.accel);
+  if (plan.endHz > plan.cruiseHz) {
+    plan.endHz = plan.cruiseHz;
+  }
+}
+
+/**
+ * Plans one segment from the commanded position, clipping each axis to its
+ * soft limits, and hands it to the generator.
+ * @param chained Continue the running segment instead of starting from rest
+ * @return false if a chained segment was clipped to nothing and skipped
+ */
+static bool startSegment(const AxisSegment& segment, bool chained) {
+  if (!chained) {
+    LOG_EVENT("Moving %d axes at %lu Hz, accel %lu\n",
+                  AXIS_COUNT, segment.speedHz, segment.acceleration);
+  }
+
+  SegmentPlan plan;
+  clipToLimits(commandedPositions, segment, plan.deltas);   // Plan from the model so lost steps stay visible
+  if (chained && pathLength(plan.deltas) == 0) {
+    return false;
+  }
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (plan.deltas[i] != segment.steps[i]) {
+      LOG_EVENT("Axis %c move clipped to %ld steps by soft limit\n", axisTable[i].name, plan.deltas[i]);
+    }
+    pulseCounts[i] += plan.deltas[i];                          // Update pulse counters
+    commandedPositions[i] += plan.deltas[i];
+  }
+
+  planSegment(segment, commandedPositions, 0, false, plan);
+  if (plan.cruiseHz != plan.speedHz) {
+    LOG_EVENT("Cruise moved to %lu Hz, out of a resonance band\n", plan.cruiseHz);
+  }
+  // Kept with the clipped steps, for a feed hold to requeue what the chain did not run
+  chainAppended = chained ? chainAppended + 1 : 0;
+  AxisSegment& kept = chainSegments[chainAppended & 1];
+  kept = segment;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    kept.steps[i] = plan.deltas[i];
+  }
+  if (chained) {
+    generator.append(plan.deltas, plan.cruiseHz, plan.accel, plan.endHz, plan.feedHz);
+  } else {
+    generator.start(plan.deltas, plan.cruiseHz, plan.accel, plan.endHz, plan.feedHz);
+  }
+  return true;
+}
+
+/**
+ * Puts the rest of a held chain back at the head of the queue once the axes
+ * are at rest: the part of the running segment between the actual position
+ * and its end, then the appended segment it never reached. Both start from
+ * rest, at once, when the hold is released.
+ */
+static void requeueHeldChain() {
+  uint32_t current = generator.chainIndex();
+  bool nextPending = generator.hasNext();
+  const AxisSegment& next = chainSegments[(current + 1) & 1];
+  AxisSegment rest = chainSegments[current & 1];
+  bool moves = false;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    int32_t end = commandedPositions[i] - (nextPending ? next.steps[i] : 0);
+    int32_t actual = steppers[i] ? steppers[i]->getCurrentPosition() - generator.backlashOffset(i) : end;
+    rest.steps[i] = end - actual;
+    moves = moves || rest.steps[i] != 0;
+    pulseCounts[i] -= rest.steps[i] + (nextPending ? next.steps[i] : 0);   // Counted again when restarted
+    commandedPositions[i] = actual;
+  }
+  rest.dwellMs = 0;
+  rest.startUs = 0;
+  if (nextPending) {
+    AxisSegment pending = next;
+    pending.dwellMs = 0;
+    pending.startUs = 0;
+    motionQueue.pushFront(pending);
+  }
+  if (moves) {
+    motionQueue.pushFront(rest);
+  }
+  LOG_EVENT("Feed hold at rest, %u segments requeued\n", (unsigned)(moves + nextPending));
+}
+
+/**
+ * Hands the head segment to the generator to continue the running one.
+ * Only called while the running segment ends moving, which the lookahead
+ * allows only when a blending successor is queued.
+ */
+static void appendNextSegment() {
+  AxisSegment segment;
+  while (motionQueue.pop(segment)) {
+    bool started = startSegment(segment, true);
+    expandArc();
+    if (started) {
+      return;
+    }
+  }
+  // Nothing left to blend into; brake rather than end the move at speed
+  LOG_EVENT("Blended move lost its successor, stopping\n");
+  generator.requestStop();
+  resyncPending = true;
+}
+
+bool serviceMotion() {
+  if (streamActive) {
+    feedStream();
+    return finishStream();
+  }
+  expandArc();
+  feedSteppers();
+  if (startStaged && timedStartUs > 0) {
+    releaseWhenDue();
+  }
+
+  // Report progress through a blended chain, at most every CHAIN_REPORT_MS
+  if (generator.takeSegmentSwitched() && millis() - chainReportMs >= CHAIN_REPORT_MS) {
+    chainReportMs = millis();
+    return true;
+  }
+
+  if (segmentActive || resyncPending) {
+    if (generator.active() || anyAxisRunning()) {
+      return false;
+    }
+    if (holdSettling) {
+      requeueHeldChain();
+      holdSettling = false;
+    }
+    if (resyncPending) {
+      // A stop abandoned the rest of the move, so the actual position is the new reference
+      for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+        commandedPositions[i] = steppers[i] ? steppers[i]->getCurrentPosition() - generator.backlashOffset(i) : 0;
+      }
+      resyncPending = false;
+    }
+    if (segmentActive) {
+      segmentActive = false;
+      idleSinceMs = millis();
+      LOG_EVENT("Move complete.\n");
+    }
+  }
+
+  AxisSegment* next = motionQueue.peek();
+  if (!next || feedHeld) {
+    return false;
+  }
+
+  // Honor the head segment's dwell, measured from when it reached the head
+  if (next->dwellMs > 0) {
+    if (!dwelling) {
+      dwelling = true;
+      dwellStartMs = millis();
+    }
+    if (millis() - dwellStartMs < next->dwellMs) {
+      return false;
+    }
+    dwelling = false;
+  }
+
+  // A timed move is loaded shortly before it is due
+  if (next->startUs > 0 && (int64_t)next->startUs - esp_timer_get_time() > (int64_t)TIMED_START_STAGE_MS * 1000) {
+    return false;
+  }
+
+  AxisSegment segment;
+  motionQueue.pop(segment);
+  startSegment(segment, false);
+  expandArc();
+  if (generator.active()) {
+    stageStart();
+    timedStartUs = segment.startUs;
+  }
+  segmentActive = true;
+  feedSteppers();
+  if (startStaged && timedStartUs > 0) {
+    releaseWhenDue();
+  }
+  return true;
+}
+
+bool motionIdle() {
+  return !segmentActive && motionQueue.empty() && !arc.active() && !streamActive;
+}
+
+uint32_t motionIdleSinceMs() {
+  return idleSinceMs;
+}
+
+uint8_t motionQueueSpace() {
+  if (arc.active() || streamActive || motionQueue.space() < HOLD_REQUEUE_SLOTS) {
+    return 0;
+  }
+  return motionQueue.space() - HOLD_REQUEUE_SLOTS;
+}
+
+int32_t commandedPosition(uint8_t axis) {
+  return commandedPositions[axis];
+}
+
+int32_t backlashOffset(uint8_t axis) {
+  return generator.backlashOffset(axis);
+}
+
+bool commandedPositionValid() {
+  return !resyncPending;
+}
+
+void setFeedOverride(uint16_t percent) {
+  percent = constrain(percent, FEED_OVERRIDE_MIN_PERCENT, FEED_OVERRIDE_MAX_PERCENT);
+  percent = (uint16_t)((percent + FEED_OVERRIDE_STEP_PERCENT / 2) / FEED_OVERRIDE_STEP_PERCENT * FEED_OVERRIDE_STEP_PERCENT);
+  if (percent == feedOverride) {
+    return;
+  }
+  feedOverride = percent;
+  generator.rescale([](const int32_t (&steps)[AXIS_COUNT], uint32_t feedHz) {
+    return moveLimits.cruise(steps, overridden(feedHz));
+  });
+  LOG_EVENT("Feed override %u%%\n", feedOverride);
+}
+
+uint16_t feedOverridePercent() {
+  return feedOverride;
+}
+
+const QueueHealth& queueHealth(uint8_t axis) {
+  return queueMonitor.health(axis);
+}
+
+void resetQueueHealth() {
+  queueMonitor.reset();
+}
+
+void printQueueHealthReport() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    const QueueHealth& health = queueMonitor.health(i);
+    if (health.refills == 0) {
+      Serial.printf("Axis %c queue: no running refills sampled\n", axisTable[i].name);
+      continue;
+    }
+    Serial.printf("Axis %c queue: %lu refills, min %lu us / %u cmds, avg %lu us, "
+                  "worst gap %lu us, %lu near misses, %lu underruns\n",
+                  axisTable[i].name, health.refills, health.minTicks / (TICKS_PER_S / 1000000),
+                  health.minEntries, queueMonitor.averageTicks(i) / (TICKS_PER_S / 1000000),
+                  health.worstGapUs, health.nearMisses, health.underruns);
+  }
+}
+
+void printPlanCacheReport() {
+  uint32_t total = planCache.reused() + planCache.planned();
+  Serial.printf("Move plans: %lu reused, %lu planned (%lu%% reused)\n", planCache.reused(), planCache.planned(),
+                (total > 0) ? planCache.reused() * 100 / total : 0);
+}
+
+void feedHold() {
+  if (feedHeld || streamActive) {
+    return;
+  }
+  feedHeld = true;
+  dwelling = false;           // A dwell in progress starts over on resume
+  if (timedStartUs > 0) {
+    // Nothing of the timed move has run yet; take it back from the held queues
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (steppers[i]) {
+        steppers[i]->forceStop();
+      }
+    }
+    generator.cancel();
+    startStaged = false;
+    timedStartUs = 0;
+  }
+  generator.hold();
+  holdSettling = segmentActive;
+  LOG_EVENT("Feed hold\n");
+}
+
+void resumeFeedHold() {
+  if (!feedHeld) {
+    return;
+  }
+  feedHeld = false;           // A hold still settling requeues its remainder, which then starts at once
+  LOG_EVENT("Feed hold released\n");
+}
+
+bool feedHoldActive() {
+  return feedHeld;
+}
+
+/**
+ * Adds the estimated run time of one queued segment, planned from position
+ * the way startSegment() would plan it, and moves position to its end.
+ * @param entryPathHz Path speed the segment is entered with; receives its exit speed
+ * @param next Queue index of the segment that follows it
+ */
+static uint32_t estimateSegmentUs(const AxisSegment& segment, int32_t (&position)[AXIS_COUNT],
+                                  uint32_t& entryPathHz, uint8_t next) {
+  SegmentPlan plan;
+  clipToLimits(position, segment, plan.deltas);
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    position[i] += plan.deltas[i];
+  }
+  uint32_t length = pathLength(plan.deltas);
+  if (length == 0) {
+    return 0;
+  }
+  planSegment(segment, position, next, true, plan);
+  uint32_t durationUs = profileDurationUs(plan.major, speedToSample(pathToDominant(entryPathHz, plan.major, length)),
+                                          plan.cruiseHz, plan.endHz, plan.accel);
+  entryPathHz = (plan.major > 0) ? (uint32_t)((uint64_t)plan.endHz * length / plan.major) : 0;
+  return durationUs;
+}
+
+uint32_t remainingJobUs() {
+  if (streamActive) {
+    return 0;
+  }
+  // Step commands already queued, then what the generator has still to produce
+  uint32_t queuedTicks = 0;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    if (steppers[i] && steppers[i]->ticksInQueue() > queuedTicks) {
+      queuedTicks = steppers[i]->ticksInQueue();
+    }
+  }
+  uint64_t totalUs = queuedTicks / (TICKS_PER_S / 1000000) + generator.remainingUs();
+
+  int32_t position[AXIS_COUNT];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    position[i] = commandedPositions[i];
+  }
+  uint32_t entryPathHz = generator.active() ? generator.chainEndPathHz() : 0;
+  for (uint8_t k = 0; k < motionQueue.size(); k++) {
+    const AxisSegment& segment = *motionQueue.at(k);
+    if (entryPathHz == 0) {
+      // The chain is at rest here: wait for the dwell or the start time, and let the shapers settle
+      int64_t untilStartUs = (segment.startUs > 0) ? (int64_t)segment.startUs - esp_timer_get_time() : 0;
+      int64_t dwellUs = (int64_t)segment.dwellMs * 1000;
+      if (k == 0 && dwelling) {
+        dwellUs -= (int64_t)(millis() - dwellStartMs) * 1000;
+      }
+      int64_t waitUs = (untilStartUs > dwellUs) ? untilStartUs : dwellUs;
+      totalUs += (waitUs > 0) ? waitUs : 0;
+    }
+    totalUs += estimateSegmentUs(segment, position, entryPathHz, k + 1);
+    if (entryPathHz == 0) {
+      totalUs += (uint32_t)generator.shaperTailSamples() * PROFILE_SAMPLE_US;
+    }
+  }
+  if (arc.active()) {
+    // Chords not split off yet, at the arc's speed
+    uint32_t feedHz = overridden(arcChord.speedHz);
+    totalUs += (feedHz > 0) ? (uint64_t)arc.remainingLength() * 1000000 / feedHz : 0;
+  }
+  return (totalUs > UINT32_MAX) ? UINT32_MAX : (uint32_t)totalUs;
+}
+
+uint32_t estimateMoveUs(const AxisSegment& segment) {
+  int32_t position[AXIS_COUNT];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    position[i] = queuedPosition(i);
+  }
+  AxisSegment single = segment;
+  single.flags &= ~SEGMENT_BLEND;             // Estimated on its own, from rest to rest
+  uint32_t entryPathHz = 0;
+  return estimateSegmentUs(single, position, entryPathHz, motionQueue.size()) +
+         (uint32_t)generator.shaperTailSamples() * PROFILE_SAMPLE_US;
+}
+
+void printJobTimeReport() {
+  uint32_t leftUs = remainingJobUs();
+  Serial.printf("Job time left: %lu.%03lu s%s\n", leftUs / 1000000, leftUs / 1000 % 1000,
+                feedHeld ? " (held)" : "");
+}
@@ -0,0 +1,28 @@
+/*
+*******************************************************************************
+* Description:
+*   PCNT unit allocation shared by encoder and position-compare inputs.
+*******************************************************************************
+*/
+
+#include "PcntUnits.h"
+
+#include "MachineConfig.h"
+
+static int nextUnit = PCNT_UNIT_MAX - 1;
+static bool isrServiceInstalled = false;
+
+pcnt_unit_t allocatePcntUnit() {
+  // Units below AXIS_COUNT may be claimed by FastAccelStepper for its step counters
+  if (nextUnit < AXIS_COUNT) {
+    return PCNT_UNIT_MAX;
+  }
+  return (pcnt_unit_t)nextUnit--;
+}
+
+bool installPcntIsrService() {
+  if (!isrServiceInstalled) {
+    isrServiceInstalled = pcnt_isr_service_install(0) == ESP_OK;
+  }
+  return isrServiceInstalled;
+}
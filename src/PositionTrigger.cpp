@@ -0,0 +1,289 @@
+/*
+*******************************************************************************
+* Description:
+*   Position-synchronized output: PCNT position and compare counters,
+*   compare interrupt and output pulse.
+*******************************************************************************
+*/
+
+#include "PositionTrigger.h"
+
+#include <Arduino.h>
+#include <esp32/rom/gpio.h>
+#include <esp_timer.h>
+#include <soc/gpio_periph.h>
+#include <soc/gpio_struct.h>
+#include <soc/io_mux_reg.h>
+#include <soc/pcnt_periph.h>
+
+#include "DeferredLog.h"
+#include "MachineConfig.h"
+#include "MotionControl.h"
+#include "PcntUnits.h"
+
+static pcnt_unit_t compareUnit = PCNT_UNIT_MAX;
+static pcnt_unit_t positionUnit = PCNT_UNIT_MAX;   // Never cleared while armed
+static PsoPositionCount positionCount;
+static PositionCompare compare;
+static uint8_t compareAxis = 0;
+static bool routed = false;                    // Step and direction pins of compareAxis feed both units
+static volatile bool outputHigh = false;
+static volatile uint32_t fired = 0;
+static volatile uint32_t worstFireCycles = 0;  // Interrupt entry to output edge
+static esp_timer_handle_t pulseTimer = nullptr;
+
+static void IRAM_ATTR setOutput(bool high) {
+  uint8_t pin = PSO_OUTPUT_PIN;
+  outputHigh = high;
+  if (pin < 32) {
+    if (high) {
+      GPIO.out_w1ts = 1u << pin;
+    } else {
+      GPIO.out_w1tc = 1u << pin;
+    }
+  } else if (high) {
+    GPIO.out1_w1ts.val = 1u << (pin - 32);
+  } else {
+    GPIO.out1_w1tc.val = 1u << (pin - 32);
+  }
+}
+
+static void endPulse(void*) {
+  setOutput(false);
+}
+
+/**
+ * Axis position from the position counter.
+ */
+static int32_t IRAM_ATTR axisPosition() {
+  int16_t count;
+  pcnt_get_counter_value(positionUnit, &count);
+  return positionCount.update(count);
+}
+
+/**
+ * Axis position at the compare counter's 0: the position less the compare
+ * count, both read without a step between them.
+ */
+static int32_t IRAM_ATTR compareOrigin() {
+  int16_t before;
+  int16_t after;
+  int32_t position;
+  do {
+    pcnt_get_counter_value(compareUnit, &before);
+    position = axisPosition();
+    pcnt_get_counter_value(compareUnit, &after);
+  } while (before != after);
+  return position - before;
+}
+
+/**
+ * Loads the window limits of the compare positions and restarts the compare
+ * counter from 0. Limits only take effect from a counter reset, and steps
+ * between reading the position and the reset move the counter's 0 off the
+ * window position: the window is then moved on to where the counter
+ * restarted and reloaded. No step is lost, as the position counter runs on.
+ * @return true if the steps taken meanwhile reached a compare position
+ */
+static bool IRAM_ATTR reloadWindow() {
+  bool reached = false;
+  for (;;) {
+    pcnt_set_event_value(compareUnit, PCNT_EVT_H_LIM, compare.high());
+    pcnt_set_event_value(compareUnit, PCNT_EVT_L_LIM, compare.low());
+    pcnt_counter_clear(compareUnit);
+    int32_t origin = compareOrigin();
+    if (origin == compare.position()) {
+      return reached;
+    }
+    reached |= compare.moveTo(origin);
+  }
+}
+
+/**
+ * The compare counter wrapped at a window limit: the step that reached a
+ * compare position fires the output before anything else happens. The
+ * position counter says where the axis is, so an event left over from
+ * before a reload only moves the window.
+ */
+static void IRAM_ATTR compareIsr(void*) {
+  uint32_t entry = ESP.getCycleCount();
+  uint32_t status = 0;
+  pcnt_get_event_status(compareUnit, &status);
+  if (!(status & (PCNT_EVT_H_LIM | PCNT_EVT_L_LIM))) {
+    return;
+  }
+  bool fire = compare.moveTo(axisPosition());
+  if (fire) {
+    setOutput(PSO_OUTPUT_MODE == PsoOutput::Pulse || !outputHigh);
+    uint32_t cycles = ESP.getCycleCount() - entry;
+    worstFireCycles = (cycles > worstFireCycles) ? cycles : worstFireCycles;
+    fired++;
+  }
+  if (reloadWindow()) {
+    setOutput(PSO_OUTPUT_MODE == PsoOutput::Pulse || !outputHigh);
+    fire = true;
+    fired++;
+  }
+  if (fire && PSO_OUTPUT_MODE == PsoOutput::Pulse) {
+    esp_timer_stop(pulseTimer);                // Fires closer than the pulse width merge into one pulse
+    esp_timer_start_once(pulseTimer, PSO_PULSE_US);
+  }
+}
+
+/**
+ * Feeds both units from the step pin of an axis, counting rising edges up
+ * while its direction pin is high (FastAccelStepper's default). The pins
+ * stay outputs: only their input buffer is enabled and matrixed to the units.
+ */
+static void routeAxis(uint8_t axis) {
+  uint8_t stepPin = axisTable[axis].stepPin;
+  uint8_t dirPin = axisTable[axis].dirPin;
+  PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[stepPin]);
+  PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[dirPin]);
+  for (pcnt_unit_t unit : {compareUnit, positionUnit}) {
+    gpio_matrix_in(stepPin, pcnt_periph_signals.groups[0].units[unit].channels[0].pulse_sig, false);
+    gpio_matrix_in(dirPin, pcnt_periph_signals.groups[0].units[unit].channels[0].control_sig, false);
+  }
+  compareAxis = axis;
+  routed = true;
+}
+
+/**
+ * Stops the counter and its interrupt, so the compare positions can change.
+ * @return false if the axis cannot be armed: no unit, or it is not at rest
+ */
+static bool pauseCompare(uint8_t axis) {
+  if (compareUnit == PCNT_UNIT_MAX || axis >= AXIS_COUNT || !motionIdle() || anyAxisRunning() ||
+      !commandedPositionValid()) {
+    return false;
+  }
+  pcnt_intr_disable(compareUnit);
+  pcnt_counter_pause(compareUnit);
+  pcnt_counter_pause(positionUnit);
+  return true;
+}
+
+/**
+ * Starts counting on an axis from its motor position at rest; the position
+ * counter is only cleared here, with the axis still.
+ */
+static void armCompare(uint8_t axis) {
+  if (!routed || axis != compareAxis) {
+    routeAxis(axis);
+  }
+  int32_t position = commandedPosition(axis) + backlashOffset(axis);
+  pcnt_counter_clear(positionUnit);
+  positionCount.start(position, 0);
+  compare.start(position);
+  reloadWindow();
+  fired = 0;
+  pcnt_counter_resume(positionUnit);
+  pcnt_counter_resume(compareUnit);
+  pcnt_intr_enable(compareUnit);
+}
+
+/**
+ * Counts the armed axis' steps on a unit, up with the direction pin high.
+ * Pins are matrixed in when an axis is armed.
+ */
+static void configureCounter(pcnt_unit_t unit, int16_t limit) {
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = PCNT_PIN_NOT_USED;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = unit;
+  config.pos_mode = PCNT_COUNT_INC;      // Count each step pulse (rising edge)
+  config.neg_mode = PCNT_COUNT_DIS;
+  config.hctrl_mode = PCNT_MODE_KEEP;    // Direction high: up
+  config.lctrl_mode = PCNT_MODE_REVERSE; // Direction low: down
+  config.counter_h_lim = limit;
+  config.counter_l_lim = -limit;
+  pcnt_unit_config(&config);
+  pcnt_counter_pause(unit);
+  pcnt_counter_clear(unit);
+}
+
+bool initPositionTrigger() {
+  if (PSO_OUTPUT_PIN == NO_PIN) {
+    return false;
+  }
+  pinMode(PSO_OUTPUT_PIN, OUTPUT);
+  setOutput(false);
+
+  compareUnit = allocatePcntUnit();
+  positionUnit = allocatePcntUnit();
+  if (compareUnit == PCNT_UNIT_MAX || positionUnit == PCNT_UNIT_MAX || !installPcntIsrService()) {
+    compareUnit = PCNT_UNIT_MAX;
+    LOG_EVENT("PSO: no two free PCNT units\n");
+    return false;
+  }
+  esp_timer_create_args_t timer = {};
+  timer.callback = endPulse;
+  timer.name = "pso";
+  esp_timer_create(&timer, &pulseTimer);
+
+  // The position counter wraps at fixed limits without an interrupt; the compare limits follow the window
+  configureCounter(positionUnit, PSO_COUNT_LIMIT);
+  configureCounter(compareUnit, PSO_WINDOW_LIMIT);
+  pcnt_event_enable(compareUnit, PCNT_EVT_H_LIM);
+  pcnt_event_enable(compareUnit, PCNT_EVT_L_LIM);
+  pcnt_intr_disable(compareUnit);
+  pcnt_isr_handler_add(compareUnit, compareIsr, nullptr);
+  return true;
+}
+
+bool addTriggerPosition(uint8_t axis, int32_t position) {
+  if (!pauseCompare(axis)) {
+    return false;
+  }
+  if (axis != compareAxis || compare.every() > 0) {
+    compare.clear();
+  }
+  bool added = compare.addPosition(position);
+  armCompare(axis);
+  return added;
+}
+
+bool setTriggerInterval(uint8_t axis, uint32_t everySteps) {
+  if (everySteps == 0 || !pauseCompare(axis)) {
+    return false;
+  }
+  compare.setInterval(commandedPosition(axis) + backlashOffset(axis), everySteps);
+  armCompare(axis);
+  return true;
+}
+
+void disarmPositionTrigger() {
+  if (compareUnit == PCNT_UNIT_MAX) {
+    return;
+  }
+  pcnt_intr_disable(compareUnit);
+  pcnt_counter_pause(compareUnit);
+  pcnt_counter_pause(positionUnit);
+  compare.clear();
+  esp_timer_stop(pulseTimer);
+  setOutput(false);
+}
+
+uint32_t positionTriggerCount() {
+  return fired;
+}
+
+void printPositionTriggerReport() {
+  if (compareUnit == PCNT_UNIT_MAX) {
+    Serial.println("PSO: not available");
+    return;
+  }
+  if (!compare.armed()) {
+    Serial.println("PSO: disarmed");
+    return;
+  }
+  uint32_t worstNs = (uint32_t)((uint64_t)worstFireCycles * 1000 / getCpuFrequencyMhz());
+  if (compare.every() > 0) {
+    Serial.printf("PSO: axis %c every %lu steps, %lu fired, output within %lu ns of the interrupt\n",
+                  axisTable[compareAxis].name, compare.every(), fired, worstNs);
+  } else {
+    Serial.printf("PSO: axis %c at %u positions, %lu fired, output within %lu ns of the interrupt\n",
+                  axisTable[compareAxis].name, compare.count(), fired, worstNs);
+  }
+}
@@ -0,0 +1,162 @@
+/*
+*******************************************************************************
+* Description:
+*   Pulse backend benchmark on the controller. Each trial loads the step
+*   queue of a benchmark stepper with constant-rate commands and refills it
+*   from a busy loop until the last step. The loop counts its passes: the
+*   share it loses against the same loop on the idle stepper is the CPU load
+*   of the backend (interrupts plus refills). For jitter, the step pin's
+*   input is enabled and a GPIO interrupt timestamps every rising edge in
+*   CPU cycles; that includes interrupt latency, so it is an upper bound on
+*   the peripheral's own jitter.
+*******************************************************************************
+*/
+
+#include "PulseBenchmark.h"
+
+#include <Arduino.h>
+#include <FastAccelStepper.h>
+#include <soc/gpio_periph.h>
+#include <soc/io_mux_reg.h>
+
+#include "MachineConfig.h"
+#include "MotionControl.h"
+#include "PulseBench.h"
+
+// Length of the idle loop measurement each load figure is compared with
+constexpr uint32_t PULSE_BENCH_BASELINE_MS = 50;
+
+// A trial running this many times over its nominal duration is aborted
+constexpr uint32_t PULSE_BENCH_TIMEOUT_FACTOR = 4;
+
+static EdgeTiming benchEdges;      // Written by the edge interrupt during a jitter trial
+
+static void IRAM_ATTR benchEdgeIsr() {
+  benchEdges.edge(ESP.getCycleCount());
+}
+
+/**
+ * Runs benchmark trials on the real peripherals, one stepper per backend
+ * connected on first use.
+ */
+class BoardPulseRunner {
+ public:
+  bool run(PulseBackend backend, const PulseTrial& trial, PulseTrialResult& result) {
+    FastAccelStepper* stepper = connect(backend);
+    if (!stepper) {
+      return false;
+    }
+    result = {};
+    result.edges.reset();
+    result.stampsPerUs = getCpuFrequencyMhz();
+
+    ConstantRateCommands commands(trial.rateHz, trial.steps);
+    int32_t startPosition = stepper->getCurrentPosition();
+    bool ok = fill(stepper, commands, false);
+    uint8_t pin = stepPin(backend);
+    if (trial.measureJitter) {
+      benchEdges.reset();
+      PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[pin]);
+      attachInterrupt(pin, benchEdgeIsr, RISING);
+    }
+
+    uint32_t timeoutUs = pulseTrialNominalUs(trial) * PULSE_BENCH_TIMEOUT_FACTOR + 100000;
+    uint32_t loops = 0;
+    uint32_t startUs = micros();
+    stepper->addQueueEntry(nullptr, true);
+    while (ok && (stepper->isRunning() || !commands.done())) {
+      if (!stepper->isQueueRunning() && !commands.done()) {
+        result.underruns++;
+      }
+      ok = fill(stepper, commands, true);
+      if (micros() - startUs > timeoutUs) {
+        ok = false;
+      }
+      loops++;
+    }
+    result.elapsedUs = micros() - startUs;
+    if (!ok) {
+      stepper->forceStop();
+    }
+    if (trial.measureJitter) {
+      detachInterrupt(pin);
+      result.edges = benchEdges;
+    }
+    result.steps = (uint32_t)(stepper->getCurrentPosition() - startPosition);
+
+    uint64_t idleLoops = (uint64_t)idleLoopsPerMs(backend) * result.elapsedUs / 1000;
+    result.loadPermille = (uint16_t)((idleLoops > loops) ? 1000 - loops * 1000 / idleLoops : 0);
+    return true;
+  }
+
+ private:
+  static uint8_t stepPin(PulseBackend backend) {
+    return (backend == PulseBackend::Rmt) ? PULSE_BENCH_RMT_PIN : PULSE_BENCH_MCPWM_PCNT_PIN;
+  }
+
+  FastAccelStepper* connect(PulseBackend backend) {
+    uint8_t index = (uint8_t)backend;
+    if (!_tried[index]) {
+      _tried[index] = true;
+      _steppers[index] = connectStepper(stepPin(backend), backend);
+    }
+    return _steppers[index];
+  }
+
+  /**
+   * Queues commands until the queue holds MOTION_LOOKAHEAD_MS or is full.
+   * @return false if the queue rejected a command
+   */
+  static bool fill(FastAccelStepper* stepper, ConstantRateCommands& commands, bool start) {
+    StepCommand next;
+    while (stepper->queueEntries() < QUEUE_LEN &&
+           stepper->ticksInQueue() < MOTION_LOOKAHEAD_MS * (TICKS_PER_S / 1000) && commands.next(next)) {
+      struct stepper_command_s command = {next.ticks, next.steps, next.countUp};
+      if (stepper->addQueueEntry(&command, start) != AQE_OK) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Passes per ms of the trial loop with the stepper idle and nothing left
+   * to queue, measured once per backend.
+   */
+  uint32_t idleLoopsPerMs(PulseBackend backend) {
+    uint8_t index = (uint8_t)backend;
+    if (_idleLoopsPerMs[index] == 0) {
+      FastAccelStepper* stepper = _steppers[index];
+      ConstantRateCommands none(PULSE_BENCH_START_HZ, 0);
+      uint32_t loops = 0;
+      uint32_t startUs = micros();
+      while (!stepper->isRunning() && micros() - startUs < PULSE_BENCH_BASELINE_MS * 1000) {
+        stepper->isQueueRunning();     // Same calls as a trial pass
+        fill(stepper, none, true);
+        loops++;
+      }
+      _idleLoopsPerMs[index] = loops / PULSE_BENCH_BASELINE_MS;
+    }
+    return _idleLoopsPerMs[index];
+  }
+
+  FastAccelStepper* _steppers[3] = {};
+  bool _tried[3] = {};
+  uint32_t _idleLoopsPerMs[3] = {};
+};
+
+void runPulseBenchmark() {
+  Serial.println("Pulse backend benchmark...");
+  BoardPulseRunner runner;
+  PulseBackendReport mcpwmPcnt = benchmarkPulseBackend(runner, PulseBackend::McpwmPcnt);
+  PulseBackendReport rmt = benchmarkPulseBackend(runner, PulseBackend::Rmt);
+
+  char line[160];
+  formatPulseBackendReport(line, sizeof(line), PulseBackend::McpwmPcnt, mcpwmPcnt);
+  Serial.println(line);
+  formatPulseBackendReport(line, sizeof(line), PulseBackend::Rmt, rmt);
+  Serial.println(line);
+  PulseBackend preferred = preferredPulseBackend(mcpwmPcnt, rmt, PULSE_BENCH_REFERENCE_HZ);
+  Serial.printf("Preferred backend at %lu Hz: %s (set it in pulseBackendTable)\n",
+                PULSE_BENCH_REFERENCE_HZ, pulseBackendName(preferred));
+}
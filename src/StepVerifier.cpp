@@ -0,0 +1,184 @@
+/*
+*******************************************************************************
+* Description:
+*   Step-loss detection: position checks and PCNT quadrature encoder input.
+*******************************************************************************
+*/
+
+#include "StepVerifier.h"
+
+#include <Arduino.h>
+
+#include "DeferredLog.h"
+#include "MotionControl.h"
+#include "PcntUnits.h"
+#include "PositionMonitor.h"
+
+// PCNT counters are 16-bit; they wrap at these limits and the ISR extends them to 32 bits
+constexpr int16_t ENCODER_COUNT_LIMIT = 30000;
+
+static PositionMonitor<AXIS_COUNT> monitor;
+static pcnt_unit_t encoderUnits[AXIS_COUNT];
+static volatile int32_t encoderOverflow[AXIS_COUNT] = {};
+static bool checkedAtRest = false;     // Generator check already done for this rest period
+static uint32_t lastEncoderCheckMs = 0;
+
+static bool hasEncoder(uint8_t axis) {
+  return axisTable[axis].encoderCountsPerRev > 0 && encoderUnits[axis] != PCNT_UNIT_MAX;
+}
+
+/**
+ * Carries counter wrap-arounds into the 32-bit overflow accumulator.
+ */
+static void IRAM_ATTR encoderOverflowIsr(void* arg) {
+  uint8_t axis = (uint8_t)(uintptr_t)arg;
+  uint32_t status = 0;
+  pcnt_get_event_status(encoderUnits[axis], &status);
+  if (status & PCNT_EVT_H_LIM) {
+    encoderOverflow[axis] += ENCODER_COUNT_LIMIT;
+  } else if (status & PCNT_EVT_L_LIM) {
+    encoderOverflow[axis] -= ENCODER_COUNT_LIMIT;
+  }
+}
+
+/**
+ * Configures one PCNT unit as a 4x quadrature decoder on the axis encoder pins.
+ */
+static bool initEncoder(uint8_t axis) {
+  pcnt_unit_t unit = allocatePcntUnit();
+  encoderUnits[axis] = unit;
+  if (unit == PCNT_UNIT_MAX || !installPcntIsrService()) {
+    encoderUnits[axis] = PCNT_UNIT_MAX;
+    return false;
+  }
+
+  // Channel 0 counts edges of A, direction from B; channel 1 counts edges of B, direction from A
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = axisTable[axis].encoderPinA;
+  config.ctrl_gpio_num = axisTable[axis].encoderPinB;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = unit;
+  config.pos_mode = PCNT_COUNT_DEC;
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_REVERSE;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = ENCODER_COUNT_LIMIT;
+  config.counter_l_lim = -ENCODER_COUNT_LIMIT;
+  pcnt_unit_config(&config);
+
+  config.pulse_gpio_num = axisTable[axis].encoderPinB;
+  config.ctrl_gpio_num = axisTable[axis].encoderPinA;
+  config.channel = PCNT_CHANNEL_1;
+  config.pos_mode = PCNT_COUNT_INC;
+  config.neg_mode = PCNT_COUNT_DEC;
+  pcnt_unit_config(&config);
+
+  pcnt_set_filter_value(unit, 100);   // Reject glitches shorter than 100 APB cycles (1.25 µs)
+  pcnt_filter_enable(unit);
+  pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+  pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+  pcnt_counter_pause(unit);
+  pcnt_counter_clear(unit);
+  pcnt_isr_handler_add(unit, encoderOverflowIsr, (void*)(uintptr_t)axis);
+  pcnt_counter_resume(unit);
+  return true;
+}
+
+int32_t encoderSteps(uint8_t axis) {
+  if (!hasEncoder(axis)) {
+    return 0;
+  }
+  // Re-read the overflow if the counter wrapped between the two reads
+  int32_t overflow;
+  int16_t count;
+  do {
+    overflow = encoderOverflow[axis];
+    pcnt_get_counter_value(encoderUnits[axis], &count);
+  } while (overflow != encoderOverflow[axis]);
+
+  int64_t counts = (int64_t)overflow + count;
+  return (int32_t)(counts * axisTable[axis].stepsPerRev / axisTable[axis].encoderCountsPerRev);
+}
+
+void initStepVerifier() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    encoderUnits[i] = PCNT_UNIT_MAX;
+    monitor.setThreshold(i, axisTable[i].stepLossThreshold);
+    if (axisTable[i].encoderCountsPerRev > 0) {
+      if (initEncoder(i)) {
+        monitor.resync(i, steppers[i] ? steppers[i]->getCurrentPosition() : 0, encoderSteps(i));
+        Serial.printf("Axis %c encoder on PCNT unit %d\n", axisTable[i].name, encoderUnits[i]);
+      } else {
+        Serial.printf("Axis %c encoder: no PCNT unit available\n", axisTable[i].name);
+      }
+    }
+  }
+}
+
+/**
+ * Reports a divergence and re-baselines the encoder so it is flagged once.
+ */
+static void reportLoss(uint8_t axis, PositionSource source) {
+  const PositionCheckStats& stats = monitor.stats(axis, source);
+  if (source == PositionSource::Encoder) {
+    LOG_EVENT("STEP LOSS axis %c: encoder diverged by %ld steps (threshold %ld)\n", axisTable[axis].name,
+              stats.lastError, axisTable[axis].stepLossThreshold);
+  } else {
+    LOG_EVENT("STEP LOSS axis %c: generated position diverged by %ld steps (threshold %ld)\n",
+              axisTable[axis].name, stats.lastError, axisTable[axis].stepLossThreshold);
+  }
+  if (source == PositionSource::Encoder && steppers[axis]) {
+    monitor.resync(axis, steppers[axis]->getCurrentPosition(), encoderSteps(axis));
+  }
+}
+
+bool serviceStepVerifier() {
+  bool lossDetected = false;
+  bool atRest = motionIdle() && !anyAxisRunning() && commandedPositionValid();
+
+  // Generator check: once per rest period, when the planner's target must have been reached
+  if (!atRest) {
+    checkedAtRest = false;
+  } else if (!checkedAtRest) {
+    checkedAtRest = true;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (steppers[i] &&
+          monitor.checkGenerated(i, commandedPosition(i) + backlashOffset(i), steppers[i]->getCurrentPosition())) {
+        reportLoss(i, PositionSource::Generator);
+        lossDetected = true;
+      }
+    }
+  }
+
+  // Encoder check: periodically, valid during motion as both positions are real time
+  if (millis() - lastEncoderCheckMs >= STEP_CHECK_INTERVAL_MS) {
+    lastEncoderCheckMs = millis();
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (steppers[i] && hasEncoder(i) &&
+          monitor.checkEncoder(i, steppers[i]->getCurrentPosition(), encoderSteps(i))) {
+        reportLoss(i, PositionSource::Encoder);
+        lossDetected = true;
+      }
+    }
+  }
+  return lossDetected;
+}
+
+bool stepLossDetected(uint8_t axis) {
+  return monitor.faulted(axis);
+}
+
+void printStepVerifierReport() {
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    const PositionCheckStats& generated = monitor.stats(i, PositionSource::Generator);
+    Serial.printf("Axis %c: expected %ld, generated %ld (worst %ld, faults %u)",
+                  axisTable[i].name, commandedPosition(i) + backlashOffset(i),
+                  steppers[i] ? steppers[i]->getCurrentPosition() : 0,
+                  generated.worstError, generated.faults);
+    if (hasEncoder(i)) {
+      const PositionCheckStats& encoder = monitor.stats(i, PositionSource::Encoder);
+      Serial.printf(", encoder %ld (worst %ld, faults %u)", encoderSteps(i), encoder.worstError, encoder.faults);
+    }
+    Serial.println("");
+  }
+}
@@ -0,0 +1,149 @@
+/*
+*******************************************************************************
+* Description:
+*   Teach-mode recorder and playback engine backed by the memory-mapped
+*   "motionprog" flash partition.
+*******************************************************************************
+*/
+
+#include "TeachMode.h"
+
+#include <Arduino.h>
+
+#include "MotionProgram.h"
+#include "ProgramImage.h"
+
+static_assert(AXIS_COUNT <= PROGRAM_MAX_AXES, "Motion programs hold at most PROGRAM_MAX_AXES axes");
+
+static TeachState state = TeachState::Idle;
+static ProgramImage program;                        // Mapped program during playback
+static ProgramRecord recording[TEACH_MAX_MOVES];    // Moves captured since recording started
+static uint32_t recordCount = 0;
+static uint32_t playbackIndex = 0;
+
+/**
+ * Counts the records in the stored program, or 0 if it is missing or invalid.
+ */
+static uint32_t storedRecordCount() {
+  ProgramImage image;
+  return image.open(AXIS_COUNT) ? image.recordCount() : 0;
+}
+
+bool initTeach() {
+  recordCount = storedRecordCount();
+  Serial.printf("Stored teach program: %lu moves\n", recordCount);
+  return recordCount > 0;
+}
+
+bool startTeachRecording() {
+  if (state != TeachState::Idle) {
+    return false;
+  }
+  recordCount = 0;
+  state = TeachState::Recording;
+  Serial.println("Teach recording started.");
+  return true;
+}
+
+void stopTeachRecording() {
+  if (state != TeachState::Recording) {
+    return;
+  }
+  state = TeachState::Saving;
+}
+
+bool teachRecordMove(const AxisSegment& segment) {
+  if (state != TeachState::Recording) {
+    return false;
+  }
+  if (recordCount >= TEACH_MAX_MOVES) {
+    Serial.println("Teach buffer full, move not recorded.");
+    return false;
+  }
+  ProgramRecord record = toProgramRecord(segment);
+
+  // Only pauses the operator clearly meant to keep become dwells
+  uint32_t idleMs = motionIdle() ? millis() - motionIdleSinceMs() : 0;
+  if (recordCount > 0 && idleMs > TEACH_DWELL_THRESHOLD_MS) {
+    record.dwellMs = (idleMs > UINT16_MAX) ? UINT16_MAX : idleMs;
+  }
+
+  recording[recordCount++] = record;
+  return true;
+}
+
+bool startTeachPlayback() {
+  if (state != TeachState::Idle) {
+    return false;
+  }
+  if (!program.open(AXIS_COUNT)) {
+    Serial.println("No valid teach program stored for this machine.");
+    return false;
+  }
+  recordCount = program.recordCount();
+  playbackIndex = 0;
+  state = TeachState::Playing;
+  Serial.printf("Teach playback started: %lu moves\n", recordCount);
+  return true;
+}
+
+void stopTeachPlayback() {
+  if (state != TeachState::Playing) {
+    return;
+  }
+  program.close();
+  state = TeachState::Idle;
+  Serial.println("Teach playback stopped.");
+}
+
+bool serviceTeach() {
+  if (state == TeachState::Saving) {
+    if (!motionIdle()) {
+      return false;
+    }
+    if (recordCount == 0) {
+      Serial.println("Nothing recorded, stored program kept.");
+      recordCount = storedRecordCount();
+    } else if (ProgramImage::write(recording, recordCount, AXIS_COUNT)) {
+      Serial.printf("Teach recording saved: %lu moves\n", recordCount);
+    } else {
+      Serial.println("Teach recording could not be written to flash.");
+      recordCount = storedRecordCount();
+    }
+    state = TeachState::Idle;
+    return true;
+  }
+
+  if (state != TeachState::Playing) {
+    return false;
+  }
+
+  // Keep the motion queue full straight from mapped flash (queue length = lookahead);
+  // a refused move is retried on the next call rather than skipped
+  while (playbackIndex < recordCount && motionQueueSpace() > 0) {
+    if (!queueMove(fromProgramRecord<AXIS_COUNT>(*program.record(playbackIndex)))) {
+      break;
+    }
+    playbackIndex++;
+  }
+
+  if (playbackIndex >= recordCount && motionIdle()) {
+    program.close();
+    state = TeachState::Idle;
+    Serial.println("Teach playback complete.");
+    return true;
+  }
+  return false;
+}
+
+TeachState teachState() {
+  return state;
+}
+
+uint32_t teachRecordCount() {
+  return recordCount;
+}
+
+uint32_t teachPlaybackIndex() {
+  return playbackIndex;
+}
@@ -0,0 +1,171 @@
+/*
+*******************************************************************************
+* Description:
+*   Host-side estimate of the controller clock. Every sync exchange (see
+*   ClockSync.h) gives two one-way readings of controller minus host time:
+*   t2 - t1, the offset plus the delay out, and t3 - t4, the offset minus
+*   the delay back. Queuing in USB, the OS and the controller's loop only
+*   lengthens a delay, so over the sync span the outgoing readings lie on or
+*   above the line offset + shortest delay out, and the return readings on
+*   or below offset - shortest delay back. The two directions are fitted
+*   separately: the shortest delay each way turns up in some exchange, while
+*   a round trip that is short both ways is much rarer.
+*
+*   Drift is the slope of a least-squares line through the lowest outgoing
+*   (highest return) reading of every CLOCK_FIT_WINDOW consecutive exchanges.
+*   Taking the extreme of each window drops the queuing tails, which would
+*   otherwise pull a plain fit around, and keeps the points spread over the
+*   whole span that drift is seen over. At that slope each line is then
+*   moved onto its envelope: under every outgoing reading and over every
+*   return one. The clock estimate is the mean of the two lines. The two
+*   shortest delays may differ, and no round trip protocol can measure by
+*   how much; half the gap between the lines bounds the error.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Consecutive exchanges of which the drift fit uses the one with the shortest delay, per direction
+constexpr size_t CLOCK_FIT_WINDOW = 8;
+
+class ClockEstimator {
+ public:
+  /**
+   * Adds one exchange: host send t1, controller receive t2 and reply t3,
+   * host receive t4, all in µs on the respective clocks.
+   */
+  void add(int64_t t1, uint64_t t2, uint64_t t3, int64_t t4) {
+    if (_out.empty()) {
+      _hostBase = (double)t1;
+      _controllerBase = (double)t2;
+    }
+    double sent = t1 - _hostBase;
+    double received = t4 - _hostBase;
+    _out.push_back({sent, (double)t2 - _controllerBase - sent});
+    _back.push_back({received, (double)t3 - _controllerBase - received});
+    int64_t rtt = (t4 - t1) - (int64_t)(t3 - t2);
+    _minRtt = (_out.size() == 1 || rtt < _minRtt) ? rtt : _minRtt;
+  }
+
+  /**
+   * Fits offset and drift to the exchanges so far.
+   * @return false with fewer than two exchanges
+   */
+  bool fit() {
+    if (_out.size() < 2) {
+      return false;
+    }
+    // Fewer exchanges than two windows: use every one
+    size_t window = (_out.size() >= 2 * CLOCK_FIT_WINDOW) ? CLOCK_FIT_WINDOW : 1;
+    _drift = (slope(_out, window, 1) + slope(_back, window, -1)) / 2;
+    double out = envelope(_out, 1);
+    double back = envelope(_back, -1);
+    _offset = (out + back) / 2;
+    _asymmetry = (out - back) / 2;
+    _used = 2 * (_out.size() / window);
+    return true;
+  }
+
+  /**
+   * Controller time at a host time, from the last fit.
+   */
+  uint64_t toController(int64_t hostUs) const {
+    double x = hostUs - _hostBase;
+    return (uint64_t)llround(_controllerBase + x + _offset + _drift * x);
+  }
+
+  /**
+   * Host time at a controller time, from the last fit.
+   */
+  int64_t toHost(uint64_t controllerUs) const {
+    double x = ((double)controllerUs - _controllerBase - _offset) / (1 + _drift);
+    return (int64_t)llround(_hostBase + x);
+  }
+
+  /**
+   * Controller minus host clock at the latest exchange, µs.
+   */
+  double offsetUs() const {
+    double x = _back.empty() ? 0 : _back.back().x;
+    return _controllerBase - _hostBase + _offset + _drift * x;
+  }
+
+  double driftPpm() const { return _drift * 1e6; }
+  int64_t minRoundTripUs() const { return _minRtt; }
+
+  /**
+   * Half the gap between the outgoing and return envelopes: the most the
+   * estimate can be off by an asymmetry of the link, µs.
+   */
+  double asymmetryBoundUs() const { return _asymmetry; }
+  size_t samples() const { return _out.size(); }
+
+  /**
+   * Readings the drift fit used, both directions.
+   */
+  size_t used() const { return _used; }
+
+ private:
+  struct Reading {
+    double x;         // Host time after the first exchange, µs
+    double y;         // Controller minus host change since the first exchange, µs
+  };
+
+  /**
+   * Least-squares slope through the lowest (sign 1) or highest (sign -1)
+   * reading of every window.
+   */
+  static double slope(const std::vector<Reading>& readings, size_t window, double sign) {
+    std::vector<Reading> extremes;
+    for (size_t start = 0; start + window <= readings.size(); start += window) {
+      Reading extreme = readings[start];
+      for (size_t k = start + 1; k < start + window; k++) {
+        extreme = (sign * readings[k].y < sign * extreme.y) ? readings[k] : extreme;
+      }
+      extremes.push_back(extreme);
+    }
+    double meanX = 0;
+    double meanY = 0;
+    for (const Reading& r : extremes) {
+      meanX += r.x;
+      meanY += r.y;
+    }
+    meanX /= extremes.size();
+    meanY /= extremes.size();
+    double sxx = 0;
+    double sxy = 0;
+    for (const Reading& r : extremes) {
+      sxx += (r.x - meanX) * (r.x - meanX);
+      sxy += (r.x - meanX) * (r.y - meanY);
+    }
+    return (sxx > 0) ? sxy / sxx : 0;
+  }
+
+  /**
+   * Intercept of the line at the fitted drift that stays under (sign 1) or
+   * over (sign -1) every reading and touches one.
+   */
+  double envelope(const std::vector<Reading>& readings, double sign) const {
+    double intercept = readings[0].y - _drift * readings[0].x;
+    for (const Reading& r : readings) {
+      double value = r.y - _drift * r.x;
+      intercept = (sign * value < sign * intercept) ? value : intercept;
+    }
+    return intercept;
+  }
+
+  std::vector<Reading> _out;
+  std::vector<Reading> _back;
+  double _hostBase = 0;
+  double _controllerBase = 0;
+  double _offset = 0;
+  double _drift = 0;
+  double _asymmetry = 0;
+  int64_t _minRtt = 0;
+  size_t _used = 0;
+};
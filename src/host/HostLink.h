@@ -0,0 +1,123 @@
+/*
+*******************************************************************************
+* Description:
+*   Byte links from the host tools to the controller: the Link interface,
+*   the POSIX serial port behind it and the random source of the simulated
+*   links the tools test themselves against.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Byte link to the MCU.
+ */
+class Link {
+ public:
+  virtual ~Link() {}
+  virtual void write(const uint8_t* bytes, size_t length) = 0;
+
+  /**
+   * Host time in µs, on the clock the link's traffic is timed by.
+   */
+  virtual int64_t micros() = 0;
+
+  /**
+   * Reads one byte.
+   * @return false if none arrived within timeoutMs
+   */
+  virtual bool read(uint8_t& byte, uint32_t timeoutMs) = 0;
+};
+
+/**
+ * Serial port of the controller (POSIX).
+ */
+class SerialLink : public Link {
+ public:
+  bool open(const char* path, uint32_t baud) {
+    _fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (_fd < 0) {
+      return false;
+    }
+    termios tty = {};
+    tcgetattr(_fd, &tty);
+    cfmakeraw(&tty);
+    speed_t speed = (baud == 921600) ? B921600 : (baud == 460800) ? B460800 : (baud == 230400) ? B230400 : B115200;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tcsetattr(_fd, TCSANOW, &tty);
+    sleep(2);                    // Opening the port resets the ESP32
+    tcflush(_fd, TCIOFLUSH);
+    return true;
+  }
+
+  ~SerialLink() override {
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  void write(const uint8_t* bytes, size_t length) override {
+    while (length > 0) {
+      ssize_t n = ::write(_fd, bytes, length);
+      if (n <= 0) {
+        return;
+      }
+      bytes += n;
+      length -= (size_t)n;
+    }
+  }
+
+  int64_t micros() override {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  }
+
+  bool read(uint8_t& byte, uint32_t timeoutMs) override {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(_fd, &set);
+    timeval timeout = {(time_t)(timeoutMs / 1000), (suseconds_t)(timeoutMs % 1000) * 1000};
+    return select(_fd + 1, &set, nullptr, nullptr, &timeout) > 0 && ::read(_fd, &byte, 1) == 1;
+  }
+
+ private:
+  int _fd = -1;
+};
+
+/**
+ * Xorshift random numbers for link faults and latency, reproducible by seed.
+ */
+class SimRandom {
+ public:
+  explicit SimRandom(uint32_t seed) : _state(seed ? seed : 1) {}
+
+  uint32_t next() {
+    _state ^= _state << 13;
+    _state ^= _state >> 17;
+    _state ^= _state << 5;
+    return _state;
+  }
+
+  /**
+   * True with the given probability.
+   */
+  bool chance(double probability) { return probability > 0 && (next() % 1000000) < probability * 1000000; }
+
+  /**
+   * Uniform in [0, 1).
+   */
+  double uniform() { return (next() >> 8) / 16777216.0; }
+
+ private:
+  uint32_t _state;
+};
@@ -0,0 +1,214 @@
+/*
+*******************************************************************************
+* Description:
+*   Host-side step compression. Takes the exact step timeline of one axis
+*   (absolute times in FastAccelStepper ticks) and covers it with StepBlocks
+*   (interval, count, add) so that every replayed step lies within a maximum
+*   error of its exact time. Each block is about the longest run for which a
+*   constant or a linearly changing interval fits, and only blocks the
+*   MCU can replay (stepBlockValid) are produced. Time is carried from block
+*   to block in integer ticks, so errors never accumulate.
+*******************************************************************************
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "StepBlock.h"
+
+// Longest block the compressor searches for
+constexpr uint32_t COMPRESS_MAX_COUNT = 4096;
+
+/**
+ * One step of an exact timeline.
+ */
+struct StepTime {
+  int64_t ticks;   // Absolute time of the step
+  bool countUp;
+};
+
+struct CompressStats {
+  uint32_t blocks = 0;
+  uint32_t forced = 0;          // Blocks that had to exceed the error bound to stay replayable
+  int64_t maxErrorTicks = 0;    // Largest |replayed - exact| step time
+};
+
+class StepCompressor {
+ public:
+  explicit StepCompressor(uint32_t maxErrorTicks) : _maxError(maxErrorTicks) {}
+
+  /**
+   * Compresses one axis. The stream starts at tick 0; the first step must
+   * come at least STEP_MIN_CMD_TICKS later, and the last block ends at
+   * endTicks, which must leave STEP_MIN_CMD_TICKS after the last step.
+   */
+  void compress(const std::vector<StepTime>& steps, int64_t endTicks, std::vector<StepBlock>& out) {
+    if (steps.empty()) {
+      emitPause(endTicks, true, out);
+      return;
+    }
+
+    // Blocks end on the next step (within the error bound), so only the lead-in is a pause
+    int64_t now = steps[0].ticks;
+    emitPause(now, steps[0].countUp, out);
+    size_t i = 0;
+    while (i < steps.size()) {
+      StepBlock block = fit(steps, i, now, endTicks);
+      out.push_back(block);
+      _stats.blocks++;
+      for (uint32_t k = 1; k <= block.count; k++) {
+        int64_t error = now + partialTicks(block, k) - eventTime(steps, i + k, endTicks);
+        if (i + k < steps.size() && llabs(error) > _stats.maxErrorTicks) {
+          _stats.maxErrorTicks = llabs(error);
+        }
+      }
+      now += stepBlockTicks(block);
+      i += block.count;
+    }
+  }
+
+  const CompressStats& stats() const { return _stats; }
+
+ private:
+  /**
+   * Ticks from the first step of a block to step k (k = count: to its end).
+   */
+  static int64_t partialTicks(const StepBlock& block, int64_t k) {
+    return k * block.interval + (int64_t)block.add * k * (k - 1) / 2;
+  }
+
+  /**
+   * Exact time of step index j, or the end of the stream after the last step.
+   */
+  static int64_t eventTime(const std::vector<StepTime>& steps, size_t j, int64_t endTicks) {
+    return (j < steps.size()) ? steps[j].ticks : endTicks;
+  }
+
+  static int64_t divRound(int64_t a, int64_t b) { return (a >= 0) ? (a + b / 2) / b : -((-a + b / 2) / b); }
+
+  void emitPause(int64_t ticks, bool countUp, std::vector<StepBlock>& out) {
+    constexpr int64_t longest = UINT32_MAX / 2;
+    for (int64_t pieces = (ticks + longest - 1) / longest; pieces > 0; pieces--) {
+      int64_t piece = ticks / pieces;
+      out.push_back({(uint32_t)piece, 0, 0, countUp});
+      ticks -= piece;
+    }
+  }
+
+  /**
+   * Largest error of a candidate block over steps first + 1 .. first + count.
+   */
+  int64_t blockError(const std::vector<StepTime>& steps, size_t first, int64_t now, int64_t endTicks,
+                     const StepBlock& block) const {
+    int64_t worst = 0;
+    for (uint32_t k = 1; k <= block.count; k++) {
+      int64_t error = llabs(now + partialTicks(block, k) - eventTime(steps, first + k, endTicks));
+      if (error > worst) {
+        worst = error;
+      }
+    }
+    return worst;
+  }
+
+  bool candidate(int64_t interval, int64_t add, uint32_t count, bool countUp, StepBlock& block) const {
+    if (interval <= 0 || interval > UINT32_MAX || add < INT16_MIN || add > INT16_MAX) {
+      return false;
+    }
+    block = {(uint32_t)interval, (uint16_t)count, (int16_t)add, countUp};
+    return stepBlockValid(block);
+  }
+
+  /**
+   * Best block of exactly count steps within the error bound: a constant
+   * interval ending on the last event, or a linear one through the first and
+   * last events, whichever is closer.
+   */
+  bool fitCount(const std::vector<StepTime>& steps, size_t first, int64_t now, int64_t endTicks, uint32_t count,
+                bool countUp, StepBlock& block) const {
+    int64_t first1 = eventTime(steps, first + 1, endTicks) - now;
+    int64_t last = eventTime(steps, first + count, endTicks) - now;
+    int64_t bestError = _maxError + 1;
+    StepBlock trial;
+    if (candidate(divRound(last, count), 0, count, countUp, trial)) {
+      int64_t error = blockError(steps, first, now, endTicks, trial);
+      if (error < bestError) {
+        block = trial;
+        bestError = error;
+      }
+    }
+    if (count >= 2) {
+      int64_t pairs = (int64_t)count * (count - 1) / 2;
+      int64_t add = divRound(last - count * first1, pairs);
+      if (candidate(divRound(last - add * pairs, count), add, count, countUp, trial)) {
+        int64_t error = blockError(steps, first, now, endTicks, trial);
+        if (error < bestError) {
+          block = trial;
+          bestError = error;
+        }
+      }
+    }
+    return bestError <= _maxError;
+  }
+
+  /**
+   * Longest block starting with step first at time now that stays within the
+   * error bound: counts are doubled until one no longer fits, then bisected.
+   */
+  StepBlock fit(const std::vector<StepTime>& steps, size_t first, int64_t now, int64_t endTicks) {
+    bool countUp = steps[first].countUp;
+    uint32_t run = 1;
+    while (first + run < steps.size() && steps[first + run].countUp == countUp && run < COMPRESS_MAX_COUNT) {
+      run++;
+    }
+
+    StepBlock best = {};
+    StepBlock trial;
+    uint32_t good = 0;
+    uint32_t bad = 0;
+    for (uint32_t count = 1;; count *= 2) {
+      if (count > run) {
+        count = run;
+      }
+      if (fitCount(steps, first, now, endTicks, count, countUp, trial)) {
+        good = count;
+        best = trial;
+      } else if (good > 0) {
+        bad = count;
+        break;
+      }
+      if (count == run) {
+        break;
+      }
+    }
+    while (bad > good + 1) {
+      uint32_t count = (good + bad) / 2;
+      if (fitCount(steps, first, now, endTicks, count, countUp, trial)) {
+        good = count;
+        best = trial;
+      } else {
+        bad = count;
+      }
+    }
+    if (good > 0) {
+      return best;
+    }
+
+    // Nothing replayable fits: shortest valid constant run, or a single step stretched to a valid command
+    _stats.forced++;
+    for (uint32_t count = 1; count <= run; count++) {
+      int64_t last = eventTime(steps, first + count, endTicks) - now;
+      if (candidate(divRound(last, count), 0, count, countUp, trial)) {
+        return trial;
+      }
+    }
+    int64_t interval = eventTime(steps, first + 1, endTicks) - now;
+    return {(uint32_t)((interval > STEP_MIN_CMD_TICKS) ? interval : STEP_MIN_CMD_TICKS), 1, 0, countUp};
+  }
+
+  int64_t _maxError;
+  CompressStats _stats;
+};
@@ -0,0 +1,396 @@
+/*
+*******************************************************************************
+* Description:
+*   Host tool for clock sync and timestamp-scheduled moves. It exchanges sync
+*   frames with the controller (ClockSync.h) and fits the controller clock's
+*   offset and drift against the host clock. It can then send a move due a
+*   given time from now, converted to controller time, and resend it with
+*   the same sequence number until it is acknowledged, so it is queued once.
+*
+*   --sim runs the controller side in-process: the firmware's
+*   TimedMoveReceiver behind a simulated serial link with latency, jitter,
+*   loop() delay and frame loss, and a controller clock with its own offset
+*   and drift. It reports how far the scheduled start lands from the
+*   requested host time, and fails when that (or, without a move, the clock
+*   estimate) is off by more than SIM_START_TOLERANCE_US.
+*
+*   Build and run with PlatformIO's clock_sync environment:
+*     pio run -e clock_sync
+*     .pio/build/clock_sync/program --sim --drift-ppm 80 --jitter-us 3000 --move 3200,0 --at-ms 500
+*     .pio/build/clock_sync/program --port /dev/ttyUSB0 --move 3200,-3200 --at-ms 1000
+*******************************************************************************
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include "ClockEstimator.h"
+#include "ClockSync.h"
+#include "HostLink.h"
+#include "MachineConfig.h"
+
+// Wait for a reply before an exchange counts as lost (USB serial adapters add milliseconds)
+constexpr uint32_t SYNC_REPLY_TIMEOUT_MS = 100;
+
+// Attempts to deliver a timed move before giving up
+constexpr uint32_t TIMED_MOVE_RETRIES = 10;
+
+// Largest error of the clock estimate and the scheduled start --sim accepts, µs
+constexpr double SIM_START_TOLERANCE_US = 75;
+
+struct SyncOptions {
+  uint32_t exchanges = 1000;
+  uint32_t intervalMs = 10;          // Between exchanges; the span sets how well drift is seen
+  int32_t steps[AXIS_COUNT] = {};
+  bool move = false;
+  uint32_t speedHz = 8000;
+  uint32_t acceleration = 20000;
+  uint32_t atMs = 500;               // Move start after the sync, host time
+  const char* port = nullptr;
+  uint32_t baud = 115200;
+  bool sim = false;
+  double offsetUs = 123456789;       // Simulated controller clock
+  double driftPpm = 50;
+  uint32_t latencyUs = 1000;         // Simulated link, one way
+  uint32_t jitterUs = 300;           // Mean of the extra queuing delay, exponential
+  uint32_t loopUs = 1000;            // Longest wait for loop() to read a received frame
+  double drop = 0;
+  uint32_t seed = 1;
+};
+
+/**
+ * Controller queue of the simulation: records the moves queued through the
+ * firmware's TimedMoveReceiver.
+ */
+struct SimMoveSink {
+  std::vector<TimedMove> queued;
+
+  TimedMoveStatus queue(const TimedMove& move) {
+    queued.push_back(move);
+    return TimedMoveStatus::Queued;
+  }
+  uint8_t space() { return 8 - (uint8_t)queued.size(); }
+};
+
+/**
+ * Serial link and controller simulated in host µs. Each frame is delayed
+ * by its transmission time, a fixed latency and an exponentially
+ * distributed queuing delay per direction; the controller reads it after up
+ * to loopUs and answers at once. Frames are lost in either direction at
+ * random.
+ */
+class SimClockLink : public Link {
+ public:
+  explicit SimClockLink(const SyncOptions& options) : _options(options), _random(options.seed) {
+    _byteUs = 10e6 / options.baud;
+  }
+
+  int64_t micros() override { return _now; }
+
+  void write(const uint8_t* bytes, size_t length) override {
+    _now += (int64_t)(length * _byteUs);
+    for (size_t b = 0; b < length; b++) {
+      if (!_decoder.feed(bytes[b])) {
+        continue;
+      }
+      if (_random.chance(_options.drop)) {
+        _dropped++;
+        continue;
+      }
+      double arrived = _now + delay();
+      double handled = arrived + _random.uniform() * _options.loopUs;
+      Frame reply;
+      _receiver.handle(_decoder.frame(), controllerAt(handled), controllerAt(handled + 20), reply, _sink);
+      if (_random.chance(_options.drop)) {
+        _dropped++;
+        continue;
+      }
+      uint8_t encoded[FRAME_MAX_BYTES];
+      size_t n = encodeFrame(reply, encoded);
+      double back = handled + 20 + n * _byteUs + delay();
+      std::vector<uint8_t>& pending = _replies[(int64_t)back];
+      pending.insert(pending.end(), encoded, encoded + n);
+    }
+  }
+
+  bool read(uint8_t& byte, uint32_t timeoutMs) override {
+    int64_t deadline = _now + (int64_t)timeoutMs * 1000;
+    if (_replies.empty() || _replies.begin()->first > deadline) {
+      _now = deadline;
+      return false;
+    }
+    auto first = _replies.begin();
+    _now = (first->first > _now) ? first->first : _now;
+    byte = first->second.front();
+    first->second.erase(first->second.begin());
+    if (first->second.empty()) {
+      _replies.erase(first);
+    }
+    return true;
+  }
+
+  /**
+   * Controller clock at a host time.
+   */
+  uint64_t controllerAt(double hostUs) const {
+    return (uint64_t)llround(_options.offsetUs + hostUs * (1 + _options.driftPpm * 1e-6));
+  }
+
+  /**
+   * Host time at a controller time.
+   */
+  double hostAt(uint64_t controllerUs) const {
+    return ((double)controllerUs - _options.offsetUs) / (1 + _options.driftPpm * 1e-6);
+  }
+
+  const std::vector<TimedMove>& queued() const { return _sink.queued; }
+  uint32_t dropped() const { return _dropped; }
+
+ private:
+  double delay() { return _options.latencyUs - log(1 - _random.uniform()) * _options.jitterUs; }
+
+  const SyncOptions& _options;
+  SimRandom _random;
+  FrameDecoder _decoder;
+  TimedMoveReceiver _receiver;
+  SimMoveSink _sink;
+  std::map<int64_t, std::vector<uint8_t>> _replies;   // By arrival time at the host
+  int64_t _now = 1000000;
+  double _byteUs;
+  uint32_t _dropped = 0;
+};
+
+/**
+ * Reads until a frame of the given type and sequence number arrives.
+ * @return false if none did within timeoutMs
+ */
+static bool awaitReply(Link& link, FrameDecoder& decoder, ClockFrame type, uint8_t seq, uint32_t timeoutMs) {
+  int64_t deadline = link.micros() + (int64_t)timeoutMs * 1000;
+  uint8_t byte;
+  while (link.micros() < deadline) {
+    uint32_t left = (uint32_t)((deadline - link.micros() + 999) / 1000);
+    if (!link.read(byte, left)) {
+      return false;
+    }
+    if (decoder.feed(byte) && decoder.frame().type == (uint8_t)type && decoder.frame().seq == seq) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Runs the sync exchanges, one every intervalMs.
+ * @return exchanges that were answered
+ */
+static uint32_t synchronize(Link& link, const SyncOptions& options, ClockEstimator& estimator) {
+  FrameDecoder decoder;
+  uint32_t answered = 0;
+  double byteUs = 10e6 / options.baud;     // Start, 8 data and stop bit
+  for (uint32_t k = 0; k < options.exchanges; k++) {
+    int64_t roundStart = link.micros();
+    Frame frame = {};
+    frame.seq = (uint8_t)k;
+    frame.type = (uint8_t)ClockFrame::Sync;
+    frame.length = SYNC_BYTES;
+    int64_t t1 = link.micros();
+    putU64(frame.payload, (uint64_t)t1);
+    uint8_t bytes[FRAME_MAX_BYTES];
+    link.write(bytes, encodeFrame(frame, bytes));
+
+    if (awaitReply(link, decoder, ClockFrame::SyncReply, frame.seq, SYNC_REPLY_TIMEOUT_MS)) {
+      const Frame& reply = decoder.frame();
+      int64_t t4 = link.micros();
+      if (reply.length == SYNC_REPLY_BYTES && (int64_t)getU64(reply.payload) == t1) {
+        // The request is timestamped once fully received, the reply before it is sent: take out both transmissions
+        int64_t sent = t1 + (int64_t)(frameBytes(SYNC_BYTES) * byteUs);
+        int64_t received = t4 - (int64_t)(frameBytes(SYNC_REPLY_BYTES) * byteUs);
+        estimator.add(sent, getU64(reply.payload + 8), getU64(reply.payload + 16), received);
+        answered++;
+      }
+    }
+
+    // Keep the exchanges evenly spaced; late replies are skipped by their sequence number
+    uint8_t byte;
+    int64_t next = roundStart + (int64_t)options.intervalMs * 1000;
+    while (link.micros() < next) {
+      if (link.read(byte, (uint32_t)((next - link.micros() + 999) / 1000))) {
+        decoder.feed(byte);
+      }
+    }
+  }
+  return answered;
+}
+
+/**
+ * Sends a timed move until the controller answers it.
+ * @return the controller's status, Invalid if it never answered
+ */
+static TimedMoveStatus sendTimedMove(Link& link, const TimedMove& move, uint8_t seq, uint32_t& attempts) {
+  FrameDecoder decoder;
+  Frame frame = {};
+  frame.seq = seq;
+  packTimedMove(move, frame);
+  uint8_t bytes[FRAME_MAX_BYTES];
+  size_t n = encodeFrame(frame, bytes);
+  for (attempts = 1; attempts <= TIMED_MOVE_RETRIES; attempts++) {
+    link.write(bytes, n);
+    if (awaitReply(link, decoder, ClockFrame::MoveReply, seq, SYNC_REPLY_TIMEOUT_MS)) {
+      return (TimedMoveStatus)decoder.frame().payload[0];
+    }
+  }
+  return TimedMoveStatus::Invalid;
+}
+
+static const char* statusName(TimedMoveStatus status) {
+  switch (status) {
+    case TimedMoveStatus::Queued:
+      return "queued";
+    case TimedMoveStatus::Full:
+      return "queue full";
+    case TimedMoveStatus::Late:
+      return "too late";
+    case TimedMoveStatus::Busy:
+      return "busy";
+    default:
+      return "invalid or unanswered";
+  }
+}
+
+static void usage() {
+  printf("Usage: clock_sync (--port DEV [--baud B] | --sim [--offset-us U] [--drift-ppm P] [--latency-us U]\n"
+         "                   [--jitter-us U] [--loop-us U] [--drop P] [--seed N])\n"
+         "                  [--exchanges N] [--interval-ms MS]\n"
+         "                  [--move S[,S...] [--speed HZ] [--accel A] [--at-ms MS]]\n");
+}
+
+static bool parseSteps(const char* text, int32_t (&steps)[AXIS_COUNT]) {
+  for (uint8_t i = 0; i < AXIS_COUNT && *text; i++) {
+    char* end;
+    steps[i] = (int32_t)strtol(text, &end, 10);
+    if (end == text) {
+      return false;
+    }
+    text = (*end == ',') ? end + 1 : end;
+  }
+  return *text == '\0';
+}
+
+int main(int argc, char** argv) {
+  SyncOptions options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--sim")) {
+      options.sim = true;
+    } else if (value && !strcmp(arg, "--port")) {
+      options.port = value, i++;
+    } else if (value && !strcmp(arg, "--baud")) {
+      options.baud = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--exchanges")) {
+      options.exchanges = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--interval-ms")) {
+      options.intervalMs = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--move")) {
+      options.move = parseSteps(value, options.steps), i++;
+      if (!options.move) {
+        usage();
+        return 1;
+      }
+    } else if (value && !strcmp(arg, "--speed")) {
+      options.speedHz = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--accel")) {
+      options.acceleration = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--at-ms")) {
+      options.atMs = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--offset-us")) {
+      options.offsetUs = atof(value), i++;
+    } else if (value && !strcmp(arg, "--drift-ppm")) {
+      options.driftPpm = atof(value), i++;
+    } else if (value && !strcmp(arg, "--latency-us")) {
+      options.latencyUs = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--jitter-us")) {
+      options.jitterUs = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--loop-us")) {
+      options.loopUs = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--drop")) {
+      options.drop = atof(value), i++;
+    } else if (value && !strcmp(arg, "--seed")) {
+      options.seed = (uint32_t)atol(value), i++;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (options.sim == (options.port != nullptr) || options.exchanges < 2) {
+    usage();
+    return 1;
+  }
+
+  SerialLink serial;
+  SimClockLink sim(options);
+  Link* link = &sim;
+  if (options.port) {
+    if (!serial.open(options.port, options.baud)) {
+      fprintf(stderr, "Cannot open %s\n", options.port);
+      return 1;
+    }
+    link = &serial;
+  }
+
+  ClockEstimator estimator;
+  uint32_t answered = synchronize(*link, options, estimator);
+  if (!estimator.fit()) {
+    fprintf(stderr, "Only %u of %u sync exchanges answered\n", answered, options.exchanges);
+    return 1;
+  }
+  printf("sync: %u of %u exchanges answered, drift fit on %zu readings; shortest round trip %lld us\n", answered,
+         options.exchanges, estimator.used(), (long long)estimator.minRoundTripUs());
+  printf("controller clock: offset %.1f us, drift %.2f ppm, asymmetry bound %.1f us\n", estimator.offsetUs(),
+         estimator.driftPpm(), estimator.asymmetryBoundUs());
+  if (options.sim) {
+    int64_t now = sim.micros();
+    double error = (double)estimator.toController(now) - (double)sim.controllerAt(now);
+    printf("sim: true drift %.2f ppm, clock estimate off by %.1f us now\n", options.driftPpm, error);
+    if (!options.move) {
+      return (fabs(error) <= SIM_START_TOLERANCE_US) ? 0 : 1;
+    }
+  }
+  if (!options.move) {
+    return 0;
+  }
+
+  TimedMove move = {};
+  int64_t hostTarget = link->micros() + (int64_t)options.atMs * 1000;
+  move.startUs = estimator.toController(hostTarget);
+  move.speedHz = options.speedHz;
+  move.acceleration = options.acceleration;
+  move.axes = AXIS_COUNT;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    move.steps[i] = options.steps[i];
+  }
+  uint32_t attempts = 0;
+  TimedMoveStatus status = sendTimedMove(*link, move, (uint8_t)link->micros(), attempts);
+  printf("timed move: %s after %u attempts, due at controller time %llu us\n", statusName(status), attempts,
+         (unsigned long long)move.startUs);
+  if (options.sim) {
+    printf("sim: %u frames lost, move queued %zu times", sim.dropped(), sim.queued().size());
+    if (sim.queued().empty()) {
+      printf("\n");
+      return 1;
+    }
+    double error = sim.hostAt(sim.queued()[0].startUs) - hostTarget;
+    bool onTime = fabs(error) <= SIM_START_TOLERANCE_US;
+    printf(", start lands %.1f us from the requested host time (tolerance %.0f us)%s\n", error,
+           SIM_START_TOLERANCE_US, onTime ? "" : ": FAIL");
+    if (!onTime) {
+      return 1;
+    }
+  }
+  return (status == TimedMoveStatus::Queued) ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/*
+*******************************************************************************
+* Description:
+*   Host decoder for the firmware's deferred log (DeferredLog.h). Reads the
+*   controller's Serial output from the port or from stdin (a capture). It
+*   passes text through and formats the binary log records with the string
+*   table that scripts/log_strings.py writes at build time. Each record is
+*   printed with its controller timestamp. Lost log frames (by sequence
+*   number) and records dropped on the controller are reported.
+*
+*   Build and run with PlatformIO's log_decode environment:
+*     pio run -e log_decode
+*     .pio/build/log_decode/program --port /dev/ttyUSB0
+*     .pio/build/log_decode/program --strings log_strings.tsv < capture.bin
+*******************************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+#include "EventLog.h"
+#include "HostLink.h"
+
+// String table of the firmware build, as scripts/log_strings.py writes it
+constexpr const char* DEFAULT_STRINGS = ".pio/build/m5stack-core-esp32/log_strings.tsv";
+
+/**
+ * Reads the string table: hex ID, tab, format with C escapes.
+ * @return false if the file cannot be read
+ */
+static bool loadStrings(const char* path, std::map<uint32_t, std::string>& table) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    char* tab = strchr(line, '\t');
+    if (!tab) {
+      continue;
+    }
+    uint32_t id = (uint32_t)strtoul(line, nullptr, 16);
+    std::string format;
+    for (const char* p = tab + 1; *p && *p != '\n'; p++) {
+      if (*p != '\\' || !p[1]) {
+        format += *p;
+        continue;
+      }
+      p++;
+      switch (*p) {
+        case 'n': format += '\n'; break;
+        case 't': format += '\t'; break;
+        case 'r': format += '\r'; break;
+        case '0': format += '\0'; break;
+        default: format += *p; break;
+      }
+    }
+    table[id] = format;
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Formats a record the way the firmware's printf would have. Every
+ * conversion takes one argument word, or two for ll; h and l only change
+ * the width on the controller, where int and long are both 32 bits.
+ */
+static std::string formatRecord(const std::string& format, const LogRecord& record) {
+  std::string out;
+  uint8_t next = 0;
+  for (size_t i = 0; i < format.size(); i++) {
+    if (format[i] != '%') {
+      out += format[i];
+      continue;
+    }
+    if (i + 1 < format.size() && format[i + 1] == '%') {
+      out += '%';
+      i++;
+      continue;
+    }
+    size_t start = i++;
+    while (i < format.size() && strchr("-+ #0123456789.", format[i])) {
+      i++;
+    }
+    std::string spec = format.substr(start, i - start);
+    bool wide = format.compare(i, 2, "ll") == 0;
+    while (i < format.size() && strchr("hlzjt", format[i])) {
+      i++;
+    }
+    char conversion = (i < format.size()) ? format[i] : 'd';
+    uint8_t words = wide ? 2 : 1;
+    if (next + words > record.count) {
+      out += "<?>";
+      continue;
+    }
+    uint64_t value = record.words[next];
+    if (wide) {
+      value |= (uint64_t)record.words[next + 1] << 32;
+    }
+    next += words;
+
+    char text[64];
+    if (strchr("di", conversion)) {
+      snprintf(text, sizeof(text), (spec + "lld").c_str(), wide ? (long long)value : (long long)(int32_t)value);
+    } else if (strchr("uxXo", conversion)) {
+      snprintf(text, sizeof(text), (spec + "ll" + conversion).c_str(), (unsigned long long)value);
+    } else if (conversion == 'c') {
+      snprintf(text, sizeof(text), (spec + "c").c_str(), (int)(uint8_t)value);
+    } else if (strchr("fFeEgG", conversion)) {
+      float number;
+      uint32_t bits = (uint32_t)value;
+      memcpy(&number, &bits, sizeof(number));
+      snprintf(text, sizeof(text), (spec + conversion).c_str(), (double)number);
+    } else {
+      snprintf(text, sizeof(text), "<%%%c?>", conversion);
+    }
+    out += text;
+  }
+  return out;
+}
+
+/**
+ * Prints the records of one log frame.
+ */
+static void printRecords(const Frame& frame, const std::map<uint32_t, std::string>& table) {
+  LogRecord record;
+  uint8_t offset = 0;
+  while (readLogRecord(frame, offset, record)) {
+    printf("[%10.6f] ", record.stamp / 1e6);
+    if (record.id == LOG_DROPPED_ID) {
+      printf("%u log records dropped on the controller\n", record.count ? record.words[0] : 0);
+      continue;
+    }
+    auto format = table.find(record.id);
+    if (format == table.end()) {
+      printf("unknown log format %08x (%u words), string table out of date?\n", record.id, record.count);
+      continue;
+    }
+    std::string text = formatRecord(format->second, record);
+    fputs(text.c_str(), stdout);
+    if (text.empty() || text.back() != '\n') {
+      putchar('\n');
+    }
+  }
+  if (offset != frame.length) {
+    printf("[malformed log frame]\n");
+  }
+}
+
+static void usage() {
+  printf("Usage: log_decode [--strings FILE] [--port DEV [--baud B]]   (reads stdin without --port)\n");
+}
+
+int main(int argc, char** argv) {
+  const char* strings = DEFAULT_STRINGS;
+  const char* port = nullptr;
+  uint32_t baud = 115200;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (value && !strcmp(arg, "--strings")) {
+      strings = value, i++;
+    } else if (value && !strcmp(arg, "--port")) {
+      port = value, i++;
+    } else if (value && !strcmp(arg, "--baud")) {
+      baud = (uint32_t)atol(value), i++;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  std::map<uint32_t, std::string> table;
+  if (!loadStrings(strings, table)) {
+    fprintf(stderr, "Cannot read string table %s\n", strings);
+    return 1;
+  }
+  SerialLink serial;
+  if (port && !serial.open(port, baud)) {
+    fprintf(stderr, "Cannot open %s\n", port);
+    return 1;
+  }
+
+  FrameDecoder decoder;
+  uint8_t expectedSeq = 0;
+  bool seenFrame = false;
+  for (;;) {
+    uint8_t byte;
+    if (port) {
+      if (!serial.read(byte, 1000)) {
+        fflush(stdout);
+        continue;
+      }
+    } else {
+      int c = getchar();
+      if (c == EOF) {
+        break;
+      }
+      byte = (uint8_t)c;
+    }
+
+    // Text between frames is passed through
+    bool inFrame = decoder.receiving() || byte == FRAME_START;
+    if (decoder.feed(byte)) {
+      const Frame& frame = decoder.frame();
+      if (frame.type != LOG_FRAME_TYPE) {
+        continue;     // Replies of the host link
+      }
+      if (seenFrame && frame.seq != expectedSeq) {
+        printf("[%u log frames lost]\n", (uint8_t)(frame.seq - expectedSeq));
+      }
+      seenFrame = true;
+      expectedSeq = frame.seq + 1;
+      printRecords(frame, table);
+    } else if (!inFrame) {
+      putchar(byte);
+    }
+  }
+  return 0;
+}
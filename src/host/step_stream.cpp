@@ -0,0 +1,569 @@
+/*
+*******************************************************************************
+* Description:
+*   Host planner for the firmware's step stream mode. Plans coordinated
+*   trapezoid moves with exact per-step times, compresses each axis into
+*   StepBlocks and sends them as numbered frames with go-back-N resends, so
+*   every block reaches the MCU exactly once.
+*
+*   --verify runs the MCU side in-process (the firmware's FrameDecoder,
+*   StreamReceiver and StepBlockExpander) behind a simulated serial link that
+*   can drop, duplicate and corrupt frames, replays the received blocks in
+*   simulated real time and checks that the expanded step commands
+*   reproduce the compressed schedule bit for bit.
+*
+*   Build and run with PlatformIO's step_stream environment:
+*     pio run -e step_stream
+*     .pio/build/step_stream/program --steps 32000,-12000 --speed 8000 --accel 20000 --verify
+*     .pio/build/step_stream/program --steps 3200 --repeat 4 --verify --drop 0.05 --dup 0.05 --corrupt 0.02
+*     .pio/build/step_stream/program --steps 16000,16000 --port /dev/ttyUSB0
+*******************************************************************************
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+#include <vector>
+
+#include "HostLink.h"
+#include "MachineConfig.h"
+#include "StepCompressor.h"
+#include "StepStream.h"
+
+// Default compression error bound, ticks (25 µs)
+constexpr uint32_t DEFAULT_MAX_ERROR_TICKS = STEP_TICKS_PER_S / 40000;
+
+// Frames sent ahead of the last acknowledged one
+constexpr uint32_t STREAM_WINDOW = 4;
+
+// Wait for a reply before the window is resent, and consecutive silent waits before giving up
+constexpr uint32_t REPLY_TIMEOUT_MS = 20;
+constexpr uint32_t STREAM_RETRY_LIMIT = 50;
+
+// Pause before offering a frame again that did not fit the MCU queues
+constexpr uint32_t FULL_RETRY_MS = 2;
+
+// MCU block queue and step queue lookahead, as STEP_BLOCK_QUEUE_LENGTH and MOTION_LOOKAHEAD_MS in MotionControl.h
+constexpr uint32_t MCU_BLOCK_QUEUE_LENGTH = 32;
+constexpr uint32_t MCU_LOOKAHEAD_MS = 20;
+
+struct StreamOptions {
+  int32_t steps[AXIS_COUNT] = {};
+  uint32_t speedHz = 8000;
+  uint32_t acceleration = 20000;
+  uint32_t repeat = 1;              // Moves, alternating direction
+  uint32_t maxErrorTicks = DEFAULT_MAX_ERROR_TICKS;
+  bool verify = false;
+  double drop = 0;                  // Simulated link faults, per frame
+  double duplicate = 0;
+  double corrupt = 0;
+  uint32_t seed = 1;
+  uint32_t baud = 115200;
+  const char* port = nullptr;
+  bool verbose = false;
+};
+
+/**
+ * Step times of every axis for the moves, from one trapezoid on the dominant
+ * axis; the other axes follow it proportionally. Each step falls where its
+ * axis passes the middle of the step.
+ */
+static int64_t planTimelines(const StreamOptions& options, std::vector<StepTime> (&timelines)[AXIS_COUNT]) {
+  double start = STEP_MIN_CMD_TICKS;
+  for (uint32_t move = 0; move < options.repeat; move++) {
+    int32_t sign = (move % 2 == 0) ? 1 : -1;
+    double major = 0;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      major = fmax(major, fabs((double)options.steps[i]));
+    }
+    if (major == 0) {
+      break;
+    }
+    double accel = options.acceleration;
+    double speed = fmin((double)options.speedHz, sqrt(accel * major));   // Triangle if cruise is not reached
+    double rampTime = speed / accel;
+    double rampDistance = speed * rampTime / 2;
+    double total = 2 * rampTime + (major - 2 * rampDistance) / speed;
+
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      int32_t count = abs(options.steps[i]);
+      bool countUp = (options.steps[i] * sign) > 0;
+      for (int32_t n = 1; n <= count; n++) {
+        double x = (n - 0.5) * major / count;
+        double t;
+        if (x <= rampDistance) {
+          t = sqrt(2 * x / accel);
+        } else if (x <= major - rampDistance) {
+          t = rampTime + (x - rampDistance) / speed;
+        } else {
+          t = total - sqrt(2 * (major - x) / accel);
+        }
+        timelines[i].push_back({(int64_t)llround(start + t * STEP_TICKS_PER_S), countUp});
+      }
+    }
+    start += total * STEP_TICKS_PER_S;
+  }
+  return (int64_t)llround(start) + STEP_MIN_CMD_TICKS;
+}
+
+/**
+ * Step times the MCU produces from blocks: the commands of StepBlockExpander
+ * replayed as FastAccelStepper runs them (a step at the start of each period).
+ * @return false if a command breaks FastAccelStepper's limits
+ */
+static bool replayBlocks(const std::vector<StepBlock>& blocks, std::vector<int64_t>& times) {
+  StepBlockExpander expander;
+  StepCommand command;
+  int64_t now = 0;
+  bool valid = true;
+  for (const StepBlock& block : blocks) {
+    expander.load(block);
+    while (expander.next(command)) {
+      uint32_t length = (uint32_t)command.ticks * (command.steps ? command.steps : 1);
+      if (length < STEP_MIN_CMD_TICKS || (command.steps > 0 && command.ticks < STEP_MIN_INTERVAL_TICKS)) {
+        valid = false;
+      }
+      for (uint8_t s = 0; s < command.steps; s++) {
+        times.push_back(now + (int64_t)s * command.ticks);
+      }
+      now += length;
+    }
+  }
+  return valid;
+}
+
+/**
+ * Step times encoded by the blocks, computed directly from their definition.
+ */
+static void scheduleTimes(const std::vector<StepBlock>& blocks, std::vector<int64_t>& times) {
+  int64_t now = 0;
+  for (const StepBlock& block : blocks) {
+    for (uint32_t k = 0; k < block.count; k++) {
+      times.push_back(now);
+      now += stepBlockInterval(block, k);
+    }
+    if (block.count == 0) {
+      now += block.interval;
+    }
+  }
+}
+
+/**
+ * Packs the blocks of all axes into frames in the order they start, so the
+ * MCU queues of all axes fill evenly: Begin, Blocks..., End.
+ */
+static std::vector<Frame> buildFrames(const std::vector<StepBlock> (&blocks)[AXIS_COUNT], uint8_t firstSeq) {
+  std::vector<Frame> frames;
+  Frame frame = {};
+  frame.type = (uint8_t)StreamFrame::Begin;
+  frames.push_back(frame);
+
+  size_t next[AXIS_COUNT] = {};
+  int64_t startTicks[AXIS_COUNT] = {};
+  frame.type = (uint8_t)StreamFrame::Blocks;
+  while (true) {
+    int axis = -1;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (next[i] < blocks[i].size() && (axis < 0 || startTicks[i] < startTicks[axis])) {
+        axis = i;
+      }
+    }
+    if (axis < 0) {
+      break;
+    }
+    const StepBlock& block = blocks[axis][next[axis]++];
+    packStepBlock((uint8_t)axis, block, frame.payload + frame.length);
+    frame.length += STEP_BLOCK_BYTES;
+    startTicks[axis] += stepBlockTicks(block);
+    if (frame.length + STEP_BLOCK_BYTES > FRAME_MAX_PAYLOAD) {
+      frames.push_back(frame);
+      frame.length = 0;
+    }
+  }
+  if (frame.length > 0) {
+    frames.push_back(frame);
+  }
+  frame.type = (uint8_t)StreamFrame::End;
+  frame.length = 0;
+  frames.push_back(frame);
+
+  for (size_t f = 0; f < frames.size(); f++) {
+    frames[f].seq = (uint8_t)(firstSeq + f);
+  }
+  return frames;
+}
+
+/**
+ * MCU block queues as the firmware's executor runs them: blocks are moved
+ * to the step queues up to the lookahead ahead of the replay time, the axes
+ * start together once every queue is filled or the stream has ended.
+ */
+struct SimMcu {
+  std::deque<StepBlock> queues[AXIS_COUNT];
+  std::vector<StepBlock> replayed[AXIS_COUNT];
+  int64_t fedTicks[AXIS_COUNT] = {};   // Schedule time handed to the step queue
+  bool active = false;
+  bool ending = false;
+  bool started = false;
+  int64_t startTicks = 0;
+  uint32_t underruns = 0;
+
+  bool begin() {
+    if (active) {
+      return false;
+    }
+    active = true;
+    return true;
+  }
+  uint8_t axisCount() const { return AXIS_COUNT; }
+  uint8_t space(uint8_t axis) { return (active && !ending) ? MCU_BLOCK_QUEUE_LENGTH - queues[axis].size() : 0; }
+  void push(uint8_t axis, const StepBlock& block) { queues[axis].push_back(block); }
+  void end() { ending = true; }
+
+  /**
+   * Runs the executor up to host time now.
+   */
+  void advance(int64_t now) {
+    if (!active) {
+      return;
+    }
+    int64_t lookahead = (int64_t)MCU_LOOKAHEAD_MS * (STEP_TICKS_PER_S / 1000);
+    int64_t elapsed = started ? now - startTicks : 0;
+    bool filled = true;
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      while (!queues[i].empty() && fedTicks[i] < elapsed + lookahead) {
+        if (started && fedTicks[i] < elapsed) {
+          underruns++;     // The step queue ran dry before this block arrived
+        }
+        fedTicks[i] += stepBlockTicks(queues[i].front());
+        replayed[i].push_back(queues[i].front());
+        queues[i].pop_front();
+      }
+      filled = filled && fedTicks[i] >= lookahead;
+    }
+    if (!started && (filled || ending)) {
+      started = true;
+      startTicks = now;
+    }
+  }
+
+  bool done() const {
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      if (!queues[i].empty()) {
+        return false;
+      }
+    }
+    return ending;
+  }
+};
+
+/**
+ * Serial link simulated in host time (FastAccelStepper ticks): every byte
+ * takes its transmission time at the configured baud rate, and whole frames
+ * from the host are dropped, duplicated or corrupted at random.
+ */
+class SimLink : public Link {
+ public:
+  SimLink(const StreamOptions& options, SimMcu& mcu) : _options(options), _mcu(mcu), _random(options.seed) {
+    _byteTicks = (int64_t)STEP_TICKS_PER_S * 10 / options.baud;
+  }
+
+  void write(const uint8_t* bytes, size_t length) override {
+    _now += (int64_t)length * _byteTicks;
+    if (_random.chance(_options.drop)) {
+      _dropped++;
+      return;
+    }
+    uint8_t copy[FRAME_MAX_BYTES];
+    memcpy(copy, bytes, length);
+    if (_random.chance(_options.corrupt)) {
+      copy[1 + _random.next() % (length - 1)] ^= (uint8_t)(1 + _random.next() % 255);
+      _corrupted++;
+    }
+    deliver(copy, length);
+    if (_random.chance(_options.duplicate)) {
+      _duplicated++;
+      deliver(copy, length);
+    }
+  }
+
+  int64_t micros() override { return _now / (STEP_TICKS_PER_S / 1000000); }
+
+  bool read(uint8_t& byte, uint32_t timeoutMs) override {
+    if (_replies.empty()) {
+      _now += (int64_t)timeoutMs * (STEP_TICKS_PER_S / 1000);
+      _mcu.advance(_now);
+      return false;
+    }
+    byte = _replies.front();
+    _replies.pop_front();
+    _now += _byteTicks;
+    return true;
+  }
+
+  /**
+   * Lets simulated time pass until the MCU has replayed everything.
+   */
+  void drain() {
+    while (!_mcu.done()) {
+      _now += STEP_TICKS_PER_S / 1000;
+      _mcu.advance(_now);
+    }
+  }
+
+  uint32_t dropped() const { return _dropped; }
+  uint32_t duplicated() const { return _duplicated; }
+  uint32_t corrupted() const { return _corrupted; }
+  uint32_t crcErrors() const { return _decoder.errors(); }
+
+ private:
+  /**
+   * Feeds one frame's bytes to the MCU and queues its replies, of which a
+   * share is lost on the way back.
+   */
+  void deliver(const uint8_t* bytes, size_t length) {
+    _mcu.advance(_now);
+    for (size_t b = 0; b < length; b++) {
+      if (!_decoder.feed(bytes[b])) {
+        continue;
+      }
+      Frame reply;
+      _receiver.handle(_decoder.frame(), reply, _mcu);
+      if (_random.chance(_options.drop)) {
+        _dropped++;
+        continue;
+      }
+      uint8_t encoded[FRAME_MAX_BYTES];
+      size_t n = encodeFrame(reply, encoded);
+      _replies.insert(_replies.end(), encoded, encoded + n);
+    }
+  }
+
+  const StreamOptions& _options;
+  SimMcu& _mcu;
+  FrameDecoder _decoder;
+  StreamReceiver _receiver;
+  std::deque<uint8_t> _replies;
+  int64_t _now = 0;
+  int64_t _byteTicks = 0;
+  SimRandom _random;
+  uint32_t _dropped = 0;
+  uint32_t _duplicated = 0;
+  uint32_t _corrupted = 0;
+};
+
+struct SendStats {
+  uint32_t sent = 0;       // Frames written, including resends
+  uint32_t resends = 0;
+  uint32_t naks = 0;
+  uint32_t timeouts = 0;
+};
+
+/**
+ * Sends the frames with go-back-N: up to STREAM_WINDOW frames (and no more
+ * blocks than the MCU reported room for) are in flight; a Nak or a silent
+ * timeout resends from the oldest unacknowledged frame.
+ */
+static bool sendFrames(Link& link, const std::vector<Frame>& frames, SendStats& stats) {
+  FrameDecoder decoder;
+  size_t base = 0;
+  size_t next = 0;
+  size_t highest = 0;              // Frames sent at least once
+  uint32_t space = STREAM_BLOCKS_PER_FRAME;   // Until the first reply tells
+  uint32_t silent = 0;
+  uint8_t bytes[FRAME_MAX_BYTES];
+
+  while (base < frames.size()) {
+    while (next < frames.size() && next < base + STREAM_WINDOW &&
+           (next == base || (next - base + 1) * STREAM_BLOCKS_PER_FRAME <= space)) {
+      link.write(bytes, encodeFrame(frames[next], bytes));
+      stats.sent++;
+      if (next < highest) {
+        stats.resends++;
+      }
+      next++;
+      highest = (next > highest) ? next : highest;
+    }
+
+    uint8_t byte;
+    bool replied = false;
+    while (!replied && link.read(byte, REPLY_TIMEOUT_MS)) {
+      // Log frames of the controller share the port; only Ack and Nak answer the stream
+      replied = decoder.feed(byte) && (decoder.frame().type == (uint8_t)StreamFrame::Ack ||
+                                       decoder.frame().type == (uint8_t)StreamFrame::Nak);
+    }
+    if (!replied) {
+      stats.timeouts++;
+      if (++silent > STREAM_RETRY_LIMIT) {
+        fprintf(stderr, "No reply from the controller\n");
+        return false;
+      }
+      next = base;
+      continue;
+    }
+    silent = 0;
+
+    // The reply carries the next sequence number the MCU expects
+    const Frame& reply = decoder.frame();
+    size_t acked = base + (uint8_t)(reply.seq - frames[base].seq);
+    if (acked > base && acked <= highest) {
+      base = acked;
+    }
+    if (next < base) {
+      next = base;
+    }
+    space = (reply.length >= 2) ? reply.payload[1] : 0;
+    if (reply.type == (uint8_t)StreamFrame::Nak) {
+      stats.naks++;
+      StreamNak reason = (StreamNak)reply.payload[0];
+      if (reason == StreamNak::Invalid || reason == StreamNak::NoSession ||
+          (reason == StreamNak::Busy && base == 0 && stats.naks > STREAM_RETRY_LIMIT)) {
+        fprintf(stderr, "Controller refused frame %u (reason %u)\n", frames[base].seq, reply.payload[0]);
+        return false;
+      }
+      if (reason == StreamNak::Full || reason == StreamNak::Busy) {
+        if (link.read(byte, FULL_RETRY_MS)) {
+          decoder.feed(byte);      // Start of a reply to a frame still in flight, completed below
+        }
+      }
+      next = base;     // Out of order, full or busy: resend from the first unacknowledged frame
+    }
+  }
+  return true;
+}
+
+static void usage() {
+  printf("Usage: step_stream --steps S[,S...] [--speed HZ] [--accel A] [--repeat N]\n"
+         "                   [--max-error TICKS] [--verbose]\n"
+         "                   (--verify [--drop P] [--dup P] [--corrupt P] [--seed N] | --port DEV)\n"
+         "                   [--baud B]\n");
+}
+
+static bool parseSteps(const char* text, int32_t (&steps)[AXIS_COUNT]) {
+  for (uint8_t i = 0; i < AXIS_COUNT && *text; i++) {
+    char* end;
+    steps[i] = (int32_t)strtol(text, &end, 10);
+    if (end == text) {
+      return false;
+    }
+    text = (*end == ',') ? end + 1 : end;
+  }
+  return *text == '\0';
+}
+
+int main(int argc, char** argv) {
+  StreamOptions options;
+  bool haveSteps = false;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--verify")) {
+      options.verify = true;
+    } else if (!strcmp(arg, "--verbose")) {
+      options.verbose = true;
+    } else if (value && !strcmp(arg, "--steps")) {
+      haveSteps = parseSteps(value, options.steps), i++;
+    } else if (value && !strcmp(arg, "--speed")) {
+      options.speedHz = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--accel")) {
+      options.acceleration = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--repeat")) {
+      options.repeat = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--max-error")) {
+      options.maxErrorTicks = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--drop")) {
+      options.drop = atof(value), i++;
+    } else if (value && !strcmp(arg, "--dup")) {
+      options.duplicate = atof(value), i++;
+    } else if (value && !strcmp(arg, "--corrupt")) {
+      options.corrupt = atof(value), i++;
+    } else if (value && !strcmp(arg, "--seed")) {
+      options.seed = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--baud")) {
+      options.baud = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--port")) {
+      options.port = value, i++;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!haveSteps || options.speedHz == 0 || options.acceleration == 0 || (!options.verify && !options.port)) {
+    usage();
+    return 1;
+  }
+
+  // Plan and compress
+  std::vector<StepTime> timelines[AXIS_COUNT];
+  int64_t endTicks = planTimelines(options, timelines);
+  std::vector<StepBlock> blocks[AXIS_COUNT];
+  size_t totalSteps = 0;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    StepCompressor compressor(options.maxErrorTicks);
+    compressor.compress(timelines[i], endTicks, blocks[i]);
+    const CompressStats& stats = compressor.stats();
+    totalSteps += timelines[i].size();
+    printf("axis %c: %zu steps in %zu blocks (%.1f steps/block), max error %.2f us, %u forced\n",
+           axisTable[i].name, timelines[i].size(), blocks[i].size(),
+           blocks[i].empty() ? 0.0 : (double)timelines[i].size() / blocks[i].size(),
+           stats.maxErrorTicks * 1e6 / STEP_TICKS_PER_S, stats.forced);
+    if (options.verbose) {
+      for (const StepBlock& block : blocks[i]) {
+        printf("  interval %u count %u add %d %s\n", block.interval, block.count, block.add,
+               block.countUp ? "up" : "down");
+      }
+    }
+  }
+  std::vector<Frame> frames = buildFrames(blocks, options.verify ? 0 : (uint8_t)time(nullptr));
+  printf("%zu steps, %zu frames, %.1f s of motion\n", totalSteps, frames.size(), (double)endTicks / STEP_TICKS_PER_S);
+
+  SendStats sendStats;
+  if (options.port) {
+    SerialLink link;
+    if (!link.open(options.port, options.baud)) {
+      fprintf(stderr, "Cannot open %s\n", options.port);
+      return 1;
+    }
+    bool ok = sendFrames(link, frames, sendStats);
+    printf("sent %u frames, %u resends, %u naks, %u timeouts\n", sendStats.sent, sendStats.resends,
+           sendStats.naks, sendStats.timeouts);
+    return ok ? 0 : 1;
+  }
+
+  // Verify through the simulated link and the firmware's receiver and expander
+  SimMcu mcu;
+  SimLink link(options, mcu);
+  if (!sendFrames(link, frames, sendStats)) {
+    return 1;
+  }
+  link.drain();
+  printf("link: %u frames sent, %u resends, %u naks, %u timeouts; %u dropped, %u duplicated, %u corrupted "
+         "(%u CRC errors); %.2f s\n",
+         sendStats.sent, sendStats.resends, sendStats.naks, sendStats.timeouts, link.dropped(), link.duplicated(),
+         link.corrupted(), link.crcErrors(), link.micros() / 1e6);
+  printf("mcu: %u underruns\n", mcu.underruns);
+
+  bool exact = true;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    std::vector<int64_t> expected;
+    std::vector<int64_t> replayed;
+    scheduleTimes(blocks[i], expected);
+    bool valid = replayBlocks(mcu.replayed[i], replayed);
+    bool same = expected == replayed;
+    size_t mismatch = 0;
+    while (mismatch < expected.size() && mismatch < replayed.size() && expected[mismatch] == replayed[mismatch]) {
+      mismatch++;
+    }
+    printf("axis %c: %zu blocks received, %zu steps replayed, %s%s\n", axisTable[i].name, mcu.replayed[i].size(),
+           replayed.size(), same ? "bit-exact" : "MISMATCH", valid ? "" : ", INVALID COMMANDS");
+    if (!same) {
+      printf("  first difference at step %zu\n", mismatch);
+    }
+    exact = exact && same && valid;
+  }
+  return exact ? 0 : 2;
+}
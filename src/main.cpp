@@ -4,16 +4,64 @@
 * Date: 2024-02-01
 * Version: 2.7
 * Description:
-*   Controls two stepper motors using M5Stack Core ESP32 and Module 13.2 driver.
+*   Controls the stepper axes listed in MachineConfig.h (one to four) using
+*   M5Stack Core ESP32 and Module 13.2 driver.
 *   Implements 1/16 microstepping, speed control cycling with Button B,
 *   movement for multiple revolutions with Buttons A (forward) and C (reverse),
-*   and proper stopping behavior when speed is zero.
+*   and a feed hold when speed is zero.
+*   Moves are queued and executed without blocking loop(); a teach mode
+*   records button moves and replays them back to back.
 *
 * Key Features:
 * - Smooth ramp-up and ramp-down with configurable acceleration.
+* - Short moves (too short to reach cruise speed) queued back to back blend
+*   instead of stopping; with accelBoundTable they also ramp harder at low
+*   speed.
+* - Optional per-axis input shaping (ZV/ZVD/EI) from shaperTable in MachineConfig.h.
 * - Speed steps: 0%, 20%, 40%, 60%, 80%, 100% mapped to microstep frequencies.
 * - Auto enable pin control via FastAccelStepper's setAutoEnable(true).
-* - Stops motors cleanly when speed is zero to prevent unwanted rotation.
+* - Speed zero is a feed hold: the axes decelerate to rest, and the next
+*   speed level resumes the interrupted move and the queue (teach playback
+*   included) exactly where they stopped. GRBL's '!' and '~' over Serial
+*   hold and resume as well.
+* - Teach mode: hold B to start/stop recording, hold A to play back,
+*   hold C to abort playback. During playback A and C raise and lower the
+*   feed override.
+* - Feed override (10-200 %) rescales the running and queued moves, with
+*   GRBL's realtime bytes over Serial (0x90 reset, 0x91/0x92 +/-10 %,
+*   0x93/0x94 +/-5 %).
+* - Buttons are captured by GPIO interrupts, so presses are not missed while
+*   loop() is busy. Keeping A or C held when the hold has no teach action
+*   jogs the axes one revolution at a time.
+* - Backlash compensation per axis (backlashTable): take-up steps are
+*   blended into the start of every reversing move and left out of the
+*   pulse counts.
+* - Step-loss detection against generated pulses and optional encoders;
+*   detected loss stops all motion.
+* - G-code over Serial (G0/G1 lines, G2/G3 arcs, G90/G91), distances in
+*   motor revolutions and F in revolutions per minute. Consecutive G-code
+*   moves blend through corners; each line is answered "ok" or "error".
+* - Host step stream on the same port: a host planner sends compressed step
+*   schedules in binary frames (HostStream.h), replayed step-exact.
+* - Clock sync on the same frames: the host fits this controller's clock
+*   and sends moves due at a given controller time (ClockSync.h).
+* - Control path messages are logged deferred in binary (DeferredLog.h);
+*   decode them with host/log_decode, or build with -DLOG_TEXT for text.
+* - Step pulse peripheral per axis (pulseBackendTable); the pulse_bench
+*   build benchmarks MCPWM/PCNT against RMT at startup.
+* - Emergency stop input (ESTOP_PIN, off until a switch is fitted): its
+*   interrupt cuts the step outputs at once, loop() then disables the
+*   driver. The stop stays latched until the input is released and a
+*   button is clicked (or Ctrl-X over Serial); '?' reports the worst stop
+*   latencies.
+* - Step queue diagnostics: lowest buffered motion, worst refill gap of
+*   loop() and underruns per axis on screen; '?' over Serial prints them
+*   along with how often move plans were reused.
+* - Job time left, planned ahead over the queued moves, on screen and with
+*   '?' over Serial; the instructions show how long a button move takes.
+* - Position-synchronized output (PSO_OUTPUT_PIN): pulses or toggles when an
+*   axis reaches listed positions (M100) or every N steps (M101), fired
+*   from the axis' step pulses by a PCNT interrupt; M102 disarms it.
 *******************************************************************************
 */
 
@@ -22,37 +70,76 @@
 #include <M5Unified.h>
 #include <Module_Stepmotor.h>
 
+#include "ButtonInput.h"
+#include "DeferredLog.h"
+#include "EmergencyStop.h"
+#include "GcodeLine.h"
+#include "HostStream.h"
+#include "MachineConfig.h"
+#include "MotionControl.h"
+#include "PositionTrigger.h"
+#include "PulseBenchmark.h"
+#include "StepVerifier.h"
+#include "TeachMode.h"
+
 // Function prototypes for clarity and compiler correctness
 void drawStatus();
 void drawInstructions();
-void moveBothMotors(int32_t steps);
+void drawTeachStatus();
+void drawQueueHealth();
+void drawJobTime();
+template <uint8_t N> void moveAxes(const int32_t (&steps)[N]);
+void moveRevolutions(int32_t revolutions);
 void updateSpeed();
+void handleButton(const ButtonEvent& event);
+bool executeMcode(const GcodeLine& line);
+bool executeGcode(const char* text);
+bool gcodeReady(const char* text);
+void serviceGcode();
+bool handleRealtime(uint8_t c);
 
-// Pin definitions for M5Stack Core (Basic) + Module 13.2
-#define X_DIR_PIN 17     // Direction control pin for X motor
-#define X_STEP_PIN 16    // Step control pin for X motor
-#define Y_DIR_PIN 13     // Direction control pin for Y motor
-#define Y_STEP_PIN 12    // Step control pin for Y motor
+// LCD layout: one status line per axis, instructions below the status block
+constexpr int STATUS_TOP = 40;
+constexpr int LINE_HEIGHT = 16;
+constexpr int STATUS_HEIGHT = (AXIS_COUNT * LINE_HEIGHT > 60) ? AXIS_COUNT * LINE_HEIGHT : 60;
+constexpr int INSTRUCTIONS_TOP = STATUS_TOP + STATUS_HEIGHT;
+constexpr int TEACH_TOP = INSTRUCTIONS_TOP + 4 * LINE_HEIGHT + 8;
+constexpr int QUEUE_HEALTH_TOP = TEACH_TOP + LINE_HEIGHT + 4;
+constexpr int SMALL_LINE_HEIGHT = 8;     // Text size 1
+constexpr int JOB_TIME_TOP = QUEUE_HEALTH_TOP + AXIS_COUNT * SMALL_LINE_HEIGHT;
 
-// Stepper motor constants
-#define FULL_STEP_PER_REV 200            // Number of full steps per motor revolution (1.8° steps)
-#define MICRO_STEPS 16                   // Microstepping factor (1/16 microstepping)
-#define STEPS_PER_REV (FULL_STEP_PER_REV * MICRO_STEPS)  // Total microsteps per revolution (3200 steps)
+// Interval between job time refreshes while motion is queued
+constexpr uint32_t JOB_TIME_REFRESH_MS = 500;
 
 // Adjustable runtime parameters
 int accelerationRate = 2000;             // Acceleration in steps/sec² for ramping speed
 int revolutionsPerMove = 5;              // Number of revolutions moved per Button A or C press
+int jogRevolutions = 1;                  // Revolutions per auto-repeat while A or C is held
+
+// Longest G-code line accepted over Serial
+constexpr size_t GCODE_LINE_LENGTH = 96;
 
-// FastAccelStepper engine and motor stepper pointers
-FastAccelStepperEngine engine;
-FastAccelStepper* steppers[2] = {nullptr, nullptr}; // Pointer array for X and Y motors
+// Position trigger M codes (LinuxCNC leaves M100-M199 to the user)
+constexpr uint8_t MCODE_PSO_POSITION = 100;
+constexpr uint8_t MCODE_PSO_INTERVAL = 101;
+constexpr uint8_t MCODE_PSO_OFF = 102;
+
+// Realtime Serial bytes, acted on wherever they arrive outside host frames (GRBL's codes;
+// the fine override steps are FEED_OVERRIDE_STEP_PERCENT instead of 1 %)
+constexpr uint8_t REALTIME_STATUS = '?';
+constexpr uint8_t REALTIME_FEED_HOLD = '!';
+constexpr uint8_t REALTIME_CYCLE_START = '~';
+constexpr uint8_t REALTIME_RESET = 0x18;
+constexpr uint8_t REALTIME_FEED_RESET = 0x90;
+constexpr uint8_t REALTIME_FEED_COARSE_UP = 0x91;
+constexpr uint8_t REALTIME_FEED_COARSE_DOWN = 0x92;
+constexpr uint8_t REALTIME_FEED_FINE_UP = 0x93;
+constexpr uint8_t REALTIME_FEED_FINE_DOWN = 0x94;
+constexpr uint16_t FEED_OVERRIDE_COARSE_PERCENT = 10;
 
 // Module_Stepmotor driver instance for motor control communication
 Module_Stepmotor driver;
 
-// Track the number of pulses sent to each motor (for display)
-long pulseCounts[2] = {0, 0};
-
 // Define the speeds: microsteps per second values, and corresponding speed percentages
 const int speedLevels[] = {0, 1600, 3200, 4800, 6400, 8000};   // Speeds in microsteps/sec (Hz)
 const int speedPercentages[] = {0, 20, 40, 60, 80, 100};       // Display percentages
@@ -64,14 +151,91 @@ int currentSpeedIndex = 0;           // Index for current speed in speedLevels a
  * and current speed/revolutions/acceleration settings.
  */
 void drawInstructions() {
-  M5.Lcd.fillRect(0, 100, 320, 50, BLACK);  // Clear instruction area
-  M5.Lcd.setCursor(0, 100);
-  M5.Lcd.printf("Press B to change speed\n");
-  M5.Lcd.printf("Speed: %d%%\n", speedPercentages[currentSpeedIndex]);
-  M5.Lcd.printf("Move %d revolutions\n", revolutionsPerMove);
+  M5.Lcd.fillRect(0, INSTRUCTIONS_TOP, 320, 50, BLACK);  // Clear instruction area
+  M5.Lcd.setCursor(0, INSTRUCTIONS_TOP);
+  if (emergencyStopLatched()) {
+    M5.Lcd.printf("E-STOP: release, click to arm\n");
+  } else {
+    M5.Lcd.printf(feedHoldActive() ? "HOLD: B or ~ resumes\n" : "Press B to change speed\n");
+  }
+  M5.Lcd.printf("Speed: %d%%  Feed: %u%%\n", speedPercentages[currentSpeedIndex], feedOverridePercent());
+  if (speedLevels[currentSpeedIndex] > 0) {
+    AxisSegment move = {};
+    MachineAxes::revsToSteps(revolutionsPerMove, move.steps);
+    move.speedHz = speedLevels[currentSpeedIndex];
+    move.acceleration = accelerationRate;
+    uint32_t moveUs = estimateMoveUs(move);
+    M5.Lcd.printf("Move %d revs: %lu.%03lu s\n", revolutionsPerMove, moveUs / 1000000, moveUs / 1000 % 1000);
+  } else {
+    M5.Lcd.printf("Move %d revolutions\n", revolutionsPerMove);
+  }
   M5.Lcd.printf("Accel: %d\n", accelerationRate);
 }
 
+/**
+ * Shows the teach-mode state (recording, playing or the stored program size).
+ */
+void drawTeachStatus() {
+  M5.Lcd.fillRect(0, TEACH_TOP, 320, LINE_HEIGHT, BLACK);  // Clear teach status line
+  M5.Lcd.setCursor(0, TEACH_TOP);
+  switch (teachState()) {
+    case TeachState::Recording:
+      M5.Lcd.printf("Teach: REC %lu moves", teachRecordCount());
+      break;
+    case TeachState::Saving:
+      M5.Lcd.printf("Teach: saving %lu moves", teachRecordCount());
+      break;
+    case TeachState::Playing:
+      M5.Lcd.printf("Teach: PLAY %lu/%lu", teachPlaybackIndex(), teachRecordCount());
+      break;
+    default:
+      M5.Lcd.printf("Teach: %lu moves stored", teachRecordCount());
+      break;
+  }
+}
+
+/**
+ * Shows the step queue statistics, one small line per axis: least motion
+ * left at a refill, the worst gap between refills, the lookahead left over
+ * after that gap, and the near-miss and underrun counts.
+ */
+void drawQueueHealth() {
+  M5.Lcd.fillRect(0, QUEUE_HEALTH_TOP, 320, AXIS_COUNT * SMALL_LINE_HEIGHT, BLACK);  // Clear diagnostics
+  M5.Lcd.setTextSize(1);
+  M5.Lcd.setCursor(0, QUEUE_HEALTH_TOP);
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    const QueueHealth& health = queueHealth(i);
+    if (health.refills == 0) {
+      M5.Lcd.printf("%c queue: -\n", axisTable[i].name);
+      continue;
+    }
+    uint32_t minUs = health.minTicks / (STEP_TICKS_PER_S / 1000000);
+    int32_t headroomUs = (int32_t)(MOTION_LOOKAHEAD_MS * 1000) - (int32_t)health.worstGapUs;
+    M5.Lcd.printf("%c queue: min %lu.%lums gap %lu.%lums room %ldus U%lu N%lu\n", axisTable[i].name,
+                  minUs / 1000, minUs / 100 % 10, health.worstGapUs / 1000, health.worstGapUs / 100 % 10,
+                  headroomUs, health.underruns, health.nearMisses);
+  }
+  M5.Lcd.setTextSize(2);
+}
+
+/**
+ * Shows the estimated time until the queued job has run, on one small line
+ * below the queue statistics.
+ */
+void drawJobTime() {
+  M5.Lcd.fillRect(0, JOB_TIME_TOP, 320, SMALL_LINE_HEIGHT, BLACK);  // Clear job time line
+  M5.Lcd.setTextSize(1);
+  M5.Lcd.setCursor(0, JOB_TIME_TOP);
+  if (stepStreamActive()) {
+    M5.Lcd.printf("Job left: host stream");
+  } else {
+    uint32_t leftUs = remainingJobUs();
+    M5.Lcd.printf("Job left: %lu.%03lu s%s", leftUs / 1000000, leftUs / 1000 % 1000,
+                  feedHoldActive() ? " (held)" : "");
+  }
+  M5.Lcd.setTextSize(2);
+}
+
 /**
  * Initialization code, runs once at startup.
  * Sets up M5Stack, initializes steppers, driver, LCD, and serial.
@@ -81,6 +245,7 @@ void setup() {
   M5.begin(cfg);                // Initialize M5Stack
   Serial.begin(115200);         // Serial for debug output
   Serial.println("Setup starting...");
+  initDeferredLog();            // Control path messages go through the log drain from here on
 
   // Initialize LCD display
   M5.Lcd.setTextSize(2);
@@ -90,145 +255,442 @@ void setup() {
   M5.Lcd.println("Stepper Ready (1/16 Step)");
   M5.Lcd.println("A: FWD 5rev  C: REV 5rev");
 
-  // Initialize stepper engine
-  engine.init();
-
-  // Connect the step pins to the stepper engine and configure direction pins
-  steppers[0] = engine.stepperConnectToPin(X_STEP_PIN);  // X axis stepper
-  steppers[1] = engine.stepperConnectToPin(Y_STEP_PIN);  // Y axis stepper
-
-  // Setup each stepper motor's direction pin, acceleration, speed, and enable auto management of enable pin
-  for (int i = 0; i < 2; i++) {
-    if (steppers[i]) {
-      int dirPin = (i == 0) ? X_DIR_PIN : Y_DIR_PIN;
-      steppers[i]->setDirectionPin(dirPin);     // Set direction control pin
-      steppers[i]->setAutoEnable(true);          // Let library manage enable pin automatically
-      steppers[i]->setAcceleration(accelerationRate);    // Set acceleration rate
-      steppers[i]->setSpeedInHz(speedLevels[currentSpeedIndex]);  // Initial speed (likely zero)
-      Serial.printf("Initial speed stepper %d: %d Hz\n", i, speedLevels[currentSpeedIndex]);
-      Serial.printf("Acceleration: %d\n", accelerationRate);
-    }
-  }
+  // Initialize stepper engine and connect every configured axis
+  initMotion();
+  initStepVerifier();
+#ifdef PULSE_BENCHMARK
+  runPulseBenchmark();          // Benchmark build: report the pulse backends before running as usual
+#endif
 
   // Initialize I2C and motor driver (Module 13.2)
-  Wire.begin(21, 22, 400000UL);
+  Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN, 400000UL);
   driver.init(Wire);
-  driver.resetMotor(0, 0);      // Reset motor 0 (X)
-  driver.resetMotor(1, 0);      // Reset motor 1 (Y)
-  driver.enableMotor(1);        // Enable driver chip (both motors)
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    driver.resetMotor(axisTable[i].driverChannel, 0);  // Reset each configured motor channel
+  }
+  driver.enableMotor(1);        // Enable driver chip (all motors)
+  initEmergencyStop(driver);
+  initPositionTrigger();
+
+  initTeach();
+
+  initButtons();
+  setButtonRepeat(BUTTON_A, true);   // Auto-repeat jog forward
+  setButtonRepeat(BUTTON_C, true);   // Auto-repeat jog reverse
 
   // Display initial UI elements
   drawInstructions();
   drawStatus();
+  drawTeachStatus();
+  drawQueueHealth();
+  drawJobTime();
 
   Serial.println("Setup complete.");
 }
 
 /**
- * Moves both motors by the specified number of microsteps.
+ * Queues a move of every axis by its own number of microsteps; the motion
+ * executor clips it to the axis soft limits when it starts.
  * If speed is zero, motors are stopped and no move is issued.
- * @param steps Number of microsteps to move (positive or negative)
+ * While teach mode is recording, the move is also appended to the program.
+ * @param steps Microsteps to move per axis (positive or negative), indexed like axisTable
  */
-void moveBothMotors(int32_t steps) {
-  // If speed is zero, do not move but ensure motors are stopped cleanly
+template <uint8_t N>
+void moveAxes(const int32_t (&steps)[N]) {
+  static_assert(N == AXIS_COUNT, "moveAxes() needs one step count per configured axis");
+
+  // Speed zero holds the feed; keep the held job intact and queue nothing
   if (speedLevels[currentSpeedIndex] == 0) {
-    Serial.println("Speed is 0, skipping move and stopping motors.");
-    for (int i = 0; i < 2; i++) {
-      if (steppers[i]) {
-        steppers[i]->setSpeedInHz(0);   // Set stepper speed to zero (no pulses)
-        steppers[i]->stopMove();        // Stop any ongoing moves immediately
-      }
-    }
+    LOG_EVENT("Speed is 0 (feed hold), skipping move.\n");
     return;  // Exit without initiating move
   }
 
-  Serial.printf("Moving motors by %ld steps at speed index %d (%d Hz)\n",
-                steps, currentSpeedIndex, speedLevels[currentSpeedIndex]);
-  Serial.printf("Acceleration: %d\n", accelerationRate);
+  if (stepStreamActive()) {
+    LOG_EVENT("Host step stream running, move ignored.\n");
+    return;
+  }
 
-  // Configure each stepper and issue the move command
-  for (int i = 0; i < 2; i++) {
-    if (steppers[i]) {
-      steppers[i]->setAcceleration(accelerationRate);                // Set acceleration
-      steppers[i]->setSpeedInHz(speedLevels[currentSpeedIndex]);     // Set speed for this move
-      steppers[i]->move(steps);                                      // Start move (non-blocking)
-      pulseCounts[i] += steps;                                       // Update pulse counters
-    }
+  AxisSegment segment = {};
+  for (uint8_t i = 0; i < N; i++) {
+    segment.steps[i] = steps[i];
   }
+  segment.speedHz = speedLevels[currentSpeedIndex];
+  segment.acceleration = accelerationRate;
 
-  // Wait for both motors to finish the move (blocking)
-  while (
-    (steppers[0] && steppers[0]->isRunning()) ||
-    (steppers[1] && steppers[1]->isRunning())
-  ) {
-    delay(10);
+  if (!queueMove(segment)) {
+    LOG_EVENT("Motion queue full, move ignored.\n");
+    return;
+  }
+  if (teachState() == TeachState::Recording) {
+    teachRecordMove(segment);
+    drawTeachStatus();
   }
-  Serial.println("Move complete.");
 }
 
 /**
- * Updates the RTC and Y pulses count shown on the LCD.
+ * Moves every axis by the same number of revolutions, converted with each
+ * axis' compile-time steps-per-revolution constant.
+ * @param revolutions Revolutions to move (negative for reverse)
+ */
+void moveRevolutions(int32_t revolutions) {
+  int32_t steps[AXIS_COUNT];
+  MachineAxes::revsToSteps(revolutions, steps);
+  moveAxes(steps);
+}
+
+/**
+ * Updates the pulse count of every axis shown on the LCD.
  * Clears previous pulse count area before writing.
  */
 void drawStatus() {
-  M5.Lcd.fillRect(0, 40, 320, 60, BLACK);  // Clear pulse count display area
-  M5.Lcd.setCursor(0, 40);
-  M5.Lcd.printf("X Pulses: %ld\n", pulseCounts[0]);
-  M5.Lcd.printf("Y Pulses: %ld\n", pulseCounts[1]);
+  M5.Lcd.fillRect(0, STATUS_TOP, 320, STATUS_HEIGHT, BLACK);  // Clear pulse count display area
+  M5.Lcd.setCursor(0, STATUS_TOP);
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    M5.Lcd.printf("%c Pulses: %ld%s\n", axisTable[i].name, pulseCounts[i],
+                  stepLossDetected(i) ? " LOST" : "");
+  }
 }
 
 /**
  * Cycles the speed setting to the next value in the speed array.
- * If speed is set to zero, motors are stopped immediately.
- * Otherwise motors remain ready for moves at new speed.
+ * Speed zero holds the feed: the running move decelerates to rest and the
+ * queue waits. Any other speed releases a hold and applies to the next move.
  */
 void updateSpeed() {
   currentSpeedIndex++;
   if (currentSpeedIndex >= speedLevelsCount) {
     currentSpeedIndex = 0;  // Wrap around to start of speed array
   }
-  Serial.printf("Speed changed to index %d (%d Hz = %d%%)\n",
+  LOG_EVENT("Speed changed to index %d (%d Hz = %d%%)\n",
                 currentSpeedIndex, speedLevels[currentSpeedIndex], speedPercentages[currentSpeedIndex]);
 
-  // Update motor speed and stop if zero speed selected
   if (speedLevels[currentSpeedIndex] == 0) {
-    for (int i = 0; i < 2; i++) {
-      if (steppers[i]) {
-        steppers[i]->setSpeedInHz(0);    // Ensure speed zero
-        steppers[i]->stopMove();         // Stop immediately
-      }
-    }
+    feedHold();                          // Ramp down, keep the rest of the job
   } else {
-    for (int i = 0; i < 2; i++) {
-      if (steppers[i]) {
-        steppers[i]->setSpeedInHz(speedLevels[currentSpeedIndex]);   // Set new speed
-      }
-    }
+    resumeFeedHold();
   }
 
   drawInstructions();
 }
 
 /**
- * Main loop - handles button input and triggers motor moves/speed changes.
+ * Acts on one decoded button event.
  * Button A -> move forward by revolutionsPerMove revolutions.
  * Button C -> move backward by revolutionsPerMove revolutions.
  * Button B -> cycle through speed settings.
+ * Button A / C during playback -> feed override up / down by FEED_OVERRIDE_STEP_PERCENT.
+ * Hold B -> start/stop teach recording. Hold A -> play back the taught program.
+ * Hold C -> abort playback.
+ * Keep A or C held -> jog, unless the hold started or stopped playback.
+ * After an emergency stop, a click only re-arms once the input is released.
+ */
+void handleButton(const ButtonEvent& event) {
+  static bool jogEnabled[BUTTON_COUNT] = {};   // Current hold may auto-repeat
+
+  if (emergencyStopLatched()) {
+    if (event.type == ButtonEventType::Click && rearmEmergencyStop()) {
+      drawInstructions();
+    }
+    return;
+  }
+
+  switch (event.type) {
+    case ButtonEventType::Click:
+      if (event.button == BUTTON_B) {
+        updateSpeed();
+      } else if (teachState() != TeachState::Playing) {
+        moveRevolutions(event.button == BUTTON_A ? revolutionsPerMove : -revolutionsPerMove);
+      } else {
+        setFeedOverride(feedOverridePercent() + (event.button == BUTTON_A ? FEED_OVERRIDE_STEP_PERCENT
+                                                                          : -FEED_OVERRIDE_STEP_PERCENT));
+        drawInstructions();
+      }
+      break;
+
+    case ButtonEventType::Hold:
+      jogEnabled[event.button] = false;
+      if (event.button == BUTTON_B) {
+        if (teachState() == TeachState::Recording) {
+          stopTeachRecording();
+        } else {
+          startTeachRecording();
+        }
+      } else if (event.button == BUTTON_A) {
+        jogEnabled[event.button] = !startTeachPlayback() && teachState() != TeachState::Playing;
+      } else if (teachState() == TeachState::Playing) {
+        stopTeachPlayback();
+        stopAllMotion();
+      } else {
+        jogEnabled[event.button] = true;
+      }
+      drawTeachStatus();
+      break;
+
+    case ButtonEventType::Repeat:
+      // Queue the next jog only once the previous one has started, so motion ends soon after release
+      if (jogEnabled[event.button] && teachState() != TeachState::Playing &&
+          motionQueueSpace() == MOTION_QUEUE_LENGTH) {
+        moveRevolutions(event.button == BUTTON_A ? jogRevolutions : -jogRevolutions);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+ * Converts a G-code distance (revolutions, GCODE_SCALE fixed point) to microsteps of an axis.
+ */
+int32_t gcodeToSteps(int32_t value, uint8_t axis) {
+  return (int32_t)((int64_t)value * axisTable[axis].stepsPerRev / GCODE_SCALE);
+}
+
+/**
+ * Runs a position trigger M code: M100 X1.5 adds a compare position
+ * (absolute, in revolutions) on the one axis named, M101 X0.25 fires every
+ * 0.25 revolutions from where the axis is, M102 disarms.
+ * @return false for another M code, or if the trigger refused it
+ */
+bool executeMcode(const GcodeLine& line) {
+  if (line.mcode == MCODE_PSO_OFF) {
+    disarmPositionTrigger();
+    return line.axisMask == 0;
+  }
+  uint8_t axis = 0;
+  while (axis < AXIS_COUNT && line.axisMask != (1 << axis)) {
+    axis++;
+  }
+  if (axis == AXIS_COUNT) {
+    return false;                        // Needs exactly one axis of this machine
+  }
+  int32_t steps = gcodeToSteps(line.axes[axis], axis);
+  switch (line.mcode) {
+    case MCODE_PSO_POSITION:
+      return addTriggerPosition(axis, steps);
+    case MCODE_PSO_INTERVAL:
+      return steps > 0 && setTriggerInterval(axis, steps);
+    default:
+      return false;
+  }
+}
+
+/**
+ * Runs one G-code line. Moves blend into each other; feed, motion and
+ * distance mode are modal. Arcs need the X/Y plane axes to share their
+ * steps per revolution, and path speeds use the X axis scale.
+ * @return false if the line is invalid or could not be queued
+ */
+bool executeGcode(const char* text) {
+  static GcodeMotion motion = GcodeMotion::Linear;
+  static bool relative = false;
+  static int32_t feedHz = 0;             // Programmed feed, 0 = current speed level
+
+  GcodeLine line;
+  if (!parseGcodeLine(text, line)) {
+    return false;
+  }
+  if (line.hasMcode) {
+    return line.motion == GcodeMotion::None && !line.hasOffsets && !line.hasFeed && executeMcode(line);
+  }
+  if (line.distance != GcodeDistance::Unchanged) {
+    relative = line.distance == GcodeDistance::Relative;
+  }
+  if (line.hasFeed) {
+    feedHz = (int32_t)((int64_t)line.feed * axisTable[0].stepsPerRev / GCODE_SCALE / 60);
+  }
+  if (line.motion != GcodeMotion::None) {
+    motion = line.motion;
+  }
+  if (line.axisMask == 0 && !line.hasOffsets) {
+    return true;                         // Modal words only
+  }
+
+  int32_t steps[AXIS_COUNT] = {};
+  for (uint8_t i = 0; i < AXIS_COUNT && i < GCODE_MAX_AXES; i++) {
+    if (line.axisMask & (1 << i)) {
+      int32_t target = gcodeToSteps(line.axes[i], i);
+      steps[i] = relative ? target : target - queuedPosition(i);
+    }
+  }
+  if (line.axisMask >> AXIS_COUNT) {
+    return false;                        // Word for an axis this machine does not have
+  }
+
+  uint32_t speedHz = (motion == GcodeMotion::Rapid) ? speedLevels[speedLevelsCount - 1]
+                     : (feedHz > 0)                 ? feedHz
+                                                    : speedLevels[currentSpeedIndex];
+  if (speedHz == 0) {
+    return false;
+  }
+
+  if (motion == GcodeMotion::ArcCW || motion == GcodeMotion::ArcCCW) {
+    if (AXIS_COUNT < 2 || !line.hasOffsets) {
+      return false;
+    }
+    return queueArc(steps, gcodeToSteps(line.offsetI, 0), gcodeToSteps(line.offsetJ, 0),
+                    motion == GcodeMotion::ArcCW, speedHz, accelerationRate);
+  }
+
+  AxisSegment segment = {};
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    segment.steps[i] = steps[i];
+  }
+  segment.speedHz = speedHz;
+  segment.acceleration = accelerationRate;
+  segment.flags = SEGMENT_BLEND;
+  return queueMove(segment);
+}
+
+/**
+ * M codes act on axes at rest, so a line holding one waits for the queued
+ * motion to finish.
+ */
+bool gcodeReady(const char* text) {
+  GcodeLine line;
+  if (!parseGcodeLine(text, line) || !line.hasMcode) {
+    return true;
+  }
+  return motionIdle() && !anyAxisRunning() && commandedPositionValid();
+}
+
+/**
+ * Acts on a realtime Serial byte: '?' prints the statistics, '!' and '~'
+ * hold and resume the feed, Ctrl-X re-arms after an emergency stop, the
+ * feed bytes change the override at once, even while a G-code line waits
+ * for room.
+ * @return false if c is not a realtime byte
+ */
+bool handleRealtime(uint8_t c) {
+  uint16_t feed = feedOverridePercent();
+  switch (c) {
+    case REALTIME_STATUS:
+      printQueueHealthReport();
+      printPlanCacheReport();
+      printEmergencyStopReport();
+      printJobTimeReport();
+      printPositionTriggerReport();
+      return true;
+    case REALTIME_RESET:
+      rearmEmergencyStop();
+      drawInstructions();
+      return true;
+    case REALTIME_FEED_HOLD:
+      feedHold();
+      drawInstructions();
+      return true;
+    case REALTIME_CYCLE_START:
+      resumeFeedHold();
+      drawInstructions();
+      return true;
+    case REALTIME_FEED_RESET: feed = 100; break;
+    case REALTIME_FEED_COARSE_UP: feed += FEED_OVERRIDE_COARSE_PERCENT; break;
+    case REALTIME_FEED_COARSE_DOWN: feed -= FEED_OVERRIDE_COARSE_PERCENT; break;
+    case REALTIME_FEED_FINE_UP: feed += FEED_OVERRIDE_STEP_PERCENT; break;
+    case REALTIME_FEED_FINE_DOWN: feed -= FEED_OVERRIDE_STEP_PERCENT; break;
+    default:
+      return false;
+  }
+  setFeedOverride(feed);
+  drawInstructions();
+  return true;
+}
+
+/**
+ * Collects G-code from Serial without blocking. A complete line waits while
+ * the motion queue is full (an M code line until the axes are at rest), so
+ * the sender is paced by the "ok" replies.
+ * Host stream frames are passed on to HostStream instead, and realtime
+ * bytes are taken out of the stream wherever they arrive.
+ */
+void serviceGcode() {
+  static char line[GCODE_LINE_LENGTH + 1];
+  static size_t length = 0;
+  static bool complete = false;
+  static bool overflow = false;
+
+  while (Serial.available() > 0) {
+    bool inFrame = length == 0 && hostStreamReceiving();
+    if (!inFrame && handleRealtime((uint8_t)Serial.peek())) {
+      Serial.read();
+      continue;
+    }
+    if (complete) {
+      break;                             // The rest waits for the pending line
+    }
+    char c = (char)Serial.read();
+    if (inFrame || (length == 0 && (uint8_t)c == FRAME_START)) {
+      feedHostStream((uint8_t)c);
+    } else if (c == '\n' || c == '\r') {
+      complete = length > 0 || overflow;
+    } else if (length < GCODE_LINE_LENGTH) {
+      line[length++] = c;
+    } else {
+      overflow = true;
+    }
+  }
+  if (!complete) {
+    return;
+  }
+  line[length] = '\0';
+
+  if (!overflow && (motionQueueSpace() == 0 || !gcodeReady(line))) {
+    return;                              // Retry once the queue drains
+  }
+  bool ok = !overflow && teachState() != TeachState::Playing && !stepStreamActive() && executeGcode(line);
+  Serial.println(ok ? "ok" : "error");
+  length = 0;
+  complete = false;
+  overflow = false;
+}
+
+/**
+ * Main loop - handles button events, teach mode and the motion queue.
  */
 void loop() {
-  M5.update();     // Update button states
+  // The interrupt has already cut the step outputs; finish the stop before anything else runs
+  if (serviceEmergencyStop()) {
+    stopTeachPlayback();
+    drawInstructions();
+    drawStatus();
+    drawTeachStatus();
+  }
 
-  if (M5.BtnA.wasClicked()) {
-    moveBothMotors(STEPS_PER_REV * revolutionsPerMove);
+  ButtonEvent event;
+  while (nextButtonEvent(event)) {
+    handleButton(event);
+  }
+  serviceGcode();
+  serviceHostStream();
+
+  // Lost steps invalidate the rest of the job, so stop before running further out of position
+  if (serviceStepVerifier()) {
+    stopTeachPlayback();
+    stopAllMotion();
+    printStepVerifierReport();
     drawStatus();
+    drawTeachStatus();
   }
 
-  if (M5.BtnC.wasClicked()) {
-    moveBothMotors(-STEPS_PER_REV * revolutionsPerMove);
+  if (serviceTeach()) {
+    drawTeachStatus();
+  }
+  if (serviceMotion()) {
     drawStatus();
+    drawQueueHealth();
+    drawJobTime();
+    if (teachState() == TeachState::Playing) {
+      drawTeachStatus();
+    }
   }
 
-  if (M5.BtnB.wasClicked()) {
-    updateSpeed();
+  // Count the job time down while there is motion, and show the final zero once idle
+  static uint32_t jobTimeDrawnMs = 0;
+  static bool jobTimeIdle = true;
+  bool idle = motionIdle();
+  if ((!idle && millis() - jobTimeDrawnMs >= JOB_TIME_REFRESH_MS) || (idle && !jobTimeIdle)) {
+    jobTimeDrawnMs = millis();
+    drawJobTime();
   }
+  jobTimeIdle = idle;
 }
@@ -0,0 +1,709 @@
+/*
+*******************************************************************************
+* Description:
+*   Host simulator: runs moves through the firmware's motion pipeline
+*   (MoveGenerator with the shapers and resonance bands from MachineConfig.h)
+*   and feeds the step commands of one axis into a physical MotorModel. Reports
+*   the rotor's position error and stalls, can search for the highest
+*   constant acceleration each speed level tolerates, and derives an
+*   acceleration curve for accelCurveTable from the motor model; --bound
+*   tries an acceleration bound (accelBoundTable) on the simulated axis.
+*   The pulse backend benchmark runs against a simulated backend
+*   (PulseBackendModel).
+*   --estop estimates the emergency stop latencies and the steps still
+*   leaving after a stop from the assumed costs in ESTOP_MODEL, replayed
+*   against a move's step edges. It checks those assumptions against the
+*   budgets; it does not run the firmware's stop code, whose measured
+*   latencies the controller reports ('?'). The move duration estimate
+*   (MoveDuration.h) is checked against the samples the generator produces,
+*   at every speed level and from very short (triangular) to long moves.
+*   The position trigger (PositionCompare.h) is replayed against a move out
+*   and back, counting step pulses like its two PCNT units while its
+*   interrupt runs behind the steps; the run fails if a trigger is missing,
+*   extra or off its position, or the position count drifts.
+*
+*   Build and run with PlatformIO's native environment:
+*     pio run -e native
+*     .pio/build/native/program --speed 6400 --accel 2000 --revs 5
+*     .pio/build/native/program --search --load-inertia 1e-3
+*     .pio/build/native/program --curve --margin 0.5 --load-inertia 2e-5
+*     .pio/build/native/program --compare --model-curve --margin 0.3 --load-inertia 1e-3 --speed 8000 --revs 0.5
+*     .pio/build/native/program --pulse-bench
+*     .pio/build/native/program --estop --speed 8000
+*     .pio/build/native/program --estimate --model-curve
+*     .pio/build/native/program --bound 8000 --revs 0.2 --speed 8000
+*     .pio/build/native/program --pso --speed 8000
+*******************************************************************************
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EstopModel.h"
+#include "MachineConfig.h"
+#include "MotorModel.h"
+#include "MoveDuration.h"
+#include "MoveGenerator.h"
+#include "PositionCompare.h"
+#include "PulseBackendModel.h"
+
+// Speed levels of the firmware's Button B table (src/main.cpp)
+constexpr uint32_t SIM_SPEED_LEVELS[] = {1600, 3200, 4800, 6400, 8000};
+
+// Accelerations tried by --search, steps/sec². The bare motor (or a light
+// load) stays in step well above the ceiling; a load around 1e-3 kg·m²
+// brings its limit into the range.
+constexpr uint32_t SIM_SEARCH_MIN_ACCEL = 200;
+constexpr uint32_t SIM_SEARCH_MAX_ACCEL = 400000;
+
+// Settling time simulated after the last step of a move
+constexpr double SIM_SETTLE_S = 0.2;
+
+// Stops --estop spreads over the move
+constexpr uint32_t SIM_ESTOP_TRIALS = 500;
+
+// Move lengths --estimate tries, as fractions of --revs
+constexpr double SIM_ESTIMATE_FRACTIONS[] = {0.001, 0.01, 0.05, 0.2, 1, 4};
+
+// Largest error --estimate accepts, µs
+constexpr uint32_t SIM_ESTIMATE_TOLERANCE_US = 3000;
+
+// Compare interval --pso arms, revolutions
+constexpr double SIM_PSO_INTERVAL_REVS = 0.1;
+
+// --pso: compare interrupt entry after the counter event, and each reload pass (limits, clear, read back)
+constexpr uint64_t SIM_PSO_ENTRY_NS = 4000;
+constexpr uint64_t SIM_PSO_RELOAD_NS = 1500;
+
+/**
+ * NEMA 17, 1.8°, 0.4 N·m class motor on a DRV8825 at 12 V and about 1.2 A.
+ * Replace with the datasheet values of the motor actually fitted.
+ */
+constexpr MotorParams DEFAULT_MOTOR = {
+  200,        // fullStepsPerRev
+  16,         // microSteps
+  100,        // currentLevels
+  5.4e-6,     // rotorInertia, 54 g·cm²
+  0.0,        // loadInertia
+  0.015,      // detentTorque
+  0.005,      // frictionTorque
+  1e-4,       // viscousDamping
+  {{0, 0.40}, {2, 0.38}, {5, 0.33}, {10, 0.24}, {15, 0.16}, {20, 0.10}, {30, 0.04}, {40, 0.0}},
+  8,
+};
+
+struct SimOptions {
+  uint8_t axis = 0;
+  uint32_t speedHz = 3200;
+  uint32_t acceleration = 2000;
+  double revolutions = 5;
+  double maxErrorFullSteps = 1.0;   // --search: error allowed for an acceleration to count as safe
+  double margin = 0.5;              // Share of the spare torque an acceleration curve may use
+  bool search = false;
+  bool printCurve = false;
+  bool compare = false;
+  bool pulseBench = false;
+  bool estop = false;
+  bool estimate = false;
+  bool pso = false;
+  bool modelCurve = false;          // Use the curve derived from the motor instead of accelCurveTable
+  bool verbose = false;
+  MotorParams motor = DEFAULT_MOTOR;
+  AccelCurve curve = {};            // Acceleration curve of the simulated axis
+  int64_t boundAccel = -1;          // Acceleration bound of the simulated axis, -1 for accelBoundTable
+};
+
+/**
+ * Acceleration curve of the motor model: the torque left over after friction
+ * and damping at each point of the pull-out curve, times the margin, over the
+ * total inertia.
+ */
+static AccelCurve modelAccelCurve(const SimOptions& options) {
+  const MotorParams& motor = options.motor;
+  double stepsPerRev = (double)motor.fullStepsPerRev * motor.microSteps;
+  double inertia = motor.rotorInertia + motor.loadInertia;
+  AccelCurve curve = {};
+  for (uint8_t p = 0; p < motor.curvePoints && p < ACCEL_CURVE_MAX_POINTS; p++) {
+    double omega = motor.curve[p].speedRps * 2 * M_PI;
+    double spare = motor.curve[p].torqueNm - motor.frictionTorque - motor.viscousDamping * omega;
+    double accel = (spare > 0) ? options.margin * spare / inertia * stepsPerRev / (2 * M_PI) : 0;
+    curve.points[curve.count++] = {(uint32_t)(motor.curve[p].speedRps * stepsPerRev),
+                                   (uint32_t)(accel > UINT32_MAX ? UINT32_MAX : accel)};
+  }
+  return curve;
+}
+
+/**
+ * Lowest value of a curve between 0 and speedHz: the constant acceleration a
+ * trapezoid needs to respect the curve up to that speed.
+ */
+static uint32_t curveMinimum(const AccelCurve& curve, uint32_t speedHz) {
+  AccelCurvePlanner<1> planner;
+  planner.configure(0, curve);
+  AccelProfile profile;
+  int32_t steps[1] = {1};
+  planner.build(0, steps, profile);
+  return sampleToAccel(profile.minimumUpTo(speedToSample(speedHz)));
+}
+
+/**
+ * Runs one move of the selected axis and returns the model statistics.
+ * @param useCurve Follow options.curve; otherwise accelerate at a constant rate
+ */
+static MotorSimStats simulateMove(const SimOptions& options, uint32_t speedHz, uint32_t acceleration,
+                                  bool useCurve = true) {
+  static MoveGenerator<AXIS_COUNT> generator;
+  static MoveLimits<AXIS_COUNT> limits;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    ShaperImpulses impulses;
+    designShaper(shaperTable[i], impulses);
+    generator.setShaper(i, impulses);
+    bool simulated = i == options.axis && useCurve;
+    uint32_t bound = (i != options.axis) ? accelBoundTable[i] : useCurve ? (uint32_t)options.boundAccel : 0;
+    limits.configure(i, simulated ? options.curve : AccelCurve{}, bandTable[i], bound);
+  }
+
+  int32_t steps[AXIS_COUNT] = {};
+  steps[options.axis] = (int32_t)(options.revolutions * axisTable[options.axis].stepsPerRev);
+  AccelProfile accel;
+  uint32_t cruiseHz = limits.plan(steps, speedHz, acceleration, accel);
+  generator.start(steps, cruiseHz, accel);
+
+  MotorModel motor;
+  motor.configure(options.motor);
+  StepCommand commands[AXIS_COUNT][SAMPLE_MAX_COMMANDS];
+  uint8_t counts[AXIS_COUNT];
+  uint32_t sample = 0;
+  double moveTimeS = 0;
+  while (generator.active()) {
+    generator.nextSample(commands, counts);
+    for (uint8_t c = 0; c < counts[options.axis]; c++) {
+      motor.run(commands[options.axis][c]);
+    }
+    if (options.verbose && sample++ % 50 == 0) {
+      printf("%8.3f s  %6u Hz  error %7.2f\n", motor.stats().timeS,
+             sampleToSpeed(generator.velocity()), motor.errorSteps());
+    }
+  }
+  moveTimeS = motor.stats().timeS;
+  motor.settle(SIM_SETTLE_S);
+  MotorSimStats stats = motor.stats();
+  stats.timeS = moveTimeS;     // Report the move itself, not the settling time
+  return stats;
+}
+
+static bool moveIsSafe(const SimOptions& options, const MotorSimStats& stats) {
+  double limit = options.maxErrorFullSteps * options.motor.microSteps;
+  return stats.stalls == 0 && stats.maxErrorSteps <= limit;
+}
+
+/**
+ * Prints one run; acceleration 0 marks a run that followed the acceleration curve.
+ */
+static void printStats(uint32_t speedHz, uint32_t acceleration, const MotorSimStats& stats) {
+  printf("speed %u Hz, accel ", speedHz);
+  if (acceleration > 0) {
+    printf("%u", acceleration);
+  } else {
+    printf("curve");
+  }
+  printf(": %.3f s, max error %.2f, final error %.2f microsteps, %u stalls",
+         stats.timeS, stats.maxErrorSteps, stats.finalErrorSteps, stats.stalls);
+  if (stats.stalls > 0) {
+    printf(" (first at %.3f s)", stats.firstStallS);
+  }
+  printf("\n");
+}
+
+/**
+ * Finds the lowest unsafe acceleration for every speed level and reports
+ * the highest safe one below it. The search climbs from
+ * SIM_SEARCH_MIN_ACCEL in 25 % steps and bisects the last one. Climbing
+ * matters because a resonance can make a higher acceleration safe again. A
+ * level still safe at SIM_SEARCH_MAX_ACCEL is reported as at least that.
+ */
+static void searchAccelerations(const SimOptions& options) {
+  printf("speedHz  maxSafeAccel  maxError\n");
+  for (uint32_t speedHz : SIM_SPEED_LEVELS) {
+    MotorSimStats best = simulateMove(options, speedHz, SIM_SEARCH_MIN_ACCEL, false);
+    if (!moveIsSafe(options, best)) {
+      printf("%7u  stalls even at %u\n", speedHz, SIM_SEARCH_MIN_ACCEL);
+      continue;
+    }
+    uint32_t low = SIM_SEARCH_MIN_ACCEL;
+    uint32_t high = 0;
+    while (high == 0 && low < SIM_SEARCH_MAX_ACCEL) {
+      uint32_t next = (low + low / 4 < SIM_SEARCH_MAX_ACCEL) ? low + low / 4 : SIM_SEARCH_MAX_ACCEL;
+      MotorSimStats stats = simulateMove(options, speedHz, next, false);
+      if (moveIsSafe(options, stats)) {
+        low = next;
+        best = stats;
+      } else {
+        high = next;
+      }
+    }
+    if (high == 0) {
+      printf("%7u  >= %9u  %8.2f  (search ceiling)\n", speedHz, SIM_SEARCH_MAX_ACCEL, best.maxErrorSteps);
+      continue;
+    }
+    while (high - low > low / 50 + 1) {     // 2% resolution
+      uint32_t mid = low + (high - low) / 2;
+      MotorSimStats stats = simulateMove(options, speedHz, mid, false);
+      if (moveIsSafe(options, stats)) {
+        low = mid;
+        best = stats;
+      } else {
+        high = mid;
+      }
+    }
+    printf("%7u  %12u  %8.2f\n", speedHz, low, best.maxErrorSteps);
+  }
+}
+
+/**
+ * Prints the model-derived curve as an accelCurveTable entry.
+ */
+static void printAccelCurve(const SimOptions& options) {
+  AccelCurve curve = modelAccelCurve(options);
+  printf("  {{");
+  for (uint8_t p = 0; p < curve.count; p++) {
+    printf("%s{%u, %u}", p ? ", " : "", curve.points[p].speedHz, curve.points[p].acceleration);
+  }
+  printf("}, %u},   // %c, margin %.2f\n", curve.count, axisTable[options.axis].name, options.margin);
+}
+
+/**
+ * Runs the same move with the acceleration curve and with the constant
+ * acceleration a trapezoid needs to stay within the curve up to cruise speed.
+ * The curve can only gain what the pull-out torque drops by up to cruise.
+ * At the Button B speeds that is under 10 % (2.5 rev/s at 8000 Hz). Only
+ * short moves, mostly ramp, gain a few percent (the usage example at the
+ * top); a long move gains nothing measurable and fails.
+ * @return true if the curve finishes sooner, without a stall and with no
+ *         more position error than the trapezoid
+ */
+static bool compareProfiles(const SimOptions& options) {
+  if (options.curve.count == 0) {
+    fprintf(stderr, "No acceleration curve for axis %c; set accelCurveTable or use --model-curve\n",
+            axisTable[options.axis].name);
+    return false;
+  }
+  uint32_t constant = curveMinimum(options.curve, options.speedHz);
+  MotorSimStats curved = simulateMove(options, options.speedHz, constant, true);
+  MotorSimStats trapezoid = simulateMove(options, options.speedHz, constant, false);
+  printf("curve:     ");
+  printStats(options.speedHz, 0, curved);
+  printf("trapezoid: ");
+  printStats(options.speedHz, constant, trapezoid);
+
+  bool faster = curved.timeS < trapezoid.timeS;
+  bool accurate = curved.stalls == 0 && curved.maxErrorSteps <= trapezoid.maxErrorSteps;
+  printf("curve %.1f%% %s, max error %+.2f microsteps: %s\n",
+         100 * fabs(trapezoid.timeS - curved.timeS) / trapezoid.timeS, faster ? "faster" : "not faster",
+         curved.maxErrorSteps - trapezoid.maxErrorSteps, faster && accurate ? "pass" : "FAIL");
+  return faster && accurate;
+}
+
+/**
+ * Runs the firmware's pulse backend benchmark against the simulated backends.
+ */
+static void benchmarkPulseBackends() {
+  PulseBackendModel model;
+  PulseBackendReport mcpwmPcnt = benchmarkPulseBackend(model, PulseBackend::McpwmPcnt);
+  PulseBackendReport rmt = benchmarkPulseBackend(model, PulseBackend::Rmt);
+  char line[160];
+  formatPulseBackendReport(line, sizeof(line), PulseBackend::McpwmPcnt, mcpwmPcnt);
+  printf("%s\n", line);
+  formatPulseBackendReport(line, sizeof(line), PulseBackend::Rmt, rmt);
+  printf("%s\n", line);
+  printf("preferred: %s (simulated backends; confirm on the board)\n",
+         pulseBackendName(preferredPulseBackend(mcpwmPcnt, rmt, PULSE_BENCH_REFERENCE_HZ)));
+}
+
+/**
+ * Stops the move on every axis at SIM_ESTOP_TRIALS points through it and
+ * records the latencies of the stop path.
+ * @return false if the worst case exceeds a budget
+ */
+static bool simulateEmergencyStops(const SimOptions& options) {
+  MoveGenerator<AXIS_COUNT> generator;
+  int32_t steps[AXIS_COUNT];
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    steps[i] = (int32_t)(options.revolutions * axisTable[i].stepsPerRev);
+  }
+  generator.start(steps, options.speedHz, options.acceleration);
+
+  EstopModel<AXIS_COUNT> model;
+  StepCommand commands[AXIS_COUNT][SAMPLE_MAX_COMMANDS];
+  uint8_t counts[AXIS_COUNT];
+  while (generator.active()) {
+    generator.nextSample(commands, counts);
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      for (uint8_t c = 0; c < counts[i]; c++) {
+        model.add(i, commands[i][c]);
+      }
+    }
+  }
+
+  StopLatencyLog log;
+  uint32_t worstPulses = 0;
+  for (uint32_t k = 0; k < SIM_ESTOP_TRIALS; k++) {
+    uint32_t pulses = 0;
+    log.record(model.stop(model.durationNs() * k / SIM_ESTOP_TRIALS, pulses));
+    worstPulses = (pulses > worstPulses) ? pulses : worstPulses;
+  }
+  char line[160];
+  formatStopLatencyReport(line, sizeof(line), log);
+  printf("%s\n", line);
+  printf("speed %u Hz on %u axes: at most %u steps left the controller after a stop\n",
+         options.speedHz, AXIS_COUNT, worstPulses);
+  return log.withinBudget();
+}
+
+/**
+ * Compares the estimated duration of moves of the selected axis, with and
+ * without its acceleration curve, against the samples the generator runs.
+ * @return false if an estimate is off by more than SIM_ESTIMATE_TOLERANCE_US
+ */
+static bool checkDurationEstimates(const SimOptions& options) {
+  MoveGenerator<AXIS_COUNT> generator;
+  MoveLimits<AXIS_COUNT> limits;
+  for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+    ShaperImpulses impulses;
+    designShaper(shaperTable[i], impulses);
+    generator.setShaper(i, impulses);
+  }
+
+  int32_t worstUs = 0;
+  uint32_t moves = 0;
+  for (uint8_t useCurve = 0; useCurve < 2; useCurve++) {
+    if (useCurve && options.curve.count == 0) {
+      continue;
+    }
+    for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+      bool simulated = i == options.axis;
+      limits.configure(i, (useCurve && simulated) ? options.curve : AccelCurve{}, bandTable[i],
+                       simulated ? (uint32_t)options.boundAccel : accelBoundTable[i]);
+    }
+    for (uint32_t speedHz : SIM_SPEED_LEVELS) {
+      for (double fraction : SIM_ESTIMATE_FRACTIONS) {
+        int32_t steps[AXIS_COUNT] = {};
+        steps[options.axis] = (int32_t)(options.revolutions * fraction * axisTable[options.axis].stepsPerRev);
+        if (steps[options.axis] == 0) {
+          continue;
+        }
+        AccelProfile accel;
+        uint32_t cruiseHz = limits.plan(steps, speedHz, options.acceleration, accel);
+        generator.start(steps, cruiseHz, accel);
+        StepCommand commands[AXIS_COUNT][SAMPLE_MAX_COMMANDS];
+        uint8_t counts[AXIS_COUNT];
+        uint32_t samples = 0;
+        while (generator.active()) {
+          generator.nextSample(commands, counts);
+          samples++;
+        }
+
+        uint32_t estimateUs = profileDurationUs(steps[options.axis], 0, cruiseHz, 0, accel) +
+                              generator.shaperTailSamples() * PROFILE_SAMPLE_US;
+        int32_t errorUs = (int32_t)estimateUs - (int32_t)(samples * PROFILE_SAMPLE_US);
+        if (options.verbose) {
+          printf("%s %5u Hz %7d steps: run %8u us, estimate %8u us (%+d)\n", useCurve ? "curve" : "const",
+                 speedHz, steps[options.axis], samples * PROFILE_SAMPLE_US, estimateUs, errorUs);
+        }
+        worstUs = (abs(errorUs) > abs(worstUs)) ? errorUs : worstUs;
+        moves++;
+      }
+    }
+  }
+  printf("duration estimate: %u moves, worst error %+d us (tolerance %u us)\n", moves, worstUs,
+         SIM_ESTIMATE_TOLERANCE_US);
+  return (uint32_t)abs(worstUs) <= SIM_ESTIMATE_TOLERANCE_US;
+}
+
+/**
+ * The two PCNT units of the position trigger, fed by the same step pulses.
+ * The compare limits take effect when the compare counter is cleared.
+ */
+struct SimPsoCounters {
+  int16_t position = 0;    // Never cleared, wraps at +-PSO_COUNT_LIMIT
+  int16_t compare = 0;
+  int16_t high = 0;
+  int16_t low = 0;
+  bool event = false;      // Compare interrupt raised
+
+  void step(int16_t direction) {
+    position += direction;
+    position = (position == PSO_COUNT_LIMIT || position == -PSO_COUNT_LIMIT) ? 0 : position;
+    compare += direction;
+    if (compare == high || compare == low) {
+      compare = 0;
+      event = true;
+    }
+  }
+
+  void clearCompare(int16_t newHigh, int16_t newLow) {
+    high = newHigh;
+    low = newLow;
+    compare = 0;
+  }
+};
+
+/**
+ * Compare interrupt of the position trigger as PositionTrigger.cpp runs
+ * it: entered SIM_PSO_ENTRY_NS after the event, then reload passes
+ * SIM_PSO_RELOAD_NS apart, with steps going on in between.
+ */
+class SimPsoInterrupt {
+ public:
+  SimPsoInterrupt(SimPsoCounters& counters, PositionCompare& compare) : _counters(counters), _compare(compare) {}
+
+  /**
+   * Arms at position with the axis still.
+   */
+  void arm(int32_t position) {
+    _count.start(position, _counters.position);
+    _compare.start(position);
+    _counters.clearCompare(_compare.high(), _compare.low());
+  }
+
+  /**
+   * Runs the interrupt up to timeNs.
+   * @param fires Receives the target of every fire
+   */
+  void run(uint64_t timeNs, std::vector<int32_t>& fires) {
+    while (_phase != Phase::Idle && _opNs <= timeNs) {
+      if (_phase == Phase::Entry) {
+        record(_compare.moveTo(_count.update(_counters.position)), fires);
+        _phase = Phase::Reload;
+        _opNs += SIM_PSO_RELOAD_NS;
+        continue;
+      }
+      _counters.clearCompare(_compare.high(), _compare.low());
+      int32_t origin = _count.update(_counters.position) - _counters.compare;
+      if (origin != _compare.position()) {
+        record(_compare.moveTo(origin), fires);
+        _opNs += SIM_PSO_RELOAD_NS;
+      } else if (_pending) {
+        _pending = false;
+        _phase = Phase::Entry;
+        _opNs += SIM_PSO_ENTRY_NS;
+      } else {
+        _phase = Phase::Idle;
+      }
+    }
+  }
+
+  /**
+   * Takes the event of a step at timeNs, after run() up to it.
+   */
+  void step(uint64_t timeNs, int32_t position) {
+    _position = position;
+    if (!_counters.event) {
+      return;
+    }
+    _counters.event = false;
+    if (_phase == Phase::Idle) {
+      _phase = Phase::Entry;
+      _opNs = timeNs + SIM_PSO_ENTRY_NS;
+    } else {
+      _pending = true;
+    }
+  }
+
+  int32_t countedPosition() const { return _count.position(); }
+  uint32_t worstLateSteps() const { return _worstLate; }
+  uint64_t closestNs() const { return _closestNs; }
+
+ private:
+  enum class Phase : uint8_t { Idle, Entry, Reload };
+
+  void record(bool fire, std::vector<int32_t>& fires) {
+    if (!fire) {
+      return;
+    }
+    fires.push_back(_compare.lastTarget());
+    int32_t late = _position - _compare.lastTarget();
+    _worstLate = ((uint32_t)abs(late) > _worstLate) ? (uint32_t)abs(late) : _worstLate;
+    _closestNs = (fires.size() > 1 && _opNs - _lastFireNs < _closestNs) ? _opNs - _lastFireNs : _closestNs;
+    _lastFireNs = _opNs;
+  }
+
+  SimPsoCounters& _counters;
+  PositionCompare& _compare;
+  PsoPositionCount _count;
+  Phase _phase = Phase::Idle;
+  bool _pending = false;
+  uint64_t _opNs = 0;
+  int32_t _position = 0;
+  uint32_t _worstLate = 0;
+  uint64_t _lastFireNs = 0;
+  uint64_t _closestNs = UINT64_MAX;
+};
+
+/**
+ * Runs the selected axis out by --revs and back with the position trigger
+ * armed every SIM_PSO_INTERVAL_REVS, counting its steps the way the PCNT
+ * units do, with the interrupt running late against the steps.
+ * @return false if the triggers differ from the interval positions reached
+ *         or the position count is off
+ */
+static bool checkPositionTrigger(const SimOptions& options) {
+  uint8_t axis = options.axis;
+  int32_t every = (int32_t)(SIM_PSO_INTERVAL_REVS * axisTable[axis].stepsPerRev);
+  int32_t distance = (int32_t)(options.revolutions * axisTable[axis].stepsPerRev);
+  if (every <= 0 || distance <= 0) {
+    fprintf(stderr, "Move and interval must be at least a step\n");
+    return false;
+  }
+  PositionCompare compare;
+  compare.setInterval(0, (uint32_t)every);
+  SimPsoCounters counters;
+  SimPsoInterrupt interrupt(counters, compare);
+  interrupt.arm(0);
+
+  MoveGenerator<AXIS_COUNT> generator;
+  std::vector<int32_t> fires;
+  std::vector<int32_t> expected;        // Interval positions reached, other than the last one (or 0 at arming)
+  int32_t lastTarget = 0;
+  int32_t position = 0;
+  uint64_t timeNs = 0;
+  for (int32_t direction : {1, -1}) {
+    int32_t steps[AXIS_COUNT] = {};
+    steps[axis] = direction * distance;
+    generator.start(steps, options.speedHz, options.acceleration);
+    StepCommand commands[AXIS_COUNT][SAMPLE_MAX_COMMANDS];
+    uint8_t counts[AXIS_COUNT];
+    while (generator.active()) {
+      generator.nextSample(commands, counts);
+      for (uint8_t c = 0; c < counts[axis]; c++) {
+        const StepCommand& command = commands[axis][c];
+        uint64_t intervalNs = (uint64_t)command.ticks * 1000000000ull / STEP_TICKS_PER_S;
+        for (uint8_t k = 0; k < command.steps; k++) {
+          int16_t step = command.countUp ? 1 : -1;
+          interrupt.run(timeNs, fires);
+          position += step;
+          counters.step(step);
+          interrupt.step(timeNs, position);
+          if (position % every == 0 && position != lastTarget) {
+            expected.push_back(position);
+            lastTarget = position;
+          }
+          timeNs += intervalNs;
+        }
+        if (command.steps == 0) {
+          timeNs += intervalNs;
+        }
+      }
+    }
+  }
+  interrupt.run(UINT64_MAX, fires);
+
+  uint32_t misplaced = 0;
+  for (size_t k = 0; k < fires.size() || k < expected.size(); k++) {
+    bool match = k < fires.size() && k < expected.size() && fires[k] == expected[k];
+    misplaced += !match;
+    if (!match && options.verbose) {
+      printf("trigger %zu: at %d, expected %d\n", k, k < fires.size() ? fires[k] : -1,
+             k < expected.size() ? expected[k] : -1);
+    }
+  }
+  printf("position trigger: every %d steps over %d steps out and back, %zu fired, %u misplaced, "
+         "at most %u steps late\n",
+         every, distance, fires.size(), misplaced, interrupt.worstLateSteps());
+  printf("position count: %d, axis at %d\n", interrupt.countedPosition(), position);
+  if (interrupt.closestNs() != UINT64_MAX) {
+    printf("closest triggers %llu us apart (pulse width %u us)\n",
+           (unsigned long long)(interrupt.closestNs() / 1000), PSO_PULSE_US);
+  }
+  return misplaced == 0 && position == 0 && interrupt.countedPosition() == position;
+}
+
+static void usage() {
+  printf("Usage: motor_sim [--axis N] [--speed HZ] [--accel A] [--revs R]\n"
+         "                 [--load-inertia KGM2] [--friction NM] [--damping NMS]\n"
+         "                 [--max-error FULLSTEPS] [--margin M] [--model-curve] [--bound A]\n"
+         "                 [--search | --curve | --compare | --pulse-bench | --estop |\n"
+         "                  --estimate | --pso]\n"
+         "                 [--verbose]\n");
+}
+
+int main(int argc, char** argv) {
+  SimOptions options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--search")) {
+      options.search = true;
+    } else if (!strcmp(arg, "--curve")) {
+      options.printCurve = true;
+    } else if (!strcmp(arg, "--compare")) {
+      options.compare = true;
+    } else if (!strcmp(arg, "--pulse-bench")) {
+      options.pulseBench = true;
+    } else if (!strcmp(arg, "--estop")) {
+      options.estop = true;
+    } else if (!strcmp(arg, "--estimate")) {
+      options.estimate = true;
+    } else if (!strcmp(arg, "--pso")) {
+      options.pso = true;
+    } else if (!strcmp(arg, "--model-curve")) {
+      options.modelCurve = true;
+    } else if (!strcmp(arg, "--verbose")) {
+      options.verbose = true;
+    } else if (value && !strcmp(arg, "--axis")) {
+      options.axis = (uint8_t)atoi(value), i++;
+    } else if (value && !strcmp(arg, "--speed")) {
+      options.speedHz = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--accel")) {
+      options.acceleration = (uint32_t)atol(value), i++;
+    } else if (value && !strcmp(arg, "--revs")) {
+      options.revolutions = atof(value), i++;
+    } else if (value && !strcmp(arg, "--load-inertia")) {
+      options.motor.loadInertia = atof(value), i++;
+    } else if (value && !strcmp(arg, "--friction")) {
+      options.motor.frictionTorque = atof(value), i++;
+    } else if (value && !strcmp(arg, "--damping")) {
+      options.motor.viscousDamping = atof(value), i++;
+    } else if (value && !strcmp(arg, "--margin")) {
+      options.margin = atof(value), i++;
+    } else if (value && !strcmp(arg, "--bound")) {
+      options.boundAccel = atol(value), i++;
+    } else if (value && !strcmp(arg, "--max-error")) {
+      options.maxErrorFullSteps = atof(value), i++;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (options.axis >= AXIS_COUNT) {
+    fprintf(stderr, "Axis %u not configured (%u axes)\n", options.axis, AXIS_COUNT);
+    return 1;
+  }
+  options.motor.microSteps = (uint16_t)(axisTable[options.axis].stepsPerRev / options.motor.fullStepsPerRev);
+  options.curve = options.modelCurve ? modelAccelCurve(options) : accelCurveTable[options.axis];
+  if (options.boundAccel < 0) {
+    options.boundAccel = accelBoundTable[options.axis];
+  }
+
+  if (options.search) {
+    searchAccelerations(options);
+  } else if (options.printCurve) {
+    printAccelCurve(options);
+  } else if (options.compare) {
+    return compareProfiles(options) ? 0 : 1;
+  } else if (options.pulseBench) {
+    benchmarkPulseBackends();
+  } else if (options.estop) {
+    return simulateEmergencyStops(options) ? 0 : 1;
+  } else if (options.estimate) {
+    return checkDurationEstimates(options) ? 0 : 1;
+  } else if (options.pso) {
+    return checkPositionTrigger(options) ? 0 : 1;
+  } else {
+    printStats(options.speedHz, options.curve.count > 0 ? 0 : options.acceleration,
+               simulateMove(options, options.speedHz, options.acceleration));
+  }
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*
+*******************************************************************************
+* Description:
+*   Native tests of ButtonDecoder fed with synthetic edges: bounce and glitch
+*   rejection, click against hold against auto-repeat timing, and the
+*   microsecond clock wrapping in the middle of a press.
+*
+*   Run with: pio test -e native
+*******************************************************************************
+*/
+
+#include <unity.h>
+
+#include <vector>
+
+#include "ButtonEvents.h"
+
+constexpr uint32_t MS = 1000;
+
+/**
+ * Feeds edges in time order, draining the events due before each one as
+ * the firmware's consumer does.
+ */
+struct Harness {
+  ButtonDecoder<2> decoder;
+  std::vector<ButtonEvent> events;
+
+  explicit Harness(uint32_t startUs) {
+    decoder.reset(0, false, startUs);
+    decoder.reset(1, false, startUs);
+  }
+
+  void drain(uint32_t nowUs) {
+    ButtonEvent event;
+    while (decoder.poll(nowUs, event)) {
+      events.push_back(event);
+    }
+  }
+
+  void edge(uint8_t button, bool pressed, uint32_t timeUs) {
+    drain(timeUs);
+    decoder.feed({button, pressed, timeUs});
+  }
+};
+
+static void checkEvent(const Harness& harness, size_t index, ButtonEventType type, uint32_t timeUs,
+                       uint8_t button = 0) {
+  TEST_ASSERT_LESS_THAN(harness.events.size(), index);
+  const ButtonEvent& event = harness.events[index];
+  TEST_ASSERT_EQUAL_UINT8(button, event.button);
+  TEST_ASSERT_EQUAL_UINT8((uint8_t)type, (uint8_t)event.type);
+  TEST_ASSERT_EQUAL_UINT32(timeUs, event.timeUs);
+}
+
+/**
+ * A click of durationUs starting at startUs, with contact bounce on both edges.
+ */
+static void bouncyPress(Harness& harness, uint32_t startUs, uint32_t durationUs) {
+  harness.edge(0, true, startUs);
+  harness.edge(0, false, startUs + 300);
+  harness.edge(0, true, startUs + 700);
+  harness.edge(0, false, startUs + durationUs);
+  harness.edge(0, true, startUs + durationUs + 400);
+  harness.edge(0, false, startUs + durationUs + 900);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_glitch_is_rejected() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.edge(0, true, t);
+  harness.edge(0, false, t + 2 * MS);                // Shorter than the debounce time
+  harness.drain(t + 2 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(0, harness.events.size());
+  TEST_ASSERT_FALSE(harness.decoder.pressed(0));
+}
+
+void test_bounces_settle_into_one_press() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.edge(0, true, t);
+  harness.edge(0, false, t + 300);
+  harness.edge(0, true, t + 700);
+  harness.drain(t + 700 + BUTTON_DEBOUNCE_US - 1);   // Not quiet long enough yet
+  TEST_ASSERT_EQUAL(0, harness.events.size());
+  harness.drain(t + 700 + BUTTON_DEBOUNCE_US);
+  TEST_ASSERT_EQUAL(1, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);  // Timed from the first edge
+  TEST_ASSERT_TRUE(harness.decoder.pressed(0));
+}
+
+void test_short_press_is_a_click() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  bouncyPress(harness, t, 200 * MS);
+  harness.drain(t + 2 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(3, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);
+  checkEvent(harness, 1, ButtonEventType::Click, t + 200 * MS);
+  checkEvent(harness, 2, ButtonEventType::Release, t + 200 * MS);
+}
+
+void test_click_just_below_hold_time() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  bouncyPress(harness, t, BUTTON_HOLD_US - 1);
+  harness.drain(t + 3 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(3, harness.events.size());
+  checkEvent(harness, 1, ButtonEventType::Click, t + BUTTON_HOLD_US - 1);
+}
+
+void test_long_press_is_a_hold() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  bouncyPress(harness, t, BUTTON_HOLD_US + 500 * MS);
+  harness.drain(t + 3 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(3, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);
+  checkEvent(harness, 1, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+  checkEvent(harness, 2, ButtonEventType::Release, t + BUTTON_HOLD_US + 500 * MS);
+}
+
+void test_hold_is_reported_at_its_deadline() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.edge(0, true, t);
+  harness.drain(t + BUTTON_HOLD_US - 1);
+  TEST_ASSERT_EQUAL(1, harness.events.size());
+  harness.drain(t + BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(2, harness.events.size());
+  checkEvent(harness, 1, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+}
+
+void test_auto_repeat_while_held() {
+  const uint32_t t = 100 * MS;
+  const uint32_t releaseUs = t + BUTTON_HOLD_US + 3 * BUTTON_REPEAT_US + 100 * MS;
+  Harness harness(0);
+  harness.decoder.setRepeat(0, true);
+  harness.edge(0, true, t);
+  harness.edge(0, false, releaseUs);
+  harness.drain(releaseUs + BUTTON_HOLD_US);
+
+  TEST_ASSERT_EQUAL(6, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);
+  checkEvent(harness, 1, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+  for (uint8_t k = 1; k <= 3; k++) {
+    checkEvent(harness, 1 + k, ButtonEventType::Repeat, t + BUTTON_HOLD_US + k * BUTTON_REPEAT_US);
+  }
+  checkEvent(harness, 5, ButtonEventType::Release, releaseUs);
+}
+
+void test_no_repeat_unless_enabled() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.decoder.setRepeat(1, true);                // The other button only
+  harness.edge(0, true, t);
+  harness.drain(t + BUTTON_HOLD_US + 5 * BUTTON_REPEAT_US);
+  TEST_ASSERT_EQUAL(2, harness.events.size());
+  checkEvent(harness, 1, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+}
+
+void test_buttons_are_independent() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.edge(0, true, t);
+  harness.edge(1, true, t + 50 * MS);
+  harness.edge(1, false, t + 150 * MS);
+  harness.drain(t + 200 * MS);                       // loop() polls long before the next deadline
+  harness.edge(0, false, t + BUTTON_HOLD_US + 10 * MS);
+  harness.drain(t + 3 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(6, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);
+  checkEvent(harness, 1, ButtonEventType::Press, t + 50 * MS, 1);
+  checkEvent(harness, 2, ButtonEventType::Click, t + 150 * MS, 1);
+  checkEvent(harness, 3, ButtonEventType::Release, t + 150 * MS, 1);
+  checkEvent(harness, 4, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+  checkEvent(harness, 5, ButtonEventType::Release, t + BUTTON_HOLD_US + 10 * MS);
+}
+
+void test_clock_wraps_during_click() {
+  const uint32_t t = UINT32_MAX - 100 * MS;          // Wraps 100 ms into the press
+  Harness harness(t - 200 * MS);
+  bouncyPress(harness, t, 200 * MS);
+  harness.drain(t + 2 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(3, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Press, t);
+  checkEvent(harness, 1, ButtonEventType::Click, t + 200 * MS);
+  checkEvent(harness, 2, ButtonEventType::Release, t + 200 * MS);
+}
+
+void test_clock_wraps_during_hold_and_repeat() {
+  const uint32_t t = UINT32_MAX - BUTTON_HOLD_US - BUTTON_REPEAT_US / 2;   // Wraps between Hold and the first Repeat
+  const uint32_t releaseUs = t + BUTTON_HOLD_US + 2 * BUTTON_REPEAT_US + 10 * MS;
+  Harness harness(t - 200 * MS);
+  harness.decoder.setRepeat(0, true);
+  harness.edge(0, true, t);
+  harness.edge(0, false, releaseUs);
+  harness.drain(releaseUs + BUTTON_HOLD_US);
+
+  TEST_ASSERT_EQUAL(5, harness.events.size());
+  checkEvent(harness, 1, ButtonEventType::Hold, t + BUTTON_HOLD_US);
+  checkEvent(harness, 2, ButtonEventType::Repeat, t + BUTTON_HOLD_US + BUTTON_REPEAT_US);
+  checkEvent(harness, 3, ButtonEventType::Repeat, t + BUTTON_HOLD_US + 2 * BUTTON_REPEAT_US);
+  checkEvent(harness, 4, ButtonEventType::Release, releaseUs);
+}
+
+void test_button_down_at_reset_never_clicks() {
+  const uint32_t t = 100 * MS;
+  Harness harness(0);
+  harness.decoder.reset(0, true, t);
+  harness.drain(t + 2 * BUTTON_HOLD_US);
+  harness.edge(0, false, t + 2 * BUTTON_HOLD_US + MS);
+  harness.drain(t + 3 * BUTTON_HOLD_US);
+  TEST_ASSERT_EQUAL(1, harness.events.size());
+  checkEvent(harness, 0, ButtonEventType::Release, t + 2 * BUTTON_HOLD_US + MS);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_glitch_is_rejected);
+  RUN_TEST(test_bounces_settle_into_one_press);
+  RUN_TEST(test_short_press_is_a_click);
+  RUN_TEST(test_click_just_below_hold_time);
+  RUN_TEST(test_long_press_is_a_hold);
+  RUN_TEST(test_hold_is_reported_at_its_deadline);
+  RUN_TEST(test_auto_repeat_while_held);
+  RUN_TEST(test_no_repeat_unless_enabled);
+  RUN_TEST(test_buttons_are_independent);
+  RUN_TEST(test_clock_wraps_during_click);
+  RUN_TEST(test_clock_wraps_during_hold_and_repeat);
+  RUN_TEST(test_button_down_at_reset_never_clicks);
+  return UNITY_END();
+}
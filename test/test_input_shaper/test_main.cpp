@@ -0,0 +1,246 @@
+/*
+*******************************************************************************
+* Description:
+*   Native tests of the input shaper: designShaper() against the reference
+*   ZV, ZVD and EI impulse trains (Singhose's closed forms: amplitudes from
+*   K = exp(-zeta pi / sqrt(1 - zeta^2)), impulses half a damped period
+*   apart), Q15 weights summing to exactly unity, and filter() moving the
+*   same distance as its input. Also the step train MoveGenerator emits at
+*   cruise: constant intervals at speeds off the 1 kHz sample grid.
+*
+*   Run with: pio test -e native
+*******************************************************************************
+*/
+
+#include <math.h>
+#include <unity.h>
+
+#include "InputShaper.h"
+#include "MoveGenerator.h"
+#include "StepCommand.h"
+
+// One Q15 count of rounding, plus the unity correction folded into the first weight
+constexpr int32_t WEIGHT_TOLERANCE_Q15 = 2;
+
+// Cruise step interval spread allowed by tick rounding, 0.25 µs
+constexpr uint32_t INTERVAL_TOLERANCE_TICKS = 4;
+
+struct ReferenceTrain {
+  uint8_t count;
+  double amplitude[SHAPER_MAX_IMPULSES];
+  double timeS[SHAPER_MAX_IMPULSES];
+};
+
+static double decayK(double zeta) {
+  return exp(-zeta * M_PI / sqrt(1 - zeta * zeta));
+}
+
+static double halfPeriodS(double frequencyHz, double zeta) {
+  return 0.5 / (frequencyHz * sqrt(1 - zeta * zeta));
+}
+
+static ReferenceTrain referenceZv(double frequencyHz, double zeta) {
+  double k = decayK(zeta);
+  double half = halfPeriodS(frequencyHz, zeta);
+  return {2, {1 / (1 + k), k / (1 + k), 0}, {0, half, 0}};
+}
+
+static ReferenceTrain referenceZvd(double frequencyHz, double zeta) {
+  double k = decayK(zeta);
+  double half = halfPeriodS(frequencyHz, zeta);
+  double d = (1 + k) * (1 + k);
+  return {3, {1 / d, 2 * k / d, k * k / d}, {0, half, 2 * half}};
+}
+
+/**
+ * Undamped EI shaper for a 5 % vibration tolerance: (1 + V)/4, (1 - V)/2, (1 + V)/4.
+ */
+static ReferenceTrain referenceEi(double frequencyHz) {
+  double half = halfPeriodS(frequencyHz, 0);
+  return {3, {0.2625, 0.475, 0.2625}, {0, half, 2 * half}};
+}
+
+static void checkTrain(const ShaperConfig& config, const ReferenceTrain& reference) {
+  ShaperImpulses impulses;
+  TEST_ASSERT_TRUE(designShaper(config, impulses));
+  TEST_ASSERT_EQUAL_UINT8(reference.count, impulses.count);
+  for (uint8_t i = 0; i < reference.count; i++) {
+    int32_t weight = (int32_t)lround(reference.amplitude[i] * 32768);
+    TEST_ASSERT_INT32_WITHIN(WEIGHT_TOLERANCE_Q15, weight, impulses.weightQ15[i]);
+    int32_t delay = (int32_t)lround(reference.timeS[i] * PROFILE_SAMPLES_PER_S);
+    TEST_ASSERT_INT32_WITHIN(1, delay, impulses.delaySamples[i]);
+  }
+}
+
+static uint32_t weightSum(const ShaperImpulses& impulses) {
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < impulses.count; i++) {
+    sum += impulses.weightQ15[i];
+  }
+  return sum;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_none_is_pass_through() {
+  ShaperImpulses impulses;
+  TEST_ASSERT_TRUE(designShaper({ShaperType::None, 0, 0}, impulses));
+  TEST_ASSERT_EQUAL_UINT8(1, impulses.count);
+  TEST_ASSERT_EQUAL_UINT16(32768, impulses.weightQ15[0]);
+  TEST_ASSERT_EQUAL_UINT16(0, impulses.delaySamples[0]);
+}
+
+void test_zv_matches_reference() {
+  checkTrain({ShaperType::Zv, 40, 0}, referenceZv(40, 0));
+  checkTrain({ShaperType::Zv, 40, 0.1f}, referenceZv(40, 0.1));
+  checkTrain({ShaperType::Zv, 12.5f, 0.3f}, referenceZv(12.5, 0.3));
+}
+
+void test_zvd_matches_reference() {
+  checkTrain({ShaperType::Zvd, 40, 0}, referenceZvd(40, 0));
+  checkTrain({ShaperType::Zvd, 40, 0.1f}, referenceZvd(40, 0.1));
+  checkTrain({ShaperType::Zvd, 25, 0.05f}, referenceZvd(25, 0.05));
+}
+
+void test_ei_matches_reference() {
+  checkTrain({ShaperType::Ei, 40, 0}, referenceEi(40));
+  checkTrain({ShaperType::Ei, 20, 0}, referenceEi(20));
+}
+
+void test_weights_sum_to_unity() {
+  const ShaperType types[] = {ShaperType::Zv, ShaperType::Zvd, ShaperType::Ei};
+  const float frequencies[] = {5, 17.3f, 40, 99};
+  const float dampings[] = {0, 0.02f, 0.1f, 0.5f};
+  for (ShaperType type : types) {
+    for (float frequency : frequencies) {
+      for (float damping : dampings) {
+        ShaperImpulses impulses;
+        TEST_ASSERT_TRUE(designShaper({type, frequency, damping}, impulses));
+        TEST_ASSERT_EQUAL_UINT32(32768, weightSum(impulses));
+      }
+    }
+  }
+}
+
+void test_rejects_invalid_configs() {
+  ShaperImpulses impulses;
+  TEST_ASSERT_FALSE(designShaper({ShaperType::Zv, 0, 0}, impulses));
+  TEST_ASSERT_FALSE(designShaper({ShaperType::Zvd, 40, -0.1f}, impulses));
+  TEST_ASSERT_FALSE(designShaper({ShaperType::Ei, 40, 1.0f}, impulses));
+  TEST_ASSERT_FALSE(designShaper({ShaperType::Zvd, 1, 0}, impulses));   // Delay beyond SHAPER_HISTORY
+  TEST_ASSERT_EQUAL_UINT8(1, impulses.count);                          // Failure leaves a pass-through
+  TEST_ASSERT_EQUAL_UINT16(32768, impulses.weightQ15[0]);
+}
+
+void test_filter_holds_constant_velocity() {
+  ShaperImpulses impulses;
+  designShaper({ShaperType::Zvd, 40, 0.1f}, impulses);
+  InputShaper shaper;
+  shaper.configure(impulses);
+  q16_t velocity = 3 * Q16_ONE + 12345;
+  q16_t out = 0;
+  for (uint16_t n = 0; n <= shaper.tailSamples(); n++) {
+    out = shaper.filter(velocity);
+  }
+  TEST_ASSERT_EQUAL_INT32(velocity, out);
+}
+
+/**
+ * A trapezoidal velocity profile and its shaped copy (tail included) cover
+ * the same distance: per-sample truncation loses under one Q16 count per
+ * sample, far less than a step.
+ */
+void test_filter_conserves_steps() {
+  const ShaperType types[] = {ShaperType::Zv, ShaperType::Zvd, ShaperType::Ei};
+  for (ShaperType type : types) {
+    ShaperImpulses impulses;
+    designShaper({type, 33, 0.07f}, impulses);
+    InputShaper shaper;
+    shaper.configure(impulses);
+
+    const int32_t samples = 900;
+    int64_t raw = 0;
+    int64_t shaped = 0;
+    for (int32_t n = 0; n < samples + shaper.tailSamples(); n++) {
+      q16_t velocity = 0;
+      if (n < samples) {
+        int32_t ramp = (n < samples - n) ? n : samples - n;
+        velocity = (ramp < 200) ? ramp * (Q16_ONE / 25) : 8 * Q16_ONE;
+        velocity = (type == ShaperType::Zvd) ? -velocity : velocity;   // Moving down as well
+      }
+      raw += velocity;
+      shaped += shaper.filter(velocity);
+    }
+    TEST_ASSERT_INT_WITHIN(samples + shaper.tailSamples(), raw, shaped);
+    TEST_ASSERT_LESS_THAN(Q16_ONE, samples + shaper.tailSamples());   // So under one step in total
+  }
+}
+
+/**
+ * Step intervals of the dominant axis of a two-axis move over the middle
+ * third of its steps, where it cruises.
+ */
+static void cruiseIntervals(uint32_t speedHz, uint32_t& shortest, uint32_t& longest) {
+  MoveGenerator<2> generator;
+  int32_t steps[2] = {(int32_t)(2 * speedHz), (int32_t)speedHz};
+  generator.start(steps, speedHz, 50000);
+  StepCommand commands[2][SAMPLE_MAX_COMMANDS];
+  uint8_t counts[2];
+  uint64_t ticks = 0;
+  uint64_t previous = 0;
+  int32_t issued = 0;
+  shortest = UINT32_MAX;
+  longest = 0;
+  while (generator.active()) {
+    generator.nextSample(commands, counts);
+    for (uint8_t c = 0; c < counts[0]; c++) {
+      const StepCommand& command = commands[0][c];
+      if (command.steps == 0) {
+        ticks += command.ticks;
+      }
+      for (uint8_t k = 0; k < command.steps; k++) {
+        if (issued > steps[0] / 3 && issued < 2 * steps[0] / 3) {
+          uint32_t interval = (uint32_t)(ticks - previous);
+          shortest = (interval < shortest) ? interval : shortest;
+          longest = (interval > longest) ? interval : longest;
+        }
+        previous = ticks;
+        issued++;
+        ticks += command.ticks;
+      }
+    }
+  }
+  TEST_ASSERT_EQUAL_INT32(steps[0], issued);
+}
+
+/**
+ * 1600 and 4800 Hz (motor_sim's speed levels) are no whole number of steps
+ * per 1 ms sample; the steps still follow the position, not the sample grid.
+ */
+void test_cruise_intervals_are_constant() {
+  const uint32_t speeds[] = {1600, 4800};
+  for (uint32_t speedHz : speeds) {
+    uint32_t shortest;
+    uint32_t longest;
+    cruiseIntervals(speedHz, shortest, longest);
+    uint32_t expected = STEP_TICKS_PER_S / speedHz;
+    TEST_ASSERT_UINT32_WITHIN(INTERVAL_TOLERANCE_TICKS, expected, shortest);
+    TEST_ASSERT_UINT32_WITHIN(INTERVAL_TOLERANCE_TICKS, expected, longest);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_none_is_pass_through);
+  RUN_TEST(test_zv_matches_reference);
+  RUN_TEST(test_zvd_matches_reference);
+  RUN_TEST(test_ei_matches_reference);
+  RUN_TEST(test_weights_sum_to_unity);
+  RUN_TEST(test_rejects_invalid_configs);
+  RUN_TEST(test_filter_holds_constant_velocity);
+  RUN_TEST(test_filter_conserves_steps);
+  RUN_TEST(test_cruise_intervals_are_constant);
+  return UNITY_END();
+}
@@ -0,0 +1,180 @@
+/*
+*******************************************************************************
+* Description:
+*   Native tests of the program image: an image packed byte by byte the way
+*   tools/pack_program.py does (struct "<IBBHII" header, "<4iHHHH" records,
+*   zlib CRC-32) is opened through ProgramImage's file-backed host backend
+*   and walked; bad magic, a bad CRC and truncated images are refused.
+*
+*   Run with: pio test -e native
+*******************************************************************************
+*/
+
+#include <stdio.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "ProgramImage.h"
+
+static const char IMAGE_PATH[] = "test_program_image.bin";
+constexpr uint8_t TEST_AXES = 2;
+
+// Moves of the test program: steps per axis, speedHz, acceleration, dwellMs
+struct TestMove {
+  int32_t steps[TEST_AXES];
+  uint16_t speedHz;
+  uint16_t acceleration;
+  uint16_t dwellMs;
+};
+
+static const TestMove MOVES[] = {
+  {{3200, -1600}, 6400, 2000, 0},
+  {{-70000, 0}, 8000, 65535, 250},
+  {{0, 123456789}, 1, 1, 65535},
+};
+constexpr uint32_t MOVE_COUNT = sizeof(MOVES) / sizeof(MOVES[0]);
+
+static void putLe(std::vector<uint8_t>& out, uint32_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; i++) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+/**
+ * Packs MOVES like pack_program.py, without the C structs.
+ */
+static std::vector<uint8_t> packProgram() {
+  std::vector<uint8_t> records;
+  for (const TestMove& move : MOVES) {
+    for (uint8_t i = 0; i < PROGRAM_MAX_AXES; i++) {
+      putLe(records, (uint32_t)(i < TEST_AXES ? move.steps[i] : 0), 4);
+    }
+    putLe(records, move.speedHz, 2);
+    putLe(records, move.acceleration, 2);
+    putLe(records, move.dwellMs, 2);
+    putLe(records, 0, 2);
+  }
+  std::vector<uint8_t> image;
+  putLe(image, 0x5052474D, 4);        // "MGRP"
+  putLe(image, 3, 1);                 // Version
+  putLe(image, TEST_AXES, 1);
+  putLe(image, 24, 2);                // Record size
+  putLe(image, MOVE_COUNT, 4);
+  putLe(image, programCrc(records.data(), records.size()), 4);
+  image.insert(image.end(), records.begin(), records.end());
+  return image;
+}
+
+static void writeImage(const std::vector<uint8_t>& image, size_t size) {
+  FILE* file = fopen(IMAGE_PATH, "wb");
+  TEST_ASSERT_NOT_NULL(file);
+  TEST_ASSERT_EQUAL(size, fwrite(image.data(), 1, size, file));
+  fclose(file);
+}
+
+static bool opens(const std::vector<uint8_t>& image, size_t size) {
+  writeImage(image, size);
+  ProgramImage program;
+  return program.open(TEST_AXES);
+}
+
+void setUp() {
+  ProgramImage::setBackingFile(IMAGE_PATH);
+}
+
+void tearDown() {
+  remove(IMAGE_PATH);
+}
+
+void test_crc_matches_zlib() {
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, programCrc("123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, programCrc("6789", 4, programCrc("12345", 5)));
+}
+
+void test_packed_image_walks_records() {
+  std::vector<uint8_t> image = packProgram();
+  TEST_ASSERT_EQUAL(sizeof(ProgramHeader) + MOVE_COUNT * sizeof(ProgramRecord), image.size());
+  writeImage(image, image.size());
+
+  ProgramImage program;
+  TEST_ASSERT_TRUE(program.open(TEST_AXES));
+  TEST_ASSERT_EQUAL_UINT32(MOVE_COUNT, program.recordCount());
+  for (uint32_t k = 0; k < MOVE_COUNT; k++) {
+    const ProgramRecord* record = program.record(k);
+    TEST_ASSERT_NOT_NULL(record);
+    MotionSegment<TEST_AXES> segment = fromProgramRecord<TEST_AXES>(*record);
+    TEST_ASSERT_EQUAL_INT32(MOVES[k].steps[0], segment.steps[0]);
+    TEST_ASSERT_EQUAL_INT32(MOVES[k].steps[1], segment.steps[1]);
+    TEST_ASSERT_EQUAL_INT32(0, record->steps[2]);
+    TEST_ASSERT_EQUAL_UINT32(MOVES[k].speedHz, segment.speedHz);
+    TEST_ASSERT_EQUAL_UINT32(MOVES[k].acceleration, segment.acceleration);
+    TEST_ASSERT_EQUAL_UINT32(MOVES[k].dwellMs, segment.dwellMs);
+  }
+  TEST_ASSERT_NULL(program.record(MOVE_COUNT));
+}
+
+void test_write_round_trips() {
+  ProgramRecord records[MOVE_COUNT] = {};
+  for (uint32_t k = 0; k < MOVE_COUNT; k++) {
+    records[k].steps[0] = MOVES[k].steps[0];
+    records[k].steps[1] = MOVES[k].steps[1];
+    records[k].speedHz = MOVES[k].speedHz;
+    records[k].acceleration = MOVES[k].acceleration;
+    records[k].dwellMs = MOVES[k].dwellMs;
+  }
+  TEST_ASSERT_TRUE(ProgramImage::write(records, MOVE_COUNT, TEST_AXES));
+
+  // The firmware's writer produces the packer's bytes
+  std::vector<uint8_t> expected = packProgram();
+  std::vector<uint8_t> written(expected.size() + 1);
+  FILE* file = fopen(IMAGE_PATH, "rb");
+  TEST_ASSERT_NOT_NULL(file);
+  TEST_ASSERT_EQUAL(expected.size(), fread(written.data(), 1, written.size(), file));
+  fclose(file);
+  written.pop_back();
+  TEST_ASSERT_TRUE(written == expected);
+}
+
+void test_rejects_bad_magic() {
+  std::vector<uint8_t> image = packProgram();
+  image[0] ^= 0x01;
+  TEST_ASSERT_FALSE(opens(image, image.size()));
+}
+
+void test_rejects_other_axis_count() {
+  std::vector<uint8_t> image = packProgram();
+  image[5] = TEST_AXES + 1;
+  TEST_ASSERT_FALSE(opens(image, image.size()));
+}
+
+void test_rejects_bad_crc() {
+  std::vector<uint8_t> image = packProgram();
+  image[sizeof(ProgramHeader) + sizeof(ProgramRecord) + 3] ^= 0x80;   // One step count bit
+  TEST_ASSERT_FALSE(opens(image, image.size()));
+
+  image = packProgram();
+  image[12] ^= 0x01;                                                // The CRC field itself
+  TEST_ASSERT_FALSE(opens(image, image.size()));
+}
+
+void test_rejects_truncated_image() {
+  std::vector<uint8_t> image = packProgram();
+  TEST_ASSERT_FALSE(opens(image, image.size() - 1));                // Last record cut short
+  TEST_ASSERT_FALSE(opens(image, sizeof(ProgramHeader)));           // Records missing
+  TEST_ASSERT_FALSE(opens(image, sizeof(ProgramHeader) - 1));       // Header cut short
+  TEST_ASSERT_FALSE(opens(image, 0));
+  TEST_ASSERT_TRUE(opens(image, image.size()));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_matches_zlib);
+  RUN_TEST(test_packed_image_walks_records);
+  RUN_TEST(test_write_round_trips);
+  RUN_TEST(test_rejects_bad_magic);
+  RUN_TEST(test_rejects_other_axis_count);
+  RUN_TEST(test_rejects_bad_crc);
+  RUN_TEST(test_rejects_truncated_image);
+  return UNITY_END();
+}
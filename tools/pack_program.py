@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Packs a motion program for the "motionprog" flash partition.
+
+Input is a CSV file with one move per line:
+
+    <axis steps...>, speedHz, acceleration, dwellMs
+
+with one step column per configured axis (see --axes). Blank lines and lines
+starting with '#' are ignored. The output image uses the layout defined in
+lib/Motion/src/MotionProgram.h and can be flashed with ESP-IDF's parttool:
+
+    parttool.py --port <port> write_partition --partition-name motionprog --input program.bin
+
+The same image can be handed to host builds, which map it in place of the
+flash partition (ProgramImage::setBackingFile).
+"""
+
+import argparse
+import csv
+import struct
+import sys
+import zlib
+
+PROGRAM_MAGIC = 0x5052474D
+PROGRAM_VERSION = 3
+PROGRAM_MAX_AXES = 4
+PARTITION_SIZE = 0x80000  # Must match partitions.csv
+
+HEADER = struct.Struct("<IBBHII")
+RECORD = struct.Struct("<%diHHHH" % PROGRAM_MAX_AXES)
+MAX_RECORDS = (PARTITION_SIZE - HEADER.size) // RECORD.size
+
+
+def parse_moves(path, axes):
+    moves = []
+    with open(path, newline="") as source:
+        for line_number, row in enumerate(csv.reader(source), start=1):
+            fields = [field.strip() for field in row]
+            if not fields or not fields[0] or fields[0].startswith("#"):
+                continue
+            if len(fields) != axes + 3:
+                raise ValueError("line %d: expected %d columns, got %d" % (line_number, axes + 3, len(fields)))
+            values = [int(field, 0) for field in fields]
+            steps, (speed, acceleration, dwell) = values[:axes], values[axes:]
+            for name, value in (("speedHz", speed), ("acceleration", acceleration), ("dwellMs", dwell)):
+                if not 0 <= value <= 0xFFFF:
+                    raise ValueError("line %d: %s %d out of range 0..65535" % (line_number, name, value))
+            for value in steps:
+                if not -(2 ** 31) <= value < 2 ** 31:
+                    raise ValueError("line %d: step count %d does not fit 32 bits" % (line_number, value))
+            moves.append((steps + [0] * (PROGRAM_MAX_AXES - axes), speed, acceleration, dwell))
+    return moves
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="CSV move list")
+    parser.add_argument("output", help="binary program image")
+    parser.add_argument("--axes", type=int, default=2, help="axes configured on the target machine (default 2)")
+    args = parser.parse_args()
+
+    if not 1 <= args.axes <= PROGRAM_MAX_AXES:
+        parser.error("--axes must be between 1 and %d" % PROGRAM_MAX_AXES)
+
+    try:
+        moves = parse_moves(args.input, args.axes)
+    except (OSError, ValueError) as error:
+        sys.exit("pack_program: %s" % error)
+    if not moves:
+        sys.exit("pack_program: no moves in %s" % args.input)
+    if len(moves) > MAX_RECORDS:
+        sys.exit("pack_program: %d moves exceed the partition capacity of %d" % (len(moves), MAX_RECORDS))
+
+    records = b"".join(RECORD.pack(*steps, speed, acceleration, dwell, 0)
+                       for steps, speed, acceleration, dwell in moves)
+    with open(args.output, "wb") as image:
+        image.write(HEADER.pack(PROGRAM_MAGIC, PROGRAM_VERSION, args.axes, RECORD.size, len(moves),
+                                zlib.crc32(records)))
+        image.write(records)
+
+    print("Packed %d moves for %d axes into %s (%d bytes)"
+          % (len(moves), args.axes, args.output, HEADER.size + len(moves) * RECORD.size))
+
+
+if __name__ == "__main__":
+    main()